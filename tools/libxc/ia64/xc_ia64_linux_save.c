@@ -381,7 +381,8 @@ out:
 
 int
 xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iters,
-               uint32_t max_factor, uint32_t min_remaining, uint32_t flags,
+               uint32_t max_factor, uint32_t min_remaining,
+               uint32_t max_downtime, uint32_t flags,
                struct save_callbacks* callbacks, int hvm,
                unsigned long vm_generationid_addr)
 {
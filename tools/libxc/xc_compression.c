@@ -38,6 +38,7 @@
 #include "xg_save_restore.h"
 #include "xg_private.h"
 #include "xc_dom.h"
+#include "xc_lzo.h"
 
 /* Page Cache for Delta Compression*/
 #define DELTA_CACHE_SIZE (XC_PAGE_SIZE * 8192)
@@ -541,6 +542,239 @@ error:
     return NULL;
 }
 
+/*
+ * Batch compression for live migration (XC_SAVE_ID_COMPRESSED_BATCH).
+ *
+ * Unlike checkpoint compression, the receiver does not decode deltas
+ * against guest memory.  Both ends instead keep an identical direct-mapped
+ * cache of page contents, written only for the pages of encoded batches.
+ * The sender also drops a pfn from its cache whenever the page is sent by
+ * other means, so a delta is only ever produced against a copy that the
+ * receiver holds as well.  A direct-mapped cache (rather than the LRU
+ * above) keeps the two ends in step without them seeing the same set of
+ * invalidations.
+ */
+#define BATCH_CACHE_PAGES (DELTA_CACHE_SIZE / XC_PAGE_SIZE)
+
+struct batch_comp_ctx
+{
+    comp_ctx out;               /* output cursor for compress_page() */
+    char *cache_base;
+    xen_pfn_t *cache_pfn;
+    char *scratch;              /* contiguous copy of a batch, for LZO */
+    void *lzo_wrkmem;
+};
+
+static inline char *batch_cache_page(batch_comp_ctx *ctx, xen_pfn_t pfn)
+{
+    return ctx->cache_base + (pfn % BATCH_CACHE_PAGES) * XC_PAGE_SIZE;
+}
+
+static inline xen_pfn_t *batch_cache_tag(batch_comp_ctx *ctx, xen_pfn_t pfn)
+{
+    return &ctx->cache_pfn[pfn % BATCH_CACHE_PAGES];
+}
+
+static void batch_cache_store(batch_comp_ctx *ctx, const char *page,
+                              xen_pfn_t pfn)
+{
+    if (pfn == INVALID_P2M_ENTRY)
+        return;
+    *batch_cache_tag(ctx, pfn) = pfn;
+    memcpy(batch_cache_page(ctx, pfn), page, XC_PAGE_SIZE);
+}
+
+void xc_batch_comp_invalidate(batch_comp_ctx *ctx, xen_pfn_t pfn)
+{
+    xen_pfn_t *tag = batch_cache_tag(ctx, pfn);
+
+    if (*tag == pfn)
+        *tag = INVALID_P2M_ENTRY;
+}
+
+unsigned long xc_batch_comp_bound(unsigned int nr_pages)
+{
+    unsigned long delta = nr_pages * (unsigned long)WORST_COMP_PAGE_SIZE;
+    unsigned long lzo = lzo1x_worst_compress(nr_pages *
+                                             (unsigned long)XC_PAGE_SIZE);
+
+    return (delta > lzo) ? delta : lzo;
+}
+
+int xc_batch_comp_encode(xc_interface *xch, batch_comp_ctx *ctx, int codec,
+                         char **pages, const xen_pfn_t *pfns, unsigned int nr,
+                         char *out, unsigned long outsize,
+                         unsigned long *outlen)
+{
+    unsigned int i;
+    char *page;
+    size_t len;
+    int rc;
+
+    if (nr > MAX_BATCH_SIZE)
+        return -1;
+
+    /*
+     * The pages may belong to a running guest.  Work from a snapshot so
+     * that what is sent and what is cached cannot differ.
+     */
+    for (i = 0; i < nr; i++)
+        memcpy(ctx->scratch + i * XC_PAGE_SIZE, pages[i], XC_PAGE_SIZE);
+
+    switch (codec)
+    {
+    case XC_BATCH_COMP_DELTA:
+        ctx->out.compbuf = out;
+        ctx->out.compbuf_size = outsize;
+        ctx->out.compbuf_pos = 0;
+
+        for (i = 0; i < nr; i++)
+        {
+            page = ctx->scratch + i * XC_PAGE_SIZE;
+            if (pfns[i] == INVALID_P2M_ENTRY)
+                rc = add_full_page(&ctx->out, page, NULL);
+            else if (*batch_cache_tag(ctx, pfns[i]) == pfns[i])
+                rc = compress_page(&ctx->out, page,
+                                   batch_cache_page(ctx, pfns[i]));
+            else
+            {
+                *batch_cache_tag(ctx, pfns[i]) = pfns[i];
+                rc = add_full_page(&ctx->out, page,
+                                   batch_cache_page(ctx, pfns[i]));
+            }
+            if (rc < 0)
+                return -1;
+        }
+        *outlen = ctx->out.compbuf_pos;
+        return 0;
+
+    case XC_BATCH_COMP_LZO:
+        if (outsize < lzo1x_worst_compress(nr * XC_PAGE_SIZE))
+            return -1;
+
+        if (lzo1x_1_compress((unsigned char *)ctx->scratch, nr * XC_PAGE_SIZE,
+                             (unsigned char *)out, &len,
+                             ctx->lzo_wrkmem) != LZO_E_OK)
+            return -1;
+
+        for (i = 0; i < nr; i++)
+            batch_cache_store(ctx, ctx->scratch + i * XC_PAGE_SIZE, pfns[i]);
+        *outlen = len;
+        return 0;
+    }
+
+    ERROR("Unknown batch codec %d\n", codec);
+    return -1;
+}
+
+int xc_batch_comp_decode(xc_interface *xch, batch_comp_ctx *ctx, int codec,
+                         char *in, unsigned long inlen,
+                         char **pages, const xen_pfn_t *pfns, unsigned int nr)
+{
+    unsigned long pos = 0;
+    unsigned int i;
+    size_t len;
+
+    if (nr > MAX_BATCH_SIZE)
+        return -1;
+
+    switch (codec)
+    {
+    case XC_BATCH_COMP_DELTA:
+        for (i = 0; i < nr; i++)
+        {
+            if (pos >= inlen)
+            {
+                ERROR("Truncated delta compressed batch\n");
+                return -1;
+            }
+            if (in[pos] != FULL_PAGE)
+            {
+                if (pfns[i] == INVALID_P2M_ENTRY ||
+                    *batch_cache_tag(ctx, pfns[i]) != pfns[i])
+                {
+                    ERROR("Delta for uncached pfn %" PRIpfn "\n", pfns[i]);
+                    return -1;
+                }
+                memcpy(pages[i], batch_cache_page(ctx, pfns[i]),
+                       XC_PAGE_SIZE);
+            }
+            if (xc_compression_uncompress_page(xch, in, inlen, &pos,
+                                               pages[i]))
+                return -1;
+            batch_cache_store(ctx, pages[i], pfns[i]);
+        }
+        if (pos != inlen)
+        {
+            ERROR("Trailing data in delta compressed batch\n");
+            return -1;
+        }
+        return 0;
+
+    case XC_BATCH_COMP_LZO:
+        len = nr * XC_PAGE_SIZE;
+        if (lzo1x_decompress_safe((unsigned char *)in, inlen,
+                                  (unsigned char *)ctx->scratch,
+                                  &len) != LZO_E_OK ||
+            len != nr * XC_PAGE_SIZE)
+        {
+            ERROR("Corrupt LZO compressed batch\n");
+            return -1;
+        }
+        for (i = 0; i < nr; i++)
+        {
+            memcpy(pages[i], ctx->scratch + i * XC_PAGE_SIZE, XC_PAGE_SIZE);
+            batch_cache_store(ctx, pages[i], pfns[i]);
+        }
+        return 0;
+    }
+
+    ERROR("Unknown batch codec %d\n", codec);
+    return -1;
+}
+
+void xc_batch_comp_free(xc_interface *xch, batch_comp_ctx *ctx)
+{
+    if (!ctx) return;
+
+    free(ctx->cache_base);
+    free(ctx->cache_pfn);
+    free(ctx->scratch);
+    free(ctx->lzo_wrkmem);
+    free(ctx);
+}
+
+batch_comp_ctx *xc_batch_comp_create(xc_interface *xch)
+{
+    batch_comp_ctx *ctx;
+    unsigned long i;
+
+    ctx = calloc(1, sizeof(*ctx));
+    if (!ctx)
+    {
+        ERROR("Failed to allocate batch compression context\n");
+        return NULL;
+    }
+
+    ctx->cache_base = xc_memalign(xch, XC_PAGE_SIZE, DELTA_CACHE_SIZE);
+    ctx->cache_pfn = malloc(BATCH_CACHE_PAGES * sizeof(xen_pfn_t));
+    ctx->scratch = xc_memalign(xch, XC_PAGE_SIZE,
+                               MAX_BATCH_SIZE * XC_PAGE_SIZE);
+    ctx->lzo_wrkmem = malloc(LZO1X_1_MEM_COMPRESS);
+    if (!ctx->cache_base || !ctx->cache_pfn || !ctx->scratch ||
+        !ctx->lzo_wrkmem)
+    {
+        ERROR("Failed to allocate batch compression buffers\n");
+        xc_batch_comp_free(xch, ctx);
+        return NULL;
+    }
+
+    for (i = 0; i < BATCH_CACHE_PAGES; i++)
+        ctx->cache_pfn[i] = INVALID_P2M_ENTRY;
+
+    return ctx;
+}
+
 /*
  * Local variables:
  * mode: C
@@ -1492,6 +1492,22 @@ int xc_domain_p2m_audit(xc_interface *xch,
     return rc;
 }
 
+int xc_domain_p2m_stats(xc_interface *xch,
+                        uint32_t domid,
+                        xc_p2m_stats_t *stats)
+{
+    DECLARE_DOMCTL;
+    int rc;
+
+    domctl.cmd = XEN_DOMCTL_get_p2m_stats;
+    domctl.domain = domid;
+    rc = do_domctl(xch, &domctl);
+    if ( rc == 0 )
+        *stats = domctl.u.p2m_stats;
+
+    return rc;
+}
+
 int xc_domain_set_access_required(xc_interface *xch,
                                   uint32_t domid,
                                   unsigned int required)
@@ -25,6 +25,8 @@
 
 #include <stdlib.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
 
 #include "xg_private.h"
 #include "xg_save_restore.h"
@@ -44,6 +46,7 @@ struct restore_ctx {
     int completed; /* Set when a consistent image is available */
     int last_checkpoint; /* Set when we should commit to the current checkpoint when it completes. */
     int compressing; /* Set when sender signals that pages would be sent compressed (for Remus) */
+    batch_comp_ctx *batch_comp; /* Page cache for XC_SAVE_ID_COMPRESSED_BATCH */
     struct domain_info_context dinfo;
 };
 
@@ -107,11 +110,17 @@ static ssize_t rdexact(xc_interface *xch, struct restore_ctx *ctx,
 ** In the state file (or during transfer), all page-table pages are
 ** converted into a 'canonical' form where references to actual mfns
 ** are replaced with references to the corresponding pfns.
-** This function inverts that operation, replacing the pfn values with
-** the (now known) appropriate mfn values.
+** uncanonicalize_pagetable() inverts that operation, replacing the pfn
+** values with the (now known) appropriate mfn values.
+**
+** It is split in two halves so that the rewrite can be done by restore
+** worker threads: uncanonicalize_alloc() allocates any frames the page
+** refers to and updates the p2m, and uncanonicalize_fixup() then only
+** reads the p2m while rewriting the PTEs.
 */
-static int uncanonicalize_pagetable(
-    xc_interface *xch, uint32_t dom, struct restore_ctx *ctx, void *page)
+static int uncanonicalize_alloc(
+    xc_interface *xch, uint32_t dom, struct restore_ctx *ctx,
+    const void *page)
 {
     int i, pte_last, nr_mfns = 0;
     unsigned long pfn;
@@ -124,9 +133,9 @@ static int uncanonicalize_pagetable(
     for ( i = 0; i < pte_last; i++ )
     {
         if ( ctx->pt_levels == 2 )
-            pte = ((uint32_t *)page)[i];
+            pte = ((const uint32_t *)page)[i];
         else
-            pte = ((uint64_t *)page)[i];
+            pte = ((const uint64_t *)page)[i];
 
         /* XXX SMH: below needs fixing for PROT_NONE etc */
         if ( !(pte & _PAGE_PRESENT) )
@@ -151,18 +160,49 @@ static int uncanonicalize_pagetable(
         }
     }
 
+    if ( !nr_mfns )
+        return 1;
+
     /* Allocate the requisite number of mfns. */
-    if ( nr_mfns &&
-         (xc_domain_populate_physmap_exact(xch, dom, nr_mfns, 0, 0,
-                                            ctx->p2m_batch) != 0) )
+    if ( xc_domain_populate_physmap_exact(xch, dom, nr_mfns, 0, 0,
+                                          ctx->p2m_batch) != 0 )
     { 
         ERROR("Failed to allocate memory for batch.!\n"); 
         errno = ENOMEM;
         return 0; 
     }
     
-    /* Second pass: uncanonicalize each present PTE */
+    /* Second pass: record the new mfns, in first pass order */
     nr_mfns = 0;
+    for ( i = 0; i < pte_last; i++ )
+    {
+        if ( ctx->pt_levels == 2 )
+            pte = ((const uint32_t *)page)[i];
+        else
+            pte = ((const uint64_t *)page)[i];
+
+        if ( !(pte & _PAGE_PRESENT) )
+            continue;
+
+        pfn = (pte >> PAGE_SHIFT) & MFN_MASK_X86;
+
+        if ( ctx->p2m[pfn] == (INVALID_P2M_ENTRY-1) )
+            ctx->p2m[pfn] = ctx->p2m_batch[nr_mfns++];
+    }
+
+    return 1;
+}
+
+/* Rewrite each present PTE.  Must follow a successful uncanonicalize_alloc */
+static void uncanonicalize_fixup(struct restore_ctx *ctx, void *page)
+{
+    int i, pte_last;
+    unsigned long pfn;
+    uint64_t pte;
+    struct domain_info_context *dinfo = &ctx->dinfo;
+
+    pte_last = PAGE_SIZE / ((ctx->pt_levels == 2)? 4 : 8);
+
     for ( i = 0; i < pte_last; i++ )
     {
         if ( ctx->pt_levels == 2 )
@@ -176,9 +216,6 @@ static int uncanonicalize_pagetable(
         
         pfn = (pte >> PAGE_SHIFT) & MFN_MASK_X86;
 
-        if ( ctx->p2m[pfn] == (INVALID_P2M_ENTRY-1) )
-            ctx->p2m[pfn] = ctx->p2m_batch[nr_mfns++];
-
         pte &= ~MADDR_MASK_X86;
         pte |= (uint64_t)ctx->p2m[pfn] << PAGE_SHIFT;
 
@@ -187,10 +224,177 @@ static int uncanonicalize_pagetable(
         else
             ((uint64_t *)page)[i] = (uint64_t)pte;
     }
+}
+
+static int uncanonicalize_pagetable(
+    xc_interface *xch, uint32_t dom, struct restore_ctx *ctx, void *page)
+{
+    if ( !uncanonicalize_alloc(xch, dom, ctx, page) )
+        return 0;
 
+    uncanonicalize_fixup(ctx, page);
     return 1;
 }
 
+/*
+** Restore workers.  The calling thread decodes the stream, allocates
+** and maps each batch; page copies and page-table fixups are then
+** spread across the workers, the caller taking a share as well.
+*/
+#define RESTORE_JOB_CHUNK 32
+
+struct restore_job {
+    void *dst;
+    const void *src;
+    unsigned long pfn, mfn;
+    int fixup;     /* rewrite the PTEs once copied */
+    int update;    /* needs a machphys update */
+};
+
+struct restore_workers {
+    struct restore_ctx *ctx;
+    unsigned int nr_threads;
+    pthread_t *threads;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int stop;
+    unsigned int gen;        /* bumped each time a batch is handed out */
+    struct restore_job jobs[MAX_BATCH_SIZE];
+    unsigned int nr_jobs, next_job, done_jobs;
+};
+
+static void restore_do_jobs(struct restore_workers *w)
+{
+    unsigned int first, last, i;
+
+    for ( ; ; )
+    {
+        pthread_mutex_lock(&w->lock);
+        first = w->next_job;
+        last = first + RESTORE_JOB_CHUNK;
+        if ( last > w->nr_jobs )
+            last = w->nr_jobs;
+        w->next_job = last;
+        pthread_mutex_unlock(&w->lock);
+
+        if ( first >= last )
+            return;
+
+        for ( i = first; i < last; i++ )
+        {
+            memcpy(w->jobs[i].dst, w->jobs[i].src, PAGE_SIZE);
+            if ( w->jobs[i].fixup )
+                uncanonicalize_fixup(w->ctx, w->jobs[i].dst);
+        }
+
+        pthread_mutex_lock(&w->lock);
+        w->done_jobs += last - first;
+        if ( w->done_jobs == w->nr_jobs )
+            pthread_cond_broadcast(&w->cond);
+        pthread_mutex_unlock(&w->lock);
+    }
+}
+
+static void *restore_worker_thread(void *arg)
+{
+    struct restore_workers *w = arg;
+    unsigned int seen = 0;
+
+    pthread_mutex_lock(&w->lock);
+    for ( ; ; )
+    {
+        while ( !w->stop && (w->gen == seen) )
+            pthread_cond_wait(&w->cond, &w->lock);
+        if ( w->stop )
+            break;
+        seen = w->gen;
+
+        pthread_mutex_unlock(&w->lock);
+        restore_do_jobs(w);
+        pthread_mutex_lock(&w->lock);
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    return NULL;
+}
+
+static void restore_workers_destroy(struct restore_workers *w)
+{
+    unsigned int i;
+
+    pthread_mutex_lock(&w->lock);
+    w->stop = 1;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+
+    for ( i = 0; i < w->nr_threads; i++ )
+        pthread_join(w->threads[i], NULL);
+
+    pthread_cond_destroy(&w->cond);
+    pthread_mutex_destroy(&w->lock);
+    free(w->threads);
+    free(w);
+}
+
+static struct restore_workers *restore_workers_create(
+    xc_interface *xch, struct restore_ctx *ctx, unsigned int nr_workers)
+{
+    struct restore_workers *w;
+
+    if ( nr_workers > XC_RESTORE_MAX_WORKERS )
+        nr_workers = XC_RESTORE_MAX_WORKERS;
+
+    /* The calling thread is one of the workers. */
+    if ( nr_workers < 2 )
+        return NULL;
+
+    if ( !(w = calloc(1, sizeof(*w))) ||
+         !(w->threads = calloc(nr_workers - 1, sizeof(*w->threads))) )
+    {
+        free(w);
+        DPRINTF("Couldn't allocate restore workers, restoring serially\n");
+        return NULL;
+    }
+
+    w->ctx = ctx;
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+
+    for ( ; w->nr_threads < nr_workers - 1; w->nr_threads++ )
+        if ( pthread_create(&w->threads[w->nr_threads], NULL,
+                            restore_worker_thread, w) )
+            break;
+
+    if ( !w->nr_threads )
+    {
+        restore_workers_destroy(w);
+        DPRINTF("Couldn't start restore workers, restoring serially\n");
+        return NULL;
+    }
+
+    DPRINTF("Using %u restore workers\n", w->nr_threads + 1);
+
+    return w;
+}
+
+/* Run the queued jobs to completion. */
+static void restore_workers_run(struct restore_workers *w, unsigned int nr_jobs)
+{
+    pthread_mutex_lock(&w->lock);
+    w->nr_jobs = nr_jobs;
+    w->next_job = w->done_jobs = 0;
+    w->gen++;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+
+    restore_do_jobs(w);
+
+    pthread_mutex_lock(&w->lock);
+    while ( w->done_jobs != w->nr_jobs )
+        pthread_cond_wait(&w->cond, &w->lock);
+    pthread_mutex_unlock(&w->lock);
+}
+
 
 /* Load the p2m frame list, plus potential extended info chunk */
 static xen_pfn_t *load_p2m_frame_list(
@@ -676,6 +880,14 @@ typedef struct {
     /* Types of the pfns in the current region */
     unsigned long* pfn_types;
 
+    /* Zero/duplicate pages of the next batch (XC_SAVE_ID_PAGE_REFS) */
+    uint32_t refs[MAX_BATCH_SIZE];
+    unsigned int nr_refs;
+
+    /* Encoding of the next batch (XC_SAVE_ID_COMPRESSED_BATCH) */
+    uint32_t batch_codec, batch_len;
+    char *compdata;
+
     int verify;
 
     int new_ctxt_format;
@@ -714,6 +926,119 @@ static void pagebuf_free(pagebuf_t* buf)
         free(buf->pfn_types);
         buf->pfn_types = NULL;
     }
+    free(buf->compdata);
+    buf->compdata = NULL;
+}
+
+/*
+ * Read the data of a batch whose pfn types are already in buf, decoding it
+ * if XC_SAVE_ID_COMPRESSED_BATCH preceded the batch and recreating the
+ * pages elided by a preceding XC_SAVE_ID_PAGE_REFS chunk.
+ */
+static int pagebuf_read_pages(xc_interface *xch, struct restore_ctx *ctx,
+                              pagebuf_t* buf, int fd,
+                              int first, int count, int firstpage)
+{
+    int ref[MAX_BATCH_SIZE]; /* -2: sent, -1: zero, else source index */
+    int pos[MAX_BATCH_SIZE]; /* index into buf->pages */
+    char *dest[MAX_BATCH_SIZE];
+    xen_pfn_t pfns[MAX_BATCH_SIZE];
+    unsigned long pagetype;
+    unsigned int r, idx, src, nr = 0;
+    int i, p, run, start = 0;
+
+    for ( i = 0; i < count; i++ )
+        ref[i] = -2;
+
+    for ( r = 0; r < buf->nr_refs; r++ )
+    {
+        idx = XC_PAGE_REF_IDX(buf->refs[r]);
+        src = XC_PAGE_REF_SRC(buf->refs[r]);
+        if ( idx >= count || ref[idx] != -2 ||
+             (buf->pfn_types[first + idx] & XEN_DOMCTL_PFINFO_LTAB_MASK) ||
+             (src != XC_PAGE_REF_ZERO &&
+              (src >= idx || ref[src] != -2 ||
+               (buf->pfn_types[first + src] & XEN_DOMCTL_PFINFO_LTAB_MASK))) )
+        {
+            ERROR("Bad page reference %#x in batch of %d", buf->refs[r], count);
+            errno = EINVAL;
+            return -1;
+        }
+        ref[idx] = (src == XC_PAGE_REF_ZERO) ? -1 : src;
+    }
+
+    /* Read the pages which were sent, in runs. */
+    for ( i = run = 0, p = firstpage; i <= count; i++ )
+    {
+        if ( i < count )
+        {
+            pagetype = buf->pfn_types[first + i] & XEN_DOMCTL_PFINFO_LTAB_MASK;
+            if ( pagetype == XEN_DOMCTL_PFINFO_XTAB ||
+                 pagetype == XEN_DOMCTL_PFINFO_XALLOC )
+            {
+                pos[i] = -1;
+                continue;
+            }
+            pos[i] = p++;
+            if ( ref[i] == -2 && buf->batch_codec )
+            {
+                /* Page tables are never cached, as on the sending side. */
+                pagetype &= XEN_DOMCTL_PFINFO_LTABTYPE_MASK;
+                dest[nr] = buf->pages + pos[i] * PAGE_SIZE;
+                pfns[nr++] = ((pagetype >= XEN_DOMCTL_PFINFO_L1TAB) &&
+                              (pagetype <= XEN_DOMCTL_PFINFO_L4TAB)) ?
+                    INVALID_P2M_ENTRY :
+                    buf->pfn_types[first + i] & ~XEN_DOMCTL_PFINFO_LTAB_MASK;
+                continue;
+            }
+            if ( ref[i] == -2 )
+            {
+                if ( !run++ )
+                    start = pos[i];
+                continue;
+            }
+        }
+        if ( run &&
+             RDEXACT(fd, buf->pages + start * PAGE_SIZE, run * PAGE_SIZE) )
+        {
+            PERROR("Error when reading pages");
+            return -1;
+        }
+        run = 0;
+    }
+
+    if ( buf->batch_codec )
+    {
+        if ( !ctx->batch_comp &&
+             !(ctx->batch_comp = xc_batch_comp_create(xch)) )
+            return -1;
+        if ( RDEXACT(fd, buf->compdata, buf->batch_len) )
+        {
+            PERROR("Error when reading compressed batch");
+            return -1;
+        }
+        if ( xc_batch_comp_decode(xch, ctx->batch_comp, buf->batch_codec,
+                                  buf->compdata, buf->batch_len,
+                                  dest, pfns, nr) )
+        {
+            ERROR("Failed to decode compressed batch");
+            errno = EINVAL;
+            return -1;
+        }
+        buf->batch_codec = 0;
+    }
+
+    for ( i = 0; i < count; i++ )
+    {
+        if ( ref[i] == -1 )
+            memset(buf->pages + pos[i] * PAGE_SIZE, 0, PAGE_SIZE);
+        else if ( ref[i] >= 0 )
+            memcpy(buf->pages + pos[i] * PAGE_SIZE,
+                   buf->pages + pos[ref[i]] * PAGE_SIZE, PAGE_SIZE);
+    }
+
+    buf->nr_refs = 0;
+    return 0;
 }
 
 static int pagebuf_get_one(xc_interface *xch, struct restore_ctx *ctx,
@@ -932,6 +1257,40 @@ static int pagebuf_get_one(xc_interface *xch, struct restore_ctx *ctx,
         DPRINTF("read generation id buffer address");
         return pagebuf_get_one(xch, ctx, buf, fd, dom);
 
+    case XC_SAVE_ID_COMPRESSED_BATCH:
+        if ( RDEXACT(fd, &buf->batch_codec, sizeof(uint32_t)) ||
+             RDEXACT(fd, &buf->batch_len, sizeof(uint32_t)) )
+        {
+            PERROR("Error when reading batch compression header");
+            return -1;
+        }
+        if ( (buf->batch_codec != XC_BATCH_COMP_DELTA &&
+              buf->batch_codec != XC_BATCH_COMP_LZO) ||
+             buf->batch_len > xc_batch_comp_bound(MAX_BATCH_SIZE) )
+        {
+            ERROR("Bad batch compression header (codec %u, %u bytes)",
+                  buf->batch_codec, buf->batch_len);
+            errno = EINVAL;
+            return -1;
+        }
+        if ( !buf->compdata &&
+             !(buf->compdata = malloc(xc_batch_comp_bound(MAX_BATCH_SIZE))) )
+        {
+            ERROR("Could not allocate compressed batch buffer");
+            return -1;
+        }
+        return pagebuf_get_one(xch, ctx, buf, fd, dom);
+
+    case XC_SAVE_ID_PAGE_REFS:
+        if ( RDEXACT(fd, &buf->nr_refs, sizeof(uint32_t)) ||
+             buf->nr_refs > MAX_BATCH_SIZE ||
+             RDEXACT(fd, buf->refs, buf->nr_refs * sizeof(uint32_t)) )
+        {
+            PERROR("Error when reading page references");
+            return -1;
+        }
+        return pagebuf_get_one(xch, ctx, buf, fd, dom);
+
     default:
         if ( (count > MAX_BATCH_SIZE) || (count < 0) ) {
             ERROR("Max batch size exceeded (%d). Giving up.", count);
@@ -966,15 +1325,21 @@ static int pagebuf_get_one(xc_interface *xch, struct restore_ctx *ctx,
             ||(buf->pfn_types[i] & XEN_DOMCTL_PFINFO_LTAB_MASK) == XEN_DOMCTL_PFINFO_XALLOC)
             --countpages;
 
-    if (!countpages)
+    if (!countpages && !buf->nr_refs && !buf->batch_codec)
         return count;
 
     /* If Remus Checkpoint Compression is turned on, we will only be
      * receiving the pfn lists now. The compressed pages will come in later,
      * following a <XC_SAVE_ID_COMPRESSED_DATA, compressedChunkSize> tuple.
      */
-    if (buf->compressing)
+    if (buf->compressing) {
+        if (buf->nr_refs || buf->batch_codec) {
+            ERROR("Page references in a compressed checkpoint");
+            errno = EINVAL;
+            return -1;
+        }
         return pagebuf_get_one(xch, ctx, buf, fd, dom);
+    }
 
     oldcount = buf->nr_physpages;
     buf->nr_physpages += countpages;
@@ -990,7 +1355,11 @@ static int pagebuf_get_one(xc_interface *xch, struct restore_ctx *ctx,
         }
         buf->pages = ptmp;
     }
-    if ( RDEXACT(fd, buf->pages + oldcount * PAGE_SIZE, countpages * PAGE_SIZE) ) {
+    if (buf->nr_refs || buf->batch_codec) {
+        if (pagebuf_read_pages(xch, ctx, buf, fd, buf->nr_pages - count,
+                               count, oldcount))
+            return -1;
+    } else if ( RDEXACT(fd, buf->pages + oldcount * PAGE_SIZE, countpages * PAGE_SIZE) ) {
         PERROR("Error when reading pages");
         return -1;
     }
@@ -1019,7 +1388,8 @@ static int pagebuf_get(xc_interface *xch, struct restore_ctx *ctx,
 static int apply_batch(xc_interface *xch, uint32_t dom, struct restore_ctx *ctx,
                        xen_pfn_t* region_mfn, unsigned long* pfn_type, int pae_extended_cr3,
                        unsigned int hvm, struct xc_mmu* mmu,
-                       pagebuf_t* pagebuf, int curbatch, int superpages)
+                       pagebuf_t* pagebuf, int curbatch, int superpages,
+                       struct restore_workers *workers)
 {
     int i, j, curpage, nr_mfns;
     int k, scount;
@@ -1034,6 +1404,8 @@ static int apply_batch(xc_interface *xch, uint32_t dom, struct restore_ctx *ctx,
     struct domain_info_context *dinfo = &ctx->dinfo;
     int* pfn_err = NULL;
     int rc = -1;
+    struct restore_job *job;
+    unsigned int nr_jobs = 0;
 
     unsigned long mfn, pfn, pagetype;
 
@@ -1190,6 +1562,10 @@ static int apply_batch(xc_interface *xch, uint32_t dom, struct restore_ctx *ctx,
         return -1;
     }
 
+    /* Verify mode and Remus decompression need the serial loop below */
+    if ( workers && !pagebuf->verify && !pagebuf->compressing )
+        goto parallel;
+
     for ( i = 0, curpage = -1; i < j; i++ )
     {
         pfn      = pagebuf->pfn_types[i + curbatch] & ~XEN_DOMCTL_PFINFO_LTAB_MASK;
@@ -1309,6 +1685,93 @@ static int apply_batch(xc_interface *xch, uint32_t dom, struct restore_ctx *ctx,
     } /* end of 'batch' for loop */
 
     rc = nraces;
+    goto err_mapped;
+
+  parallel:
+    /*
+     * Same as above, except that the page copies and PTE rewrites are
+     * queued for the workers.  Frames referenced by page tables are
+     * allocated here first, so the workers only ever read the p2m.
+     */
+    for ( i = 0, curpage = -1; i < j; i++ )
+    {
+        pfn      = pagebuf->pfn_types[i + curbatch] & ~XEN_DOMCTL_PFINFO_LTAB_MASK;
+        pagetype = pagebuf->pfn_types[i + curbatch] &  XEN_DOMCTL_PFINFO_LTAB_MASK;
+
+        if ( pagetype == XEN_DOMCTL_PFINFO_XTAB 
+             || pagetype == XEN_DOMCTL_PFINFO_XALLOC)
+            continue;
+
+        if (pfn_err[i])
+        {
+            ERROR("unexpected PFN mapping failure pfn %lx map_mfn %lx p2m_mfn %lx",
+                  pfn, region_mfn[i], ctx->p2m[pfn]);
+            goto err_mapped;
+        }
+
+        ++curpage;
+
+        if ( pfn > dinfo->p2m_size )
+        {
+            ERROR("pfn out of range");
+            goto err_mapped;
+        }
+
+        pfn_type[pfn] = pagetype;
+
+        job = &workers->jobs[nr_jobs++];
+        job->dst = region_base + i*PAGE_SIZE;
+        job->src = pagebuf->pages + (curpage + curbatch) * PAGE_SIZE;
+        job->pfn = pfn;
+        job->mfn = ctx->p2m[pfn];
+        job->fixup = 0;
+        job->update = !hvm;
+
+        pagetype &= XEN_DOMCTL_PFINFO_LTABTYPE_MASK;
+
+        if ( (pagetype >= XEN_DOMCTL_PFINFO_L1TAB) &&
+             (pagetype <= XEN_DOMCTL_PFINFO_L4TAB) )
+        {
+            if ((ctx->pt_levels != 3) ||
+                pae_extended_cr3 ||
+                (pagetype != XEN_DOMCTL_PFINFO_L1TAB)) {
+
+                if (!uncanonicalize_alloc(xch, dom, ctx, job->src)) {
+                    DPRINTF("PT L%ld race on pfn=%08lx mfn=%08lx\n",
+                            pagetype >> 28, pfn, job->mfn);
+                    nraces++;
+                    /* Skipped, as in the serial path. */
+                    nr_jobs--;
+                    continue;
+                }
+                job->fixup = 1;
+            }
+        }
+        else if ( pagetype != XEN_DOMCTL_PFINFO_NOTAB )
+        {
+            ERROR("Bogus page type %lx page table is out of range: "
+                  "i=%d p2m_size=%lu", pagetype, i, dinfo->p2m_size);
+            goto err_mapped;
+        }
+    }
+
+    restore_workers_run(workers, nr_jobs);
+
+    for ( i = 0; i < nr_jobs; i++ )
+    {
+        job = &workers->jobs[i];
+        if ( job->update &&
+             xc_add_mmu_update(xch, mmu,
+                               (((unsigned long long)job->mfn) << PAGE_SHIFT)
+                               | MMU_MACHPHYS_UPDATE, job->pfn) )
+        {
+            PERROR("failed machpys update mfn=%lx pfn=%lx",
+                   job->mfn, job->pfn);
+            goto err_mapped;
+        }
+    }
+
+    rc = nraces;
 
   err_mapped:
     munmap(region_base, j*PAGE_SIZE);
@@ -1324,6 +1787,7 @@ int xc_domain_restore(xc_interface *xch, int io_fd, uint32_t dom,
                       unsigned int hvm, unsigned int pae, int superpages,
                       int no_incr_generationid,
                       unsigned long *vm_generationid_addr,
+                      unsigned int nr_workers,
                       struct restore_callbacks *callbacks)
 {
     DECLARE_DOMCTL;
@@ -1382,6 +1846,10 @@ int xc_domain_restore(xc_interface *xch, int io_fd, uint32_t dom,
     struct restore_ctx *ctx = &_ctx;
     struct domain_info_context *dinfo = &ctx->dinfo;
 
+    struct restore_workers *workers = NULL;
+    struct timeval load_start, load_end;
+    unsigned long load_pages, load_ms;
+
     DPRINTF("%s: starting restore of new domid %u", __func__, dom);
 
     pagebuf_init(&pagebuf);
@@ -1489,6 +1957,8 @@ int xc_domain_restore(xc_interface *xch, int io_fd, uint32_t dom,
         goto out;
     }
 
+    workers = restore_workers_create(xch, ctx, nr_workers);
+
     xc_report_progress_start(xch, "Reloading memory pages", dinfo->p2m_size);
 
     /*
@@ -1498,6 +1968,8 @@ int xc_domain_restore(xc_interface *xch, int io_fd, uint32_t dom,
 
     n = m = 0;
  loadpages:
+    gettimeofday(&load_start, NULL);
+    load_pages = 0;
     for ( ; ; )
     {
         int j, curbatch;
@@ -1578,7 +2050,7 @@ int xc_domain_restore(xc_interface *xch, int io_fd, uint32_t dom,
 
             brc = apply_batch(xch, dom, ctx, region_mfn, pfn_type,
                               pae_extended_cr3, hvm, mmu, &pagebuf, curbatch,
-                              superpages);
+                              superpages, workers);
             if ( brc < 0 )
                 goto out;
 
@@ -1591,6 +2063,7 @@ int xc_domain_restore(xc_interface *xch, int io_fd, uint32_t dom,
         pagebuf.compbuf_pos = pagebuf.compbuf_size = 0;
 
         n += j; /* crude stats */
+        load_pages += j;
 
         /* 
          * Discard cache for portion of file read so far up to last
@@ -1604,6 +2077,13 @@ int xc_domain_restore(xc_interface *xch, int io_fd, uint32_t dom,
         }
     }
 
+    gettimeofday(&load_end, NULL);
+    load_ms = (load_end.tv_sec - load_start.tv_sec) * 1000 +
+              (load_end.tv_usec - load_start.tv_usec) / 1000;
+    DPRINTF("Loaded %lu pages in %lums (%lu pages/s) with %u workers\n",
+            load_pages, load_ms, load_pages * 1000 / (load_ms ? : 1),
+            workers ? workers->nr_threads + 1 : 1);
+
     /*
      * Ensure we flush all machphys updates before potential PAE-specific
      * reallocations below.
@@ -2204,6 +2684,9 @@ int xc_domain_restore(xc_interface *xch, int io_fd, uint32_t dom,
     rc = 0;
 
  out:
+    if ( workers )
+        restore_workers_destroy(workers);
+    xc_batch_comp_free(xch, ctx->batch_comp);
     if ( (rc != 0) && (dom != 0) )
         xc_domain_destroy(xch, dom);
     xc_hypercall_buffer_free(xch, ctxt);
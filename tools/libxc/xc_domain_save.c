@@ -25,6 +25,10 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/time.h>
+#include <pthread.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "xc_private.h"
 #include "xc_bitops.h"
@@ -269,6 +273,174 @@ static int write_compressed(xc_interface *xch, comp_ctx *compress_ctx,
     return 0;
 }
 
+/*
+** Adaptive batch compression (XCFLAGS_BATCH_COMPRESS).
+**
+** Each batch is sent raw, delta-encoded against previously sent pages or
+** LZO1X-compressed, whichever is expected to get it to the receiver
+** soonest.  The estimate uses running averages of each codec's ratio and
+** encoding speed and of the rate at which the stream drains.  Every
+** COMP_PROBE_INTERVAL batches one of the compressing codecs is forced, so
+** that the estimates for a codec which is not being picked stay current.
+*/
+#define COMP_PROBE_INTERVAL 16
+#define COMP_EWMA(old, new) ((old) ? ((old) * 3 + (new)) / 4 : (new))
+
+static const char *comp_codec_name[XC_BATCH_COMP_NR] = { "raw", "delta", "lzo" };
+
+struct batch_comp {
+    batch_comp_ctx *ctx;
+    int pipelined;              /* encoding overlaps with writing */
+
+    /* Running estimates */
+    unsigned long ratio[XC_BATCH_COMP_NR];  /* output bytes per KiB input */
+    unsigned long speed[XC_BATCH_COMP_NR];  /* input bytes encoded per ms */
+    unsigned long link_speed;               /* bytes written per ms, under
+                                               save_pipe.lock if pipelined */
+    unsigned long nr_choices;
+
+    /* Pages of the batch being encoded */
+    char *pages[MAX_BATCH_SIZE];
+    xen_pfn_t pfns[MAX_BATCH_SIZE];
+    unsigned int nr_pages;
+
+    /* Buffers for the serial path */
+    char *ptpages;
+    char *buf;
+    unsigned long buf_size;
+
+    /* Counters, reported by print_stats() */
+    unsigned long batches[XC_BATCH_COMP_NR];
+    unsigned long long bytes_in[XC_BATCH_COMP_NR];
+    unsigned long long bytes_out[XC_BATCH_COMP_NR];
+};
+
+static struct batch_comp *comp_create(xc_interface *xch, int pipelined)
+{
+    struct batch_comp *bc;
+
+    if ( !(bc = calloc(1, sizeof(*bc))) )
+        return NULL;
+
+    bc->pipelined = pipelined;
+    bc->ratio[XC_BATCH_COMP_RAW] = 1024;
+    bc->buf_size = xc_batch_comp_bound(MAX_BATCH_SIZE);
+    bc->buf = malloc(bc->buf_size);
+    bc->ptpages = malloc(MAX_BATCH_SIZE * PAGE_SIZE);
+    bc->ctx = xc_batch_comp_create(xch);
+    if ( !bc->buf || !bc->ptpages || !bc->ctx )
+    {
+        xc_batch_comp_free(xch, bc->ctx);
+        free(bc->ptpages);
+        free(bc->buf);
+        free(bc);
+        return NULL;
+    }
+
+    return bc;
+}
+
+static void comp_destroy(xc_interface *xch, struct batch_comp *bc)
+{
+    xc_batch_comp_free(xch, bc->ctx);
+    free(bc->ptpages);
+    free(bc->buf);
+    free(bc);
+}
+
+/* Estimated time in us to get len bytes to the receiver with codec. */
+static uint64_t comp_cost(struct batch_comp *bc, int codec, uint64_t len)
+{
+    uint64_t enc = 0, wire;
+
+    wire = (len * bc->ratio[codec] / 1024) * 1000 / bc->link_speed;
+    if ( codec != XC_BATCH_COMP_RAW )
+        enc = len * 1000 / bc->speed[codec];
+
+    if ( bc->pipelined )
+        return (enc > wire) ? enc : wire;
+    return enc + wire;
+}
+
+/* Pick the codec for the next batch. */
+static int comp_choose(struct batch_comp *bc)
+{
+    int codec, best = XC_BATCH_COMP_RAW;
+    uint64_t cost, best_cost;
+
+    /* Measure the link with raw batches first. */
+    if ( !bc->link_speed )
+        return XC_BATCH_COMP_RAW;
+
+    if ( (bc->nr_choices++ % COMP_PROBE_INTERVAL) == 0 )
+        return 1 + (bc->nr_choices / COMP_PROBE_INTERVAL) %
+            (XC_BATCH_COMP_NR - 1);
+
+    best_cost = comp_cost(bc, XC_BATCH_COMP_RAW, MAX_BATCH_SIZE * PAGE_SIZE);
+    for ( codec = 1; codec < XC_BATCH_COMP_NR; codec++ )
+    {
+        if ( !bc->speed[codec] )
+            return codec;
+        cost = comp_cost(bc, codec, MAX_BATCH_SIZE * PAGE_SIZE);
+        if ( cost < best_cost )
+        {
+            best = codec;
+            best_cost = cost;
+        }
+    }
+
+    return best;
+}
+
+/*
+ * Encode the pages queued in bc with codec into out.  Returns the codec
+ * actually used: XC_BATCH_COMP_RAW if encoding failed or did not pay off,
+ * in which case the pages must be sent as usual.
+ */
+static int comp_encode(xc_interface *xch, struct batch_comp *bc, int codec,
+                       char *out, unsigned long outsize,
+                       unsigned long *outlen)
+{
+    unsigned long len = bc->nr_pages * PAGE_SIZE, usec;
+    struct timeval start, end;
+    unsigned int i;
+    int rc;
+
+    gettimeofday(&start, NULL);
+    rc = xc_batch_comp_encode(xch, bc->ctx, codec, bc->pages, bc->pfns,
+                              bc->nr_pages, out, outsize, outlen);
+    gettimeofday(&end, NULL);
+
+    usec = tv_delta(&end, &start) ? : 1;
+    bc->speed[codec] = COMP_EWMA(bc->speed[codec],
+                                 ((uint64_t)len * 1000 / usec) ? : 1);
+    bc->ratio[codec] = COMP_EWMA(bc->ratio[codec],
+                                 rc ? 1024 : ((uint64_t)*outlen * 1024 / len));
+
+    if ( rc || *outlen >= len )
+    {
+        for ( i = 0; i < bc->nr_pages; i++ )
+            if ( bc->pfns[i] != INVALID_P2M_ENTRY )
+                xc_batch_comp_invalidate(bc->ctx, bc->pfns[i]);
+        codec = XC_BATCH_COMP_RAW;
+        *outlen = len;
+    }
+
+    bc->batches[codec]++;
+    bc->bytes_in[codec] += len;
+    bc->bytes_out[codec] += *outlen;
+
+    return codec;
+}
+
+/* Account for len bytes of the stream having taken usec to write. */
+static void comp_note_write(struct batch_comp *bc, unsigned long len,
+                            uint64_t usec)
+{
+    bc->link_speed = COMP_EWMA(bc->link_speed,
+                               ((uint64_t)len * 1000 / (usec ? : 1)) ? : 1);
+}
+
 struct time_stats {
     struct timeval wall;
     long long d0_cpu, d1_cpu;
@@ -276,8 +448,11 @@ struct time_stats {
 
 static int print_stats(xc_interface *xch, uint32_t domid, int pages_sent,
                        struct time_stats *last,
-                       xc_shadow_op_stats_t *stats, int print)
+                       xc_shadow_op_stats_t *stats, struct batch_comp *bc,
+                       int print)
 {
+    int codec;
+
     struct time_stats now;
 
     gettimeofday(&now.wall, NULL);
@@ -309,6 +484,14 @@ static int print_stats(xc_interface *xch, uint32_t domid, int pages_sent,
                 (int)((pages_sent*PAGE_SIZE)/(wall_delta*(1000/8))),
                 (int)((stats->dirty_count*PAGE_SIZE)/(wall_delta*(1000/8))),
                 stats->dirty_count);
+
+        for ( codec = 0; bc && codec < XC_BATCH_COMP_NR; codec++ )
+            if ( bc->batches[codec] )
+                DPRINTF("%s: %lu batches, %lluKB -> %lluKB (%lu%%)\n",
+                        comp_codec_name[codec], bc->batches[codec],
+                        bc->bytes_in[codec] >> 10, bc->bytes_out[codec] >> 10,
+                        (unsigned long)(bc->bytes_out[codec] * 100 /
+                                        bc->bytes_in[codec]));
     }
 
     *last = now;
@@ -316,6 +499,367 @@ static int print_stats(xc_interface *xch, uint32_t domid, int pages_sent,
     return 0;
 }
 
+/*
+ * Convergence control for the live iterations.  After each round the
+ * pages dirtied since the last CLEAN are counted with a stats-only PEEK;
+ * together with the rate at which the round was sent this predicts the
+ * downtime of stopping now.  If the guest dirties memory faster than we
+ * can send it, its vCPUs may optionally be capped until it converges.
+ * Without a downtime target the rounds end as they always have, on
+ * max_iters, max_factor and min_remaining alone.
+ */
+#define CONVERGE_STALL_ROUNDS  3 /* rounds without progress before giving up */
+#define CONVERGE_MIN_CAP      10 /* lowest throttle, % of a pCPU per vCPU */
+
+#define CONVERGE_CONTINUE 0
+#define CONVERGE_DONE     1
+#define CONVERGE_STALLED  2
+
+struct converge {
+    uint32_t max_downtime;   /* ms, 0 for no target */
+    uint64_t start;          /* start of the current round, usec */
+    unsigned int stalled;
+    uint64_t send_rate;      /* pages/s in the last round */
+    int throttle;
+    /* Original scheduler parameters and the cap currently imposed
+     * (0 when not throttling). */
+    struct xen_domctl_sched_credit sched;
+    unsigned int cap, min_cap, max_cap;
+};
+
+static void converge_init(xc_interface *xch, uint32_t dom,
+                          struct converge *cv, uint32_t max_downtime,
+                          int throttle, unsigned int nr_vcpus)
+{
+    memset(cv, 0, sizeof(*cv));
+    cv->max_downtime = max_downtime;
+    cv->start = llgettimeofday();
+
+    if ( !throttle )
+        return;
+
+    if ( xc_sched_credit_domain_get(xch, dom, &cv->sched) )
+    {
+        DPRINTF("Couldn't get scheduler parameters, not throttling\n");
+        return;
+    }
+
+    cv->throttle = 1;
+    cv->max_cap = MIN(nr_vcpus * 100, 0xffffU);
+    if ( cv->sched.cap && cv->sched.cap < cv->max_cap )
+        cv->max_cap = cv->sched.cap;
+    cv->min_cap = MIN(nr_vcpus * CONVERGE_MIN_CAP, cv->max_cap);
+}
+
+static int converge_set_cap(xc_interface *xch, uint32_t dom,
+                            struct converge *cv, unsigned int cap)
+{
+    struct xen_domctl_sched_credit sdom = cv->sched;
+
+    sdom.cap = cap;
+    if ( xc_sched_credit_domain_set(xch, dom, &sdom) )
+    {
+        PERROR("Couldn't cap domain %u at %u%%", dom, cap);
+        return -1;
+    }
+    cv->cap = cap;
+    return 0;
+}
+
+static void converge_restore(xc_interface *xch, uint32_t dom,
+                             struct converge *cv)
+{
+    if ( !cv->cap )
+        return;
+
+    if ( xc_sched_credit_domain_set(xch, dom, &cv->sched) )
+        PERROR("Couldn't restore scheduler parameters of domain %u", dom);
+    cv->cap = 0;
+}
+
+static int converge_check(xc_interface *xch, uint32_t dom,
+                          struct converge *cv, unsigned int sent,
+                          unsigned long p2m_size)
+{
+    xc_shadow_op_stats_t stats;
+    uint64_t now = llgettimeofday();
+    uint64_t usec = (now - cv->start) ? : 1;
+    uint64_t send_rate, dirty_rate, downtime; /* pages/s, pages/s, ms */
+    unsigned int cap;
+
+    cv->start = now;
+
+    if ( xc_shadow_control(xch, dom, XEN_DOMCTL_SHADOW_OP_PEEK, NULL,
+                           p2m_size, NULL, 0, &stats) < 0 )
+    {
+        DPRINTF("Couldn't sample the dirty rate\n");
+        return CONVERGE_CONTINUE;
+    }
+
+    cv->send_rate = send_rate = (uint64_t)sent * 1000000 / usec;
+    dirty_rate = (uint64_t)stats.dirty_count * 1000000 / usec;
+    if ( !stats.dirty_count )
+        downtime = 0;
+    else if ( !send_rate )
+        downtime = ~0ULL;
+    else
+        downtime = (uint64_t)stats.dirty_count * 1000 / send_rate;
+
+    DPRINTF("Sent %"PRIu64" pages/s, dirtied %"PRIu64" pages/s, "
+            "%"PRIu32" dirty: predicted downtime %"PRIu64"ms\n",
+            send_rate, dirty_rate, stats.dirty_count, downtime);
+
+    if ( cv->max_downtime && downtime <= cv->max_downtime )
+        return CONVERGE_DONE;
+
+    if ( cv->max_downtime )
+        cv->stalled = (dirty_rate >= send_rate) ? cv->stalled + 1 : 0;
+
+    /* Aim for the guest to dirty at most half of what we can send. */
+    if ( cv->throttle && dirty_rate * 2 > send_rate )
+    {
+        cap = cv->cap ? : cv->max_cap;
+        cap = (uint64_t)cap * send_rate / (dirty_rate * 2);
+        if ( cap < cv->min_cap )
+            cap = cv->min_cap;
+        if ( cap < (cv->cap ? : cv->max_cap) &&
+             !converge_set_cap(xch, dom, cv, cap) )
+        {
+            DPRINTF("Throttling domain %u to %u%%\n", dom, cap);
+            cv->stalled = 0;
+        }
+    }
+
+    return (cv->stalled >= CONVERGE_STALL_ROUNDS) ?
+        CONVERGE_STALLED : CONVERGE_CONTINUE;
+}
+
+/*
+ * Post-copy: when the live rounds cannot converge, the final round sends
+ * the vCPU state and a working set of pages dirtied in each of the last
+ * two rounds, sized to the downtime budget.  The rest is left behind in
+ * a bitmap and served on demand once the stream is complete.
+ */
+#define POSTCOPY_MIN_WSS   256   /* pages, always allowed in the working set */
+#define POSTCOPY_DOWNTIME  300   /* ms, working set budget without a target */
+#define POSTCOPY_LOW_PFNS  0x100 /* the first MB is always sent */
+
+static unsigned int postcopy_special(xc_interface *xch, uint32_t dom,
+                                     unsigned long *pfns)
+{
+    static const int pfn_params[] = {
+        HVM_PARAM_IOREQ_PFN, HVM_PARAM_BUFIOREQ_PFN, HVM_PARAM_STORE_PFN,
+        HVM_PARAM_CONSOLE_PFN, HVM_PARAM_PAGING_RING_PFN,
+        HVM_PARAM_ACCESS_RING_PFN, HVM_PARAM_SHARING_RING_PFN,
+    };
+    static const int addr_params[] = {
+        HVM_PARAM_IDENT_PT, HVM_PARAM_VM86_TSS,
+    };
+    unsigned long val;
+    unsigned int i, nr = 0;
+
+    for ( i = 0; i < sizeof(pfn_params) / sizeof(pfn_params[0]); i++ )
+        if ( !xc_get_hvm_param(xch, dom, pfn_params[i], &val) && val )
+            pfns[nr++] = val;
+    for ( i = 0; i < sizeof(addr_params) / sizeof(addr_params[0]); i++ )
+        if ( !xc_get_hvm_param(xch, dom, addr_params[i], &val) && val )
+            pfns[nr++] = val >> PAGE_SHIFT;
+
+    return nr;
+}
+
+/*
+ * Move those of the n pages in pfns which can be mapped and have contents
+ * from to_send into left.  Anything else stays in to_send, so the final
+ * round describes it (as XTAB if need be) the way it always has: the
+ * target owns the domain by the time a page left behind is asked for.
+ */
+static unsigned long postcopy_defer_batch(xc_interface *xch, uint32_t dom,
+                                          const xen_pfn_t *pfns,
+                                          unsigned int n,
+                                          unsigned long *to_send,
+                                          unsigned long *left)
+{
+    xen_pfn_t types[MAX_BATCH_SIZE];
+    int err[MAX_BATCH_SIZE];
+    unsigned long nr = 0;
+    unsigned int i;
+    void *region;
+
+    memcpy(types, pfns, n * sizeof(*types));
+    region = xc_map_foreign_bulk(xch, dom, PROT_READ, types, err, n);
+    if ( region == NULL )
+        return 0;
+    munmap(region, n * PAGE_SIZE);
+
+    if ( xc_get_pfn_type_batch(xch, dom, n, types) )
+        return 0;
+
+    for ( i = 0; i < n; i++ )
+    {
+        switch ( types[i] & XEN_DOMCTL_PFINFO_LTAB_MASK )
+        {
+        case XEN_DOMCTL_PFINFO_XTAB:
+        case XEN_DOMCTL_PFINFO_XALLOC:
+        case XEN_DOMCTL_PFINFO_PAGEDTAB:
+            continue;
+        }
+        if ( err[i] )
+            continue;
+
+        clear_bit(pfns[i], to_send);
+        set_bit(pfns[i], left);
+        nr++;
+    }
+
+    return nr;
+}
+
+/* Move the pages of to_send outside the working set into left. */
+static unsigned long postcopy_defer(xc_interface *xch, uint32_t dom,
+                                    unsigned long *to_send,
+                                    unsigned long *hot,
+                                    unsigned long *left,
+                                    unsigned long p2m_size,
+                                    unsigned long budget)
+{
+    unsigned long special[16];
+    xen_pfn_t batch[MAX_BATCH_SIZE];
+    unsigned long pfn, nr = 0, wss = 0;
+    unsigned int i, n = 0, nr_special = postcopy_special(xch, dom, special);
+
+    for ( pfn = POSTCOPY_LOW_PFNS; pfn < p2m_size; pfn++ )
+    {
+        if ( !test_bit(pfn, to_send) )
+            continue;
+
+        if ( test_bit(pfn, hot) && wss < budget )
+        {
+            wss++;
+            continue;
+        }
+
+        for ( i = 0; i < nr_special && special[i] != pfn; i++ )
+            ;
+        if ( i < nr_special )
+            continue;
+
+        batch[n++] = pfn;
+        if ( n == MAX_BATCH_SIZE )
+        {
+            nr += postcopy_defer_batch(xch, dom, batch, n, to_send, left);
+            n = 0;
+        }
+    }
+    if ( n )
+        nr += postcopy_defer_batch(xch, dom, batch, n, to_send, left);
+
+    DPRINTF("Post-copy: sending a working set of %lu pages, "
+            "leaving %lu behind\n", wss, nr);
+    return nr;
+}
+
+static int postcopy_serve(xc_interface *xch, int io_fd, int req_fd,
+                          uint32_t dom, unsigned long *left,
+                          unsigned long p2m_size, uint64_t nr_left)
+{
+    static const char zero[PAGE_SIZE];
+    uint64_t pfns[1024];
+    xen_pfn_t gmfns[XC_POSTCOPY_BATCH];
+    int err[XC_POSTCOPY_BATCH];
+    struct iovec iov[2 + XC_POSTCOPY_BATCH];
+    unsigned long pfn, served = 0, requests = 0;
+    uint32_t nr;
+    unsigned int i, n;
+    void *region;
+
+    if ( write_exact(io_fd, &nr_left, sizeof(nr_left)) )
+        goto write_err;
+
+    for ( pfn = 0, n = 0; pfn < p2m_size; pfn++ )
+    {
+        if ( !test_bit(pfn, left) )
+            continue;
+        pfns[n++] = pfn;
+        if ( n == sizeof(pfns) / sizeof(pfns[0]) )
+        {
+            if ( write_exact(io_fd, pfns, n * sizeof(*pfns)) )
+                goto write_err;
+            n = 0;
+        }
+    }
+    if ( n && write_exact(io_fd, pfns, n * sizeof(*pfns)) )
+        goto write_err;
+
+    for ( ; ; )
+    {
+        if ( read_exact(req_fd, &nr, sizeof(nr)) )
+        {
+            PERROR("Error reading post-copy request");
+            return -1;
+        }
+
+        if ( !nr )
+            break;
+
+        if ( nr > XC_POSTCOPY_BATCH ||
+             read_exact(req_fd, pfns, nr * sizeof(*pfns)) )
+        {
+            ERROR("Bad post-copy request for %u pages", nr);
+            return -1;
+        }
+
+        for ( i = 0; i < nr; i++ )
+        {
+            if ( pfns[i] >= p2m_size || !test_bit(pfns[i], left) )
+            {
+                ERROR("Post-copy request for pfn %"PRIx64" not left behind",
+                      pfns[i]);
+                return -1;
+            }
+            gmfns[i] = pfns[i];
+        }
+
+        /*
+         * The target owns the domain now: failing here would lose the
+         * guest, so a page which cannot be read goes out zeroed.
+         */
+        region = xc_map_foreign_bulk(xch, dom, PROT_READ, gmfns, err, nr);
+        if ( region == NULL )
+            PERROR("Couldn't map post-copy pages, sending them zeroed");
+
+        iov[0].iov_base = &nr;
+        iov[0].iov_len = sizeof(nr);
+        iov[1].iov_base = pfns;
+        iov[1].iov_len = nr * sizeof(*pfns);
+        for ( i = 0; i < nr; i++ )
+        {
+            if ( region && err[i] )
+                ERROR("Couldn't map pfn %"PRIx64" for post-copy (%d), "
+                      "sending it zeroed", pfns[i], err[i]);
+            iov[2 + i].iov_base = (region && !err[i])
+                ? (char *)region + i * PAGE_SIZE : (char *)zero;
+            iov[2 + i].iov_len = PAGE_SIZE;
+        }
+        i = writev_exact(io_fd, iov, 2 + nr);
+        if ( region )
+            munmap(region, nr * PAGE_SIZE);
+        if ( i )
+            goto write_err;
+
+        served += nr;
+        requests++;
+    }
+
+    DPRINTF("Post-copy: served %lu of %"PRIu64" pages in %lu requests\n",
+            served, nr_left, requests);
+    return 0;
+
+ write_err:
+    PERROR("Error when writing post-copy pages");
+    return -1;
+}
+
 
 static int analysis_phase(xc_interface *xch, uint32_t domid, struct save_ctx *ctx,
                           xc_hypercall_buffer_t *arr, int runs)
@@ -525,6 +1069,576 @@ static int canonicalize_pagetable(struct save_ctx *ctx,
     return race;
 }
 
+/*
+** Zero and duplicate page elision (XCFLAGS_ELIDE_PAGES).
+**
+** Before a batch goes out, its plain data pages are checked for being all
+** zeroes or identical to an earlier page of the same batch.  Such pages are
+** listed in an XC_SAVE_ID_PAGE_REFS chunk and their data is left out of
+** the batch.  Duplicates are only looked for within a batch: a page sent
+** in an earlier batch may since have been dirtied and resent, so the
+** receiver's copy is not a safe reference.  Candidates are found through a
+** hash of a sample of each page and always confirmed with memcmp().
+**
+** Duplicates are only elided in the final iteration, once the guest is
+** paused.  While it runs, the referenced page may change between the
+** compare and the send, and the receiver would then rebuild the duplicate
+** from the new contents; a page that was zero and is no longer is simply
+** dirty again and gets resent.
+*/
+#define ELIDE_HASH_SIZE   2048  /* power of two, >= 2 * MAX_BATCH_SIZE */
+#define ELIDE_HASH_SAMPLE 32    /* words sampled per page */
+
+struct page_elide {
+    uint16_t bucket[ELIDE_HASH_SIZE];   /* first page index + 1, 0 = empty */
+    uint16_t next[MAX_BATCH_SIZE];      /* chain, page index + 1 */
+    uint8_t skip[MAX_BATCH_SIZE];       /* page data is not sent */
+    uint32_t refs[MAX_BATCH_SIZE];
+    unsigned int nr_refs;
+
+    /* Statistics */
+    unsigned long zero_pages, dup_pages;
+};
+
+static int page_is_zero(const void *page)
+{
+#ifdef __SSE2__
+    const __m128i *p = page;
+    __m128i acc = _mm_setzero_si128();
+    unsigned int i;
+
+    for ( i = 0; i < PAGE_SIZE / sizeof(*p); i += 8 )
+    {
+        acc = _mm_or_si128(acc, _mm_or_si128(
+                  _mm_or_si128(_mm_or_si128(p[i], p[i + 1]),
+                               _mm_or_si128(p[i + 2], p[i + 3])),
+                  _mm_or_si128(_mm_or_si128(p[i + 4], p[i + 5]),
+                               _mm_or_si128(p[i + 6], p[i + 7]))));
+        /* Most non-zero pages are caught in the first cache line. */
+        if ( _mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128()))
+             != 0xffff )
+            return 0;
+    }
+    return 1;
+#else
+    const unsigned long *p = page;
+    unsigned int i;
+
+    for ( i = 0; i < PAGE_SIZE / sizeof(*p); i += 4 )
+        if ( p[i] | p[i + 1] | p[i + 2] | p[i + 3] )
+            return 0;
+    return 1;
+#endif
+}
+
+static unsigned int page_hash(const void *page)
+{
+    const uint64_t *p = page;
+    uint64_t h = 0;
+    unsigned int i;
+
+    for ( i = 0; i < ELIDE_HASH_SAMPLE; i++ )
+        h = (h ^ p[i * (PAGE_SIZE / sizeof(*p) / ELIDE_HASH_SAMPLE) + (i & 7)])
+            * 0x9e3779b97f4a7c15ULL;
+
+    return (h >> 32) & (ELIDE_HASH_SIZE - 1);
+}
+
+static void elide_reset(struct page_elide *pe)
+{
+    memset(pe->bucket, 0, sizeof(pe->bucket));
+    memset(pe->skip, 0, sizeof(pe->skip));
+    pe->nr_refs = 0;
+}
+
+/*
+ * Consider page idx of the current batch.  Returns 1 (and records a
+ * reference) if its data need not be sent.  Duplicates are only looked
+ * for if dups is set, i.e. the guest is paused.
+ */
+static int elide_page(struct page_elide *pe, unsigned int idx,
+                      const char *region_base, int dups)
+{
+    const char *page = region_base + PAGE_SIZE * idx;
+    unsigned int h, j;
+
+    if ( page_is_zero(page) )
+    {
+        pe->refs[pe->nr_refs++] = XC_PAGE_REF(idx, XC_PAGE_REF_ZERO);
+        pe->skip[idx] = 1;
+        pe->zero_pages++;
+        return 1;
+    }
+
+    if ( !dups )
+        return 0;
+
+    h = page_hash(page);
+    for ( j = pe->bucket[h]; j; j = pe->next[j - 1] )
+    {
+        if ( memcmp(region_base + PAGE_SIZE * (j - 1), page, PAGE_SIZE) )
+            continue;
+        pe->refs[pe->nr_refs++] = XC_PAGE_REF(idx, j - 1);
+        pe->skip[idx] = 1;
+        pe->dup_pages++;
+        return 1;
+    }
+
+    pe->next[idx] = pe->bucket[h];
+    pe->bucket[h] = idx + 1;
+    return 0;
+}
+
+/*
+** Pipelined sender for the live iterations (XCFLAGS_PIPELINE).
+**
+** The main thread scans the dirty bitmap, maps each batch and fetches the
+** page types, then hands the batch to a canonicalisation thread which
+** rewrites page-table pages and builds an iovec describing the batch
+** exactly as the serial path would have written it.  A writer thread then
+** pushes the iovec to the socket and unmaps the batch.  Batches travel
+** through a small ring of slots, so the stream format is unchanged and
+** an unmodified receiver can restore it.
+*/
+#define PIPE_DEPTH 4
+
+struct pipe_slot {
+    unsigned int batch;
+    void *region_base;
+    unsigned long pfn_type[MAX_BATCH_SIZE];
+    char *ptpages;            /* canonicalised page-table pages */
+    struct {
+        int id;
+        uint32_t nr;
+    } refs_hdr;               /* XC_SAVE_ID_PAGE_REFS chunk */
+    uint32_t refs[MAX_BATCH_SIZE];
+    struct {
+        int id;
+        uint32_t codec, len;
+    } comp_hdr;               /* XC_SAVE_ID_COMPRESSED_BATCH chunk */
+    char *compbuf;            /* encoded page data */
+    struct iovec iov[MAX_BATCH_SIZE + 5];
+    int iovcnt;
+    size_t len;
+};
+
+struct save_pipe {
+    xc_interface *xch;
+    struct save_ctx *ctx;
+    struct outbuf *ob;
+    int io_fd;
+    /* Shared with the serial path, which only runs while we are drained. */
+    struct page_elide *elide;
+    struct batch_comp *bc;
+
+    pthread_t canon_thread, write_thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int stop, error;
+
+    /* Free running indices: tail <= canon <= head <= tail + PIPE_DEPTH */
+    unsigned int head, canon, tail;
+    struct pipe_slot slots[PIPE_DEPTH];
+
+    /* Statistics */
+    unsigned long batches, races, full_stalls;
+    unsigned long long bytes;
+};
+
+static void *pipe_canon_thread(void *arg)
+{
+    struct save_pipe *sp = arg;
+    struct pipe_slot *slot;
+    struct page_elide *pe = sp->elide;
+    struct batch_comp *bc = sp->bc;
+    unsigned long pfn, pagetype, complen;
+    unsigned int j, first;
+    int codec;
+    void *spage;
+    char *dpage;
+
+    for ( ; ; )
+    {
+        pthread_mutex_lock(&sp->lock);
+        while ( !sp->stop && !sp->error && (sp->canon == sp->head) )
+            pthread_cond_wait(&sp->cond, &sp->lock);
+        if ( sp->stop || sp->error )
+        {
+            pthread_mutex_unlock(&sp->lock);
+            break;
+        }
+        slot = &sp->slots[sp->canon % PIPE_DEPTH];
+        pthread_mutex_unlock(&sp->lock);
+
+        slot->iovcnt = 0;
+        slot->len = 0;
+
+        if ( pe )
+        {
+            elide_reset(pe);
+            for ( j = 0; j < slot->batch; j++ )
+                if ( !(slot->pfn_type[j] & XEN_DOMCTL_PFINFO_LTAB_MASK) )
+                    elide_page(pe, j, slot->region_base, 0);
+
+            if ( pe->nr_refs )
+            {
+                slot->refs_hdr.id = XC_SAVE_ID_PAGE_REFS;
+                slot->refs_hdr.nr = pe->nr_refs;
+                memcpy(slot->refs, pe->refs, pe->nr_refs * sizeof(uint32_t));
+                slot->iov[0].iov_base = &slot->refs_hdr;
+                slot->iov[0].iov_len = sizeof(slot->refs_hdr);
+                slot->iov[1].iov_base = slot->refs;
+                slot->iov[1].iov_len = pe->nr_refs * sizeof(uint32_t);
+                slot->iovcnt = 2;
+                slot->len = slot->iov[0].iov_len + slot->iov[1].iov_len;
+            }
+        }
+
+        codec = XC_BATCH_COMP_RAW;
+        if ( bc )
+        {
+            /* The writer thread updates link_speed under the lock. */
+            pthread_mutex_lock(&sp->lock);
+            codec = comp_choose(bc);
+            pthread_mutex_unlock(&sp->lock);
+        }
+        if ( codec != XC_BATCH_COMP_RAW )
+        {
+            bc->nr_pages = 0;
+            for ( j = 0; j < slot->batch; j++ )
+            {
+                pfn      = slot->pfn_type[j] & ~XEN_DOMCTL_PFINFO_LTAB_MASK;
+                pagetype = slot->pfn_type[j] &  XEN_DOMCTL_PFINFO_LTAB_MASK;
+
+                if ( pagetype == XEN_DOMCTL_PFINFO_XTAB
+                     || pagetype == XEN_DOMCTL_PFINFO_XALLOC )
+                    continue;
+                if ( pe && pe->skip[j] )
+                {
+                    xc_batch_comp_invalidate(bc->ctx, pfn);
+                    continue;
+                }
+
+                spage = (char *)slot->region_base + (PAGE_SIZE * j);
+                pagetype &= XEN_DOMCTL_PFINFO_LTABTYPE_MASK;
+
+                if ( (pagetype >= XEN_DOMCTL_PFINFO_L1TAB) &&
+                     (pagetype <= XEN_DOMCTL_PFINFO_L4TAB) )
+                {
+                    dpage = slot->ptpages + (PAGE_SIZE * j);
+                    if ( canonicalize_pagetable(sp->ctx, pagetype, pfn,
+                                                spage, dpage) )
+                        sp->races++;
+                    xc_batch_comp_invalidate(bc->ctx, pfn);
+                    bc->pages[bc->nr_pages] = dpage;
+                    bc->pfns[bc->nr_pages++] = INVALID_P2M_ENTRY;
+                }
+                else
+                {
+                    bc->pages[bc->nr_pages] = spage;
+                    bc->pfns[bc->nr_pages++] = pfn;
+                }
+            }
+
+            codec = comp_encode(sp->xch, bc, codec, slot->compbuf,
+                                bc->buf_size, &complen);
+            if ( codec != XC_BATCH_COMP_RAW )
+            {
+                slot->comp_hdr.id = XC_SAVE_ID_COMPRESSED_BATCH;
+                slot->comp_hdr.codec = codec;
+                slot->comp_hdr.len = complen;
+                slot->iov[slot->iovcnt].iov_base = &slot->comp_hdr;
+                slot->iov[slot->iovcnt].iov_len = sizeof(slot->comp_hdr);
+                slot->len += sizeof(slot->comp_hdr);
+                slot->iovcnt++;
+            }
+        }
+        else if ( bc )
+        {
+            /* Sent raw: the receiver's cache won't see these pages. */
+            for ( j = 0; j < slot->batch; j++ )
+                xc_batch_comp_invalidate(bc->ctx, slot->pfn_type[j] &
+                                         ~XEN_DOMCTL_PFINFO_LTAB_MASK);
+        }
+
+        slot->iov[slot->iovcnt].iov_base = &slot->batch;
+        slot->iov[slot->iovcnt].iov_len = sizeof(unsigned int);
+        slot->iov[slot->iovcnt + 1].iov_base = slot->pfn_type;
+        slot->iov[slot->iovcnt + 1].iov_len =
+            sizeof(unsigned long) * slot->batch;
+        slot->len += slot->iov[slot->iovcnt].iov_len +
+                     slot->iov[slot->iovcnt + 1].iov_len;
+        slot->iovcnt += 2;
+        first = slot->iovcnt;
+
+        if ( codec != XC_BATCH_COMP_RAW )
+        {
+            slot->iov[slot->iovcnt].iov_base = slot->compbuf;
+            slot->iov[slot->iovcnt].iov_len = complen;
+            slot->len += complen;
+            slot->iovcnt++;
+        }
+
+        for ( j = 0; (codec == XC_BATCH_COMP_RAW) && (j < slot->batch); j++ )
+        {
+            struct iovec *last = &slot->iov[slot->iovcnt - 1];
+
+            pfn      = slot->pfn_type[j] & ~XEN_DOMCTL_PFINFO_LTAB_MASK;
+            pagetype = slot->pfn_type[j] &  XEN_DOMCTL_PFINFO_LTAB_MASK;
+
+            if ( pagetype == XEN_DOMCTL_PFINFO_XTAB
+                 || pagetype == XEN_DOMCTL_PFINFO_XALLOC
+                 || (pe && pe->skip[j]) )
+                continue;
+
+            spage = (char *)slot->region_base + (PAGE_SIZE * j);
+            pagetype &= XEN_DOMCTL_PFINFO_LTABTYPE_MASK;
+
+            if ( (pagetype >= XEN_DOMCTL_PFINFO_L1TAB) &&
+                 (pagetype <= XEN_DOMCTL_PFINFO_L4TAB) )
+            {
+                /* Races are only fatal for non-live saves, which never
+                   use the pipeline: the page gets resent later. */
+                dpage = slot->ptpages + (PAGE_SIZE * j);
+                if ( canonicalize_pagetable(sp->ctx, pagetype, pfn,
+                                            spage, dpage) )
+                    sp->races++;
+                spage = dpage;
+            }
+            else if ( slot->iovcnt > first &&
+                      (char *)last->iov_base + last->iov_len == spage )
+            {
+                /* Extend the current run of data pages. */
+                last->iov_len += PAGE_SIZE;
+                slot->len += PAGE_SIZE;
+                continue;
+            }
+
+            slot->iov[slot->iovcnt].iov_base = spage;
+            slot->iov[slot->iovcnt].iov_len = PAGE_SIZE;
+            slot->iovcnt++;
+            slot->len += PAGE_SIZE;
+        }
+
+        pthread_mutex_lock(&sp->lock);
+        sp->canon++;
+        pthread_cond_broadcast(&sp->cond);
+        pthread_mutex_unlock(&sp->lock);
+    }
+
+    return NULL;
+}
+
+static void *pipe_write_thread(void *arg)
+{
+    struct save_pipe *sp = arg;
+    xc_interface *xch = sp->xch;
+    struct pipe_slot *slot;
+    struct timeval start, end;
+    int rc;
+
+    for ( ; ; )
+    {
+        pthread_mutex_lock(&sp->lock);
+        while ( !sp->stop && !sp->error && (sp->tail == sp->canon) )
+            pthread_cond_wait(&sp->cond, &sp->lock);
+        if ( sp->stop || sp->error )
+        {
+            pthread_mutex_unlock(&sp->lock);
+            break;
+        }
+        slot = &sp->slots[sp->tail % PIPE_DEPTH];
+        pthread_mutex_unlock(&sp->lock);
+
+        gettimeofday(&start, NULL);
+        rc = writev_exact(sp->io_fd, slot->iov, slot->iovcnt);
+        gettimeofday(&end, NULL);
+        if ( !rc )
+        {
+            sp->ob->write_count += slot->len;
+            if ( sp->ob->write_count >= (MAX_PAGECACHE_USAGE * PAGE_SIZE) )
+            {
+                /* Time to discard cache - dont care if this fails */
+                int saved_errno = errno;
+                discard_file_cache(xch, sp->io_fd, 0 /* no flush */);
+                errno = saved_errno;
+                sp->ob->write_count = 0;
+            }
+            sp->bytes += slot->len;
+        }
+        else
+        {
+            rc = errno ? : EIO;
+            PERROR("Error when writing to state file (pipeline)");
+        }
+
+        munmap(slot->region_base, slot->batch * PAGE_SIZE);
+        slot->region_base = NULL;
+
+        pthread_mutex_lock(&sp->lock);
+        if ( rc )
+            sp->error = rc;
+        else
+        {
+            if ( sp->bc )
+                comp_note_write(sp->bc, slot->len, tv_delta(&end, &start));
+            sp->tail++;
+        }
+        pthread_cond_broadcast(&sp->cond);
+        pthread_mutex_unlock(&sp->lock);
+    }
+
+    return NULL;
+}
+
+static struct save_pipe *pipe_create(xc_interface *xch, struct save_ctx *ctx,
+                                     struct outbuf *ob, int io_fd,
+                                     struct page_elide *elide,
+                                     struct batch_comp *bc)
+{
+    struct save_pipe *sp;
+    int i;
+
+    if ( !(sp = calloc(1, sizeof(*sp))) )
+    {
+        ERROR("Couldn't allocate save pipeline");
+        return NULL;
+    }
+
+    sp->xch = xch;
+    sp->ctx = ctx;
+    sp->ob = ob;
+    sp->io_fd = io_fd;
+    sp->elide = elide;
+    sp->bc = bc;
+    pthread_mutex_init(&sp->lock, NULL);
+    pthread_cond_init(&sp->cond, NULL);
+
+    for ( i = 0; i < PIPE_DEPTH; i++ )
+    {
+        sp->slots[i].ptpages = malloc(MAX_BATCH_SIZE * PAGE_SIZE);
+        if ( bc )
+            sp->slots[i].compbuf = malloc(bc->buf_size);
+        if ( !sp->slots[i].ptpages || (bc && !sp->slots[i].compbuf) )
+        {
+            ERROR("Couldn't allocate save pipeline buffers");
+            goto err;
+        }
+    }
+
+    if ( pthread_create(&sp->canon_thread, NULL, pipe_canon_thread, sp) )
+    {
+        ERROR("Couldn't create save pipeline canonicalisation thread");
+        goto err;
+    }
+
+    if ( pthread_create(&sp->write_thread, NULL, pipe_write_thread, sp) )
+    {
+        ERROR("Couldn't create save pipeline writer thread");
+        pthread_mutex_lock(&sp->lock);
+        sp->stop = 1;
+        pthread_cond_broadcast(&sp->cond);
+        pthread_mutex_unlock(&sp->lock);
+        pthread_join(sp->canon_thread, NULL);
+        goto err;
+    }
+
+    return sp;
+
+ err:
+    for ( i = 0; i < PIPE_DEPTH; i++ )
+    {
+        free(sp->slots[i].ptpages);
+        free(sp->slots[i].compbuf);
+    }
+    pthread_cond_destroy(&sp->cond);
+    pthread_mutex_destroy(&sp->lock);
+    free(sp);
+    return NULL;
+}
+
+/* Wait for a free slot.  Returns NULL if a pipeline stage has failed. */
+static struct pipe_slot *pipe_get_slot(struct save_pipe *sp)
+{
+    struct pipe_slot *slot = NULL;
+
+    pthread_mutex_lock(&sp->lock);
+    if ( !sp->error && (sp->head - sp->tail == PIPE_DEPTH) )
+        sp->full_stalls++;
+    while ( !sp->error && (sp->head - sp->tail == PIPE_DEPTH) )
+        pthread_cond_wait(&sp->cond, &sp->lock);
+    if ( !sp->error )
+        slot = &sp->slots[sp->head % PIPE_DEPTH];
+    pthread_mutex_unlock(&sp->lock);
+
+    return slot;
+}
+
+/* Hand a filled slot (from pipe_get_slot) to the canonicalisation stage. */
+static void pipe_submit(struct save_pipe *sp)
+{
+    pthread_mutex_lock(&sp->lock);
+    sp->head++;
+    sp->batches++;
+    pthread_cond_broadcast(&sp->cond);
+    pthread_mutex_unlock(&sp->lock);
+}
+
+/*
+ * Wait until everything submitted so far has reached the socket.  Must be
+ * called before anything else writes to io_fd.  Returns 0 on success.
+ */
+static int pipe_drain(struct save_pipe *sp)
+{
+    int rc;
+
+    pthread_mutex_lock(&sp->lock);
+    while ( !sp->error && (sp->tail != sp->head) )
+        pthread_cond_wait(&sp->cond, &sp->lock);
+    rc = sp->error;
+    pthread_mutex_unlock(&sp->lock);
+
+    if ( rc )
+        errno = rc;
+
+    return rc ? -1 : 0;
+}
+
+static void pipe_destroy(struct save_pipe *sp)
+{
+    xc_interface *xch = sp->xch;
+    struct pipe_slot *slot;
+    int i;
+
+    pthread_mutex_lock(&sp->lock);
+    sp->stop = 1;
+    pthread_cond_broadcast(&sp->cond);
+    pthread_mutex_unlock(&sp->lock);
+
+    pthread_join(sp->canon_thread, NULL);
+    pthread_join(sp->write_thread, NULL);
+
+    /* Unmap anything left behind by an aborted save. */
+    for ( ; sp->tail != sp->head; sp->tail++ )
+    {
+        slot = &sp->slots[sp->tail % PIPE_DEPTH];
+        if ( slot->region_base )
+            munmap(slot->region_base, slot->batch * PAGE_SIZE);
+    }
+
+    DPRINTF("Pipeline: %lu batches, %llu bytes, %lu stalls, %lu PT races\n",
+            sp->batches, sp->bytes, sp->full_stalls, sp->races);
+
+    for ( i = 0; i < PIPE_DEPTH; i++ )
+    {
+        free(sp->slots[i].ptpages);
+        free(sp->slots[i].compbuf);
+    }
+    pthread_cond_destroy(&sp->cond);
+    pthread_mutex_destroy(&sp->lock);
+    free(sp);
+}
+
 xen_pfn_t *xc_map_m2p(xc_interface *xch,
                                  unsigned long max_mfn,
                                  int prot,
@@ -804,7 +1918,8 @@ static int save_tsc_info(xc_interface *xch, uint32_t dom, int io_fd)
 }
 
 int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iters,
-                   uint32_t max_factor, uint32_t min_remaining, uint32_t flags,
+                   uint32_t max_factor, uint32_t min_remaining,
+                   uint32_t max_downtime, uint32_t flags,
                    struct save_callbacks* callbacks, int hvm,
                    unsigned long vm_generationid_addr)
 {
@@ -899,6 +2014,27 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iter
 
     int completed = 0;
 
+    /* Pipelined sender, used for the live iterations only */
+    struct save_pipe *sp = NULL;
+    struct pipe_slot *slot;
+
+    /* Zero/duplicate page elision state */
+    struct page_elide *elide = NULL;
+    int eliding;
+
+    /* Adaptive batch compression state */
+    struct batch_comp *bc = NULL;
+    unsigned long complen;
+    struct timeval wstart, wend;
+    int codec;
+
+    /* Dirty-rate based convergence control */
+    struct converge cv = { 0 };
+
+    /* Post-copy: pages dirtied in the previous round, pages left behind */
+    unsigned long *hot = NULL, *left = NULL;
+    uint64_t nr_left = 0;
+
     DPRINTF("%s: starting save of domid %u", __func__, dom);
 
     if ( hvm && !callbacks->switch_qemu_logdirty )
@@ -1099,7 +2235,7 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iter
         DPRINTF("Had %d unexplained entries in p2m table\n", err);
     }
 
-    print_stats(xch, dom, 0, &time_stats, &shadow_stats, 0);
+    print_stats(xch, dom, 0, &time_stats, &shadow_stats, bc, 0);
 
     tmem_saved = xc_tmem_save(xch, dom, io_fd, live, XC_SAVE_ID_TMEM);
     if ( tmem_saved == -1 )
@@ -1114,6 +2250,44 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iter
         goto out;
     }
 
+    if ( (flags & XCFLAGS_ELIDE_PAGES) &&
+         !(elide = calloc(1, sizeof(*elide))) )
+        DPRINTF("Couldn't allocate page elision state, sending all pages\n");
+
+    if ( (flags & XCFLAGS_BATCH_COMPRESS) &&
+         !(flags & XCFLAGS_CHECKPOINT_COMPRESS) &&
+         !(bc = comp_create(xch, live && (flags & XCFLAGS_PIPELINE))) )
+        DPRINTF("Couldn't set up batch compression, sending uncompressed\n");
+
+    if ( live && (flags & XCFLAGS_PIPELINE) &&
+         !(sp = pipe_create(xch, ctx, &ob_pagebuf, io_fd, elide, bc)) )
+        DPRINTF("Couldn't set up save pipeline, sending serially\n");
+
+    if ( live )
+        converge_init(xch, dom, &cv, max_downtime,
+                      flags & XCFLAGS_THROTTLE, info.max_vcpu_id + 1);
+
+    if ( (flags & XCFLAGS_POSTCOPY) )
+    {
+        uint64_t pod_entries = 0;
+
+        if ( !live || !hvm || callbacks->checkpoint ||
+             !callbacks->postcopy_handoff )
+            DPRINTF("Post-copy needs a live HVM save and a handoff "
+                    "callback, ignoring\n");
+        /* The target could not page the guest in (EXDEV): stay pre-copy. */
+        else if ( !xc_domain_get_pod_target(xch, dom, NULL, NULL,
+                                            &pod_entries) && pod_entries )
+            DPRINTF("Post-copy cannot page a populate-on-demand guest, "
+                    "ignoring\n");
+        else if ( !(hot = calloc(1, bitmap_size(dinfo->p2m_size))) ||
+                  !(left = calloc(1, bitmap_size(dinfo->p2m_size))) )
+        {
+            ERROR("Couldn't allocate post-copy bitmaps");
+            goto out;
+        }
+    }
+
   copypages:
 #define wrexact(fd, buf, len) write_buffer(xch, last_iter, ob, (fd), (buf), (len))
 #define wruncached(fd, live, buf, len) write_uncached(xch, last_iter, ob, (fd), (buf), (len))
@@ -1330,6 +2504,132 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iter
                 continue; /* bail on this batch: no valid pages */
             }
 
+            if ( sp && !last_iter )
+            {
+                /* Hand the batch over; the writer thread unmaps it. */
+                if ( !(slot = pipe_get_slot(sp)) )
+                {
+                    PERROR("Error when writing to state file (pipeline)");
+                    munmap(region_base, batch*PAGE_SIZE);
+                    goto out;
+                }
+                slot->batch = batch;
+                slot->region_base = region_base;
+                for ( j = 0; j < batch; j++ )
+                    slot->pfn_type[j] = pfn_type[j];
+                pipe_submit(sp);
+
+                sent_this_iter += batch;
+                continue;
+            }
+
+            eliding = elide && !compressing;
+            if ( eliding )
+            {
+                elide_reset(elide);
+                for ( j = 0; j < batch; j++ )
+                    if ( !(pfn_type[j] & XEN_DOMCTL_PFINFO_LTAB_MASK) )
+                        elide_page(elide, j, (char *)region_base, last_iter);
+
+                if ( elide->nr_refs )
+                {
+                    int id = XC_SAVE_ID_PAGE_REFS;
+                    uint32_t nr = elide->nr_refs;
+
+                    if ( wrexact(io_fd, &id, sizeof(id)) ||
+                         wrexact(io_fd, &nr, sizeof(nr)) ||
+                         wrexact(io_fd, elide->refs, nr * sizeof(uint32_t)) )
+                    {
+                        PERROR("Error when writing to state file (page refs)");
+                        goto out;
+                    }
+                }
+            }
+
+            codec = (bc && !compressing) ? comp_choose(bc) : XC_BATCH_COMP_RAW;
+            complen = 0;
+            if ( codec != XC_BATCH_COMP_RAW )
+            {
+                bc->nr_pages = 0;
+                for ( j = 0; j < batch; j++ )
+                {
+                    unsigned long pfn, pagetype;
+                    void *spage = (char *)region_base + (PAGE_SIZE*j);
+                    char *dpage;
+
+                    pfn      = pfn_type[j] & ~XEN_DOMCTL_PFINFO_LTAB_MASK;
+                    pagetype = pfn_type[j] &  XEN_DOMCTL_PFINFO_LTAB_MASK;
+
+                    if ( pagetype == XEN_DOMCTL_PFINFO_XTAB
+                         || pagetype == XEN_DOMCTL_PFINFO_XALLOC )
+                        continue;
+                    if ( eliding && elide->skip[j] )
+                    {
+                        xc_batch_comp_invalidate(bc->ctx, pfn);
+                        continue;
+                    }
+
+                    pagetype &= XEN_DOMCTL_PFINFO_LTABTYPE_MASK;
+
+                    if ( (pagetype >= XEN_DOMCTL_PFINFO_L1TAB) &&
+                         (pagetype <= XEN_DOMCTL_PFINFO_L4TAB) )
+                    {
+                        dpage = bc->ptpages + (PAGE_SIZE * bc->nr_pages);
+                        race = canonicalize_pagetable(ctx, pagetype, pfn,
+                                                      spage, dpage);
+                        if ( race && !live )
+                        {
+                            ERROR("Fatal PT race (pfn %lx, type %08lx)", pfn,
+                                  pagetype);
+                            goto out;
+                        }
+                        xc_batch_comp_invalidate(bc->ctx, pfn);
+                        bc->pages[bc->nr_pages] = dpage;
+                        bc->pfns[bc->nr_pages++] = INVALID_P2M_ENTRY;
+                    }
+                    else
+                    {
+                        bc->pages[bc->nr_pages] = spage;
+                        bc->pfns[bc->nr_pages++] = pfn;
+                    }
+                }
+
+                codec = comp_encode(xch, bc, codec, bc->buf, bc->buf_size,
+                                    &complen);
+                if ( codec != XC_BATCH_COMP_RAW )
+                {
+                    int id = XC_SAVE_ID_COMPRESSED_BATCH;
+                    uint32_t hdr[2] = { codec, complen };
+
+                    if ( wrexact(io_fd, &id, sizeof(id)) ||
+                         wrexact(io_fd, hdr, sizeof(hdr)) )
+                    {
+                        PERROR("Error when writing to state file "
+                               "(batch compression)");
+                        goto out;
+                    }
+                }
+            }
+            else if ( bc && !compressing )
+            {
+                /* Sent raw: the receiver's cache won't see these pages. */
+                for ( j = 0; j < batch; j++ )
+                {
+                    unsigned long pagetype =
+                        pfn_type[j] & XEN_DOMCTL_PFINFO_LTAB_MASK;
+
+                    xc_batch_comp_invalidate(bc->ctx, pfn_type[j] &
+                                             ~XEN_DOMCTL_PFINFO_LTAB_MASK);
+                    if ( pagetype != XEN_DOMCTL_PFINFO_XTAB &&
+                         pagetype != XEN_DOMCTL_PFINFO_XALLOC &&
+                         !(eliding && elide->skip[j]) )
+                        complen += PAGE_SIZE;
+                }
+            }
+
+            /* Only the write counts towards the link speed. */
+            gettimeofday(&wstart, NULL);
+
             if ( wrexact(io_fd, &batch, sizeof(unsigned int)) )
             {
                 PERROR("Error when writing to state file (2)");
@@ -1348,6 +2648,16 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iter
                 while ( --j >= 0 )
                     pfn_type[j] = ((unsigned long *)pfn_type)[j];
 
+            if ( codec != XC_BATCH_COMP_RAW )
+            {
+                if ( wrexact(io_fd, bc->buf, complen) )
+                {
+                    PERROR("Error when writing to state file (4d)");
+                    goto out;
+                }
+                goto batch_done;
+            }
+
             /* entering this loop, pfn_type is now in pfns (Not mfns) */
             run = 0;
             for ( j = 0; j < batch; j++ )
@@ -1358,7 +2668,7 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iter
                 pfn      = pfn_type[j] & ~XEN_DOMCTL_PFINFO_LTAB_MASK;
                 pagetype = pfn_type[j] &  XEN_DOMCTL_PFINFO_LTAB_MASK;
 
-                if ( pagetype != 0 )
+                if ( pagetype != 0 || (eliding && elide->skip[j]) )
                 {
                     /* If the page is not a normal data page, write out any
                        run of pages we may have previously acumulated */
@@ -1381,6 +2691,10 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iter
                     || pagetype == XEN_DOMCTL_PFINFO_XALLOC )
                     continue;
 
+                /* skip zero and duplicate pages listed in the refs chunk */
+                if ( eliding && elide->skip[j] )
+                    continue;
+
                 pagetype &= XEN_DOMCTL_PFINFO_LTABTYPE_MASK;
 
                 if ( (pagetype >= XEN_DOMCTL_PFINFO_L1TAB) &&
@@ -1485,6 +2799,13 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iter
                 }                        
             }
 
+          batch_done:
+            if ( bc && !compressing && !last_iter )
+            {
+                gettimeofday(&wend, NULL);
+                comp_note_write(bc, complen, tv_delta(&wend, &wstart));
+            }
+
             sent_this_iter += batch;
 
             munmap(region_base, batch*PAGE_SIZE);
@@ -1493,17 +2814,29 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iter
 
       skip:
 
+        /* Everything below may write to io_fd directly. */
+        if ( sp && pipe_drain(sp) )
+        {
+            PERROR("Error when writing to state file (pipeline)");
+            goto out;
+        }
+
         xc_report_progress_step(xch, dinfo->p2m_size, dinfo->p2m_size);
 
         total_sent += sent_this_iter;
 
         if ( last_iter )
         {
-            print_stats( xch, dom, sent_this_iter, &time_stats, &shadow_stats, 1);
+            print_stats( xch, dom, sent_this_iter, &time_stats, &shadow_stats, bc, 1);
 
             DPRINTF("Total pages sent= %ld (%.2fx)\n",
                     total_sent, ((float)total_sent)/dinfo->p2m_size );
             DPRINTF("(of which %ld were fixups)\n", needed_to_fix  );
+            if ( elide )
+                DPRINTF("Elided %lu zero and %lu duplicate pages (%lu MB)\n",
+                        elide->zero_pages, elide->dup_pages,
+                        ((elide->zero_pages + elide->dup_pages) * PAGE_SIZE)
+                        >> 20);
         }
 
         if ( last_iter && debug )
@@ -1528,17 +2861,23 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iter
 
         if ( live )
         {
-            int min_reached = sent_this_iter + skip_this_iter < min_remaining;
+            int min_reached, cstate;
+
+            cstate = converge_check(xch, dom, &cv, sent_this_iter,
+                                    dinfo->p2m_size);
+            min_reached = (sent_this_iter + skip_this_iter < min_remaining) ||
+                          (cstate == CONVERGE_DONE);
             if ( (iter >= max_iters) ||
                  min_reached ||
+                 (cstate == CONVERGE_STALLED) ||
                  (total_sent > dinfo->p2m_size*max_factor) )
             {
-                if ( !min_reached && abort_if_busy )
+                if ( !min_reached && abort_if_busy && !left )
                 {
                     ERROR("Live migration aborted, as requested. (guest too busy?)"
                      " total_sent %lu iter %d, max_iters %u max_factor %u",
                       total_sent, iter, max_iters, max_factor);
-                    print_stats(xch, dom, sent_this_iter, &time_stats, &shadow_stats, 1);
+                    print_stats(xch, dom, sent_this_iter, &time_stats, &shadow_stats, bc, 1);
                     rc = 1;
                     goto out;
                 }
@@ -1553,6 +2892,8 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iter
                     goto out;
                 }
 
+                converge_restore(xch, dom, &cv);
+
                 DPRINTF("SUSPEND shinfo %08lx\n", info.shared_info_frame);
                 if ( (tmem_saved > 0) &&
                      (xc_tmem_save_extra(xch,dom,io_fd,XC_SAVE_ID_TMEM_EXTRA) == -1) )
@@ -1570,6 +2911,9 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iter
 
             }
 
+            if ( hot )
+                memcpy(hot, to_send, bitmap_size(dinfo->p2m_size));
+
             if ( xc_shadow_control(xch, dom,
                                    XEN_DOMCTL_SHADOW_OP_CLEAN, HYPERCALL_BUFFER(to_send),
                                    dinfo->p2m_size, NULL, 0, &shadow_stats) != dinfo->p2m_size )
@@ -1578,9 +2922,17 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iter
                 goto out;
             }
 
+            if ( last_iter && left && !min_reached )
+                nr_left = postcopy_defer(xch, dom, to_send, hot, left,
+                                         dinfo->p2m_size,
+                                         MAX(cv.send_rate *
+                                             (cv.max_downtime ? :
+                                              POSTCOPY_DOWNTIME) / 1000,
+                                             POSTCOPY_MIN_WSS));
+
             sent_last_iter = sent_this_iter;
 
-            print_stats(xch, dom, sent_this_iter, &time_stats, &shadow_stats, 1);
+            print_stats(xch, dom, sent_this_iter, &time_stats, &shadow_stats, bc, 1);
 
         }
     } /* end of infinite for loop */
@@ -2032,6 +3384,14 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iter
  out:
     completed = 1;
 
+    if ( sp )
+    {
+        pipe_destroy(sp);
+        sp = NULL;
+    }
+
+    converge_restore(xch, dom, &cv);
+
     if ( !rc && callbacks->postcopy )
         callbacks->postcopy(callbacks->data);
 
@@ -2064,6 +3424,21 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iter
 
     discard_file_cache(xch, io_fd, 1 /* flush */);
 
+    if ( !rc && nr_left )
+    {
+        int req_fd = callbacks->postcopy_handoff(callbacks->data);
+
+        if ( req_fd < 0 )
+        {
+            ERROR("Post-copy handoff failed");
+            rc = 1;
+        }
+        else if ( postcopy_serve(xch, io_fd, req_fd, dom, left,
+                                 dinfo->p2m_size, nr_left) )
+            rc = 1;
+        nr_left = 0;
+    }
+
     /* Enable compression now, finally */
     compressing = (flags & XCFLAGS_CHECKPOINT_COMPRESS);
 
@@ -2072,7 +3447,7 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iter
         callbacks->checkpoint(callbacks->data) > 0)
     {
         /* reset stats timer */
-        print_stats(xch, dom, 0, &time_stats, &shadow_stats, 0);
+        print_stats(xch, dom, 0, &time_stats, &shadow_stats, bc, 0);
 
         rc = 1;
         /* last_iter = 1; */
@@ -2083,7 +3458,7 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iter
             goto out;
         }
         DPRINTF("SUSPEND shinfo %08lx\n", info.shared_info_frame);
-        print_stats(xch, dom, 0, &time_stats, &shadow_stats, 1);
+        print_stats(xch, dom, 0, &time_stats, &shadow_stats, bc, 1);
 
         if ( xc_shadow_control(xch, dom,
                                XEN_DOMCTL_SHADOW_OP_CLEAN, HYPERCALL_BUFFER(to_send),
@@ -2125,8 +3500,13 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iter
 
     free(pfn_type);
     free(pfn_batch);
+    free(elide);
+    if ( bc )
+        comp_destroy(xch, bc);
     free(pfn_err);
     free(to_fix);
+    free(hot);
+    free(left);
 
     DPRINTF("Save exit of domid %u with rc=%d\n", dom, rc);
 
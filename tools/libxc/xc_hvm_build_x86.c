@@ -252,6 +252,7 @@ static int setup_guest(xc_interface *xch,
     unsigned long stat_normal_pages = 0, stat_2mb_pages = 0, 
         stat_1gb_pages = 0;
     int pod_mode = 0;
+    xc_p2m_stats_t p2m_stats;
 
     if ( nr_pages > target_pages )
         pod_mode = XENMEMF_populate_on_demand;
@@ -318,9 +319,9 @@ static int setup_guest(xc_interface *xch,
     /*
      * Allocate memory for HVM guest, skipping VGA hole 0xA0000-0xC0000.
      *
-     * We attempt to allocate 1GB pages if possible. It falls back on 2MB
-     * pages if 1GB allocation fails. 4KB pages will be used eventually if
-     * both fail.
+     * We attempt to allocate 1GB pages if possible. Xen backs a 1GB extent
+     * with 2MB (or, failing that, 4KB) pages if it cannot allocate it in
+     * one piece. Unaligned ranges use 2MB pages, and 4KB pages eventually.
      * 
      * Under 2MB mode, we allocate pages in batches of no more than 8MB to 
      * ensure that we can be preempted and hence dom0 remains responsive.
@@ -365,7 +366,9 @@ static int setup_guest(xc_interface *xch,
                 sp_extents[i] = page_array[cur_pages+(i<<SUPERPAGE_1GB_SHIFT)];
 
             done = xc_domain_populate_physmap(xch, dom, nr_extents, SUPERPAGE_1GB_SHIFT,
-                                              pod_mode, sp_extents);
+                                              pod_mode ? pod_mode :
+                                              XENMEMF_order_fallback,
+                                              sp_extents);
 
             if ( done > 0 )
             {
@@ -430,6 +433,15 @@ static int setup_guest(xc_interface *xch,
         goto error_out;
     }
 
+    /* Extents may have been split, so report what actually backs the
+     * guest if Xen can tell us. */
+    if ( !pod_mode && xc_domain_p2m_stats(xch, dom, &p2m_stats) == 0 )
+    {
+        stat_normal_pages = p2m_stats.ram_4k;
+        stat_2mb_pages = p2m_stats.ram_2m >> SUPERPAGE_2MB_SHIFT;
+        stat_1gb_pages = p2m_stats.ram_1g >> SUPERPAGE_1GB_SHIFT;
+    }
+
     IPRINTF("PHYSICAL MEMORY ALLOCATION:\n"
             "  4KB PAGES: 0x%016lx\n"
             "  2MB PAGES: 0x%016lx\n"
@@ -0,0 +1,62 @@
+/*
+ * Tools-side glue for the hypervisor's LZO1X implementation
+ * (xen/common/lzo.c), used to compress the migration stream.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef XC_LZO_H
+#define XC_LZO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint16_t u16;
+typedef uint32_t u32;
+
+#ifndef likely
+#define likely(x)   __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+#endif
+#ifndef noinline
+#define noinline    __attribute__((noinline))
+#endif
+
+/* Keep in sync with xen/include/xen/lzo.h */
+#define LZO1X_MEM_COMPRESS (16384 * sizeof(unsigned char *))
+#define LZO1X_1_MEM_COMPRESS LZO1X_MEM_COMPRESS
+
+#define lzo1x_worst_compress(x) ((x) + ((x) / 16) + 64 + 3)
+
+/* This requires 'workmem' of size LZO1X_1_MEM_COMPRESS */
+int lzo1x_1_compress(const unsigned char *src, size_t src_len,
+                     unsigned char *dst, size_t *dst_len, void *wrkmem);
+
+/* safe decompression with overrun testing */
+int lzo1x_decompress_safe(const unsigned char *src, size_t src_len,
+                          unsigned char *dst, size_t *dst_len);
+
+#define LZO_E_OK                  0
+#define LZO_E_ERROR               (-1)
+#define LZO_E_OUT_OF_MEMORY       (-2)
+#define LZO_E_NOT_COMPRESSIBLE    (-3)
+#define LZO_E_INPUT_OVERRUN       (-4)
+#define LZO_E_OUTPUT_OVERRUN      (-5)
+#define LZO_E_LOOKBEHIND_OVERRUN  (-6)
+#define LZO_E_EOF_NOT_FOUND       (-7)
+#define LZO_E_INPUT_NOT_CONSUMED  (-8)
+#define LZO_E_NOT_YET_IMPLEMENTED (-9)
+
+#endif /* XC_LZO_H */
@@ -336,6 +336,42 @@ int xc_getcpuinfo(xc_interface *xch, int max_cpus,
     return rc;
 }
 
+int xc_sched_latency_get(xc_interface *xch, uint32_t type, uint32_t id,
+                         xc_schedlat_stats_t *stats)
+{
+    int rc;
+    DECLARE_SYSCTL;
+    DECLARE_HYPERCALL_BOUNCE(stats, sizeof(*stats), XC_HYPERCALL_BUFFER_BOUNCE_OUT);
+
+    if ( xc_hypercall_bounce_pre(xch, stats) )
+        return -1;
+
+    sysctl.cmd = XEN_SYSCTL_schedlat_op;
+    sysctl.u.schedlat_op.cmd = XEN_SYSCTL_SCHEDLAT_OP_get;
+    sysctl.u.schedlat_op.type = type;
+    sysctl.u.schedlat_op.id = id;
+    set_xen_guest_handle(sysctl.u.schedlat_op.stats, stats);
+
+    rc = do_sysctl(xch, &sysctl);
+
+    xc_hypercall_bounce_post(xch, stats);
+
+    return rc;
+}
+
+int xc_sched_latency_reset(xc_interface *xch, uint32_t type, uint32_t id)
+{
+    DECLARE_SYSCTL;
+
+    sysctl.cmd = XEN_SYSCTL_schedlat_op;
+    sysctl.u.schedlat_op.cmd = XEN_SYSCTL_SCHEDLAT_OP_reset;
+    sysctl.u.schedlat_op.type = type;
+    sysctl.u.schedlat_op.id = id;
+    set_xen_guest_handle(sysctl.u.schedlat_op.stats, HYPERCALL_BUFFER_NULL);
+
+    return do_sysctl(xch, &sysctl);
+}
+
 
 int xc_hvm_set_pci_intx_level(
     xc_interface *xch, domid_t dom,
@@ -22,7 +22,8 @@
 #include <xenguest.h>
 
 int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iters,
-                   uint32_t max_factor, uint32_t min_remaining, uint32_t flags,
+                   uint32_t max_factor, uint32_t min_remaining,
+                   uint32_t max_downtime, uint32_t flags,
                    struct save_callbacks* callbacks, int hvm,
                    unsigned long vm_generationid_addr)
 {
@@ -37,6 +38,7 @@ int xc_domain_restore(xc_interface *xch, int io_fd, uint32_t dom,
                       unsigned int hvm, unsigned int pae, int superpages,
                       int no_incr_generationid,
                       unsigned long *vm_generationid_addr,
+                      unsigned int nr_workers,
                       struct restore_callbacks *callbacks)
 {
     errno = ENOSYS;
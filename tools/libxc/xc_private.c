@@ -26,11 +26,16 @@
 #include <unistd.h>
 #include <pthread.h>
 #include <assert.h>
+#include <limits.h>
 
 #ifndef __MINIOS__
 #include <dlfcn.h>
 #endif
 
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
 #define XENCTRL_OSDEP "XENCTRL_OSDEP"
 
 /*
@@ -856,6 +861,43 @@ int write_exact(int fd, const void *data, size_t size)
     return 0;
 }
 
+int writev_exact(int fd, const struct iovec *iov, int iovcnt)
+{
+    struct iovec local[IOV_MAX];
+    int i, cnt;
+    ssize_t len;
+
+    while ( iovcnt > 0 )
+    {
+        cnt = (iovcnt > IOV_MAX) ? IOV_MAX : iovcnt;
+        memcpy(local, iov, cnt * sizeof(*iov));
+        i = 0;
+
+        while ( i < cnt )
+        {
+            len = writev(fd, &local[i], cnt - i);
+            if ( (len == -1) && (errno == EINTR) )
+                continue;
+            if ( len <= 0 )
+                return -1;
+
+            /* Skip over fully written elements, then trim a partial one. */
+            while ( (i < cnt) && (len >= local[i].iov_len) )
+                len -= local[i++].iov_len;
+            if ( i < cnt )
+            {
+                local[i].iov_base = (char *)local[i].iov_base + len;
+                local[i].iov_len -= len;
+            }
+        }
+
+        iov += cnt;
+        iovcnt -= cnt;
+    }
+
+    return 0;
+}
+
 int xc_ffs8(uint8_t x)
 {
     int i;
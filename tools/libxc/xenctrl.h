@@ -697,6 +697,15 @@ int xc_sched_credit2_domain_get(xc_interface *xch,
                                uint32_t domid,
                                struct xen_domctl_sched_credit2 *sdom);
 
+/* sdom->vcpuid selects one vcpu, or XEN_DOMCTL_SCHED_RTDS_ALL_VCPUS. */
+int xc_sched_rtds_domain_set(xc_interface *xch,
+                             uint32_t domid,
+                             struct xen_domctl_sched_rtds *sdom);
+
+int xc_sched_rtds_domain_get(xc_interface *xch,
+                             uint32_t domid,
+                             struct xen_domctl_sched_rtds *sdom);
+
 int
 xc_sched_arinc653_schedule_set(
     xc_interface *xch,
@@ -757,6 +766,21 @@ int xc_domain_p2m_audit(xc_interface *xch,
                         uint64_t *m2p_bad,   
                         uint64_t *p2m_bad);
 
+typedef xen_domctl_p2m_stats_t xc_p2m_stats_t;
+
+/**
+ * This function reports how much of a translated domain's RAM is mapped
+ * by 4k, 2M and 1G p2m entries, along with its populate-on-demand state.
+ *
+ * @parm xch a handle to an open hypervisor interface
+ * @parm domid the domain id to query
+ * @parm stats where to store the page counts
+ * return 0 on success, -1 on failure
+ */
+int xc_domain_p2m_stats(xc_interface *xch,
+                        uint32_t domid,
+                        xc_p2m_stats_t *stats);
+
 /**
  * This function sets or clears the requirement that an access memory
  * event listener is required on the domain.
@@ -1020,6 +1044,15 @@ typedef xen_sysctl_cpuinfo_t xc_cpuinfo_t;
 int xc_getcpuinfo(xc_interface *xch, int max_cpus,
                   xc_cpuinfo_t *info, int *nr_cpus); 
 
+/*
+ * Scheduling latency statistics of a domain or a cpupool, selected by
+ * type (XEN_SYSCTL_SCHEDLAT_domain or XEN_SYSCTL_SCHEDLAT_cpupool).
+ */
+typedef xen_sysctl_schedlat_stats_t xc_schedlat_stats_t;
+int xc_sched_latency_get(xc_interface *xch, uint32_t type, uint32_t id,
+                         xc_schedlat_stats_t *stats);
+int xc_sched_latency_reset(xc_interface *xch, uint32_t type, uint32_t id);
+
 int xc_domain_setmaxmem(xc_interface *xch,
                         uint32_t domid,
                         unsigned int max_memkb);
@@ -2239,4 +2272,47 @@ int xc_compression_uncompress_page(xc_interface *xch, char *compbuf,
 				   unsigned long compbuf_size,
 				   unsigned long *compbuf_pos, char *dest);
 
+/**
+ * Batch compression for live migration
+ */
+#define XC_BATCH_COMP_RAW   0
+#define XC_BATCH_COMP_DELTA 1
+#define XC_BATCH_COMP_LZO   2
+#define XC_BATCH_COMP_NR    3
+
+typedef struct batch_comp_ctx batch_comp_ctx;
+batch_comp_ctx *xc_batch_comp_create(xc_interface *xch);
+void xc_batch_comp_free(xc_interface *xch, batch_comp_ctx *ctx);
+
+/**
+ * Worst case size of the encoding of nr_pages pages, for any codec.
+ */
+unsigned long xc_batch_comp_bound(unsigned int nr_pages);
+
+/**
+ * Encode nr pages with the given codec into out, updating the page cache.
+ * pfns[i] is the pfn of pages[i], or INVALID_P2M_ENTRY for pages which must
+ * not be cached (page tables).  Returns 0 on success, -1 on failure; the
+ * cache is then in an undefined state for those pfns and the caller must
+ * invalidate them.
+ */
+int xc_batch_comp_encode(xc_interface *xch, batch_comp_ctx *ctx, int codec,
+                         char **pages, const xen_pfn_t *pfns, unsigned int nr,
+                         char *out, unsigned long outsize,
+                         unsigned long *outlen);
+
+/**
+ * Decode the data of a batch encoded by xc_batch_comp_encode() into pages,
+ * given the same pfns.  Returns 0 on success, -1 on a malformed stream.
+ */
+int xc_batch_comp_decode(xc_interface *xch, batch_comp_ctx *ctx, int codec,
+                         char *in, unsigned long inlen,
+                         char **pages, const xen_pfn_t *pfns, unsigned int nr);
+
+/**
+ * Drop pfn from the sender's page cache.  Must be called for each page
+ * which is sent by other means than xc_batch_comp_encode().
+ */
+void xc_batch_comp_invalidate(batch_comp_ctx *ctx, xen_pfn_t pfn);
+
 #endif /* XENCTRL_H */
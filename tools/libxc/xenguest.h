@@ -30,6 +30,32 @@
 #define XCFLAGS_CHECKPOINT_COMPRESS    (1 << 4)
 #define XCFLAGS_DOMSAVE_ABORT_IF_BUSY  (1 << 5)
 #define XCFLAGS_PROGRESS  (1 << 6)
+#define XCFLAGS_PIPELINE  (1 << 7)
+#define XCFLAGS_ELIDE_PAGES (1 << 8)
+#define XCFLAGS_BATCH_COMPRESS (1 << 9)
+#define XCFLAGS_THROTTLE (1 << 10)
+#define XCFLAGS_POSTCOPY (1 << 11)
+
+/*
+ * Post-copy migration (XCFLAGS_POSTCOPY, HVM only).  If a live save
+ * cannot converge, the final round sends only a working set and the
+ * remaining pages are left behind.  Once the stream and anything the
+ * toolstack appends in postcopy_handoff are written, the sender continues
+ * on io_fd with
+ *
+ *   uint64_t nr;  uint64_t pfn[nr];        pages left behind
+ *
+ * and then serves requests from the receiver, read from the fd returned by
+ * postcopy_handoff (io_fd itself if the stream is bidirectional), until
+ * it sends an empty one:
+ *
+ *   receiver:  uint32_t nr;  uint64_t pfn[nr];            nr <= XC_POSTCOPY_BATCH
+ *   sender:    uint32_t nr;  uint64_t pfn[nr];  pages[nr]
+ *
+ * On the receiving side, xenpaging --postcopy pages the listed pfns out
+ * before the guest is started and faults them in from the socket.
+ */
+#define XC_POSTCOPY_BATCH 64
 
 #define X86_64_B_SIZE   64 
 #define X86_32_B_SIZE   32
@@ -74,6 +100,15 @@ struct save_callbacks {
      */
     int (*toolstack_save)(uint32_t domid, uint8_t **buf, uint32_t *len, void *data);
 
+    /* Post-copy saves only (unrelated to the postcopy callback above):
+     * called once the stream is complete and before the pages left behind
+     * are served.  The toolstack appends its own records and lets the
+     * receiver start the guest.  Returns the fd the receiver's requests
+     * arrive on, or -1 on failure.  XCFLAGS_POSTCOPY is ignored unless
+     * this is provided.
+     */
+    int (*postcopy_handoff)(void *data);
+
     /* to be provided as the last argument to each callback function */
     void* data;
 };
@@ -84,10 +119,15 @@ struct save_callbacks {
  * @parm xch a handle to an open hypervisor interface
  * @parm fd the file descriptor to save a domain to
  * @parm dom the id of the domain
+ * @parm max_downtime target stop-and-copy time in ms for a live save
+ *       (0 for none: only max_iters, max_factor and min_remaining);
+ *       with XCFLAGS_THROTTLE the guest's vCPUs may be capped to get
+ *       there
  * @return 0 on success, -1 on failure
  */
 int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom, uint32_t max_iters,
-                   uint32_t max_factor, uint32_t min_remaining, uint32_t flags /* XCFLAGS_xxx */,
+                   uint32_t max_factor, uint32_t min_remaining,
+                   uint32_t max_downtime, uint32_t flags /* XCFLAGS_xxx */,
                    struct save_callbacks* callbacks, int hvm,
                    unsigned long vm_generationid_addr);
 
@@ -115,6 +155,7 @@ struct restore_callbacks {
  * @parm superpages non-zero to allocate guest memory with superpages
  * @parm no_incr_generationid non-zero if generation id is NOT to be incremented
  * @parm vm_generationid_addr returned with the address of the generation id buffer
+ * @parm nr_workers number of threads to apply pages with, 0 or 1 for serial
  * @parm callbacks non-NULL to receive a callback to restore toolstack
  *       specific data
  * @return 0 on success, -1 on failure
@@ -126,7 +167,11 @@ int xc_domain_restore(xc_interface *xch, int io_fd, uint32_t dom,
                       unsigned int hvm, unsigned int pae, int superpages,
                       int no_incr_generationid,
                       unsigned long *vm_generationid_addr,
+                      unsigned int nr_workers,
                       struct restore_callbacks *callbacks);
+
+/* Upper bound on the nr_workers argument to xc_domain_restore */
+#define XC_RESTORE_MAX_WORKERS 16
 /**
  * xc_domain_restore writes a file to disk that contains the device
  * model saved state.
@@ -85,6 +85,27 @@
  * If the chunk type is -ve then chunk consists of one of a number of
  * metadata types.  See definitions of XC_SAVE_ID_* below.
  *
+ * A chunk of type XC_SAVE_ID_PAGE_REFS lists pages of the following +ve
+ * chunk whose data is not sent (see XCFLAGS_ELIDE_PAGES):
+ *
+ *     uint32_t         : Number of entries
+ *     uint32_t[]       : Bits 15-0 are the index of the page in the batch,
+ *                        bits 31-16 are the index of an earlier page of the
+ *                        same batch with identical contents, or
+ *                        XC_PAGE_REF_ZERO if the page is all zeroes.
+ *
+ * A chunk of type XC_SAVE_ID_COMPRESSED_BATCH says that the page data of
+ * the following +ve chunk is encoded (see XCFLAGS_BATCH_COMPRESS):
+ *
+ *     uint32_t         : Codec, XC_BATCH_COMP_DELTA or XC_BATCH_COMP_LZO
+ *     uint32_t         : Length of the encoded page data
+ *
+ *   The +ve chunk then carries that many bytes in place of its pages.
+ *   DELTA uses the per-page format of Format B below, against a cache of
+ *   previously received pages which both ends maintain identically (see
+ *   xc_compression.c).  LZO is a single LZO1X block holding the pages
+ *   back to back.
+ *
  * If chunk type is 0 then body phase is complete.
  *
  *
@@ -259,6 +280,13 @@
 #define XC_SAVE_ID_HVM_ACCESS_RING_PFN  -16
 #define XC_SAVE_ID_HVM_SHARING_RING_PFN -17
 #define XC_SAVE_ID_TOOLSTACK          -18 /* Optional toolstack specific info */
+#define XC_SAVE_ID_PAGE_REFS          -19 /* Zero/duplicate pages of next batch */
+#define XC_SAVE_ID_COMPRESSED_BATCH   -20 /* Encoding of the next batch */
+
+#define XC_PAGE_REF_ZERO     0xffffU
+#define XC_PAGE_REF(idx, ref) ((uint32_t)(idx) | ((uint32_t)(ref) << 16))
+#define XC_PAGE_REF_IDX(r)   ((r) & 0xffffU)
+#define XC_PAGE_REF_SRC(r)   ((r) >> 16)
 
 /*
 ** We process save/restore/migrate in batches of pages; the below
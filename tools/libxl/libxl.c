@@ -756,12 +756,21 @@ static void domain_suspend_cb(libxl__egc *egc,
 
 }
 
-int libxl_domain_suspend(libxl_ctx *ctx, uint32_t domid, int fd, int flags,
-                         const libxl_asyncop_how *ao_how)
+static int domain_suspend(libxl_ctx *ctx, uint32_t domid, int fd, int flags,
+                          uint32_t max_downtime_ms, int recv_fd,
+                          libxl_suspend_postcopy_handoff *handoff,
+                          void *handoff_user,
+                          const libxl_asyncop_how *ao_how)
 {
     AO_CREATE(ctx, domid, ao_how);
     int rc;
 
+    if ((flags & LIBXL_SUSPEND_POSTCOPY) && (!handoff || recv_fd <= 2)) {
+        LOG(ERROR, "post-copy needs a handoff callback and a request fd");
+        rc = ERROR_INVAL;
+        goto out_err;
+    }
+
     libxl_domain_type type = libxl__domain_type(gc, domid);
     if (type == LIBXL_DOMAIN_TYPE_INVALID) {
         rc = ERROR_FAIL;
@@ -779,6 +788,13 @@ int libxl_domain_suspend(libxl_ctx *ctx, uint32_t domid, int fd, int flags,
     dss->type = type;
     dss->live = flags & LIBXL_SUSPEND_LIVE;
     dss->debug = flags & LIBXL_SUSPEND_DEBUG;
+    dss->max_downtime = max_downtime_ms;
+    dss->throttle = flags & LIBXL_SUSPEND_THROTTLE;
+    dss->compact = flags & LIBXL_SUSPEND_COMPACT;
+    dss->postcopy = flags & LIBXL_SUSPEND_POSTCOPY;
+    dss->postcopy_recv_fd = recv_fd;
+    dss->postcopy_handoff = handoff;
+    dss->postcopy_user = handoff_user;
 
     libxl__domain_suspend(egc, dss);
     return AO_INPROGRESS;
@@ -787,6 +803,31 @@ int libxl_domain_suspend(libxl_ctx *ctx, uint32_t domid, int fd, int flags,
     return AO_ABORT(rc);
 }
 
+int libxl_domain_suspend(libxl_ctx *ctx, uint32_t domid, int fd, int flags,
+                         const libxl_asyncop_how *ao_how)
+{
+    return domain_suspend(ctx, domid, fd, flags, 0, -1, NULL, NULL, ao_how);
+}
+
+int libxl_domain_suspend_downtime(libxl_ctx *ctx, uint32_t domid, int fd,
+                                  int flags, uint32_t max_downtime_ms,
+                                  const libxl_asyncop_how *ao_how)
+{
+    return domain_suspend(ctx, domid, fd, flags, max_downtime_ms,
+                          -1, NULL, NULL, ao_how);
+}
+
+int libxl_domain_suspend_postcopy(libxl_ctx *ctx, uint32_t domid, int fd,
+                                  int recv_fd, int flags,
+                                  uint32_t max_downtime_ms,
+                                  libxl_suspend_postcopy_handoff *handoff,
+                                  void *handoff_user,
+                                  const libxl_asyncop_how *ao_how)
+{
+    return domain_suspend(ctx, domid, fd, flags, max_downtime_ms,
+                          recv_fd, handoff, handoff_user, ao_how);
+}
+
 int libxl_domain_pause(libxl_ctx *ctx, uint32_t domid)
 {
     int ret;
@@ -4013,6 +4054,7 @@ static int sched_credit_domain_get(libxl__gc *gc, uint32_t domid,
     scinfo->sched = LIBXL_SCHEDULER_CREDIT;
     scinfo->weight = sdom.weight;
     scinfo->cap = sdom.cap;
+    scinfo->cosched = sdom.cosched;
 
     return 0;
 }
@@ -4058,6 +4100,14 @@ static int sched_credit_domain_set(libxl__gc *gc, uint32_t domid,
         sdom.cap = scinfo->cap;
     }
 
+    if (scinfo->cosched != LIBXL_DOMAIN_SCHED_PARAM_COSCHED_DEFAULT) {
+        if (scinfo->cosched != 0 && scinfo->cosched != 1) {
+            LOG(ERROR, "Co-scheduling must be 0 (off) or 1 (on)");
+            return ERROR_INVAL;
+        }
+        sdom.cosched = scinfo->cosched;
+    }
+
     rc = xc_sched_credit_domain_set(CTX->xch, domid, &sdom);
     if ( rc < 0 ) {
         LOGE(ERROR, "setting domain sched credit");
@@ -4128,6 +4178,64 @@ int libxl_sched_credit_params_set(libxl_ctx *ctx, uint32_t poolid,
     return 0;
 }
 
+static void sched_latency_hist_copy(libxl__gc *gc,
+                                    libxl_sched_latency_hist *dst,
+                                    const struct xen_sysctl_schedlat_hist *src)
+{
+    int i;
+
+    dst->count = src->count;
+    dst->total_ns = src->total_ns;
+    dst->max_ns = src->max_ns;
+    dst->num_buckets = XEN_SYSCTL_SCHEDLAT_BUCKETS;
+    dst->buckets = libxl__calloc(NOGC, dst->num_buckets,
+                                 sizeof(*dst->buckets));
+    for (i = 0; i < dst->num_buckets; i++)
+        dst->buckets[i] = src->buckets[i];
+}
+
+int libxl_sched_latency_get(libxl_ctx *ctx, libxl_sched_latency_target target,
+                            uint32_t id, libxl_sched_latency *lat)
+{
+    GC_INIT(ctx);
+    xc_schedlat_stats_t stats;
+    int rc;
+
+    rc = xc_sched_latency_get(ctx->xch, target, id, &stats);
+    if (rc) {
+        LOGE(ERROR, "getting scheduling latency of %s %u",
+             libxl_sched_latency_target_to_string(target), id);
+        GC_FREE;
+        return ERROR_FAIL;
+    }
+
+    libxl_sched_latency_init(lat);
+    sched_latency_hist_copy(gc, &lat->wakeup, &stats.wakeup);
+    sched_latency_hist_copy(gc, &lat->wait, &stats.wait);
+    lat->preemptions = stats.preemptions;
+
+    GC_FREE;
+    return 0;
+}
+
+int libxl_sched_latency_reset(libxl_ctx *ctx,
+                              libxl_sched_latency_target target, uint32_t id)
+{
+    GC_INIT(ctx);
+    int rc;
+
+    rc = xc_sched_latency_reset(ctx->xch, target, id);
+    if (rc) {
+        LOGE(ERROR, "resetting scheduling latency of %s %u",
+             libxl_sched_latency_target_to_string(target), id);
+        GC_FREE;
+        return ERROR_FAIL;
+    }
+
+    GC_FREE;
+    return 0;
+}
+
 static int sched_credit2_domain_get(libxl__gc *gc, uint32_t domid,
                                     libxl_domain_sched_params *scinfo)
 {
@@ -4244,6 +4352,80 @@ static int sched_sedf_domain_set(libxl__gc *gc, uint32_t domid,
     return 0;
 }
 
+/* RTDS period and budget are in microseconds, and apply to all vcpus. */
+static int sched_rtds_domain_get(libxl__gc *gc, uint32_t domid,
+                                 libxl_domain_sched_params *scinfo)
+{
+    struct xen_domctl_sched_rtds sdom;
+    int rc;
+
+    sdom.vcpuid = XEN_DOMCTL_SCHED_RTDS_ALL_VCPUS;
+    rc = xc_sched_rtds_domain_get(CTX->xch, domid, &sdom);
+    if (rc != 0) {
+        LOGE(ERROR, "getting domain sched rtds");
+        return ERROR_FAIL;
+    }
+
+    libxl_domain_sched_params_init(scinfo);
+    scinfo->sched = LIBXL_SCHEDULER_RTDS;
+    scinfo->period = sdom.period;
+    scinfo->budget = sdom.budget;
+
+    return 0;
+}
+
+static int sched_rtds_domain_set(libxl__gc *gc, uint32_t domid,
+                                 const libxl_domain_sched_params *scinfo)
+{
+    struct xen_domctl_sched_rtds sdom;
+    int rc;
+
+    /* Nothing to change: don't go through admission control again. */
+    if (scinfo->period == LIBXL_DOMAIN_SCHED_PARAM_PERIOD_DEFAULT &&
+        scinfo->budget == LIBXL_DOMAIN_SCHED_PARAM_BUDGET_DEFAULT)
+        return 0;
+
+    sdom.vcpuid = XEN_DOMCTL_SCHED_RTDS_ALL_VCPUS;
+    rc = xc_sched_rtds_domain_get(CTX->xch, domid, &sdom);
+    if (rc != 0) {
+        LOGE(ERROR, "getting domain sched rtds");
+        return ERROR_FAIL;
+    }
+
+    if (scinfo->period != LIBXL_DOMAIN_SCHED_PARAM_PERIOD_DEFAULT) {
+        if (scinfo->period < 1) {
+            LOG(ERROR, "RTDS period must be positive");
+            return ERROR_INVAL;
+        }
+        sdom.period = scinfo->period;
+    }
+    if (scinfo->budget != LIBXL_DOMAIN_SCHED_PARAM_BUDGET_DEFAULT) {
+        if (scinfo->budget < 1) {
+            LOG(ERROR, "RTDS budget must be positive");
+            return ERROR_INVAL;
+        }
+        sdom.budget = scinfo->budget;
+    }
+    if (sdom.budget > sdom.period) {
+        LOG(ERROR, "RTDS budget %u exceeds period %u",
+            sdom.budget, sdom.period);
+        return ERROR_INVAL;
+    }
+
+    sdom.vcpuid = XEN_DOMCTL_SCHED_RTDS_ALL_VCPUS;
+    rc = xc_sched_rtds_domain_set(CTX->xch, domid, &sdom);
+    if ( rc < 0 ) {
+        if (errno == EBUSY)
+            LOG(ERROR, "RTDS parameters for domain %u would overload "
+                "its cpupool", domid);
+        else
+            LOGE(ERROR, "setting domain sched rtds");
+        return ERROR_FAIL;
+    }
+
+    return 0;
+}
+
 int libxl_domain_sched_params_set(libxl_ctx *ctx, uint32_t domid,
                                   const libxl_domain_sched_params *scinfo)
 {
@@ -4267,6 +4449,9 @@ int libxl_domain_sched_params_set(libxl_ctx *ctx, uint32_t domid,
     case LIBXL_SCHEDULER_ARINC653:
         ret=sched_arinc653_domain_set(gc, domid, scinfo);
         break;
+    case LIBXL_SCHEDULER_RTDS:
+        ret=sched_rtds_domain_set(gc, domid, scinfo);
+        break;
     default:
         LOG(ERROR, "Unknown scheduler");
         ret=ERROR_INVAL;
@@ -4297,6 +4482,9 @@ int libxl_domain_sched_params_get(libxl_ctx *ctx, uint32_t domid,
     case LIBXL_SCHEDULER_CREDIT2:
         ret=sched_credit2_domain_get(gc, domid, scinfo);
         break;
+    case LIBXL_SCHEDULER_RTDS:
+        ret=sched_rtds_domain_get(gc, domid, scinfo);
+        break;
     default:
         LOG(ERROR, "Unknown scheduler");
         ret=ERROR_INVAL;
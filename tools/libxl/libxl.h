@@ -74,6 +74,44 @@
  */
 #define LIBXL_HAVE_FIRMWARE_PASSTHROUGH 1
 
+/*
+ * LIBXL_HAVE_SUSPEND_DOWNTIME indicates that libxl_domain_suspend_downtime
+ * and LIBXL_SUSPEND_THROTTLE are available.
+ */
+#define LIBXL_HAVE_SUSPEND_DOWNTIME 1
+
+/*
+ * LIBXL_HAVE_SUSPEND_COMPACT indicates that LIBXL_SUSPEND_COMPACT is
+ * available.
+ */
+#define LIBXL_HAVE_SUSPEND_COMPACT 1
+
+/*
+ * LIBXL_HAVE_SUSPEND_POSTCOPY indicates that libxl_domain_suspend_postcopy
+ * and LIBXL_SUSPEND_POSTCOPY are available.
+ */
+#define LIBXL_HAVE_SUSPEND_POSTCOPY 1
+
+/*
+ * LIBXL_HAVE_SCHED_LATENCY indicates that libxl_sched_latency_get,
+ * libxl_sched_latency_reset and the libxl_sched_latency types are
+ * available.
+ */
+#define LIBXL_HAVE_SCHED_LATENCY 1
+
+/*
+ * LIBXL_HAVE_SCHED_COSCHED indicates that the cosched field of
+ * libxl_domain_sched_params is available.
+ */
+#define LIBXL_HAVE_SCHED_COSCHED 1
+
+/*
+ * LIBXL_HAVE_SCHED_RTDS indicates that the rtds scheduler
+ * (LIBXL_SCHEDULER_RTDS) and the budget field of
+ * libxl_domain_sched_params are available.
+ */
+#define LIBXL_HAVE_SCHED_RTDS 1
+
 /*
  * libxl ABI compatibility
  *
@@ -532,6 +570,45 @@ int libxl_domain_suspend(libxl_ctx *ctx, uint32_t domid, int fd,
                          LIBXL_EXTERNAL_CALLERS_ONLY;
 #define LIBXL_SUSPEND_DEBUG 1
 #define LIBXL_SUSPEND_LIVE 2
+#define LIBXL_SUSPEND_THROTTLE 4
+/* Leave zero and duplicate pages out of the stream and compress batches.
+ * Only a receiver with support for these stream records can restore it. */
+#define LIBXL_SUSPEND_COMPACT 8
+/* See libxl_domain_suspend_postcopy. */
+#define LIBXL_SUSPEND_POSTCOPY 16
+
+/* As libxl_domain_suspend, but a live suspend stops iterating once the
+ * predicted stop-and-copy time is within max_downtime_ms (0 for no
+ * target, iterating as libxl_domain_suspend does).  With
+ * LIBXL_SUSPEND_THROTTLE the guest's vCPUs may be capped while its memory
+ * is copied so that it converges.
+ */
+int libxl_domain_suspend_downtime(libxl_ctx *ctx, uint32_t domid, int fd,
+                                  int flags, /* LIBXL_SUSPEND_* */
+                                  uint32_t max_downtime_ms,
+                                  const libxl_asyncop_how *ao_how)
+                                  LIBXL_EXTERNAL_CALLERS_ONLY;
+
+/* As libxl_domain_suspend_downtime, for a live migration of an HVM guest
+ * which may use post-copy (LIBXL_SUSPEND_POSTCOPY).  If the guest's memory
+ * does not converge, it is moved with some of its pages left behind.
+ * handoff is then called once the stream, device model state included,
+ * has been written; it must have the receiver start the guest and return
+ * 0, or nonzero on failure.  From then on the guest cannot be resumed
+ * here.  The receiver's requests for the pages left behind are read from
+ * recv_fd, which must not be 0, 1 or 2, and the operation completes once
+ * it has all of them.  If the guest converges, handoff is not called and
+ * this behaves like libxl_domain_suspend_downtime.
+ */
+typedef int libxl_suspend_postcopy_handoff(void *user);
+int libxl_domain_suspend_postcopy(libxl_ctx *ctx, uint32_t domid, int fd,
+                                  int recv_fd,
+                                  int flags, /* LIBXL_SUSPEND_* */
+                                  uint32_t max_downtime_ms,
+                                  libxl_suspend_postcopy_handoff *handoff,
+                                  void *handoff_user,
+                                  const libxl_asyncop_how *ao_how)
+                                  LIBXL_EXTERNAL_CALLERS_ONLY;
 
 /* @param suspend_cancel [from xenctrl.h:xc_domain_resume( @param fast )]
  *   If this parameter is true, use co-operative resume. The guest
@@ -877,14 +954,22 @@ int libxl_sched_credit_params_get(libxl_ctx *ctx, uint32_t poolid,
 int libxl_sched_credit_params_set(libxl_ctx *ctx, uint32_t poolid,
                                   libxl_sched_credit_params *scinfo);
 
+/* Scheduling latency statistics of a domain or of a cpupool's domains */
+int libxl_sched_latency_get(libxl_ctx *ctx, libxl_sched_latency_target target,
+                            uint32_t id, libxl_sched_latency *lat);
+int libxl_sched_latency_reset(libxl_ctx *ctx,
+                              libxl_sched_latency_target target, uint32_t id);
+
 /* Scheduler Per-domain parameters */
 
 #define LIBXL_DOMAIN_SCHED_PARAM_WEIGHT_DEFAULT    -1
 #define LIBXL_DOMAIN_SCHED_PARAM_CAP_DEFAULT       -1
+#define LIBXL_DOMAIN_SCHED_PARAM_COSCHED_DEFAULT   -1
 #define LIBXL_DOMAIN_SCHED_PARAM_PERIOD_DEFAULT    -1
 #define LIBXL_DOMAIN_SCHED_PARAM_SLICE_DEFAULT     -1
 #define LIBXL_DOMAIN_SCHED_PARAM_LATENCY_DEFAULT   -1
 #define LIBXL_DOMAIN_SCHED_PARAM_EXTRATIME_DEFAULT -1
+#define LIBXL_DOMAIN_SCHED_PARAM_BUDGET_DEFAULT    -1
 
 int libxl_domain_sched_params_get(libxl_ctx *ctx, uint32_t domid,
                                   libxl_domain_sched_params *params);
@@ -1298,6 +1298,51 @@ static void remus_checkpoint_dm_saved(libxl__egc *egc,
     libxl__xc_domain_saverestore_async_callback_done(egc, &dss->shs, 1);
 }
 
+/*----- post-copy handoff, called by xc_domain_save -----*/
+
+static void postcopy_dm_saved(libxl__egc *egc,
+                              libxl__domain_suspend_state *dss, int rc);
+
+static int domain_has_pci(libxl__gc *gc, uint32_t domid)
+{
+    libxl_device_pci *pcidevs;
+    int i, num;
+
+    pcidevs = libxl_device_pci_list(CTX, domid, &num);
+    for (i = 0; i < num; i++)
+        libxl_device_pci_dispose(&pcidevs[i]);
+    free(pcidevs);
+
+    return num > 0;
+}
+
+static void libxl__domain_suspend_postcopy_handoff(void *data)
+{
+    libxl__save_helper_state *shs = data;
+    libxl__domain_suspend_state *dss = CONTAINER_OF(shs, *dss, shs);
+    libxl__egc *egc = dss->shs.egc;
+
+    /* The receiver needs the device model state to start the guest, so it
+     * goes out now rather than once xc_domain_save has returned. */
+    libxl__domain_save_device_model(egc, dss, postcopy_dm_saved);
+}
+
+static void postcopy_dm_saved(libxl__egc *egc,
+                              libxl__domain_suspend_state *dss, int rc)
+{
+    STATE_AO_GC(dss->ao);
+
+    if (!rc && dss->postcopy_handoff(dss->postcopy_user)) {
+        LOG(ERROR, "post-copy handoff to the receiver failed");
+        rc = ERROR_FAIL;
+    }
+    if (!rc)
+        dss->postcopy_handed_off = 1;
+
+    libxl__xc_domain_saverestore_async_callback_done(egc, &dss->shs,
+                                    rc ? -1 : dss->postcopy_recv_fd);
+}
+
 /*----- main code for suspending, in order of execution -----*/
 
 void libxl__domain_suspend(libxl__egc *egc, libxl__domain_suspend_state *dss)
@@ -1351,6 +1396,21 @@ void libxl__domain_suspend(libxl__egc *egc, libxl__domain_suspend_state *dss)
         dss->interval = r_info->interval;
         if (r_info->compression)
             dss->xcflags |= XCFLAGS_CHECKPOINT_COMPRESS;
+    } else {
+        if (dss->compact)
+            dss->xcflags |= XCFLAGS_ELIDE_PAGES | XCFLAGS_BATCH_COMPRESS;
+        if (live)
+            dss->xcflags |= XCFLAGS_PIPELINE;
+        if (live && dss->throttle)
+            dss->xcflags |= XCFLAGS_THROTTLE;
+        if (live && dss->hvm && dss->postcopy) {
+            /* The target could not page the guest in (EMLINK). */
+            if (domain_has_pci(gc, domid))
+                LOG(WARN, "post-copy cannot page a domain with passthrough "
+                    "devices, migrating it pre-copy");
+            else
+                dss->xcflags |= XCFLAGS_POSTCOPY;
+        }
     }
 
     dss->xce = xc_evtchn_open(NULL, 0);
@@ -1374,8 +1434,12 @@ void libxl__domain_suspend(libxl__egc *egc, libxl__domain_suspend_state *dss)
         callbacks->suspend = libxl__remus_domain_suspend_callback;
         callbacks->postcopy = libxl__remus_domain_resume_callback;
         callbacks->checkpoint = libxl__remus_domain_checkpoint_callback;
-    } else
+    } else {
         callbacks->suspend = libxl__domain_suspend_common_callback;
+        if (dss->xcflags & XCFLAGS_POSTCOPY)
+            callbacks->postcopy_handoff =
+                libxl__domain_suspend_postcopy_handoff;
+    }
 
     callbacks->switch_qemu_logdirty = libxl__domain_suspend_common_switch_qemu_logdirty;
     dss->shs.callbacks.save.toolstack_save = libxl__toolstack_save;
@@ -1411,7 +1475,8 @@ void libxl__xc_domain_save_done(libxl__egc *egc, void *dss_void,
         goto out;
     }
 
-    if (type == LIBXL_DOMAIN_TYPE_HVM) {
+    /* Post-copy sent the device model state in the handoff already. */
+    if (type == LIBXL_DOMAIN_TYPE_HVM && !dss->postcopy_handed_off) {
         rc = libxl__domain_suspend_device_model(gc, dss);
         if (rc) goto out;
 
@@ -2240,6 +2240,13 @@ struct libxl__domain_suspend_state {
     libxl_domain_type type;
     int live;
     int debug;
+    uint32_t max_downtime; /* ms, 0 for the libxc default */
+    int throttle;
+    int compact;
+    int postcopy;
+    int postcopy_recv_fd;
+    libxl_suspend_postcopy_handoff *postcopy_handoff;
+    void *postcopy_user;
     const libxl_domain_remus_info *remus;
     /* private */
     xc_evtchn *xce; /* event channel handle */
@@ -2247,6 +2254,7 @@ struct libxl__domain_suspend_state {
     int hvm;
     int xcflags;
     int guest_responded;
+    int postcopy_handed_off;
     const char *dm_savefile;
     int interval; /* checkpoint interval (for Remus) */
     libxl__save_helper_state shs;
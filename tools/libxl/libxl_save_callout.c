@@ -79,7 +79,7 @@ void libxl__xc_domain_save(libxl__egc *egc, libxl__domain_suspend_state *dss,
                            unsigned long vm_generationid_addr)
 {
     STATE_AO_GC(dss->ao);
-    int r, rc, toolstack_data_fd = -1;
+    int r, rc, toolstack_data_fd = -1, preserve_fds[2];
     uint32_t toolstack_data_len = 0;
 
     /* Resources we need to free */
@@ -108,7 +108,8 @@ void libxl__xc_domain_save(libxl__egc *egc, libxl__domain_suspend_state *dss,
     }
 
     const unsigned long argnums[] = {
-        dss->domid, 0, 0, dss->xcflags, dss->hvm, vm_generationid_addr,
+        dss->domid, 0, 0, dss->max_downtime, dss->xcflags, dss->hvm,
+        vm_generationid_addr,
         toolstack_data_fd, toolstack_data_len,
         cbflags,
     };
@@ -122,8 +123,13 @@ void libxl__xc_domain_save(libxl__egc *egc, libxl__domain_suspend_state *dss,
 
     free(toolstack_data_buf);
 
+    /* The helper reads post-copy requests from the receiver itself. */
+    preserve_fds[0] = toolstack_data_fd;
+    preserve_fds[1] = (dss->xcflags & XCFLAGS_POSTCOPY) ?
+        dss->postcopy_recv_fd : -1;
+
     run_helper(egc, &dss->shs, "--save-domain", dss->fd,
-               &toolstack_data_fd, 1,
+               preserve_fds, ARRAY_SIZE(preserve_fds),
                argnums, ARRAY_SIZE(argnums));
     return;
 
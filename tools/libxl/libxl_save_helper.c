@@ -221,6 +221,7 @@ int main(int argc, char **argv)
         uint32_t dom =             strtoul(NEXTARG,0,10);
         uint32_t max_iters =       strtoul(NEXTARG,0,10);
         uint32_t max_factor =      strtoul(NEXTARG,0,10);
+        uint32_t max_downtime =    strtoul(NEXTARG,0,10);
         uint32_t flags =           strtoul(NEXTARG,0,10);
         int hvm =                  atoi(NEXTARG);
         unsigned long genidad =    strtoul(NEXTARG,0,10);
@@ -235,7 +236,8 @@ int main(int argc, char **argv)
         helper_setcallbacks_save(&helper_save_callbacks, cbflags);
 
         startup("save");
-        r = xc_domain_save(xch, io_fd, dom, max_iters, max_factor, 0, flags,
+        r = xc_domain_save(xch, io_fd, dom, max_iters, max_factor, 0,
+                           max_downtime, flags,
                            &helper_save_callbacks, hvm, genidad);
         complete(r);
 
@@ -260,11 +262,15 @@ int main(int argc, char **argv)
         unsigned long console_mfn = 0;
         unsigned long genidad = 0;
 
+        /* Apply pages on every online cpu; xc_domain_restore caps it. */
+        long nr_workers = sysconf(_SC_NPROCESSORS_ONLN);
+        if (nr_workers < 1) nr_workers = 1;
+
         startup("restore");
         r = xc_domain_restore(xch, io_fd, dom, store_evtchn, &store_mfn,
                               store_domid, console_evtchn, &console_mfn,
                               console_domid, hvm, pae, superpages,
-                              no_incr_genidad, &genidad,
+                              no_incr_genidad, &genidad, nr_workers,
                               &helper_restore_callbacks);
         helper_stub_restore_results(store_mfn,console_mfn,genidad,0);
         complete(r);
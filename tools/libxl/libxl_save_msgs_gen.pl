@@ -36,6 +36,7 @@ our @msgs = (
                                               'unsigned long', 'genidad'] ],
     [  9, 'srW',    "complete",              [qw(int retval
                                                  int errnoval)] ],
+    [ 10, 'scxA',   "postcopy_handoff", [] ],
 );
 
 #----------------------------------------
@@ -81,6 +81,11 @@ static const char savefileheader_magic[32]=
 
 static const char migrate_receiver_banner[]=
     "xl migration receiver ready, send binary domain data.\n";
+  /* A receiver run with -z, which asks whether it can restore compact
+   * streams, answers with this instead.  It has the same length, so a
+   * sender reads either one the same way. */
+static const char migrate_receiver_banner_compact[]=
+    "xl migration receiver ready, send compact domain data\n";
 static const char migrate_receiver_ready[]=
     "domain received, ready to unpause";
 static const char migrate_permission_to_go[]=
@@ -94,6 +99,14 @@ static const char migrate_report[]=
    *            next thing should be a migrate_permission_to_go
    *            from target to source
    */
+  /* With migrate -P, the migrate_permission_to_go from source to target
+   * is followed by one byte:
+   *     0: the stream is complete
+   *     1: post-copy; the source sends the pages it left behind and
+   *            serves requests for them until the target has them all,
+   *            and only then is the migrate_report sent.  The domain
+   *            cannot be resumed at the source any more.
+   */
 
 struct save_file_header {
     char magic[32]; /* savefileheader_magic */
@@ -122,6 +135,9 @@ static const char *action_on_shutdown_names[] = {
  *   n bytes           config file in Unix text file format
  */
 
+/* Mandatory flags: */
+#define XL_MANDATORY_FLAG_COMPACT (1U << 0) /* LIBXL_SUSPEND_COMPACT stream */
+
 #define SAVEFILE_BYTEORDER_VALUE ((uint32_t)0x01020304UL)
 
 struct domain_create {
@@ -651,6 +667,8 @@ static void parse_config_data(const char *config_source,
         b_info->sched_params.weight = l;
     if (!xlu_cfg_get_long (config, "cap", &l, 0))
         b_info->sched_params.cap = l;
+    if (!xlu_cfg_get_long (config, "cosched", &l, 0))
+        b_info->sched_params.cosched = l;
     if (!xlu_cfg_get_long (config, "period", &l, 0))
         b_info->sched_params.period = l;
     if (!xlu_cfg_get_long (config, "slice", &l, 0))
@@ -659,6 +677,8 @@ static void parse_config_data(const char *config_source,
         b_info->sched_params.latency = l;
     if (!xlu_cfg_get_long (config, "extratime", &l, 0))
         b_info->sched_params.extratime = l;
+    if (!xlu_cfg_get_long (config, "budget", &l, 0))
+        b_info->sched_params.budget = l;
 
     if (!xlu_cfg_get_long (config, "vcpus", &l, 0)) {
         b_info->max_vcpus = l;
@@ -1771,7 +1791,7 @@ static int create_domain(struct domain_create *dom_info)
                 restore_source, hdr.mandatory_flags, hdr.optional_flags,
                 hdr.optional_data_len);
 
-        badflags = hdr.mandatory_flags & ~( 0 /* none understood yet */ );
+        badflags = hdr.mandatory_flags & ~( XL_MANDATORY_FLAG_COMPACT );
         if (badflags) {
             fprintf(stderr, "Savefile has mandatory flag(s) 0x%"PRIx32" "
                     "which are not supported; need newer xl\n",
@@ -2945,7 +2965,8 @@ static void save_domain_core_begin(const char *domain_spec,
 }
 
 static void save_domain_core_writeconfig(int fd, const char *source,
-                                  const uint8_t *config_data, int config_len)
+                                  const uint8_t *config_data, int config_len,
+                                  int suspend_flags)
 {
     struct save_file_header hdr;
     uint8_t *optdata_begin;
@@ -2954,6 +2975,8 @@ static void save_domain_core_writeconfig(int fd, const char *source,
     memset(&hdr, 0, sizeof(hdr));
     memcpy(hdr.magic, savefileheader_magic, sizeof(hdr.magic));
     hdr.byteorder = SAVEFILE_BYTEORDER_VALUE;
+    if (suspend_flags & LIBXL_SUSPEND_COMPACT)
+        hdr.mandatory_flags |= XL_MANDATORY_FLAG_COMPACT;
 
     optdata_begin= 0;
 
@@ -2984,7 +3007,7 @@ static void save_domain_core_writeconfig(int fd, const char *source,
 }
 
 static int save_domain(const char *p, const char *filename, int checkpoint,
-                const char *override_config_file)
+                const char *override_config_file, int suspend_flags)
 {
     int fd;
     uint8_t *config_data;
@@ -3002,9 +3025,10 @@ static int save_domain(const char *p, const char *filename, int checkpoint,
         exit(2);
     }
 
-    save_domain_core_writeconfig(fd, filename, config_data, config_len);
+    save_domain_core_writeconfig(fd, filename, config_data, config_len,
+                                 suspend_flags);
 
-    int rc = libxl_domain_suspend(ctx, domid, fd, 0, NULL);
+    int rc = libxl_domain_suspend(ctx, domid, fd, suspend_flags, NULL);
     close(fd);
 
     if (rc < 0)
@@ -3138,20 +3162,44 @@ static void migration_child_report(int recv_fd) {
     }
 }
 
+/*
+ * Reads the receiver's banner and writes the savefile header.  If the
+ * receiver says it can restore compact streams, LIBXL_SUSPEND_COMPACT is
+ * added to *suspend_flags; if it was already set (migrate -z) it is kept
+ * regardless.  suspend_flags may be NULL if the caller never sends compact
+ * streams.
+ */
 static void migrate_do_preamble(int send_fd, int recv_fd, pid_t child,
                                 uint8_t *config_data, int config_len,
-                                const char *rune)
+                                const char *rune, int *suspend_flags)
 {
+    char banner[sizeof(migrate_receiver_banner)-1];
     int rc = 0;
 
+    assert(sizeof(migrate_receiver_banner) ==
+           sizeof(migrate_receiver_banner_compact));
+
     if (send_fd < 0 || recv_fd < 0) {
         fprintf(stderr, "migrate_do_preamble: invalid file descriptors\n");
         exit(1);
     }
 
-    rc = migrate_read_fixedmessage(recv_fd, migrate_receiver_banner,
-                                   sizeof(migrate_receiver_banner)-1,
-                                   "banner", rune);
+    rc = libxl_read_exactly(ctx, recv_fd, banner, sizeof(banner),
+                            "migration receiver stream", "banner");
+    if (rc)
+        rc = ERROR_FAIL;
+    else if (memcmp(banner, migrate_receiver_banner, sizeof(banner))) {
+        if (!memcmp(banner, migrate_receiver_banner_compact,
+                    sizeof(banner))) {
+            if (suspend_flags)
+                *suspend_flags |= LIBXL_SUSPEND_COMPACT;
+        } else {
+            fprintf(stderr, "migration receiver stream contained unexpected"
+                    " data instead of banner\n");
+            fprintf(stderr, "(command run was: %s )\n", rune);
+            rc = ERROR_FAIL;
+        }
+    }
     if (rc) {
         close(send_fd);
         migration_child_report(recv_fd);
@@ -3159,12 +3207,58 @@ static void migrate_do_preamble(int send_fd, int recv_fd, pid_t child,
     }
 
     save_domain_core_writeconfig(send_fd, "migration stream",
-                                 config_data, config_len);
+                                 config_data, config_len,
+                                 suspend_flags ? *suspend_flags : 0);
+
+}
+
+struct migrate_postcopy {
+    int send_fd, recv_fd;
+    const char *rune;
+    char *away_domname;
+    int handed_off;
+};
+
+/* Called by libxl once the stream is written but memory is left behind. */
+static int migrate_postcopy_handoff(void *user)
+{
+    struct migrate_postcopy *mp = user;
+    static const char postcopy = 1;
+    int rc;
+
+    rc = migrate_read_fixedmessage(mp->recv_fd, migrate_receiver_ready,
+                                   sizeof(migrate_receiver_ready),
+                                   "ready message", mp->rune);
+    if (rc) return rc;
+
+    if (common_domname) {
+        if (asprintf(&mp->away_domname, "%s--migratedaway",
+                     common_domname) < 0)
+            return ERROR_NOMEM;
+        rc = libxl_domain_rename(ctx, domid, common_domname,
+                                 mp->away_domname);
+        if (rc) return rc;
+    }
+
+    fprintf(stderr, "migration sender: Giving target permission to start,"
+            " memory follows.\n");
+
+    /* As with the GO message below, there is no way back from here. */
+    mp->handed_off = 1;
+
+    rc = libxl_write_exactly(ctx, mp->send_fd,
+                             migrate_permission_to_go,
+                             sizeof(migrate_permission_to_go),
+                             "migration stream", "GO message");
+    if (rc) return rc;
 
+    return libxl_write_exactly(ctx, mp->send_fd, &postcopy, 1,
+                               "migration stream", "post-copy flag");
 }
 
 static void migrate_domain(const char *domain_spec, const char *rune,
-                           const char *override_config_file)
+                           const char *override_config_file,
+                           uint32_t max_downtime, int suspend_flags)
 {
     pid_t child = -1;
     int rc;
@@ -3173,6 +3267,7 @@ static void migrate_domain(const char *domain_spec, const char *rune,
     char rc_buf;
     uint8_t *config_data;
     int config_len;
+    struct migrate_postcopy mp;
 
     save_domain_core_begin(domain_spec, override_config_file,
                            &config_data, &config_len);
@@ -3186,14 +3281,29 @@ static void migrate_domain(const char *domain_spec, const char *rune,
     child = create_migration_child(rune, &send_fd, &recv_fd);
 
     migrate_do_preamble(send_fd, recv_fd, child, config_data, config_len,
-                        rune);
+                        rune, &suspend_flags);
 
     xtl_stdiostream_adjust_flags(logger, XTL_STDIOSTREAM_HIDE_PROGRESS, 0);
 
-    rc = libxl_domain_suspend(ctx, domid, send_fd, LIBXL_SUSPEND_LIVE, NULL);
+    memset(&mp, 0, sizeof(mp));
+    if (suspend_flags & LIBXL_SUSPEND_POSTCOPY) {
+        mp.send_fd = send_fd;
+        mp.recv_fd = recv_fd;
+        mp.rune = rune;
+        rc = libxl_domain_suspend_postcopy(ctx, domid, send_fd, recv_fd,
+                                           LIBXL_SUSPEND_LIVE | suspend_flags,
+                                           max_downtime,
+                                           migrate_postcopy_handoff, &mp,
+                                           NULL);
+    } else
+        rc = libxl_domain_suspend_downtime(ctx, domid, send_fd,
+                                           LIBXL_SUSPEND_LIVE | suspend_flags,
+                                           max_downtime, NULL);
     if (rc) {
         fprintf(stderr, "migration sender: libxl_domain_suspend failed"
                 " (rc=%d)\n", rc);
+        if (mp.handed_off)
+            goto failed_badly;
         if (rc == ERROR_GUEST_TIMEDOUT)
             goto failed_suspend;
         else
@@ -3204,6 +3314,11 @@ static void migrate_domain(const char *domain_spec, const char *rune,
     // Should only be printed when debugging as it's a bit messy with
     // progress indication.
 
+    if (mp.handed_off) {
+        fprintf(stderr, "migration sender: Target has all of the memory.\n");
+        goto report;
+    }
+
     rc = migrate_read_fixedmessage(recv_fd, migrate_receiver_ready,
                                    sizeof(migrate_receiver_ready),
                                    "ready message", rune);
@@ -3237,6 +3352,14 @@ static void migrate_domain(const char *domain_spec, const char *rune,
                              "migration stream", "GO message");
     if (rc) goto failed_badly;
 
+    if (suspend_flags & LIBXL_SUSPEND_POSTCOPY) {
+        rc_buf = 0;
+        rc = libxl_write_exactly(ctx, send_fd, &rc_buf, 1,
+                                 "migration stream", "post-copy flag");
+        if (rc) goto failed_badly;
+    }
+
+ report:
     rc = migrate_read_fixedmessage(recv_fd, migrate_report,
                                    sizeof(migrate_report),
                                    "success/failure report message", rune);
@@ -3251,6 +3374,9 @@ static void migrate_domain(const char *domain_spec, const char *rune,
         fprintf(stderr, "migration sender: Target reports startup failure"
                 " (status code %d).\n", rc_buf);
 
+        /* The target may have run the domain already. */
+        if (mp.handed_off) goto failed_badly;
+
         rc = migrate_read_fixedmessage(recv_fd, migrate_permission_to_go,
                                        sizeof(migrate_permission_to_go),
                                        "permission for sender to resume",
@@ -3309,13 +3435,54 @@ static void core_dump_domain(const char *domain_spec, const char *filename)
     if (rc) { fprintf(stderr,"core dump failed (rc=%d)\n",rc);exit(-1); }
 }
 
+/* Starts xenpaging to fetch the memory a post-copy sender left behind and
+ * returns once the domain may be unpaused. */
+static int migrate_postcopy_pager(int send_fd, int recv_fd)
+{
+    int ready[2], status;
+    char fds[64], dom[16], c;
+    pid_t child;
+
+    if (libxl_pipe(ctx, ready))
+        return ERROR_FAIL;
+
+    child = xl_fork(child_postcopy);
+    if (!child) {
+        close(ready[0]);
+        snprintf(dom, sizeof(dom), "%u", domid);
+        snprintf(fds, sizeof(fds), "%d,%d,%d", recv_fd, send_fd, ready[1]);
+        execl(LIBEXEC "/xenpaging", "xenpaging", "-d", dom, "-p", fds,
+              (char*)0);
+        perror("failed to exec xenpaging");
+        exit(-1);
+    }
+
+    close(ready[1]);
+    if (read(ready[0], &c, 1) != 1) {
+        fprintf(stderr, "migration target: xenpaging failed to start.\n");
+        close(ready[0]);
+        if (xl_waitpid(child_postcopy, &status, 0) > 0 && status)
+            libxl_report_child_exitstatus(ctx, XTL_ERROR, "xenpaging",
+                                          child, status);
+        return ERROR_FAIL;
+    }
+    close(ready[0]);
+
+    return 0;
+}
+
 static void migrate_receive(int debug, int daemonize, int monitor,
-                            int send_fd, int recv_fd, int remus)
+                            int send_fd, int recv_fd, int remus,
+                            int postcopy, int compact)
 {
-    int rc, rc2;
+    const char *banner = compact ? migrate_receiver_banner_compact
+                                 : migrate_receiver_banner;
+
+    int rc, rc2, status;
     char rc_buf;
     char *migration_domname;
     struct domain_create dom_info;
+    pid_t pager = 0;
 
     signal(SIGPIPE, SIG_IGN);
     /* if we get SIGPIPE we'd rather just have it as an error */
@@ -3323,7 +3490,7 @@ static void migrate_receive(int debug, int daemonize, int monitor,
     fprintf(stderr, "migration target: Ready to receive domain.\n");
 
     CHK_ERRNO( libxl_write_exactly(ctx, send_fd,
-                                   migrate_receiver_banner,
+                                   banner,
                                    sizeof(migrate_receiver_banner)-1,
                                    "migration ack stream",
                                    "banner") );
@@ -3394,17 +3561,51 @@ static void migrate_receive(int debug, int daemonize, int monitor,
 
     fprintf(stderr, "migration target: Got permission, starting domain.\n");
 
+    if (postcopy) {
+        rc = libxl_read_exactly(ctx, recv_fd, &rc_buf, 1,
+                                "migration stream", "post-copy flag");
+        if (rc) goto perhaps_destroy_notify_rc;
+        if (rc_buf) {
+            /* The sender is waiting for page requests on our stdout now,
+             * so failures can no longer be reported to it. */
+            fprintf(stderr, "migration target: Fetching the remaining"
+                    " memory after starting the domain.\n");
+            if (migrate_postcopy_pager(send_fd, recv_fd))
+                goto postcopy_failed;
+            pager = xl_child_pid(child_postcopy);
+        }
+    }
+
     if (migration_domname) {
         rc = libxl_domain_rename(ctx, domid, migration_domname, common_domname);
-        if (rc) goto perhaps_destroy_notify_rc;
+        if (rc) {
+            if (pager) goto postcopy_failed;
+            goto perhaps_destroy_notify_rc;
+        }
     }
 
     rc = libxl_domain_unpause(ctx, domid);
-    if (rc) goto perhaps_destroy_notify_rc;
+    if (rc) {
+        if (pager) goto postcopy_failed;
+        goto perhaps_destroy_notify_rc;
+    }
 
     fprintf(stderr, "migration target: Domain started successsfully.\n");
     rc = 0;
 
+    if (pager) {
+        if (xl_waitpid(child_postcopy, &status, 0) < 0) {
+            perror("migration target: failed to wait for xenpaging");
+            goto postcopy_failed;
+        }
+        if (status) {
+            libxl_report_child_exitstatus(ctx, XTL_ERROR, "xenpaging",
+                                          pager, status);
+            goto postcopy_failed;
+        }
+        fprintf(stderr, "migration target: All memory received.\n");
+    }
+
  perhaps_destroy_notify_rc:
     rc2 = libxl_write_exactly(ctx, send_fd,
                               migrate_report, sizeof(migrate_report),
@@ -3441,6 +3642,13 @@ static void migrate_receive(int debug, int daemonize, int monitor,
     }
 
     exit(0);
+
+ postcopy_failed:
+    fprintf(stderr,
+ "** Post-copy migration failed **\n"
+ "The domain's memory is split between source and target and it can run\n"
+ " at neither.  It has been left as it is at both ends.\n");
+    exit(-ERROR_BADFAIL);
 }
 
 int main_restore(int argc, char **argv)
@@ -3525,10 +3733,11 @@ int main_restore(int argc, char **argv)
 
 int main_migrate_receive(int argc, char **argv)
 {
-    int debug = 0, daemonize = 1, monitor = 1, remus = 0;
+    int debug = 0, daemonize = 1, monitor = 1, remus = 0, postcopy = 0;
+    int compact = 0;
     int opt;
 
-    while ((opt = def_getopt(argc, argv, "Fedr", "migrate-receive", 0)) != -1) {
+    while ((opt = def_getopt(argc, argv, "FedrPz", "migrate-receive", 0)) != -1) {
         switch (opt) {
         case 0: case 2:
             return opt;
@@ -3545,6 +3754,12 @@ int main_migrate_receive(int argc, char **argv)
         case 'r':
             remus = 1;
             break;
+        case 'P':
+            postcopy = 1;
+            break;
+        case 'z':
+            compact = 1;
+            break;
         }
     }
 
@@ -3554,7 +3769,7 @@ int main_migrate_receive(int argc, char **argv)
     }
     migrate_receive(debug, daemonize, monitor,
                     STDOUT_FILENO, STDIN_FILENO,
-                    remus);
+                    remus, postcopy, compact);
 
     return 0;
 }
@@ -3563,16 +3778,19 @@ int main_save(int argc, char **argv)
 {
     const char *filename, *p;
     const char *config_filename = NULL;
-    int checkpoint = 0;
+    int checkpoint = 0, suspend_flags = 0;
     int opt;
 
-    while ((opt = def_getopt(argc, argv, "c", "save", 2)) != -1) {
+    while ((opt = def_getopt(argc, argv, "cz", "save", 2)) != -1) {
         switch (opt) {
         case 0: case 2:
             return opt;
         case 'c':
             checkpoint = 1;
             break;
+        case 'z':
+            suspend_flags |= LIBXL_SUSPEND_COMPACT;
+            break;
         }
     }
 
@@ -3586,7 +3804,7 @@ int main_save(int argc, char **argv)
     if ( argc - optind >= 3 )
         config_filename = argv[optind + 2];
 
-    save_domain(p, filename, checkpoint, config_filename);
+    save_domain(p, filename, checkpoint, config_filename, suspend_flags);
     return 0;
 }
 
@@ -3597,9 +3815,11 @@ int main_migrate(int argc, char **argv)
     const char *ssh_command = "ssh";
     char *rune = NULL;
     char *host;
-    int opt, daemonize = 1, monitor = 1, debug = 0;
+    int opt, daemonize = 1, monitor = 1, debug = 0, suspend_flags = 0;
+    uint32_t max_downtime = 0;
+    char *endptr;
 
-    while ((opt = def_getopt(argc, argv, "FC:s:ed", "migrate", 2)) != -1) {
+    while ((opt = def_getopt(argc, argv, "FC:s:edD:TzP", "migrate", 2)) != -1) {
         switch (opt) {
         case 0: case 2:
             return opt;
@@ -3619,6 +3839,22 @@ int main_migrate(int argc, char **argv)
         case 'd':
             debug = 1;
             break;
+        case 'D':
+            max_downtime = strtoul(optarg, &endptr, 10);
+            if (endptr == optarg || *endptr || !max_downtime) {
+                fprintf(stderr, "Error: Invalid downtime: %s.\n", optarg);
+                return 1;
+            }
+            break;
+        case 'T':
+            suspend_flags |= LIBXL_SUSPEND_THROTTLE;
+            break;
+        case 'z':
+            suspend_flags |= LIBXL_SUSPEND_COMPACT;
+            break;
+        case 'P':
+            suspend_flags |= LIBXL_SUSPEND_POSTCOPY;
+            break;
         }
     }
 
@@ -3628,14 +3864,17 @@ int main_migrate(int argc, char **argv)
     if (!ssh_command[0]) {
         rune= host;
     } else {
-        if (asprintf(&rune, "exec %s %s xl migrate-receive%s%s",
+        /* -z asks the receiver whether it can restore compact streams;
+         * one that cannot ignores the option and answers as before. */
+        if (asprintf(&rune, "exec %s %s xl migrate-receive%s%s%s -z",
                      ssh_command, host,
                      daemonize ? "" : " -e",
-                     debug ? " -d" : "") < 0)
+                     debug ? " -d" : "",
+                     suspend_flags & LIBXL_SUSPEND_POSTCOPY ? " -P" : "") < 0)
             return 1;
     }
 
-    migrate_domain(p, rune, config_filename);
+    migrate_domain(p, rune, config_filename, max_downtime, suspend_flags);
     return 0;
 }
 
@@ -4641,18 +4880,20 @@ static int sched_credit_domain_output(int domid)
     int rc;
 
     if (domid < 0) {
-        printf("%-33s %4s %6s %4s\n", "Name", "ID", "Weight", "Cap");
+        printf("%-33s %4s %6s %4s %7s\n",
+               "Name", "ID", "Weight", "Cap", "Cosched");
         return 0;
     }
     rc = sched_domain_get(LIBXL_SCHEDULER_CREDIT, domid, &scinfo);
     if (rc)
         return rc;
     domname = libxl_domid_to_name(ctx, domid);
-    printf("%-33s %4d %6d %4d\n",
+    printf("%-33s %4d %6d %4d %7d\n",
         domname,
         domid,
         scinfo.weight,
-        scinfo.cap);
+        scinfo.cap,
+        scinfo.cosched);
     free(domname);
     libxl_domain_sched_params_dispose(&scinfo);
     return 0;
@@ -4732,6 +4973,31 @@ static int sched_sedf_domain_output(
     return 0;
 }
 
+static int sched_rtds_domain_output(
+    int domid)
+{
+    char *domname;
+    libxl_domain_sched_params scinfo;
+    int rc;
+
+    if (domid < 0) {
+        printf("%-33s %4s %9s %9s\n", "Name", "ID", "Period", "Budget");
+        return 0;
+    }
+    rc = sched_domain_get(LIBXL_SCHEDULER_RTDS, domid, &scinfo);
+    if (rc)
+        return rc;
+    domname = libxl_domid_to_name(ctx, domid);
+    printf("%-33s %4d %9d %9d\n",
+        domname,
+        domid,
+        scinfo.period,
+        scinfo.budget);
+    free(domname);
+    libxl_domain_sched_params_dispose(&scinfo);
+    return 0;
+}
+
 static int sched_default_pool_output(uint32_t poolid)
 {
     char *poolname;
@@ -4808,6 +5074,7 @@ int main_sched_credit(int argc, char **argv)
     const char *dom = NULL;
     const char *cpupool = NULL;
     int weight = 256, cap = 0, opt_w = 0, opt_c = 0;
+    int cosched = 0, opt_g = 0;
     int opt_s = 0;
     int tslice = 0, opt_t = 0, ratelimit = 0, opt_r = 0;
     int opt, rc;
@@ -4816,6 +5083,7 @@ int main_sched_credit(int argc, char **argv)
         {"domain", 1, 0, 'd'},
         {"weight", 1, 0, 'w'},
         {"cap", 1, 0, 'c'},
+        {"cosched", 1, 0, 'g'},
         {"schedparam", 0, 0, 's'},
         {"tslice_ms", 1, 0, 't'},
         {"ratelimit_us", 1, 0, 'r'},
@@ -4825,7 +5093,7 @@ int main_sched_credit(int argc, char **argv)
     };
 
     while (1) {
-        opt = getopt_long(argc, argv, "d:w:c:p:t:r:hs", long_options,
+        opt = getopt_long(argc, argv, "d:w:c:g:p:t:r:hs", long_options,
                           &option_index);
         if (opt == -1)
             break;
@@ -4843,6 +5111,10 @@ int main_sched_credit(int argc, char **argv)
             cap = strtol(optarg, NULL, 10);
             opt_c = 1;
             break;
+        case 'g':
+            cosched = strtol(optarg, NULL, 10);
+            opt_g = 1;
+            break;
         case 't':
             tslice = strtol(optarg, NULL, 10);
             opt_t = 1;
@@ -4863,12 +5135,12 @@ int main_sched_credit(int argc, char **argv)
         }
     }
 
-    if ((cpupool || opt_s) && (dom || opt_w || opt_c)) {
+    if ((cpupool || opt_s) && (dom || opt_w || opt_c || opt_g)) {
         fprintf(stderr, "Specifying a cpupool or schedparam is not "
                 "allowed with domain options.\n");
         return 1;
     }
-    if (!dom && (opt_w || opt_c)) {
+    if (!dom && (opt_w || opt_c || opt_g)) {
         fprintf(stderr, "Must specify a domain.\n");
         return 1;
     }
@@ -4915,7 +5187,7 @@ int main_sched_credit(int argc, char **argv)
     } else {
         find_domain(dom);
 
-        if (!opt_w && !opt_c) { /* output credit scheduler info */
+        if (!opt_w && !opt_c && !opt_g) { /* output credit scheduler info */
             sched_credit_domain_output(-1);
             return -sched_credit_domain_output(domid);
         } else { /* set credit scheduler paramaters */
@@ -4926,6 +5198,8 @@ int main_sched_credit(int argc, char **argv)
                 scinfo.weight = weight;
             if (opt_c)
                 scinfo.cap = cap;
+            if (opt_g)
+                scinfo.cosched = cosched;
             rc = sched_domain_set(domid, &scinfo);
             libxl_domain_sched_params_dispose(&scinfo);
             if (rc)
@@ -5131,6 +5405,258 @@ int main_sched_sedf(int argc, char **argv)
     return 0;
 }
 
+int main_sched_rtds(int argc, char **argv)
+{
+    const char *dom = NULL;
+    const char *cpupool = NULL;
+    int period = 0, opt_p = 0;
+    int budget = 0, opt_b = 0;
+    int opt, rc;
+    int option_index = 0;
+    static struct option long_options[] = {
+        {"domain", 1, 0, 'd'},
+        {"period", 1, 0, 'p'},
+        {"budget", 1, 0, 'b'},
+        {"cpupool", 1, 0, 'c'},
+        {"help", 0, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    while (1) {
+        opt = getopt_long(argc, argv, "d:p:b:c:h", long_options,
+                          &option_index);
+        if (opt == -1)
+            break;
+        switch (opt) {
+        case 0: case 2:
+            return opt;
+        case 'd':
+            dom = optarg;
+            break;
+        case 'p':
+            period = strtol(optarg, NULL, 10);
+            opt_p = 1;
+            break;
+        case 'b':
+            budget = strtol(optarg, NULL, 10);
+            opt_b = 1;
+            break;
+        case 'c':
+            cpupool = optarg;
+            break;
+        case 'h':
+            help("sched-rtds");
+            return 0;
+        }
+    }
+
+    if (cpupool && (dom || opt_p || opt_b)) {
+        fprintf(stderr, "Specifying a cpupool is not allowed with other "
+                "options.\n");
+        return 1;
+    }
+    if (!dom && (opt_p || opt_b)) {
+        fprintf(stderr, "Must specify a domain.\n");
+        return 1;
+    }
+
+    if (!dom) { /* list all domain's rtds scheduler info */
+        return -sched_domain_output(LIBXL_SCHEDULER_RTDS,
+                                    sched_rtds_domain_output,
+                                    sched_default_pool_output,
+                                    cpupool);
+    } else {
+        find_domain(dom);
+
+        if (!opt_p && !opt_b) { /* output rtds scheduler info */
+            sched_rtds_domain_output(-1);
+            return -sched_rtds_domain_output(domid);
+        } else { /* set rtds scheduler paramaters */
+            libxl_domain_sched_params scinfo;
+            libxl_domain_sched_params_init(&scinfo);
+            scinfo.sched = LIBXL_SCHEDULER_RTDS;
+            if (opt_p)
+                scinfo.period = period;
+            if (opt_b)
+                scinfo.budget = budget;
+            rc = sched_domain_set(domid, &scinfo);
+            libxl_domain_sched_params_dispose(&scinfo);
+            if (rc)
+                return -rc;
+        }
+    }
+
+    return 0;
+}
+
+/* Upper bound, in us, of the bucket holding the p-th percentile. */
+static uint64_t sched_latency_percentile(const libxl_sched_latency_hist *h,
+                                         unsigned int p)
+{
+    uint64_t seen = 0, want = (h->count * p + 99) / 100;
+    int i;
+
+    if (!h->count)
+        return 0;
+    for (i = 0; i < h->num_buckets - 1; i++) {
+        seen += h->buckets[i];
+        if (seen >= want)
+            break;
+    }
+    return 1ULL << i;
+}
+
+static void sched_latency_print_hist(const char *what,
+                                     const libxl_sched_latency_hist *h)
+{
+    int i;
+
+    printf("  %s:\n", what);
+    for (i = 0; i < h->num_buckets; i++) {
+        if (!h->buckets[i])
+            continue;
+        if (i == 0)
+            printf("    %10s  < 1 us %12"PRIu64"\n", "", h->buckets[i]);
+        else if (i == h->num_buckets - 1)
+            printf("    %10"PRIu64"+    us %12"PRIu64"\n",
+                   (uint64_t)1 << (i - 1), h->buckets[i]);
+        else
+            printf("    %10"PRIu64"-%-6"PRIu64"us %12"PRIu64"\n",
+                   (uint64_t)1 << (i - 1), ((uint64_t)1 << i) - 1,
+                   h->buckets[i]);
+    }
+}
+
+static int sched_latency_output(libxl_sched_latency_target target,
+                                uint32_t id, const char *name, int verbose)
+{
+    libxl_sched_latency lat;
+    int rc;
+
+    rc = libxl_sched_latency_get(ctx, target, id, &lat);
+    if (rc)
+        return rc;
+
+#define AVG_US(h) ((h).count ? (h).total_ns / (h).count / 1000 : 0)
+    printf("%-32s %5u %10"PRIu64" %8"PRIu64" %8"PRIu64" %8"PRIu64
+           " %10"PRIu64" %8"PRIu64" %8"PRIu64" %10"PRIu64"\n",
+           name, id,
+           lat.wakeup.count, AVG_US(lat.wakeup),
+           sched_latency_percentile(&lat.wakeup, 99),
+           lat.wakeup.max_ns / 1000,
+           lat.wait.count, AVG_US(lat.wait),
+           sched_latency_percentile(&lat.wait, 99),
+           lat.preemptions);
+#undef AVG_US
+
+    if (verbose) {
+        sched_latency_print_hist("wakeup to run", &lat.wakeup);
+        sched_latency_print_hist("runnable to run", &lat.wait);
+    }
+
+    libxl_sched_latency_dispose(&lat);
+    return 0;
+}
+
+int main_sched_latency(int argc, char **argv)
+{
+    const char *cpupool = NULL;
+    libxl_sched_latency_target target = LIBXL_SCHED_LATENCY_TARGET_DOMAIN;
+    libxl_dominfo *dominfo = NULL;
+    uint32_t poolid;
+    int opt_r = 0, opt_v = 0;
+    int opt, i, nb_domain = 0, rc = 0;
+    int option_index = 0;
+    char *name;
+    static struct option long_options[] = {
+        {"cpupool", 1, 0, 'c'},
+        {"reset", 0, 0, 'r'},
+        {"verbose", 0, 0, 'v'},
+        {"help", 0, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    while (1) {
+        opt = getopt_long(argc, argv, "c:rvh", long_options, &option_index);
+        if (opt == -1)
+            break;
+        switch (opt) {
+        case 0: case 2:
+            return opt;
+        case 'c':
+            cpupool = optarg;
+            break;
+        case 'r':
+            opt_r = 1;
+            break;
+        case 'v':
+            opt_v = 1;
+            break;
+        case 'h':
+            help("sched-latency");
+            return 0;
+        }
+    }
+
+    if (cpupool && optind < argc) {
+        fprintf(stderr, "Specifying a cpupool is not allowed with domains.\n");
+        return 1;
+    }
+
+    if (cpupool) {
+        if (cpupool_qualifier_to_cpupoolid(cpupool, &poolid, NULL) ||
+            !libxl_cpupoolid_to_name(ctx, poolid)) {
+            fprintf(stderr, "unknown cpupool \'%s\'\n", cpupool);
+            return 1;
+        }
+        target = LIBXL_SCHED_LATENCY_TARGET_CPUPOOL;
+    } else if (optind == argc) {
+        dominfo = libxl_list_domain(ctx, &nb_domain);
+        if (!dominfo) {
+            fprintf(stderr, "libxl_list_domain failed.\n");
+            return 1;
+        }
+    }
+
+    if (!opt_r)
+        printf("%-32s %5s %10s %8s %8s %8s %10s %8s %8s %10s\n",
+               "Name", "ID", "Wakeups", "Avg(us)", "P99(us)", "Max(us)",
+               "Waits", "Avg(us)", "P99(us)", "Preempts");
+
+    for (i = 0; !rc; i++) {
+        uint32_t id;
+
+        if (cpupool) {
+            if (i > 0)
+                break;
+            id = poolid;
+            name = libxl_cpupoolid_to_name(ctx, id);
+        } else if (dominfo) {
+            if (i >= nb_domain)
+                break;
+            id = dominfo[i].domid;
+            name = libxl_domid_to_name(ctx, id);
+        } else {
+            if (optind + i >= argc)
+                break;
+            find_domain(argv[optind + i]);
+            id = domid;
+            name = libxl_domid_to_name(ctx, id);
+        }
+
+        if (opt_r)
+            rc = libxl_sched_latency_reset(ctx, target, id);
+        else
+            rc = sched_latency_output(target, id, name ? name : "-", opt_v);
+        free(name);
+    }
+
+    if (dominfo)
+        libxl_dominfo_list_free(dominfo, nb_domain);
+
+    return rc ? 1 : 0;
+}
+
 int main_domid(int argc, char **argv)
 {
     int opt;
@@ -6790,7 +7316,7 @@ int main_remus(int argc, char **argv)
         child = create_migration_child(rune, &send_fd, &recv_fd);
 
         migrate_do_preamble(send_fd, recv_fd, child, config_data, config_len,
-                            rune);
+                            rune, NULL);
     }
 
     /* Point of no return */
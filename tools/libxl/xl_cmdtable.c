@@ -138,7 +138,9 @@ struct cmd_spec cmd_table[] = {
       "Save a domain state to restore later",
       "[options] <Domain> <CheckpointFile> [<ConfigFile>]",
       "-h  Print this help.\n"
-      "-c  Leave domain running after creating the snapshot."
+      "-c  Leave domain running after creating the snapshot.\n"
+      "-z  Leave out zero and duplicate pages and compress the\n"
+      "    memory image; needs a restoring host that supports it."
     },
     { "migrate",
       &main_migrate, 0, 1,
@@ -148,9 +150,18 @@ struct cmd_spec cmd_table[] = {
       "-C <config>     Send <config> instead of config file from creation.\n"
       "-s <sshcommand> Use <sshcommand> instead of ssh.  String will be passed\n"
       "                to sh. If empty, run <host> instead of ssh <host> xl\n"
-      "                migrate-receive [-d -e]\n"
+      "                migrate-receive [-d -e -P] -z\n"
       "-e              Do not wait in the background (on <host>) for the death\n"
-      "                of the domain."
+      "                of the domain.\n"
+      "-D <ms>         Stop copying memory once the guest can be moved with\n"
+      "                at most <ms> milliseconds of downtime.\n"
+      "-T              Throttle the guest's vCPUs if it dirties memory faster\n"
+      "                than it can be sent.\n"
+      "-z              Send a compact stream (zero and duplicate pages left\n"
+      "                out, memory image compressed) even if <host> does not\n"
+      "                say that it supports it.\n"
+      "-P              If memory does not converge, start an HVM domain on\n"
+      "                <host> and send the rest of its memory afterwards."
     },
     { "dump-core",
       &main_dump_core, 0, 1,
@@ -232,10 +243,11 @@ struct cmd_spec cmd_table[] = {
     { "sched-credit",
       &main_sched_credit, 0, 1,
       "Get/set credit scheduler parameters",
-      "[-d <Domain> [-w[=WEIGHT]|-c[=CAP]]] [-s [-t TSLICE] [-r RATELIMIT]] [-p CPUPOOL]",
+      "[-d <Domain> [-w[=WEIGHT]|-c[=CAP]|-g[=0|1]]] [-s [-t TSLICE] [-r RATELIMIT]] [-p CPUPOOL]",
       "-d DOMAIN, --domain=DOMAIN        Domain to modify\n"
       "-w WEIGHT, --weight=WEIGHT        Weight (int)\n"
       "-c CAP, --cap=CAP                 Cap (int)\n"
+      "-g 0|1, --cosched=0|1             Co-schedule the domain's vcpus\n"
       "-s         --schedparam           Query / modify scheduler parameters\n"
       "-t TSLICE, --tslice_ms=TSLICE     Set the timeslice, in milliseconds\n"
       "-r RLIMIT, --ratelimit_us=RLIMIT  Set the scheduling rate limit, in microseconds\n"
@@ -265,6 +277,23 @@ struct cmd_spec cmd_table[] = {
       "                               --period/--slice)\n"
       "-c CPUPOOL, --cpupool=CPUPOOL  Restrict output to CPUPOOL"
     },
+    { "sched-rtds",
+      &main_sched_rtds, 0, 1,
+      "Get/set rtds scheduler parameters",
+      "[-d <Domain> [-p[=PERIOD]] [-b[=BUDGET]]] [-c CPUPOOL]",
+      "-d DOMAIN, --domain=DOMAIN     Domain to modify\n"
+      "-p PERIOD, --period=PERIOD     Period (us)\n"
+      "-b BUDGET, --budget=BUDGET     Budget (us) per period, for each vcpu\n"
+      "-c CPUPOOL, --cpupool=CPUPOOL  Restrict output to CPUPOOL"
+    },
+    { "sched-latency",
+      &main_sched_latency, 0, 1,
+      "Show or reset scheduling latency statistics",
+      "[-r] [-v] [-c CPUPOOL | <Domain>...]",
+      "-c CPUPOOL, --cpupool=CPUPOOL  Show the totals of CPUPOOL's domains\n"
+      "-r, --reset                    Reset the statistics instead\n"
+      "-v, --verbose                  Also print the histograms"
+    },
     { "domid",
       &main_domid, 0, 0,
       "Convert a domain name to domain id",
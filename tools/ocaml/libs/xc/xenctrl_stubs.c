@@ -943,6 +943,7 @@ CAMLprim value stub_sched_credit_domain_set(value xch, value domid,
 
 	c_sdom.weight = Int_val(Field(sdom, 0));
 	c_sdom.cap = Int_val(Field(sdom, 1));
+	c_sdom.cosched = (uint16_t)~0U;
 	caml_enter_blocking_section();
 	ret = xc_sched_credit_domain_set(_H(xch), _D(domid), &c_sdom);
 	caml_leave_blocking_section();
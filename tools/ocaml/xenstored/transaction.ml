@@ -20,63 +20,48 @@ let none = 0
 let test_eagain = ref false
 let do_coalesce = ref true
 
-let check_parents_perms_identical root1 root2 path =
-	let hierarch = Store.Path.get_hierarchy path in
-	let permdiff = List.fold_left (fun acc path ->
-		let n1 = Store.Path.get_node root1 path
-		and n2 = Store.Path.get_node root2 path in
-		match n1, n2 with
-		| Some n1, Some n2 ->
-			not (Perms.equiv (Store.Node.get_perms n1) (Store.Node.get_perms n2)) || acc
-		| _ ->
-			true || acc
-	) false hierarch in
-	(not permdiff)
-
-let get_lowest path1 path2 =
-	match path2 with
-	| None       -> Some path1
-	| Some path2 -> Some (Store.Path.get_common_prefix path1 path2)
-
-let test_coalesce oldroot currentroot optpath =
-	match optpath with
-	| None      -> true
-	| Some path ->
-		let oldnode = Store.Path.get_node oldroot path
-		and currentnode = Store.Path.get_node currentroot path in
-		
-		match oldnode, currentnode with
-		| (Some oldnode), (Some currentnode) ->
-			if oldnode == currentnode then (
-				check_parents_perms_identical oldroot currentroot path
-			) else (
-				false
-			)
-		| None, None -> (
-			(* ok then it doesn't exists in the old version and the current version,
-			   just sneak it in as a child of the parent node if it exists, or else fail *)
-			let pnode = Store.Path.get_node currentroot (Store.Path.get_parent path) in
-			match pnode with
-			| None       -> false (* ok it doesn't exists, just bail out. *)
-			| Some pnode -> true
-			)
-		| _ ->
-			false
+(* [Store.Path.get_node] raises Not_found when an ancestor is missing *)
+let get_node root path =
+	try Store.Path.get_node root path with Not_found -> None
 
-let can_coalesce oldroot currentroot path =
-	if !do_coalesce then
-		try test_coalesce oldroot currentroot path with _ -> false
-	else
-		false
+(* a node is unchanged for a conflict check if it still has the same value
+   and permissions, and, when [children] is set (ls), the same children. the
+   children of other nodes may change freely under a transaction. *)
+let node_unchanged ~children oldroot currentroot path =
+	match get_node oldroot path, get_node currentroot path with
+	| None, None -> true
+	| Some o, Some c when o == c -> true
+	| Some o, Some c ->
+		let names n = List.sort compare
+			(List.map (fun x -> x.Store.Node.name) n.Store.Node.children) in
+		o.Store.Node.value = c.Store.Node.value
+		&& Perms.equiv o.Store.Node.perms c.Store.Node.perms
+		&& (not children || names o = names c)
+	| _ -> false
+
+(* writing under a node needs its ancestors to keep their permissions *)
+let parents_unchanged oldroot currentroot path =
+	List.for_all (fun p ->
+		match get_node oldroot p, get_node currentroot p with
+		| None, None -> true
+		| Some n1, Some n2 ->
+			Perms.equiv (Store.Node.get_perms n1) (Store.Node.get_perms n2)
+		| _ -> false
+	) (Store.Path.get_hierarchy (Store.Path.get_parent path))
 
 type ty = No | Full of (int * Store.Node.t * Store.t)
 
+type wop = Set of Store.Path.t | Del of Store.Path.t
+
 type t = {
 	ty: ty;
 	store: Store.t;
 	mutable ops: (Xenbus.Xb.Op.operation * Store.Path.t) list;
-	mutable read_lowpath: Store.Path.t option;
-	mutable write_lowpath: Store.Path.t option;
+	(* path -> children were listed *)
+	read_set: (Store.Path.t, bool) Hashtbl.t;
+	write_set: (Store.Path.t, unit) Hashtbl.t;
+	(* every modification in reverse order, including the implicit mkdirs *)
+	mutable wops: wop list;
 }
 
 let make id store =
@@ -85,8 +70,9 @@ let make id store =
 		ty = ty;
 		store = if id = none then store else Store.copy store;
 		ops = [];
-		read_lowpath = None;
-		write_lowpath = None;
+		read_set = Hashtbl.create (if id = none then 1 else 16);
+		write_set = Hashtbl.create (if id = none then 1 else 16);
+		wops = [];
 	}
 
 let get_id t = match t.ty with No -> none | Full (id, _, _) -> id
@@ -94,49 +80,114 @@ let get_store t = t.store
 let get_ops t = t.ops
 
 let add_wop t ty path = t.ops <- (ty, path) :: t.ops
-let set_read_lowpath t path = t.read_lowpath <- get_lowest path t.read_lowpath
-let set_write_lowpath t path = t.write_lowpath <- get_lowest path t.write_lowpath
 
-let path_exists t path = Store.path_exists t.store path
+let add_read t ?(children=false) path =
+	match t.ty with
+	| No -> ()
+	| Full _ ->
+		let listed = try Hashtbl.find t.read_set path with Not_found -> false in
+		Hashtbl.replace t.read_set path (children || listed)
+
+let add_write t op =
+	match t.ty with
+	| No -> ()
+	| Full _ ->
+		let path = match op with Set p | Del p -> p in
+		Hashtbl.replace t.write_set path ();
+		t.wops <- op :: t.wops
+
+let path_exists t path =
+	add_read t path;
+	Store.path_exists t.store path
 
 let write t perm path value =
-	let path_exists = path_exists t path in
 	Store.write t.store perm path value;
-	if path_exists
-	then set_write_lowpath t path
-	else set_write_lowpath t (Store.Path.get_parent path);
+	add_write t (Set path);
 	add_wop t Xenbus.Xb.Op.Write path
 
 let mkdir ?(with_watch=true) t perm path =
 	Store.mkdir t.store perm path;
-	set_write_lowpath t path;
+	add_write t (Set path);
 	if with_watch then
 		add_wop t Xenbus.Xb.Op.Mkdir path
 
 let setperms t perm path perms =
 	Store.setperms t.store perm path perms;
-	set_write_lowpath t path;
+	add_write t (Set path);
 	add_wop t Xenbus.Xb.Op.Setperms path
 
 let rm t perm path =
 	Store.rm t.store perm path;
-	set_write_lowpath t (Store.Path.get_parent path);
+	add_write t (Del path);
 	add_wop t Xenbus.Xb.Op.Rm path
 
-let ls t perm path =	
-	let r = Store.ls t.store perm path in
-	set_read_lowpath t path;
-	r
+let ls t perm path =
+	add_read t ~children:true path;
+	Store.ls t.store perm path
 
 let read t perm path =
-	let r = Store.read t.store perm path in
-	set_read_lowpath t path;
-	r
+	add_read t path;
+	Store.read t.store perm path
 
 let getperms t perm path =
-	let r = Store.getperms t.store perm path in
-	set_read_lowpath t path;
-	r
+	add_read t path;
+	Store.getperms t.store perm path
+
+let has_conflicts t oldroot currentroot =
+	let conflict = ref false in
+	Hashtbl.iter (fun path children ->
+		if not !conflict && not (node_unchanged ~children oldroot currentroot path) then
+			conflict := true
+	) t.read_set;
+	Hashtbl.iter (fun path () ->
+		if not !conflict && not (node_unchanged ~children:false oldroot currentroot path
+		                         && parents_unchanged oldroot currentroot path) then
+			conflict := true
+	) t.write_set;
+	!conflict
+
+(* replay the modifications of [t] on top of [root]: each written node gets
+   its final value and permissions from the transaction store, keeping the
+   children it has in [root]. quota is checked again against [quota] since
+   other transactions may have used it up in the meantime. *)
+let merge t root quota =
+	let apply root = function
+	| Set path ->
+		(match get_node (Store.get_root t.store) path with
+		| None -> root (* removed later in this transaction *)
+		| Some n ->
+			let owner = Store.Node.get_owner n in
+			Quota.check quota owner (String.length (Store.Node.get_value n));
+			let old = get_node root path in
+			(match old with
+			| None ->
+				Quota.add_entry quota owner
+			| Some o when Store.Node.get_owner o <> owner ->
+				Quota.del_entry quota (Store.Node.get_owner o);
+				Quota.add_entry quota owner
+			| Some _ -> ());
+			let keep_children o = { n with Store.Node.children = o.Store.Node.children } in
+			if path = [] then
+				keep_children root
+			else
+				Store.Path.apply_modify root path (fun parent name ->
+					match old with
+					| Some o -> Store.Node.replace_child parent o (keep_children o)
+					| None   -> Store.Node.add_child parent { n with Store.Node.children = [] }
+				)
+		)
+	| Del path ->
+		match get_node root path with
+		| None -> root
+		| Some o ->
+			Store.Node.recurse (fun n -> Quota.del_entry quota (Store.Node.get_owner n)) o;
+			if path = [] then
+				Store.Node.del_all_children root
+			else
+				Store.Path.apply_modify root path (fun parent name ->
+					Store.Node.del_childname parent name)
+		in
+	List.fold_left apply root (List.rev t.wops)
 
 let commit ~con t =
 	let has_write_ops = List.length t.ops > 0 in
@@ -145,31 +196,40 @@ let commit ~con t =
 	match t.ty with
 	| No                         -> true
 	| Full (id, oldroot, cstore) ->
-		let commit_partial oldroot cstore store =
-			(* get the lowest path of the query and verify that it hasn't
-			   been modified by others transactions. *)
-			if can_coalesce oldroot (Store.get_root cstore) t.read_lowpath
-			&& can_coalesce oldroot (Store.get_root cstore) t.write_lowpath then (
-				maybe (fun p ->
-					let n = Store.get_node store p in
-
-					(* it has to be in the store, otherwise it means bugs
-					   in the lowpath registration. we don't need to handle none. *)
-					maybe (fun n -> Store.set_node cstore p n) n;
-					Logging.write_coalesce ~tid:(get_id t) ~con (Store.Path.to_string p);
-				) t.write_lowpath;
-				maybe (fun p ->
+		let commit_partial oldroot cstore =
+			(* only the nodes this transaction looked at or modified have to
+			   be untouched by others; everything else is merged. *)
+			let currentroot = Store.get_root cstore in
+			let merged =
+				if not !do_coalesce || has_conflicts t oldroot currentroot then
+					None
+				else
+					let quota = Quota.copy (Store.get_quota cstore) in
+					(* over quota now, or a parent another transaction
+					   removed: the client has to redo it. anything else
+					   is a real error and is not hidden behind EAGAIN. *)
+					try Some (merge t currentroot quota, quota)
+					with Quota.Limit_reached | Quota.Data_too_big
+					   | Define.Lookup_Doesnt_exist _ -> None
+				in
+			match merged with
+			| Some (root, quota) ->
+				Store.set_root cstore root;
+				Store.set_quota cstore quota;
+				Hashtbl.iter (fun p () ->
+					Logging.write_coalesce ~tid:(get_id t) ~con (Store.Path.to_string p)
+				) t.write_set;
+				Hashtbl.iter (fun p _ ->
 					Logging.read_coalesce ~tid:(get_id t) ~con (Store.Path.to_string p)
-					) t.read_lowpath;
+				) t.read_set;
 				has_coalesced := true;
 				Store.incr_transaction_coalesce cstore;
 				true
-			) else (
+			| None ->
 				(* cannot do anything simple, just discard the queries,
 				   and the client need to redo it later *)
 				Store.incr_transaction_abort cstore;
 				false
-			)
 			in
 		let try_commit oldroot cstore store =
 			if oldroot == Store.get_root cstore then (
@@ -182,7 +242,7 @@ let commit ~con t =
 				true
 			) else
 				(* we try a partial commit if possible *)
-				commit_partial oldroot cstore store
+				commit_partial oldroot cstore
 			in
 		if !test_eagain && Random.int 3 = 0 then
 			false
@@ -190,7 +250,7 @@ let commit ~con t =
 			try_commit oldroot cstore t.store
 		in
 	if has_commited && has_write_ops then
-		Disk.write t.store;
+		Disk.write (match t.ty with No -> t.store | Full (_, _, cstore) -> cstore);
 	if not has_commited 
 	then Logging.conflict ~tid:(get_id t) ~con
 	else if not !has_coalesced 
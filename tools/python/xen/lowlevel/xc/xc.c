@@ -1633,6 +1633,7 @@ static PyObject *pyxc_sched_credit_domain_set(XcObject *self,
 
     sdom.weight = weight;
     sdom.cap = cap;
+    sdom.cosched = (uint16_t)~0U;
 
     if ( xc_sched_credit_domain_set(self->xc_handle, domid, &sdom) != 0 )
         return pyxc_error_to_exception(self->xc_handle);
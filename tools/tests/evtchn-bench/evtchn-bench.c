@@ -0,0 +1,313 @@
+/*
+ * evtchn-bench.c
+ *
+ * Measure EVTCHNOP_send throughput from the calling domain.
+ *
+ * Each worker thread binds a loopback interdomain channel to the calling
+ * domain and notifies it in a tight loop.  The run is repeated for 1, 2,
+ * 4, ... up to the requested number of threads (default: one per online
+ * CPU) and the aggregate notifications/sec is reported for each.  With -c
+ * another thread binds and closes ports for the duration of each run, to
+ * show how sends hold up against concurrent channel setup and teardown.
+ *
+ * Run it in dom0 (or pass the calling domain's ID with -d) with the vCPUs
+ * pinned as required.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <xenctrl.h>
+
+static int domid;
+static int shared;
+static volatile int stop;
+
+static evtchn_port_t shared_port;
+static xc_evtchn *shared_xce;
+
+struct worker {
+    pthread_t thread;
+    xc_evtchn *xce;
+    evtchn_port_t local, remote;
+    uint64_t count;
+    int err;
+};
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* Open a handle and bind both ends of a loopback channel to it. */
+static int bind_loopback(xc_evtchn **xcep, evtchn_port_t *local,
+                         evtchn_port_t *remote)
+{
+    xc_evtchn *xce;
+    evtchn_port_or_error_t rport, lport;
+
+    xce = xc_evtchn_open(NULL, 0);
+    if ( !xce )
+        return -1;
+
+    rport = xc_evtchn_bind_unbound_port(xce, domid);
+    if ( rport < 0 )
+        goto err;
+
+    lport = xc_evtchn_bind_interdomain(xce, domid, rport);
+    if ( lport < 0 )
+    {
+        xc_evtchn_unbind(xce, rport);
+        goto err;
+    }
+
+    *xcep = xce;
+    *local = lport;
+    *remote = rport;
+    return 0;
+
+ err:
+    xc_evtchn_close(xce);
+    return -1;
+}
+
+static void unbind_loopback(xc_evtchn *xce, evtchn_port_t local,
+                            evtchn_port_t remote)
+{
+    xc_evtchn_unbind(xce, local);
+    xc_evtchn_unbind(xce, remote);
+    xc_evtchn_close(xce);
+}
+
+static void *notify_thread(void *arg)
+{
+    struct worker *w = arg;
+    xc_evtchn *xce = shared ? shared_xce : w->xce;
+    evtchn_port_t port = shared ? shared_port : w->local;
+
+    while ( !stop )
+    {
+        if ( xc_evtchn_notify(xce, port) < 0 )
+        {
+            w->err = errno;
+            break;
+        }
+        w->count++;
+    }
+
+    return NULL;
+}
+
+static void *churn_thread(void *arg)
+{
+    struct worker *w = arg;
+    evtchn_port_or_error_t port;
+
+    while ( !stop )
+    {
+        port = xc_evtchn_bind_unbound_port(w->xce, domid);
+        if ( port < 0 )
+        {
+            w->err = errno;
+            break;
+        }
+        xc_evtchn_unbind(w->xce, port);
+        w->count++;
+    }
+
+    return NULL;
+}
+
+static int run(struct worker *workers, unsigned int nr, int churn,
+               unsigned int secs)
+{
+    struct worker churner = { .count = 0 };
+    uint64_t total = 0;
+    double start, elapsed;
+    unsigned int i;
+    int rc = 0;
+
+    if ( churn )
+    {
+        churner.xce = xc_evtchn_open(NULL, 0);
+        if ( !churner.xce )
+        {
+            perror("xc_evtchn_open");
+            return -1;
+        }
+    }
+
+    stop = 0;
+    start = now();
+
+    for ( i = 0; i < nr; i++ )
+    {
+        workers[i].count = 0;
+        workers[i].err = 0;
+        if ( pthread_create(&workers[i].thread, NULL, notify_thread,
+                            &workers[i]) )
+        {
+            fprintf(stderr, "pthread_create failed\n");
+            stop = 1;
+            nr = i;
+            rc = -1;
+            break;
+        }
+    }
+    if ( churn && !rc &&
+         pthread_create(&churner.thread, NULL, churn_thread, &churner) )
+    {
+        fprintf(stderr, "pthread_create failed\n");
+        churn = 0;
+        rc = -1;
+    }
+
+    if ( !rc )
+        sleep(secs);
+    stop = 1;
+
+    for ( i = 0; i < nr; i++ )
+    {
+        pthread_join(workers[i].thread, NULL);
+        total += workers[i].count;
+        if ( workers[i].err )
+        {
+            fprintf(stderr, "thread %u: notify failed: %s\n",
+                    i, strerror(workers[i].err));
+            rc = -1;
+        }
+    }
+    if ( churn )
+        pthread_join(churner.thread, NULL);
+    elapsed = now() - start;
+
+    if ( churner.xce )
+        xc_evtchn_close(churner.xce);
+
+    if ( rc )
+        return rc;
+
+    printf("%4u %16.0f %16.0f", nr, total / elapsed, total / elapsed / nr);
+    if ( churn )
+        printf(" %12.0f", churner.count / elapsed);
+    printf("\n");
+
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-d domid] [-n threads] [-t seconds] [-s] [-c]\n"
+            "  -d  ID of the calling domain (default 0)\n"
+            "  -n  maximum number of sending threads (default: online CPUs)\n"
+            "  -t  duration of each run in seconds (default 5)\n"
+            "  -s  all threads notify the same port\n"
+            "  -c  bind and close ports in another thread during each run\n",
+            prog);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    struct worker *workers;
+    unsigned int max = 0, secs = 5, nr, i, bound = 0;
+    evtchn_port_t shared_remote = 0;
+    int churn = 0, opt, rc = 0;
+
+    while ( (opt = getopt(argc, argv, "d:n:t:sch")) != -1 )
+    {
+        switch ( opt )
+        {
+        case 'd':
+            domid = atoi(optarg);
+            break;
+        case 'n':
+            max = atoi(optarg);
+            break;
+        case 't':
+            secs = atoi(optarg);
+            break;
+        case 's':
+            shared = 1;
+            break;
+        case 'c':
+            churn = 1;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if ( max == 0 )
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+        max = cpus > 0 ? cpus : 1;
+    }
+    if ( secs == 0 )
+        usage(argv[0]);
+
+    workers = calloc(max, sizeof(*workers));
+    if ( !workers )
+    {
+        perror("calloc");
+        return 1;
+    }
+
+    if ( shared )
+    {
+        if ( bind_loopback(&shared_xce, &shared_port, &shared_remote) )
+        {
+            perror("binding loopback event channel");
+            rc = 1;
+            goto out;
+        }
+    }
+    else
+    {
+        for ( bound = 0; bound < max; bound++ )
+            if ( bind_loopback(&workers[bound].xce, &workers[bound].local,
+                               &workers[bound].remote) )
+            {
+                perror("binding loopback event channel");
+                rc = 1;
+                goto out;
+            }
+    }
+
+    printf("%s port%s, %u s per run%s\n",
+           shared ? "shared" : "per-thread", shared ? "" : "s", secs,
+           churn ? ", concurrent bind/close" : "");
+    printf("%4s %16s %16s%s\n", "thr", "notify/s", "notify/s/thr",
+           churn ? "   bind+close/s" : "");
+
+    for ( nr = 1; ; nr = (nr * 2 > max) ? max : nr * 2 )
+    {
+        if ( run(workers, nr, churn, secs) )
+        {
+            rc = 1;
+            break;
+        }
+        if ( nr == max )
+            break;
+    }
+
+ out:
+    for ( i = 0; i < bound; i++ )
+        unbind_loopback(workers[i].xce, workers[i].local, workers[i].remote);
+    if ( shared_xce )
+        unbind_loopback(shared_xce, shared_port, shared_remote);
+    free(workers);
+
+    return rc;
+}
@@ -0,0 +1,167 @@
+/*
+ * rtds-budget.c
+ *
+ * Check that RTDS hands a CPU-bound vcpu its budget in every period.
+ *
+ * Give the domain a single vcpu that never blocks (e.g. run
+ * "while :; do :; done" in the guest) and make it the only domain in a
+ * cpupool using the rtds scheduler:
+ *
+ *   xl cpupool-create name=\"rt\" sched=\"rtds\" cpus=\"3\"
+ *   xl cpupool-migrate <domain> rt
+ *
+ * This sets the domain's budget and period, then samples the vcpu's CPU
+ * time once per second.  The vcpu exhausts its budget in every period and
+ * nothing else in the pool gives a pcpu a reason to reschedule, so it only
+ * keeps running if the scheduler replenishes it by itself.  The test fails
+ * if any interval sees no progress at all (the vcpu was never replenished)
+ * or a share of the pcpu more than 10% away from budget/period.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <xenctrl.h>
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-b budget_us] [-p period_us] [-t seconds] "
+            "domid\n", prog);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    xc_interface *xch;
+    xc_dominfo_t info;
+    xc_cpupoolinfo_t *pool;
+    xc_vcpuinfo_t vinfo;
+    struct xen_domctl_sched_rtds sdom;
+    unsigned int budget = 2000, period = 10000, seconds = 10, i;
+    uint32_t domid;
+    uint64_t last_ns;
+    double last, t, share, want;
+    int opt, failed = 0;
+
+    while ( (opt = getopt(argc, argv, "b:p:t:h")) != -1 )
+    {
+        switch ( opt )
+        {
+        case 'b':
+            budget = atoi(optarg);
+            break;
+        case 'p':
+            period = atoi(optarg);
+            break;
+        case 't':
+            seconds = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if ( optind + 1 != argc || !budget || budget > period || !seconds )
+        usage(argv[0]);
+    domid = atoi(argv[optind]);
+
+    xch = xc_interface_open(NULL, NULL, 0);
+    if ( !xch )
+    {
+        perror("xc_interface_open");
+        return 1;
+    }
+
+    if ( xc_domain_getinfo(xch, domid, 1, &info) != 1 ||
+         info.domid != domid )
+    {
+        fprintf(stderr, "No domain %"PRIu32"\n", domid);
+        return 1;
+    }
+    pool = xc_cpupool_getinfo(xch, info.cpupool);
+    if ( !pool || pool->cpupool_id != info.cpupool ||
+         pool->sched_id != XEN_SCHEDULER_RTDS )
+    {
+        fprintf(stderr, "Domain %"PRIu32" is not in an rtds cpupool\n",
+                domid);
+        return 1;
+    }
+    if ( pool->n_dom != 1 || info.nr_online_vcpus != 1 )
+        fprintf(stderr, "warning: expected a single vcpu alone in its pool "
+                "(%u domains, %u vcpus)\n", pool->n_dom,
+                info.nr_online_vcpus);
+    xc_cpupool_infofree(xch, pool);
+
+    memset(&sdom, 0, sizeof(sdom));
+    sdom.vcpuid = XEN_DOMCTL_SCHED_RTDS_ALL_VCPUS;
+    sdom.budget = budget;
+    sdom.period = period;
+    if ( xc_sched_rtds_domain_set(xch, domid, &sdom) )
+    {
+        fprintf(stderr, "Setting budget %uus period %uus: %s\n",
+                budget, period, strerror(errno));
+        return 1;
+    }
+
+    want = (double)budget / period;
+    printf("budget %uus period %uus: expecting %.1f%% of a pcpu\n",
+           budget, period, want * 100);
+
+    /* Let the new parameters take effect before the first sample. */
+    sleep(1);
+    if ( xc_vcpu_getinfo(xch, domid, 0, &vinfo) )
+    {
+        perror("xc_vcpu_getinfo");
+        return 1;
+    }
+    last_ns = vinfo.cpu_time;
+    last = now();
+
+    for ( i = 0; i < seconds; i++ )
+    {
+        sleep(1);
+        if ( xc_vcpu_getinfo(xch, domid, 0, &vinfo) )
+        {
+            perror("xc_vcpu_getinfo");
+            return 1;
+        }
+        t = now();
+        share = (vinfo.cpu_time - last_ns) / ((t - last) * 1e9);
+        printf("  %2u: %5.1f%%%s\n", i + 1, share * 100,
+               !vinfo.running ? " (not running)" : "");
+
+        if ( vinfo.cpu_time == last_ns )
+        {
+            fprintf(stderr, "FAIL: vcpu made no progress; "
+                    "was it ever replenished?\n");
+            failed = 1;
+        }
+        else if ( share < want * 0.9 || share > want * 1.1 )
+        {
+            fprintf(stderr, "FAIL: share %.1f%% outside %.1f%% +/- 10%%\n",
+                    share * 100, want * 100);
+            failed = 1;
+        }
+
+        last_ns = vinfo.cpu_time;
+        last = t;
+    }
+
+    xc_interface_close(xch);
+
+    printf("%s\n", failed ? "FAILED" : "PASSED");
+
+    return failed;
+}
@@ -0,0 +1,217 @@
+/*
+ * sched-latency.c
+ *
+ * Report the distribution of credit2 schedule() latencies from a trace.
+ *
+ * With tracing enabled, credit2 logs the time each scheduling decision
+ * took together with the runqueue it was made on and that runqueue's
+ * load.  Capture those records while running a workload, e.g.
+ *
+ *   xentrace -D -e 0x0002f000 -T 30 trace.bin
+ *
+ * and feed the file to this tool.  It prints a log2 histogram and
+ * percentiles for all decisions (or only those on runqueue -r), followed
+ * by a breakdown by runqueue load, which shows how the cost of a decision
+ * grows with the number of runnable vcpus.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <xen/xen.h>
+#include <xen/trace.h>
+
+/* Private to xen/common/sched_credit2.c. */
+#define TRC_CSCHED2_SCHEDULE_TIME (TRC_SCHED_CLASS + 13)
+
+#define NR_BUCKETS      32
+#define NR_LOAD_CLASSES 12
+
+struct samples {
+    uint32_t *ns;
+    size_t nr, size;
+};
+
+static struct samples all, by_load[NR_LOAD_CLASSES];
+
+static void add_sample(struct samples *s, uint32_t ns)
+{
+    if ( s->nr == s->size )
+    {
+        size_t size = s->size ? s->size * 2 : 4096;
+        uint32_t *ns = realloc(s->ns, size * sizeof(*ns));
+
+        if ( !ns )
+        {
+            perror("realloc");
+            exit(1);
+        }
+        s->ns = ns;
+        s->size = size;
+    }
+    s->ns[s->nr++] = ns;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static uint32_t percentile(const struct samples *s, double p)
+{
+    size_t i = p * (s->nr - 1) / 100.0;
+
+    return s->ns[i];
+}
+
+static unsigned int log2_bucket(uint32_t v)
+{
+    unsigned int b = 0;
+
+    while ( v >>= 1 )
+        b++;
+    return b;
+}
+
+static double mean(const struct samples *s)
+{
+    double sum = 0;
+    size_t i;
+
+    for ( i = 0; i < s->nr; i++ )
+        sum += s->ns[i];
+    return s->nr ? sum / s->nr : 0;
+}
+
+static void report(void)
+{
+    uint64_t hist[NR_BUCKETS] = { 0 };
+    uint64_t peak = 0;
+    size_t i;
+    unsigned int b;
+
+    qsort(all.ns, all.nr, sizeof(*all.ns), cmp_u32);
+
+    printf("%zu scheduling decisions\n", all.nr);
+    printf("  min %"PRIu32"ns  mean %.0fns  max %"PRIu32"ns\n",
+           all.ns[0], mean(&all), all.ns[all.nr - 1]);
+    printf("  p50 %"PRIu32"ns  p90 %"PRIu32"ns  p99 %"PRIu32"ns"
+           "  p99.9 %"PRIu32"ns\n\n",
+           percentile(&all, 50), percentile(&all, 90),
+           percentile(&all, 99), percentile(&all, 99.9));
+
+    for ( i = 0; i < all.nr; i++ )
+        hist[log2_bucket(all.ns[i])]++;
+    for ( b = 0; b < NR_BUCKETS; b++ )
+        if ( hist[b] > peak )
+            peak = hist[b];
+
+    for ( b = 0; b < NR_BUCKETS; b++ )
+    {
+        if ( !hist[b] )
+            continue;
+        printf("  %10lu-%-10lu ns %10"PRIu64" %.*s\n",
+               1UL << b, (2UL << b) - 1, hist[b],
+               (int)(hist[b] * 40 / peak),
+               "########################################");
+    }
+
+    printf("\n  %-12s %10s %10s %10s %10s\n",
+           "load", "count", "mean", "p50", "p99");
+    for ( b = 0; b < NR_LOAD_CLASSES; b++ )
+    {
+        struct samples *s = &by_load[b];
+        char range[16];
+
+        if ( !s->nr )
+            continue;
+        qsort(s->ns, s->nr, sizeof(*s->ns), cmp_u32);
+        if ( b <= 1 )
+            snprintf(range, sizeof(range), "%u", b);
+        else
+            snprintf(range, sizeof(range), "%u-%u",
+                     1U << (b - 1), (1U << b) - 1);
+        printf("  %-12s %10zu %9.0fns %8"PRIu32"ns %8"PRIu32"ns\n",
+               range, s->nr, mean(s), percentile(s, 50), percentile(s, 99));
+    }
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-r runqueue] [trace-file]\n", prog);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    FILE *f = stdin;
+    int opt, rqi = -1;
+    uint32_t hdr, extra[TRACE_EXTRA_MAX];
+
+    while ( (opt = getopt(argc, argv, "r:h")) != -1 )
+    {
+        switch ( opt )
+        {
+        case 'r':
+            rqi = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if ( optind < argc )
+    {
+        f = fopen(argv[optind], "rb");
+        if ( !f )
+        {
+            fprintf(stderr, "%s: %s\n", argv[optind], strerror(errno));
+            return 1;
+        }
+    }
+
+    while ( fread(&hdr, sizeof(hdr), 1, f) == 1 )
+    {
+        unsigned int n = TRC_HD_EXTRA(hdr);
+        uint32_t tsc[2];
+        unsigned int load;
+
+        if ( TRC_HD_INCLUDES_CYCLE_COUNT(hdr) &&
+             fread(tsc, sizeof(tsc), 1, f) != 1 )
+            break;
+        if ( n && fread(extra, sizeof(*extra), n, f) != n )
+            break;
+
+        if ( TRC_HD_TO_EVENT(hdr) != TRC_CSCHED2_SCHEDULE_TIME || n < 2 )
+            continue;
+
+        /* extra[0]: rqi:16, load:16; extra[1]: ns */
+        if ( rqi >= 0 && (extra[0] & 0xffff) != rqi )
+            continue;
+
+        load = log2_bucket(extra[0] >> 16) + !!(extra[0] >> 16);
+        if ( load >= NR_LOAD_CLASSES )
+            load = NR_LOAD_CLASSES - 1;
+
+        add_sample(&all, extra[1]);
+        add_sample(&by_load[load], extra[1]);
+    }
+
+    if ( !all.nr )
+    {
+        fprintf(stderr, "No credit2 schedule records found "
+                "(was tracing enabled for TRC_SCHED_CLASS?)\n");
+        return 1;
+    }
+
+    report();
+
+    return 0;
+}
+
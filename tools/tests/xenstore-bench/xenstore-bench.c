@@ -0,0 +1,321 @@
+/*
+ * xenstore-bench.c
+ *
+ * Measure xenstored transaction throughput under concurrent domain creation.
+ *
+ * Each worker thread opens its own connection to the daemon and "boots"
+ * simulated domains one after the other, writing roughly the nodes the
+ * toolstack creates for a guest with a disk and a network interface: the
+ * guest's /local/domain/<domid> directory, its /vm entry and the matching
+ * backend directories under dom0.  Every domain is created in a single
+ * transaction, retried on EAGAIN.  Workers share the backend parents, as
+ * real toolstacks do, so the retry count shows how often transactions
+ * genuinely collide.
+ *
+ * With -q, each domain also writes that many nodes of its own under its
+ * data directory.  As with libxl, the directory is owned by the guest, so
+ * its entries count against the guest's per-domain entry quota and the
+ * daemon's quota accounting takes part in every commit.  A domain refused
+ * for being over quota is counted and skipped rather than treated as a
+ * failure; set -q around the daemon's limit to see how quota checks
+ * interact with transaction retries.  oxenstored enforces the quota of
+ * any guest-owned node; C xenstored only that of guest connections, so
+ * against it -q adds the entries but never reaches a limit.
+ *
+ * The simulated domids start at -b (default 30000) so they stay clear of
+ * real guests, and everything is removed again unless -k is given.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <xenstore.h>
+
+static unsigned int nr_domains = 100;
+static unsigned int base_domid = 30000;
+static unsigned int nr_entries;
+
+struct worker {
+    pthread_t thread;
+    unsigned int first;
+    uint64_t commits, retries, over_quota;
+    int err;
+};
+
+static uint64_t now_ns(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000000ULL + tv.tv_usec * 1000ULL;
+}
+
+static bool write_node(struct xs_handle *xs, xs_transaction_t t,
+                       const char *val, const char *fmt, ...)
+    __attribute__((format(printf, 4, 5)));
+
+static bool write_node(struct xs_handle *xs, xs_transaction_t t,
+                       const char *val, const char *fmt, ...)
+{
+    char path[256];
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(path, sizeof(path), fmt, ap);
+    va_end(ap);
+
+    return xs_write(xs, t, path, val, strlen(val));
+}
+
+/*
+ * One domain's worth of toolstack writes.  On failure, *guest_owned says
+ * whether it was writing a node the guest owns, the only ones which count
+ * against a quota.
+ */
+static bool create_domain(struct xs_handle *xs, xs_transaction_t t,
+                          unsigned int domid, bool *guest_owned)
+{
+    char dom[64], be[128], name[32];
+    unsigned int i;
+    struct xs_permissions perms[2] = {
+        { .id = 0, .perms = XS_PERM_NONE },
+        { .id = domid, .perms = XS_PERM_READ },
+    };
+    struct xs_permissions data_perms[1] = {
+        { .id = domid, .perms = XS_PERM_NONE },
+    };
+    char data[80];
+
+    *guest_owned = false;
+
+    snprintf(dom, sizeof(dom), "/local/domain/%u", domid);
+    snprintf(name, sizeof(name), "bench-%u", domid);
+
+    xs_rm(xs, t, dom);
+    if ( !xs_mkdir(xs, t, dom) || !xs_set_permissions(xs, t, dom, perms, 2) )
+        return false;
+
+    if ( !write_node(xs, t, name, "%s/name", dom) ||
+         !write_node(xs, t, name, "/vm/%s/name", name) ||
+         !write_node(xs, t, "/vm/bench", "%s/vm", dom) ||
+         !write_node(xs, t, "262144", "%s/memory/target", dom) ||
+         !write_node(xs, t, "1", "%s/cpu/0/availability", dom) ||
+         !write_node(xs, t, "", "%s/control/shutdown", dom) ||
+         !write_node(xs, t, "", "%s/data", dom) )
+        return false;
+
+    snprintf(data, sizeof(data), "%s/data", dom);
+    if ( !xs_set_permissions(xs, t, data, data_perms, 1) )
+        return false;
+
+    *guest_owned = true;
+    for ( i = 0; i < nr_entries; i++ )
+        if ( !write_node(xs, t, "bench", "%s/data/%u", dom, i) )
+            return false;
+    *guest_owned = false;
+
+    snprintf(be, sizeof(be), "/local/domain/0/backend/vbd/%u/51712", domid);
+    if ( !write_node(xs, t, "1", "%s/state", be) ||
+         !write_node(xs, t, "phy", "%s/type", be) ||
+         !write_node(xs, t, "/dev/null", "%s/params", be) ||
+         !write_node(xs, t, dom, "%s/frontend", be) ||
+         !write_node(xs, t, be, "%s/device/vbd/51712/backend", dom) ||
+         !write_node(xs, t, "1", "%s/device/vbd/51712/state", dom) )
+        return false;
+
+    snprintf(be, sizeof(be), "/local/domain/0/backend/vif/%u/0", domid);
+    if ( !write_node(xs, t, "1", "%s/state", be) ||
+         !write_node(xs, t, "00:16:3e:00:00:01", "%s/mac", be) ||
+         !write_node(xs, t, "xenbr0", "%s/bridge", be) ||
+         !write_node(xs, t, dom, "%s/frontend", be) ||
+         !write_node(xs, t, be, "%s/device/vif/0/backend", dom) ||
+         !write_node(xs, t, "1", "%s/device/vif/0/state", dom) )
+        return false;
+
+    return true;
+}
+
+/*
+ * xenstored refuses an entry over quota with ENOSPC (or E2BIG for its size);
+ * oxenstored replies EQUOTA, which libxenstore does not know and reports as
+ * EINVAL.  EINVAL means little else for a guest-owned write, but anywhere
+ * else it is a real failure.
+ */
+static bool quota_error(int err, bool guest_owned)
+{
+    return err == ENOSPC || err == E2BIG || (err == EINVAL && guest_owned);
+}
+
+static void *worker_fn(void *arg)
+{
+    struct worker *w = arg;
+    struct xs_handle *xs = xs_open(0);
+    unsigned int i;
+
+    if ( !xs )
+    {
+        w->err = errno;
+        return NULL;
+    }
+
+    for ( i = 0; i < nr_domains; i++ )
+    {
+        for ( ; ; )
+        {
+            xs_transaction_t t = xs_transaction_start(xs);
+            bool guest_owned;
+
+            if ( t == XBT_NULL )
+            {
+                w->err = errno;
+                goto out;
+            }
+            if ( !create_domain(xs, t, w->first + i, &guest_owned) )
+            {
+                int err = errno ? errno : EIO;
+
+                xs_transaction_end(xs, t, true);
+                if ( !nr_entries || !quota_error(err, guest_owned) )
+                {
+                    w->err = err;
+                    goto out;
+                }
+                w->over_quota++;
+                break;
+            }
+            if ( xs_transaction_end(xs, t, false) )
+            {
+                w->commits++;
+                break;
+            }
+            if ( errno != EAGAIN )
+            {
+                w->err = errno;
+                goto out;
+            }
+            w->retries++;
+        }
+    }
+
+ out:
+    xs_close(xs);
+    return NULL;
+}
+
+static void cleanup(unsigned int nr_workers)
+{
+    struct xs_handle *xs = xs_open(0);
+    char path[128];
+    unsigned int d;
+
+    if ( !xs )
+        return;
+
+    for ( d = base_domid; d < base_domid + nr_workers * nr_domains; d++ )
+    {
+        snprintf(path, sizeof(path), "/local/domain/%u", d);
+        xs_rm(xs, XBT_NULL, path);
+        snprintf(path, sizeof(path), "/vm/bench-%u", d);
+        xs_rm(xs, XBT_NULL, path);
+        snprintf(path, sizeof(path), "/local/domain/0/backend/vbd/%u", d);
+        xs_rm(xs, XBT_NULL, path);
+        snprintf(path, sizeof(path), "/local/domain/0/backend/vif/%u", d);
+        xs_rm(xs, XBT_NULL, path);
+    }
+    xs_close(xs);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-w workers] [-n domains-per-worker] [-b base-domid]"
+            " [-q entries-per-domain] [-k]\n", prog);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int nr_workers = 4, i;
+    struct worker *workers;
+    uint64_t start, elapsed, commits = 0, retries = 0, over_quota = 0;
+    int opt, keep = 0, rc = 0;
+
+    while ( (opt = getopt(argc, argv, "w:n:b:q:kh")) != -1 )
+    {
+        switch ( opt )
+        {
+        case 'w':
+            nr_workers = strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            nr_domains = strtoul(optarg, NULL, 0);
+            break;
+        case 'b':
+            base_domid = strtoul(optarg, NULL, 0);
+            break;
+        case 'q':
+            nr_entries = strtoul(optarg, NULL, 0);
+            break;
+        case 'k':
+            keep = 1;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if ( !nr_workers || !nr_domains )
+        usage(argv[0]);
+
+    workers = calloc(nr_workers, sizeof(*workers));
+    if ( !workers )
+    {
+        perror("calloc");
+        return 1;
+    }
+
+    start = now_ns();
+    for ( i = 0; i < nr_workers; i++ )
+    {
+        workers[i].first = base_domid + i * nr_domains;
+        if ( pthread_create(&workers[i].thread, NULL, worker_fn, &workers[i]) )
+        {
+            perror("pthread_create");
+            return 1;
+        }
+    }
+    for ( i = 0; i < nr_workers; i++ )
+    {
+        pthread_join(workers[i].thread, NULL);
+        commits += workers[i].commits;
+        retries += workers[i].retries;
+        over_quota += workers[i].over_quota;
+        if ( workers[i].err )
+        {
+            fprintf(stderr, "worker %u: %s\n", i, strerror(workers[i].err));
+            rc = 1;
+        }
+    }
+    elapsed = now_ns() - start;
+
+    printf("%u workers, %"PRIu64" domains in %.3fs\n",
+           nr_workers, commits, elapsed / 1e9);
+    printf("  %.1f transactions/sec, %"PRIu64" retries (%.1f%% of attempts)\n",
+           commits * 1e9 / elapsed, retries,
+           commits + retries ? retries * 100.0 / (commits + retries) : 0);
+    if ( nr_entries )
+        printf("  %u entries per domain, %"PRIu64" domains over quota\n",
+               nr_entries, over_quota);
+
+    if ( !keep )
+        cleanup(nr_workers);
+
+    return rc;
+}
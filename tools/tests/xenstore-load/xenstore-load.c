@@ -0,0 +1,344 @@
+/*
+ * xenstore-load.c
+ *
+ * Measure xenstored request latency with many clients connected at once.
+ *
+ * Opens -c connections (default 1000) to the daemon's socket and keeps one
+ * request outstanding on each for -d seconds: mostly reads of a set of
+ * nodes under /bench-load, with -w percent writes.  With -W, that many of
+ * the connections also watch /bench-load, so every write fans out into
+ * watch events queued behind their replies.  The latency of each request,
+ * from sending it to receiving its reply, is recorded and the percentiles
+ * are printed at the end.
+ *
+ * The protocol is spoken directly, with one epoll loop driving every
+ * connection, so the client side stays cheap however many there are.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <xenstore_lib.h>
+
+#define NR_KEYS  256
+#define BUF_SIZE (sizeof(struct xsd_sockmsg) + XENSTORE_PAYLOAD_MAX)
+
+struct conn {
+    int fd;
+    uint32_t req_id;
+    uint64_t sent;
+    unsigned int used;
+    char buf[BUF_SIZE];
+};
+
+struct samples {
+    uint64_t *ns;
+    size_t nr, size;
+};
+
+static struct samples lat;
+static unsigned int write_pct = 10;
+static uint64_t nr_events, nr_errors;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void add_sample(uint64_t ns)
+{
+    if ( lat.nr == lat.size )
+    {
+        size_t size = lat.size ? lat.size * 2 : 65536;
+        uint64_t *p = realloc(lat.ns, size * sizeof(*p));
+
+        if ( !p )
+        {
+            perror("realloc");
+            exit(1);
+        }
+        lat.ns = p;
+        lat.size = size;
+    }
+    lat.ns[lat.nr++] = ns;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static uint64_t percentile(double p)
+{
+    return lat.ns[(size_t)(p * (lat.nr - 1) / 100.0)];
+}
+
+static int connect_daemon(void)
+{
+    struct sockaddr_un addr;
+    int fd = socket(PF_UNIX, SOCK_STREAM, 0);
+
+    if ( fd < 0 )
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, xs_daemon_socket(), sizeof(addr.sun_path) - 1);
+    if ( connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 )
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Blocking send of a complete request; the socket buffer always has room. */
+static int send_msg(struct conn *c, enum xsd_sockmsg_type type,
+                    const char *arg, const char *val)
+{
+    struct xsd_sockmsg msg;
+    char buf[BUF_SIZE];
+    size_t arglen = strlen(arg) + 1, vallen = 0;
+
+    /* Write data is raw bytes; a watch token is a string. */
+    if ( val )
+        vallen = strlen(val) + (type == XS_WATCH);
+
+    msg.type = type;
+    msg.req_id = ++c->req_id;
+    msg.tx_id = 0;
+    msg.len = arglen + vallen;
+    memcpy(buf, &msg, sizeof(msg));
+    memcpy(buf + sizeof(msg), arg, arglen);
+    if ( vallen )
+        memcpy(buf + sizeof(msg) + arglen, val, vallen);
+
+    c->sent = now_ns();
+    return write(c->fd, buf, sizeof(msg) + msg.len) ==
+           (ssize_t)(sizeof(msg) + msg.len) ? 0 : -1;
+}
+
+static int send_request(struct conn *c)
+{
+    char path[64];
+
+    snprintf(path, sizeof(path), "/bench-load/%u", rand() % NR_KEYS);
+    if ( (unsigned int)(rand() % 100) < write_pct )
+        return send_msg(c, XS_WRITE, path, "value");
+    return send_msg(c, XS_READ, path, NULL);
+}
+
+/*
+ * Consume whatever has arrived.  Returns 1 once the reply to the
+ * outstanding request is in, 0 if it is still pending, -1 on error.
+ */
+static int receive(struct conn *c)
+{
+    struct xsd_sockmsg msg;
+    ssize_t ret;
+    int done = 0;
+
+    ret = read(c->fd, c->buf + c->used, sizeof(c->buf) - c->used);
+    if ( ret <= 0 )
+        return (ret < 0 && errno == EAGAIN) ? 0 : -1;
+    c->used += ret;
+
+    while ( c->used >= sizeof(msg) )
+    {
+        unsigned int len;
+
+        memcpy(&msg, c->buf, sizeof(msg));
+        len = sizeof(msg) + msg.len;
+        if ( msg.len > XENSTORE_PAYLOAD_MAX )
+            return -1;
+        if ( c->used < len )
+            break;
+
+        if ( msg.type == XS_WATCH_EVENT )
+            nr_events++;
+        else if ( msg.req_id == c->req_id )
+        {
+            if ( msg.type == XS_ERROR )
+                nr_errors++;
+            done = 1;
+        }
+
+        memmove(c->buf, c->buf + len, c->used - len);
+        c->used -= len;
+    }
+    return done;
+}
+
+/* Synchronous request, used for setup. */
+static int request(struct conn *c, enum xsd_sockmsg_type type,
+                   const char *arg, const char *val)
+{
+    int ret;
+
+    if ( send_msg(c, type, arg, val) )
+        return -1;
+    while ( (ret = receive(c)) == 0 )
+        ;
+    return ret < 0 ? -1 : 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-c connections] [-d seconds] [-w write-percent]"
+            " [-W watchers]\n", prog);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int nr_conns = 1000, duration = 10, nr_watchers = 0, i;
+    struct epoll_event ev, events[256];
+    struct rlimit rlim;
+    struct conn *conns;
+    uint64_t start, end;
+    int opt, epfd, nr;
+    char path[64];
+
+    while ( (opt = getopt(argc, argv, "c:d:w:W:h")) != -1 )
+    {
+        switch ( opt )
+        {
+        case 'c':
+            nr_conns = strtoul(optarg, NULL, 0);
+            break;
+        case 'd':
+            duration = strtoul(optarg, NULL, 0);
+            break;
+        case 'w':
+            write_pct = strtoul(optarg, NULL, 0);
+            break;
+        case 'W':
+            nr_watchers = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if ( !nr_conns || nr_watchers > nr_conns )
+        usage(argv[0]);
+
+    /* Two fds per connection at most, plus slack. */
+    if ( getrlimit(RLIMIT_NOFILE, &rlim) == 0 &&
+         rlim.rlim_cur < nr_conns + 64 )
+    {
+        rlim.rlim_cur = rlim.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rlim);
+    }
+
+    conns = calloc(nr_conns, sizeof(*conns));
+    epfd = epoll_create(64);
+    if ( !conns || epfd < 0 )
+    {
+        perror("setup");
+        return 1;
+    }
+
+    for ( i = 0; i < nr_conns; i++ )
+    {
+        conns[i].fd = connect_daemon();
+        if ( conns[i].fd < 0 )
+        {
+            fprintf(stderr, "connection %u: %s\n", i, strerror(errno));
+            return 1;
+        }
+    }
+
+    for ( i = 0; i < NR_KEYS; i++ )
+    {
+        snprintf(path, sizeof(path), "/bench-load/%u", i);
+        if ( request(&conns[0], XS_WRITE, path, "value") )
+        {
+            fprintf(stderr, "populating %s failed\n", path);
+            return 1;
+        }
+    }
+    for ( i = 0; i < nr_watchers; i++ )
+    {
+        snprintf(path, sizeof(path), "load-%u", i);
+        if ( send_msg(&conns[i], XS_WATCH, "/bench-load", path) )
+            return 1;
+    }
+
+    for ( i = 0; i < nr_conns; i++ )
+    {
+        fcntl(conns[i].fd, F_SETFL, fcntl(conns[i].fd, F_GETFL) | O_NONBLOCK);
+        ev.events = EPOLLIN;
+        ev.data.ptr = &conns[i];
+        if ( epoll_ctl(epfd, EPOLL_CTL_ADD, conns[i].fd, &ev) )
+        {
+            perror("epoll_ctl");
+            return 1;
+        }
+        /* Watchers start once their XS_WATCH has been acknowledged. */
+        if ( i >= nr_watchers && send_request(&conns[i]) )
+            return 1;
+    }
+
+    start = now_ns();
+    end = start + duration * 1000000000ULL;
+    while ( now_ns() < end )
+    {
+        nr = epoll_wait(epfd, events, 256, 100);
+        for ( i = 0; i < (unsigned int)nr; i++ )
+        {
+            struct conn *c = events[i].data.ptr;
+            uint64_t sent = c->sent;
+            int ret = receive(c);
+
+            if ( ret < 0 )
+            {
+                fprintf(stderr, "connection %u: lost\n",
+                        (unsigned int)(c - conns));
+                return 1;
+            }
+            if ( ret == 0 )
+                continue;
+            if ( c - conns >= nr_watchers || c->req_id > 1 )
+                add_sample(now_ns() - sent);
+            if ( send_request(c) )
+                return 1;
+        }
+    }
+    end = now_ns();
+
+    if ( !lat.nr )
+    {
+        fprintf(stderr, "No requests completed\n");
+        return 1;
+    }
+    qsort(lat.ns, lat.nr, sizeof(*lat.ns), cmp_u64);
+
+    printf("%u connections (%u watching), %u%% writes, %.1fs\n",
+           nr_conns, nr_watchers, write_pct, (end - start) / 1e9);
+    printf("  %zu requests, %.0f requests/sec, %"PRIu64" errors,"
+           " %"PRIu64" watch events\n",
+           lat.nr, lat.nr * 1e9 / (end - start), nr_errors, nr_events);
+    printf("  p50 %"PRIu64"us  p90 %"PRIu64"us  p99 %"PRIu64"us"
+           "  p99.9 %"PRIu64"us  max %"PRIu64"us\n",
+           percentile(50) / 1000, percentile(90) / 1000,
+           percentile(99) / 1000, percentile(99.9) / 1000,
+           lat.ns[lat.nr - 1] / 1000);
+
+    return 0;
+}
@@ -0,0 +1,475 @@
+/******************************************************************************
+ * tools/xenpaging/postcopy.c
+ *
+ * Fetch the pages a post-copy migration left behind from the migration
+ * stream.  The protocol is described with XCFLAGS_POSTCOPY in xenguest.h.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#define _GNU_SOURCE
+
+#include <inttypes.h>
+#include <signal.h>
+#include <poll.h>
+#include <xc_private.h>
+#include <xenguest.h>
+#include <xenstore.h>
+
+#include "xc_bitops.h"
+#include "xenpaging.h"
+
+#define POSTCOPY_WINDOW  2    /* background requests in flight */
+#define POSTCOPY_REPORT  4096 /* pages fetched between progress updates */
+
+struct postcopy {
+    int fd;                   /* list, replies and pages from the sender */
+    int out_fd;               /* requests to the sender */
+    unsigned long max_pfn;
+    unsigned long *missing;   /* paged out, contents still at the sender */
+    unsigned long *requested; /* asked for, reply not seen yet */
+    unsigned long remaining;
+    unsigned long next;       /* background scan position */
+    unsigned int inflight;    /* requests awaiting a reply */
+    unsigned long faults;
+
+    /* Requests from the guest waiting for their page to arrive */
+    mem_event_request_t *waiting;
+    unsigned int nr_waiting, max_waiting;
+
+    char *progress;           /* xenstore node with the pages remaining */
+    unsigned long reported;
+};
+
+static int postcopy_request(struct xenpaging *paging, uint64_t *pfns,
+                            uint32_t nr)
+{
+    xc_interface *xch = paging->xc_handle;
+    struct postcopy *pc = paging->postcopy;
+    struct iovec iov[2];
+    uint32_t i;
+
+    iov[0].iov_base = &nr;
+    iov[0].iov_len = sizeof(nr);
+    iov[1].iov_base = pfns;
+    iov[1].iov_len = nr * sizeof(*pfns);
+    if ( writev_exact(pc->out_fd, iov, nr ? 2 : 1) )
+    {
+        PERROR("Error sending post-copy request");
+        return -1;
+    }
+
+    for ( i = 0; i < nr; i++ )
+        set_bit(pfns[i], pc->requested);
+    if ( nr )
+        pc->inflight++;
+
+    return 0;
+}
+
+/* Read the head of a reply; its nr pages follow */
+static int postcopy_reply(struct xenpaging *paging, uint64_t *pfns,
+                          uint32_t *nr)
+{
+    xc_interface *xch = paging->xc_handle;
+    struct postcopy *pc = paging->postcopy;
+
+    if ( read_exact(pc->fd, nr, sizeof(*nr)) ||
+         *nr > XC_POSTCOPY_BATCH ||
+         read_exact(pc->fd, pfns, *nr * sizeof(*pfns)) )
+    {
+        PERROR("Error reading post-copy reply");
+        return -1;
+    }
+    pc->inflight--;
+
+    return 0;
+}
+
+static int postcopy_load(struct xenpaging *paging, unsigned long gfn)
+{
+    xc_interface *xch = paging->xc_handle;
+    unsigned char oom = 0;
+
+    while ( xc_mem_paging_load(xch, paging->mem_event.domain_id, gfn,
+                               paging->paging_buffer) < 0 )
+    {
+        if ( errno != ENOMEM )
+        {
+            PERROR("Error loading %lx during post-copy", gfn);
+            return -1;
+        }
+        if ( oom++ == 0 )
+            DPRINTF("ENOMEM while loading gfn %lx\n", gfn);
+        sleep(1);
+    }
+
+    return 0;
+}
+
+static int postcopy_resume(struct xenpaging *paging, mem_event_request_t *req)
+{
+    mem_event_response_t rsp = {
+        .gfn = req->gfn,
+        .vcpu_id = req->vcpu_id,
+        .flags = req->flags,
+    };
+
+    return xenpaging_resume_page(paging, &rsp, 0);
+}
+
+/* Resume the requests waiting for gfn */
+static int postcopy_wake(struct xenpaging *paging, uint64_t gfn)
+{
+    xc_interface *xch = paging->xc_handle;
+    struct postcopy *pc = paging->postcopy;
+    unsigned int w;
+
+    for ( w = 0; w < pc->nr_waiting; )
+    {
+        if ( pc->waiting[w].gfn != gfn )
+        {
+            w++;
+            continue;
+        }
+        if ( postcopy_resume(paging, &pc->waiting[w]) < 0 )
+        {
+            PERROR("Error resuming page %"PRIx64, gfn);
+            return -1;
+        }
+        pc->waiting[w] = pc->waiting[--pc->nr_waiting];
+    }
+
+    return 0;
+}
+
+/* Take in one reply, loading the pages still missing */
+static int postcopy_receive(struct xenpaging *paging)
+{
+    xc_interface *xch = paging->xc_handle;
+    struct postcopy *pc = paging->postcopy;
+    uint64_t pfns[XC_POSTCOPY_BATCH];
+    uint32_t i, nr;
+
+    if ( postcopy_reply(paging, pfns, &nr) )
+        return -1;
+
+    for ( i = 0; i < nr; i++ )
+    {
+        if ( read_exact(pc->fd, paging->paging_buffer, PAGE_SIZE) )
+        {
+            PERROR("Error reading post-copy page");
+            return -1;
+        }
+
+        if ( pfns[i] > pc->max_pfn )
+        {
+            ERROR("Post-copy reply for unknown pfn %"PRIx64, pfns[i]);
+            return -1;
+        }
+        clear_bit(pfns[i], pc->requested);
+
+        /* Dropped by the guest in the meantime */
+        if ( !test_and_clear_bit(pfns[i], pc->missing) )
+            continue;
+
+        if ( postcopy_load(paging, pfns[i]) )
+            return -1;
+        pc->remaining--;
+
+        if ( postcopy_wake(paging, pfns[i]) )
+            return -1;
+    }
+
+    return 0;
+}
+
+/* Populated but pinned pages cannot be paged out: overwrite them now,
+ * before the guest runs. */
+static int postcopy_fetch_pinned(struct xenpaging *paging, uint64_t *pfns,
+                                 unsigned long nr)
+{
+    xc_interface *xch = paging->xc_handle;
+    domid_t dom = paging->mem_event.domain_id;
+    uint64_t got[XC_POSTCOPY_BATCH];
+    unsigned long done;
+    uint32_t i, n, nr_got;
+    xen_pfn_t gfn;
+    void *page;
+
+    for ( done = 0; done < nr; done += n )
+    {
+        n = nr - done;
+        if ( n > XC_POSTCOPY_BATCH )
+            n = XC_POSTCOPY_BATCH;
+        if ( postcopy_request(paging, pfns + done, n) ||
+             postcopy_reply(paging, got, &nr_got) )
+            return -1;
+        if ( nr_got != n )
+        {
+            ERROR("Post-copy reply for %u pages, asked for %u", nr_got, n);
+            return -1;
+        }
+
+        for ( i = 0; i < n; i++ )
+        {
+            if ( read_exact(paging->postcopy->fd, paging->paging_buffer,
+                            PAGE_SIZE) )
+            {
+                PERROR("Error reading post-copy page");
+                return -1;
+            }
+
+            gfn = got[i];
+            page = xc_map_foreign_pages(xch, dom, PROT_WRITE, &gfn, 1);
+            if ( page == NULL &&
+                 xc_domain_populate_physmap_exact(xch, dom, 1, 0, 0, &gfn) == 0 )
+                page = xc_map_foreign_pages(xch, dom, PROT_WRITE, &gfn, 1);
+            if ( page == NULL )
+            {
+                PERROR("Error mapping gfn %lx", (unsigned long)gfn);
+                return -1;
+            }
+            memcpy(page, paging->paging_buffer, PAGE_SIZE);
+            munmap(page, PAGE_SIZE);
+            clear_bit(got[i], paging->postcopy->requested);
+        }
+    }
+
+    return 0;
+}
+
+static void postcopy_report(struct xenpaging *paging)
+{
+    struct postcopy *pc = paging->postcopy;
+    char val[24];
+
+    if ( !pc->progress )
+        return;
+
+    snprintf(val, sizeof(val), "%lu", pc->remaining);
+    xs_write(paging->xs_handle, XBT_NULL, pc->progress, val, strlen(val));
+    pc->reported = pc->remaining;
+}
+
+/*
+ * Read the list of pages left behind and page them out.  The guest may be
+ * started once this returns; the pages remaining are published in
+ * memory/postcopy-remaining for the toolstack.
+ */
+int postcopy_init(struct xenpaging *paging, int fd, int out_fd)
+{
+    xc_interface *xch = paging->xc_handle;
+    domid_t dom = paging->mem_event.domain_id;
+    struct postcopy *pc;
+    uint64_t nr, *pfns = NULL;
+    unsigned long i, nr_pinned = 0;
+    char *dom_path;
+    int max_gpfn, rc = -1;
+
+    pc = paging->postcopy = calloc(1, sizeof(*pc));
+    if ( !pc )
+        return -1;
+    pc->fd = fd;
+    pc->out_fd = out_fd;
+
+    /* The sender hangs up once we are done; do not die for it */
+    signal(SIGPIPE, SIG_IGN);
+
+    if ( read_exact(fd, &nr, sizeof(nr)) )
+    {
+        PERROR("Error reading post-copy page list");
+        goto out;
+    }
+    if ( nr > paging->max_pages ||
+         !(pfns = malloc(nr * sizeof(*pfns))) ||
+         read_exact(fd, pfns, nr * sizeof(*pfns)) )
+    {
+        PERROR("Error reading post-copy list of %"PRIu64" pages", nr);
+        goto out;
+    }
+
+    /* The bitmaps are sized by the list: keep it inside the p2m */
+    max_gpfn = xc_domain_maximum_gpfn(xch, dom);
+    if ( max_gpfn < 0 )
+    {
+        PERROR("Error getting the maximum gpfn of domain %d", dom);
+        goto out;
+    }
+    for ( i = 0; i < nr; i++ )
+    {
+        if ( pfns[i] > (uint64_t)max_gpfn )
+        {
+            ERROR("Post-copy list has pfn %"PRIx64" beyond the p2m (%x)",
+                  pfns[i], max_gpfn);
+            goto out;
+        }
+        if ( pfns[i] > pc->max_pfn )
+            pc->max_pfn = pfns[i];
+    }
+    pc->missing = bitmap_alloc(pc->max_pfn + 1);
+    pc->requested = bitmap_alloc(pc->max_pfn + 1);
+    if ( !pc->missing || !pc->requested )
+    {
+        PERROR("Error allocating post-copy bitmaps");
+        goto out;
+    }
+
+    for ( i = 0; i < nr; i++ )
+    {
+        if ( xc_mem_paging_nominate(xch, dom, pfns[i]) == 0 &&
+             xc_mem_paging_evict(xch, dom, pfns[i]) == 0 )
+        {
+            set_bit(pfns[i], pc->missing);
+            pc->remaining++;
+        }
+        else
+            pfns[nr_pinned++] = pfns[i];
+    }
+
+    DPRINTF("post-copy: %lu pages paged out, fetching %lu pinned pages\n",
+            pc->remaining, nr_pinned);
+    if ( postcopy_fetch_pinned(paging, pfns, nr_pinned) )
+        goto out;
+
+    dom_path = xs_get_domain_path(paging->xs_handle, dom);
+    if ( dom_path &&
+         asprintf(&pc->progress, "%s/memory/postcopy-remaining", dom_path) < 0 )
+        pc->progress = NULL;
+    free(dom_path);
+    postcopy_report(paging);
+
+    rc = 0;
+
+ out:
+    free(pfns);
+    return rc;
+}
+
+/* A guest request for a page in the paging path */
+int postcopy_fault(struct xenpaging *paging, mem_event_request_t *req)
+{
+    xc_interface *xch = paging->xc_handle;
+    struct postcopy *pc = paging->postcopy;
+    mem_event_request_t *waiting;
+    uint64_t pfn = req->gfn;
+
+    if ( req->gfn > pc->max_pfn || !test_bit(req->gfn, pc->missing) )
+    {
+        /* Already fetched, let the vcpu go */
+        if ( !(req->flags & (MEM_EVENT_FLAG_VCPU_PAUSED |
+                             MEM_EVENT_FLAG_EVICT_FAIL)) )
+            return 0;
+        return postcopy_resume(paging, req);
+    }
+
+    if ( req->flags & MEM_EVENT_FLAG_DROP_PAGE )
+    {
+        DPRINTF("post-copy: gfn %"PRIx64" dropped\n", req->gfn);
+        clear_bit(req->gfn, pc->missing);
+        pc->remaining--;
+        if ( postcopy_wake(paging, req->gfn) )
+            return -1;
+        return postcopy_resume(paging, req);
+    }
+
+    if ( pc->nr_waiting == pc->max_waiting )
+    {
+        waiting = realloc(pc->waiting, (pc->max_waiting + 64) *
+                          sizeof(*waiting));
+        if ( !waiting )
+        {
+            PERROR("Error queueing request for gfn %"PRIx64, req->gfn);
+            return -1;
+        }
+        pc->waiting = waiting;
+        pc->max_waiting += 64;
+    }
+    pc->waiting[pc->nr_waiting++] = *req;
+    pc->faults++;
+
+    if ( test_bit(req->gfn, pc->requested) )
+        return 0;
+
+    return postcopy_request(paging, &pfn, 1);
+}
+
+/*
+ * Take in the replies that have arrived and keep the background fetch
+ * going.  Returns 1 once every page is in, < 0 on error.
+ */
+int postcopy_work(struct xenpaging *paging)
+{
+    xc_interface *xch = paging->xc_handle;
+    struct postcopy *pc = paging->postcopy;
+    struct pollfd pfd = { .fd = pc->fd, .events = POLLIN };
+    uint64_t pfns[XC_POSTCOPY_BATCH];
+    uint32_t nr;
+
+    while ( pc->inflight && poll(&pfd, 1, 0) > 0 )
+        if ( postcopy_receive(paging) )
+            return -1;
+
+    while ( pc->inflight < POSTCOPY_WINDOW )
+    {
+        for ( nr = 0; pc->next <= pc->max_pfn && nr < XC_POSTCOPY_BATCH;
+              pc->next++ )
+            if ( test_bit(pc->next, pc->missing) &&
+                 !test_bit(pc->next, pc->requested) )
+                pfns[nr++] = pc->next;
+        if ( !nr )
+            break;
+        if ( postcopy_request(paging, pfns, nr) )
+            return -1;
+    }
+
+    if ( pc->reported - pc->remaining >= POSTCOPY_REPORT )
+        postcopy_report(paging);
+
+    if ( pc->remaining || pc->inflight )
+        return 0;
+
+    DPRINTF("post-copy complete, %lu guest faults\n", pc->faults);
+    return postcopy_request(paging, NULL, 0) ? -1 : 1;
+}
+
+int postcopy_fd(struct xenpaging *paging)
+{
+    return paging->postcopy->fd;
+}
+
+void postcopy_teardown(struct xenpaging *paging)
+{
+    struct postcopy *pc = paging->postcopy;
+
+    if ( pc->progress )
+        xs_rm(paging->xs_handle, XBT_NULL, pc->progress);
+    free(pc->progress);
+    free(pc->waiting);
+    free(pc->missing);
+    free(pc->requested);
+    free(pc);
+    paging->postcopy = NULL;
+}
+
+
+/*
+ * Local variables:
+ * mode: C
+ * c-set-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
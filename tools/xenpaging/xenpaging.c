@@ -43,6 +43,7 @@ static char *watch_target_tot_pages;
 static char *dom_path;
 static char watch_token[16];
 static char *filename;
+static int postcopy_in = -1, postcopy_out = -1, postcopy_ready = -1;
 static int interrupted;
 
 static void unlink_pagefile(void)
@@ -77,7 +78,8 @@ static int xenpaging_wait_for_event_or_timeout(struct xenpaging *paging)
     xc_evtchn *xce = paging->mem_event.xce_handle;
     char **vec, *val;
     unsigned int num;
-    struct pollfd fd[2];
+    struct pollfd fd[3];
+    int nfds = 2;
     int port;
     int rc;
     int timeout;
@@ -90,7 +92,16 @@ static int xenpaging_wait_for_event_or_timeout(struct xenpaging *paging)
 
     /* No timeout while page-out is still in progress */
     timeout = paging->use_poll_timeout ? 100 : 0;
-    rc = poll(fd, 2, timeout);
+
+    /* Post-copy replies wake us up as well */
+    if ( paging->postcopy )
+    {
+        fd[nfds].fd = postcopy_fd(paging);
+        fd[nfds++].events = POLLIN | POLLERR;
+        timeout = -1;
+    }
+
+    rc = poll(fd, nfds, timeout);
     if ( rc < 0 )
     {
         if (errno == EINTR)
@@ -203,11 +214,17 @@ static void usage(void)
 {
     printf("usage:\n\n");
 
-    printf("  xenpaging [options] -f <pagefile> -d <domain_id>\n\n");
+    printf("  xenpaging [options] -f <pagefile> -d <domain_id>\n");
+    printf("  xenpaging [options] -p <fd> -d <domain_id>\n\n");
 
     printf("options:\n");
     printf(" -d <domid>     --domain=<domid>         numerical domain_id of guest. This option is required.\n");
     printf(" -f <file>      --pagefile=<file>        pagefile to use. This option is required.\n");
+    printf(" -p <fd>[,<out>[,<ready>]]\n"
+           "                --postcopy=<fd>[,...]    fetch the pages a post-copy migration left\n"
+           "                                         behind from <fd> instead of using a pagefile.\n"
+           "                                         Requests go to <out> (default <fd>); a byte\n"
+           "                                         is written to <ready> once the guest may run.\n");
     printf(" -m <max_memkb> --max_memkb=<max_memkb>  maximum amount of memory to handle.\n");
     printf(" -r <num>       --mru_size=<num>         number of paged-in pages to keep in memory.\n");
     printf(" -v             --verbose                enable debug output.\n");
@@ -217,13 +234,14 @@ static void usage(void)
 static int xenpaging_getopts(struct xenpaging *paging, int argc, char *argv[])
 {
     int ch;
-    static const char sopts[] = "hvd:f:m:r:";
+    static const char sopts[] = "hvd:f:m:r:p:";
     static const struct option lopts[] = {
         {"help", 0, NULL, 'h'},
         {"verbose", 0, NULL, 'v'},
         {"domain", 1, NULL, 'd'},
         {"pagefile", 1, NULL, 'f'},
         {"mru_size", 1, NULL, 'm'},
+        {"postcopy", 1, NULL, 'p'},
         { }
     };
 
@@ -243,6 +261,13 @@ static int xenpaging_getopts(struct xenpaging *paging, int argc, char *argv[])
         case 'r':
             paging->policy_mru_size = atoi(optarg);
             break;
+        case 'p':
+            if ( sscanf(optarg, "%d,%d,%d", &postcopy_in, &postcopy_out,
+                        &postcopy_ready) < 1 )
+                postcopy_in = -1;
+            if ( postcopy_out < 0 )
+                postcopy_out = postcopy_in;
+            break;
         case 'v':
             paging->debug = 1;
             break;
@@ -256,7 +281,7 @@ static int xenpaging_getopts(struct xenpaging *paging, int argc, char *argv[])
     argv += optind; argc -= optind;
     
     /* Path to pagefile is required */
-    if ( !filename )
+    if ( !filename && postcopy_in < 0 )
     {
         printf("Filename for pagefile missing!\n");
         usage();
@@ -474,7 +499,27 @@ static struct xenpaging *xenpaging_init(int argc, char *argv[])
         goto err;
     }
 
-    /* Open file */
+    /* Open file, unless pages come from a post-copy migration */
+    paging->fd = -1;
+    if ( postcopy_in >= 0 )
+    {
+        if ( postcopy_init(paging, postcopy_in, postcopy_out) )
+        {
+            ERROR("Error initialising post-copy");
+            goto err;
+        }
+        if ( postcopy_ready >= 0 )
+        {
+            if ( write(postcopy_ready, "", 1) != 1 )
+            {
+                PERROR("Error signalling post-copy readiness");
+                goto err;
+            }
+            close(postcopy_ready);
+        }
+        return paging;
+    }
+
     paging->fd = open(filename, O_CREAT | O_TRUNC | O_RDWR, S_IRUSR | S_IWUSR);
     if ( paging->fd < 0 )
     {
@@ -671,7 +716,7 @@ static int xenpaging_evict_page(struct xenpaging *paging, unsigned long gfn, int
     return ret;
 }
 
-static int xenpaging_resume_page(struct xenpaging *paging, mem_event_response_t *rsp, int notify_policy)
+int xenpaging_resume_page(struct xenpaging *paging, mem_event_response_t *rsp, int notify_policy)
 {
     /* Put the page info on the ring */
     put_response(&paging->mem_event, rsp);
@@ -874,7 +919,10 @@ int main(int argc, char *argv[])
     }
     xch = paging->xc_handle;
 
-    DPRINTF("starting %s for domain_id %u with pagefile %s\n", argv[0], paging->mem_event.domain_id, filename);
+    if ( paging->postcopy )
+        DPRINTF("starting %s for domain_id %u in post-copy mode\n", argv[0], paging->mem_event.domain_id);
+    else
+        DPRINTF("starting %s for domain_id %u with pagefile %s\n", argv[0], paging->mem_event.domain_id, filename);
 
     /* ensure that if we get a signal, we'll do cleanup, then exit */
     act.sa_handler = close_handler;
@@ -910,6 +958,13 @@ int main(int argc, char *argv[])
 
             get_request(&paging->mem_event, &req);
 
+            if ( paging->postcopy )
+            {
+                if ( postcopy_fault(paging, &req) < 0 )
+                    goto out;
+                continue;
+            }
+
             if ( req.gfn > paging->max_pages )
             {
                 ERROR("Requested gfn %"PRIx64" higher than max_pages %lx\n", req.gfn, paging->max_pages);
@@ -988,6 +1043,20 @@ int main(int argc, char *argv[])
             }
         }
 
+        /* Pages left behind by a migration are fetched even when asked
+         * to stop, only the guest going away ends it early */
+        if ( paging->postcopy )
+        {
+            if ( interrupted && interrupted != SIGTERM && interrupted != SIGINT )
+                break;
+            rc = postcopy_work(paging);
+            if ( rc < 0 )
+                goto out;
+            if ( rc > 0 )
+                break;
+            continue;
+        }
+
         /* If interrupted, write all pages back into the guest */
         if ( interrupted == SIGTERM || interrupted == SIGINT )
         {
@@ -1063,7 +1132,10 @@ int main(int argc, char *argv[])
     DPRINTF("xenpaging got signal %d\n", interrupted);
 
  out:
-    close(paging->fd);
+    if ( paging->postcopy )
+        postcopy_teardown(paging);
+    else
+        close(paging->fd);
     unlink_pagefile();
 
     /* Tear down domain paging */
@@ -40,6 +40,8 @@ struct mem_event {
     void *ring_page;
 };
 
+struct postcopy;
+
 struct xenpaging {
     xc_interface *xc_handle;
     struct xs_handle *xs_handle;
@@ -63,11 +65,22 @@ struct xenpaging {
     int stack_count;
     int *free_slot_stack;
     unsigned long pagein_queue[XENPAGING_PAGEIN_QUEUE_SIZE];
+    /* Fetching pages left behind by a post-copy migration */
+    struct postcopy *postcopy;
 };
 
 extern void create_page_in_thread(struct xenpaging *paging);
 extern void page_in_trigger(void);
 
+extern int xenpaging_resume_page(struct xenpaging *paging,
+                                 mem_event_response_t *rsp, int notify_policy);
+
+extern int postcopy_init(struct xenpaging *paging, int fd, int out_fd);
+extern int postcopy_fault(struct xenpaging *paging, mem_event_request_t *req);
+extern int postcopy_work(struct xenpaging *paging);
+extern int postcopy_fd(struct xenpaging *paging);
+extern void postcopy_teardown(struct xenpaging *paging);
+
 #endif // __XEN_PAGING_H__
 
 
@@ -54,12 +54,15 @@ typedef struct xenstat_collector {
 
 static int  xenstat_collect_vcpus(xenstat_node * node);
 static int  xenstat_collect_xen_version(xenstat_node * node);
+static int  xenstat_collect_schedlat(xenstat_node * node);
 static void xenstat_free_vcpus(xenstat_node * node);
 static void xenstat_free_networks(xenstat_node * node);
 static void xenstat_free_xen_version(xenstat_node * node);
 static void xenstat_free_vbds(xenstat_node * node);
+static void xenstat_free_schedlat(xenstat_node * node);
 static void xenstat_uninit_vcpus(xenstat_handle * handle);
 static void xenstat_uninit_xen_version(xenstat_handle * handle);
+static void xenstat_uninit_schedlat(xenstat_handle * handle);
 static char *xenstat_get_domain_name(xenstat_handle * handle, unsigned int domain_id);
 static void xenstat_prune_domain(xenstat_node *node, unsigned int entry);
 
@@ -71,7 +74,9 @@ static xenstat_collector collectors[] = {
 	{ XENSTAT_XEN_VERSION, xenstat_collect_xen_version,
 	  xenstat_free_xen_version, xenstat_uninit_xen_version },
 	{ XENSTAT_VBD, xenstat_collect_vbds,
-	  xenstat_free_vbds, xenstat_uninit_vbds }
+	  xenstat_free_vbds, xenstat_uninit_vbds },
+	{ XENSTAT_SCHEDLAT, xenstat_collect_schedlat,
+	  xenstat_free_schedlat, xenstat_uninit_schedlat }
 };
 
 #define NUM_COLLECTORS (sizeof(collectors)/sizeof(xenstat_collector))
@@ -407,6 +412,18 @@ unsigned int xenstat_domain_ssid(xenstat_domain * domain)
 	return domain->ssid;
 }
 
+/* Get the number of wakeups of the domain's vcpus */
+unsigned long long xenstat_domain_wakeups(xenstat_domain * domain)
+{
+	return domain->wakeups;
+}
+
+/* Get the total wakeup-to-run latency of the domain's vcpus */
+unsigned long long xenstat_domain_wake_ns(xenstat_domain * domain)
+{
+	return domain->wake_ns;
+}
+
 /* Get domain states */
 unsigned int xenstat_domain_dying(xenstat_domain * domain)
 {
@@ -518,6 +535,42 @@ static int xenstat_collect_vcpus(xenstat_node * node)
 	return 1;
 }
 
+/*
+ * Scheduling latency functions
+ */
+/* Collect the wakeup latency of each domain */
+static int xenstat_collect_schedlat(xenstat_node * node)
+{
+	unsigned int i;
+
+	for (i = 0; i < node->num_domains; i++) {
+		xc_schedlat_stats_t stats;
+
+		if (xc_sched_latency_get(node->handle->xc_handle,
+					 XEN_SYSCTL_SCHEDLAT_domain,
+					 node->domains[i].id, &stats) != 0) {
+			if (errno == ENOMEM)
+				return 0;
+			/* Domain going away, or a hypervisor without
+			   the statistics: report nothing */
+			continue;
+		}
+		node->domains[i].wakeups = stats.wakeup.count;
+		node->domains[i].wake_ns = stats.wakeup.total_ns;
+	}
+	return 1;
+}
+
+/* Free scheduling latency information - nothing to do */
+static void xenstat_free_schedlat(xenstat_node * node)
+{
+}
+
+/* Free scheduling latency information in handle - nothing to do */
+static void xenstat_uninit_schedlat(xenstat_handle * handle)
+{
+}
+
 /* Free VCPU information */
 static void xenstat_free_vcpus(xenstat_node * node)
 {
@@ -41,7 +41,8 @@ void xenstat_uninit(xenstat_handle * handle);
 #define XENSTAT_NETWORK 0x2
 #define XENSTAT_XEN_VERSION 0x4
 #define XENSTAT_VBD 0x8
-#define XENSTAT_ALL (XENSTAT_VCPU|XENSTAT_NETWORK|XENSTAT_XEN_VERSION|XENSTAT_VBD)
+#define XENSTAT_SCHEDLAT 0x10
+#define XENSTAT_ALL (XENSTAT_VCPU|XENSTAT_NETWORK|XENSTAT_XEN_VERSION|XENSTAT_VBD|XENSTAT_SCHEDLAT)
 
 /* Get all available information about a node */
 xenstat_node *xenstat_get_node(xenstat_handle * handle, unsigned int flags);
@@ -111,6 +112,11 @@ unsigned long long xenstat_domain_max_mem(xenstat_domain * domain);
 /* Find the domain's SSID */
 unsigned int xenstat_domain_ssid(xenstat_domain * domain);
 
+/* Get the number of wakeups of the domain's vcpus, and the total time
+ * they spent waiting to run after those */
+unsigned long long xenstat_domain_wakeups(xenstat_domain * domain);
+unsigned long long xenstat_domain_wake_ns(xenstat_domain * domain);
+
 /* Get domain states */
 unsigned int xenstat_domain_dying(xenstat_domain * domain);
 unsigned int xenstat_domain_crashed(xenstat_domain * domain);
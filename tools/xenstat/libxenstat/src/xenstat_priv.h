@@ -69,6 +69,8 @@ struct xenstat_domain {
 	unsigned long long cur_mem;	/* Current memory reservation */
 	unsigned long long max_mem;	/* Total memory allowed */
 	unsigned int ssid;
+	unsigned long long wakeups;	/* Scheduling latency */
+	unsigned long long wake_ns;
 	unsigned int num_networks;
 	xenstat_network *networks;	/* Array of length num_networks */
 	unsigned int num_vbds;
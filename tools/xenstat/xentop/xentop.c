@@ -105,6 +105,8 @@ static void print_maxmem(xenstat_domain *domain);
 static void print_max_pct(xenstat_domain *domain);
 static int compare_vcpus(xenstat_domain *domain1, xenstat_domain *domain2);
 static void print_vcpus(xenstat_domain *domain);
+static int compare_wake(xenstat_domain *domain1, xenstat_domain *domain2);
+static void print_wake(xenstat_domain *domain);
 static int compare_nets(xenstat_domain *domain1, xenstat_domain *domain2);
 static void print_nets(xenstat_domain *domain);
 static int compare_net_tx(xenstat_domain *domain1, xenstat_domain *domain2);
@@ -151,6 +153,7 @@ typedef enum field_id {
 	FIELD_MAXMEM,
 	FIELD_MAX_PCT,
 	FIELD_VCPUS,
+	FIELD_WAKE,
 	FIELD_NETS,
 	FIELD_NET_TX,
 	FIELD_NET_RX,
@@ -181,6 +184,7 @@ field fields[] = {
 	{ FIELD_MAXMEM,    "MAXMEM(k)", 10, compare_maxmem,    print_maxmem  },
 	{ FIELD_MAX_PCT,   "MAXMEM(%)",  9, compare_maxmem,    print_max_pct },
 	{ FIELD_VCPUS,     "VCPUS",      5, compare_vcpus,     print_vcpus   },
+	{ FIELD_WAKE,      "WAKE(us)",   8, compare_wake,      print_wake    },
 	{ FIELD_NETS,      "NETS",       4, compare_nets,      print_nets    },
 	{ FIELD_NET_TX,    "NETTX(k)",   8, compare_net_tx,    print_net_tx  },
 	{ FIELD_NET_RX,    "NETRX(k)",   8, compare_net_rx,    print_net_rx  },
@@ -598,6 +602,40 @@ static void print_vcpus(xenstat_domain *domain)
 	print("%5u", xenstat_domain_num_vcpus(domain));
 }
 
+/* Computes the mean wakeup-to-run latency of a domain's vcpus, in
+ * microseconds, over the last interval (or since boot for the first) */
+static double get_wake_us(xenstat_domain *domain)
+{
+	xenstat_domain *old_domain = NULL;
+	unsigned long long wakeups, wake_ns;
+
+	wakeups = xenstat_domain_wakeups(domain);
+	wake_ns = xenstat_domain_wake_ns(domain);
+
+	if (prev_node != NULL)
+		old_domain = xenstat_node_domain(prev_node,
+						 xenstat_domain_id(domain));
+	if (old_domain != NULL &&
+	    xenstat_domain_wakeups(old_domain) <= wakeups) {
+		wakeups -= xenstat_domain_wakeups(old_domain);
+		wake_ns -= xenstat_domain_wake_ns(old_domain);
+	}
+
+	return wakeups ? wake_ns / 1000.0 / wakeups : 0.0;
+}
+
+/* Compares wakeup latency of two domains, returning -1,0,1 for <,=,> */
+static int compare_wake(xenstat_domain *domain1, xenstat_domain *domain2)
+{
+	return -compare(get_wake_us(domain1), get_wake_us(domain2));
+}
+
+/* Prints wakeup latency statistic */
+static void print_wake(xenstat_domain *domain)
+{
+	print("%8.1f", get_wake_us(domain));
+}
+
 /* Compares number of virtual networks of two domains, returning -1,0,1 for
  * <,=,> */
 static int compare_nets(xenstat_domain *domain1, xenstat_domain *domain2)
@@ -8,15 +8,20 @@
 int main(int argc, char **argv)
 {
   struct xs_handle * xsh;
+  char *ret;
 
   if (argc < 2 ||
-      strcmp(argv[1], "check"))
+      (strcmp(argv[1], "check") && strcmp(argv[1], "watches") &&
+       strcmp(argv[1], "snapshot") && strcmp(argv[1], "memdb")))
   {
     fprintf(stderr,
             "Usage:\n"
             "\n"
             "       %s check\n"
-            "\n", argv[0]);
+            "       %s watches\n"
+            "       %s snapshot\n"
+            "       %s memdb\n"
+            "\n", argv[0], argv[0], argv[0], argv[0]);
     return 2;
   }
 
@@ -27,7 +32,15 @@ int main(int argc, char **argv)
     return 1;
   }
 
-  xs_debug_command(xsh, argv[1], NULL, 0);
+  ret = xs_debug_command(xsh, argv[1], NULL, 0);
+  if (ret == NULL) {
+    perror("xs_debug_command");
+    xs_daemon_close(xsh);
+    return 1;
+  }
+  if (strcmp(ret, "OK"))
+    fputs(ret, stdout);
+  free(ret);
 
   xs_daemon_close(xsh);
 
@@ -23,11 +23,14 @@
 #ifndef NO_SOCKETS
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
 #endif
 #include <sys/time.h>
 #include <time.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdarg.h>
@@ -49,11 +52,18 @@
 #include "xenstored_watch.h"
 #include "xenstored_transaction.h"
 #include "xenstored_domain.h"
+#include "xenstored_memdb.h"
 #include "xenctrl.h"
 #include "tdb.h"
 
 #include "hashtable.h"
 
+#if defined(__linux__) && !defined(NO_SOCKETS)
+#define XENSTORED_EPOLL
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#endif
+
 extern xc_evtchn *xce_handle; /* in xenstored_domain.c */
 
 static bool verbose = false;
@@ -65,7 +75,25 @@ static int reopen_log_pipe[2];
 static char *tracefile = NULL;
 static TDB_CONTEXT *tdb_ctx = NULL;
 
-static void corrupt(struct connection *conn, const char *fmt, ...);
+/* Connections with queued output, written out at the end of each loop. */
+static LIST_HEAD(flush_list);
+
+#ifdef XENSTORED_EPOLL
+static int epoll_fd = -1;
+#endif
+
+/* Stamped into every record written to the main store. */
+static uint64_t generation;
+
+/* --memory-db: keep nodes in xenstored_memdb.c, snapshotting to a file. */
+static bool memory_db;
+static char *snapshot_name;
+static unsigned int snapshot_interval;
+static uint64_t snapshot_generation;
+/* Child writing a snapshot (0 if none), and the generation it holds. */
+static pid_t snapshot_pid;
+static uint64_t snapshot_pending;
+
 static void check_store(void);
 
 #define log(...)							\
@@ -82,24 +110,140 @@ int quota_nb_watch_per_domain = 128;
 int quota_max_entry_size = 2048; /* 2K */
 int quota_max_transaction = 10;
 
-TDB_CONTEXT *tdb_context(struct connection *conn)
+TDB_DATA fetch_record(TDB_DATA key)
 {
-	/* conn = NULL used in manual_node at setup. */
-	if (!conn || !conn->transaction)
-		return tdb_ctx;
-	return tdb_transaction_context(conn->transaction);
+	TDB_DATA data;
+
+	if (memory_db)
+		return memdb_fetch(key);
+
+	data = tdb_fetch(tdb_ctx, key);
+	if (data.dptr == NULL) {
+		if (tdb_error(tdb_ctx) == TDB_ERR_NOEXIST)
+			errno = ENOENT;
+		else {
+			log("TDB error on read: %s", tdb_errorstr(tdb_ctx));
+			errno = EIO;
+		}
+	}
+	return data;
 }
 
-bool replace_tdb(const char *newname, TDB_CONTEXT *newtdb)
+bool store_record(TDB_DATA key, TDB_DATA data)
 {
-	if (!(tdb_ctx->flags & TDB_INTERNAL))
-		if (rename(newname, xs_daemon_tdb()) != 0)
-			return false;
-	tdb_close(tdb_ctx);
-	tdb_ctx = talloc_steal(talloc_autofree_context(), newtdb);
+	struct xs_tdb_record_hdr *hdr = (void *)data.dptr;
+
+	hdr->generation = generation++;
+	if (memory_db)
+		return memdb_store(key, data);
+
+	/* TDB should set errno, but doesn't even set ecode AFAICT. */
+	if (tdb_store(tdb_ctx, key, data, TDB_REPLACE) != 0) {
+		errno = EIO;
+		return false;
+	}
 	return true;
 }
 
+bool delete_record(TDB_DATA key)
+{
+	/* Not stamped anywhere, but snapshots need to see it. */
+	generation++;
+
+	if (memory_db)
+		return memdb_delete(key);
+
+	if (tdb_delete(tdb_ctx, key) != 0) {
+		errno = tdb_error(tdb_ctx) == TDB_ERR_NOEXIST ? ENOENT : EIO;
+		return false;
+	}
+	return true;
+}
+
+struct traverse_args {
+	int (*fn)(TDB_DATA key, TDB_DATA val, void *priv);
+	void *priv;
+};
+
+static int traverse_tdb_(TDB_CONTEXT *tdb, TDB_DATA key, TDB_DATA val,
+			 void *private)
+{
+	struct traverse_args *args = private;
+
+	return args->fn(key, val, args->priv);
+}
+
+/* Call fn on every record in the main store; fn may delete that record. */
+static void traverse_records(int (*fn)(TDB_DATA key, TDB_DATA val,
+				       void *priv),
+			     void *priv)
+{
+	struct traverse_args args = { fn, priv };
+
+	if (memory_db)
+		memdb_traverse(fn, priv);
+	else
+		tdb_traverse(tdb_ctx, &traverse_tdb_, &args);
+}
+
+/*
+ * Start a snapshot if anything changed since the last one.  It is written
+ * by a child from its copy of the store, so requests are not held up by
+ * the disk; reap_snapshot() notes it once the child is done.
+ */
+static bool take_snapshot(void)
+{
+	pid_t pid;
+
+	if (!memory_db) {
+		errno = EINVAL;
+		return false;
+	}
+	if (generation == snapshot_generation)
+		return true;
+	if (snapshot_pid) {
+		errno = EBUSY;
+		return false;
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		log("Could not fork to write snapshot %s: %s", snapshot_name,
+		    strerror(errno));
+		return false;
+	}
+	if (pid == 0) {
+		int fd;
+
+		/* Keep no client sockets, epoll or evtchn files alive. */
+		for (fd = sysconf(_SC_OPEN_MAX) - 1; fd > STDERR_FILENO; fd--)
+			close(fd);
+		_exit(memdb_save(snapshot_name) ? 0 : (errno ? errno : EIO));
+	}
+
+	snapshot_pid = pid;
+	snapshot_pending = generation;
+	return true;
+}
+
+static void reap_snapshot(void)
+{
+	int status;
+
+	if (!snapshot_pid ||
+	    waitpid(snapshot_pid, &status, WNOHANG) != snapshot_pid)
+		return;
+	snapshot_pid = 0;
+
+	if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+		snapshot_generation = snapshot_pending;
+	else if (WIFEXITED(status))
+		log("Could not write snapshot %s: %s", snapshot_name,
+		    strerror(WEXITSTATUS(status)));
+	else
+		log("Snapshot writer for %s was killed", snapshot_name);
+}
+
 static char *sockmsg_string(enum xsd_sockmsg_type type)
 {
 	switch (type) {
@@ -199,7 +343,7 @@ void trace_destroy(const void *data, const char *type)
 /**
  * Signal handler for SIGHUP, which requests that the trace log is reopened
  * (in the main loop).  A single byte is written to reopen_log_pipe, to awaken
- * the select() in the main loop.
+ * the main loop.
  */
 static void trigger_reopen_log(int signal __attribute__((unused)))
 {
@@ -209,6 +353,23 @@ static void trigger_reopen_log(int signal __attribute__((unused)))
 }
 
 
+/* SIGALRM: ask the main loop for a periodic snapshot. */
+static void trigger_snapshot(int signal __attribute__((unused)))
+{
+	char c = 'S';
+	int dummy;
+	dummy = write(reopen_log_pipe[1], &c, 1);
+	alarm(snapshot_interval);
+}
+
+/* SIGCHLD: a snapshot has been written, or failed. */
+static void trigger_reap(int signal __attribute__((unused)))
+{
+	char c = 'C';
+	int dummy;
+	dummy = write(reopen_log_pipe[1], &c, 1);
+}
+
 static void reopen_log(void)
 {
 	if (tracefile) {
@@ -224,6 +385,24 @@ static void reopen_log(void)
 	}
 }
 
+/*
+ * A signal handler woke us: 'S' asks for a snapshot, 'C' reports a child
+ * exiting, anything else is HUP.
+ */
+static void handle_signal_pipe(void)
+{
+	char c;
+
+	if (read(reopen_log_pipe[0], &c, 1) != 1)
+		barf_perror("read failed");
+	if (c == 'S')
+		take_snapshot();
+	else if (c == 'C')
+		reap_snapshot();
+	else
+		reopen_log();
+}
+
 static bool write_messages(struct connection *conn)
 {
 	int ret;
@@ -273,33 +452,165 @@ static bool write_messages(struct connection *conn)
 	return true;
 }
 
+#ifdef NO_SOCKETS
+static int writev_messages(struct connection *conn)
+{
+	errno = EBADF;
+	return -1;
+}
+#else
+#define OUT_IOV_MAX 64
+
+/*
+ * Sockets: hand as much of the output queue as fits in one writev() to
+ * the kernel.  Returns bytes written, 0 if the socket is full, -1 on error.
+ */
+static int writev_messages(struct connection *conn)
+{
+	struct iovec iov[OUT_IOV_MAX];
+	struct buffered_data *out, *tmp;
+	unsigned int n = 0;
+	size_t left, done;
+	ssize_t ret;
+
+	list_for_each_entry(out, &conn->out_list, list) {
+		if (n + 2 > OUT_IOV_MAX)
+			break;
+		if (out->inhdr) {
+			if (verbose)
+				xprintf("Writing msg %s (%.*s) out to %p\n",
+					sockmsg_string(out->hdr.msg.type),
+					out->hdr.msg.len,
+					out->buffer, conn);
+			iov[n].iov_base = out->hdr.raw + out->used;
+			iov[n++].iov_len = sizeof(out->hdr) - out->used;
+			iov[n].iov_base = out->buffer;
+			iov[n++].iov_len = out->hdr.msg.len;
+		} else {
+			iov[n].iov_base = out->buffer + out->used;
+			iov[n++].iov_len = out->hdr.msg.len - out->used;
+		}
+	}
+	if (n == 0)
+		return 0;
+
+	while ((ret = writev(conn->fd, iov, n)) < 0) {
+		if (errno == EAGAIN)
+			return 0;
+		if (errno != EINTR)
+			return -1;
+	}
+
+	/* Retire whatever went out completely. */
+	done = ret;
+	list_for_each_entry_safe(out, tmp, &conn->out_list, list) {
+		if (out->inhdr) {
+			left = sizeof(out->hdr) - out->used;
+			if (done < left) {
+				out->used += done;
+				break;
+			}
+			done -= left;
+			out->inhdr = false;
+			out->used = 0;
+		}
+		left = out->hdr.msg.len - out->used;
+		if (done < left) {
+			out->used += done;
+			break;
+		}
+		done -= left;
+
+		trace_io(conn, out, 1);
+		list_del(&out->list);
+		talloc_free(out);
+	}
+
+	return ret;
+}
+#endif
+
+#ifdef XENSTORED_EPOLL
+static int poll_ctl(int op, int fd, uint32_t events, void *ptr)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.ptr = ptr;
+	return epoll_ctl(epoll_fd, op, fd, &ev);
+}
+
+/* Only ask for EPOLLOUT while output is backed up. */
+static void update_poll(struct connection *conn)
+{
+	uint32_t events = EPOLLIN;
+
+	if (!list_empty(&conn->out_list))
+		events |= EPOLLOUT;
+	if (events == conn->poll_events)
+		return;
+	if (poll_ctl(EPOLL_CTL_MOD, conn->fd, events, conn) != 0)
+		barf_perror("epoll_ctl failed");
+	conn->poll_events = events;
+}
+#else
+static void update_poll(struct connection *conn)
+{
+}
+#endif
+
+/* Push out all queued output we can without blocking. */
+static bool flush_output(struct connection *conn)
+{
+	int ret;
+
+	if (conn->domain) {
+		while (!list_empty(&conn->out_list) && domain_can_write(conn))
+			if (!write_messages(conn))
+				return false;
+		return true;
+	}
+
+	while (!list_empty(&conn->out_list)) {
+		ret = writev_messages(conn);
+		if (ret < 0)
+			return false;
+		if (ret == 0)
+			break;
+	}
+	update_poll(conn);
+	return true;
+}
+
 static int destroy_conn(void *_conn)
 {
 	struct connection *conn = _conn;
 
 	/* Flush outgoing if possible, but don't block. */
 	if (!conn->domain) {
-		fd_set set;
-		struct timeval none;
-
-		FD_ZERO(&set);
-		FD_SET(conn->fd, &set);
-		none.tv_sec = none.tv_usec = 0;
-
-		while (!list_empty(&conn->out_list)
-		       && select(conn->fd+1, NULL, &set, NULL, &none) == 1)
-			if (!write_messages(conn))
-				break;
+		while (!list_empty(&conn->out_list) &&
+		       writev_messages(conn) > 0)
+			;
+#ifdef XENSTORED_EPOLL
+		/*
+		 * The registration belongs to the open file, which a snapshot
+		 * writer may still hold: drop it before closing our fd.
+		 */
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+#endif
 		close(conn->fd);
 	}
         if (conn->target)
                 talloc_unlink(conn, conn->target);
+	list_del(&conn->flush_list);
 	list_del(&conn->list);
 	trace_destroy(conn, "connection");
 	return 0;
 }
 
 
+#ifndef XENSTORED_EPOLL
 static void set_fd(int fd, fd_set *set, int *max)
 {
 	if (fd < 0)
@@ -347,6 +658,7 @@ static int initialize_set(fd_set *inset, fd_set *outset, int sock, int ro_sock,
 
 	return max;
 }
+#endif
 
 /* Is child a subnode of parent, or equal? */
 bool is_child(const char *child, const char *parent)
@@ -368,38 +680,33 @@ bool is_child(const char *child, const char *parent)
 static struct node *read_node(struct connection *conn, const char *name)
 {
 	TDB_DATA key, data;
-	uint32_t *p;
+	struct xs_tdb_record_hdr *hdr;
 	struct node *node;
-	TDB_CONTEXT * context = tdb_context(conn);
+	struct transaction *trans = conn ? conn->transaction : NULL;
 
 	key.dptr = (void *)name;
 	key.dsize = strlen(name);
-	data = tdb_fetch(context, key);
-
-	if (data.dptr == NULL) {
-		if (tdb_error(context) == TDB_ERR_NOEXIST)
-			errno = ENOENT;
-		else {
-			log("TDB error on read: %s", tdb_errorstr(context));
-			errno = EIO;
-		}
+	if (trans)
+		data = transaction_fetch(trans, key);
+	else
+		data = fetch_record(key);
+	if (data.dptr == NULL)
 		return NULL;
-	}
 
 	node = talloc(name, struct node);
 	node->name = talloc_strdup(node, name);
 	node->parent = NULL;
-	node->tdb = tdb_context(conn);
+	node->trans = trans;
 	talloc_steal(node, data.dptr);
 
 	/* Datalen, childlen, number of permissions */
-	p = (uint32_t *)data.dptr;
-	node->num_perms = p[0];
-	node->datalen = p[1];
-	node->childlen = p[2];
+	hdr = (void *)data.dptr;
+	node->num_perms = hdr->num_perms;
+	node->datalen = hdr->datalen;
+	node->childlen = hdr->childlen;
 
 	/* Permissions are struct xs_permissions. */
-	node->perms = (void *)&p[3];
+	node->perms = hdr->perms;
 	/* Data is binary blob (usually ascii, no nul). */
 	node->data = node->perms + node->num_perms;
 	/* Children is strings, nul separated. */
@@ -412,27 +719,32 @@ static bool write_node(struct connection *conn, const struct node *node)
 {
 	/*
 	 * conn will be null when this is called from manual_node.
-	 * tdb_context copes with this.
 	 */
 
 	TDB_DATA key, data;
+	struct xs_tdb_record_hdr *hdr;
 	void *p;
 
 	key.dptr = (void *)node->name;
 	key.dsize = strlen(node->name);
 
-	data.dsize = 3*sizeof(uint32_t)
+	data.dsize = sizeof(*hdr)
 		+ node->num_perms*sizeof(node->perms[0])
 		+ node->datalen + node->childlen;
 
-	if (domain_is_unprivileged(conn) && data.dsize >= quota_max_entry_size)
+	if (domain_is_unprivileged(conn) &&
+	    data.dsize - sizeof(hdr->generation) - sizeof(hdr->pad)
+	    >= quota_max_entry_size)
 		goto error;
 
 	data.dptr = talloc_size(node, data.dsize);
-	((uint32_t *)data.dptr)[0] = node->num_perms;
-	((uint32_t *)data.dptr)[1] = node->datalen;
-	((uint32_t *)data.dptr)[2] = node->childlen;
-	p = data.dptr + 3 * sizeof(uint32_t);
+	hdr = (void *)data.dptr;
+	hdr->generation = 0;
+	hdr->pad = 0;
+	hdr->num_perms = node->num_perms;
+	hdr->datalen = node->datalen;
+	hdr->childlen = node->childlen;
+	p = hdr->perms;
 
 	memcpy(p, node->perms, node->num_perms*sizeof(node->perms[0]));
 	p += node->num_perms*sizeof(node->perms[0]);
@@ -440,8 +752,10 @@ static bool write_node(struct connection *conn, const struct node *node)
 	p += node->datalen;
 	memcpy(p, node->children, node->childlen);
 
-	/* TDB should set errno, but doesn't even set ecode AFAICT. */
-	if (tdb_store(tdb_context(conn), key, data, TDB_REPLACE) != 0) {
+	if (conn && conn->transaction) {
+		if (!transaction_store(conn->transaction, key, data))
+			goto error;
+	} else if (!store_record(key, data)) {
 		corrupt(conn, "Write of %s failed", key.dptr);
 		goto error;
 	}
@@ -618,6 +932,8 @@ void send_reply(struct connection *conn, enum xsd_sockmsg_type type,
 
 	/* Queue for later transmission. */
 	list_add_tail(&bdata->list, &conn->out_list);
+	if (list_empty(&conn->flush_list))
+		list_add_tail(&conn->flush_list, &flush_list);
 }
 
 /* Some routines (write, mkdir, etc) just need a non-error return */
@@ -756,7 +1072,12 @@ static void delete_node_single(struct connection *conn, struct node *node)
 	key.dptr = (void *)node->name;
 	key.dsize = strlen(node->name);
 
-	if (tdb_delete(tdb_context(conn), key) != 0) {
+	if (conn && conn->transaction) {
+		if (!transaction_delete(conn->transaction, key)) {
+			corrupt(conn, "Could not delete '%s'", node->name);
+			return;
+		}
+	} else if (!delete_record(key)) {
 		corrupt(conn, "Could not delete '%s'", node->name);
 		return;
 	}
@@ -797,7 +1118,7 @@ static struct node *construct_node(struct connection *conn, const char *name)
 
 	/* Allocate node */
 	node = talloc(name, struct node);
-	node->tdb = tdb_context(conn);
+	node->trans = conn ? conn->transaction : NULL;
 	node->name = talloc_strdup(node, name);
 
 	/* Inherit permissions, except unprivileged domains own what they create */
@@ -826,7 +1147,10 @@ static int destroy_node(void *_node)
 	key.dptr = (void *)node->name;
 	key.dsize = strlen(node->name);
 
-	tdb_delete(node->tdb, key);
+	if (node->trans)
+		transaction_delete(node->trans, key);
+	else
+		delete_record(key);
 	return 0;
 }
 
@@ -1149,6 +1473,32 @@ static void do_debug(struct connection *conn, struct buffered_data *in)
 	if (streq(in->buffer, "check"))
 		check_store();
 
+	if (streq(in->buffer, "snapshot")) {
+		if (!take_snapshot()) {
+			send_error(conn, errno);
+			return;
+		}
+	}
+
+	if (streq(in->buffer, "memdb")) {
+		char *stats;
+
+		if (!memory_db) {
+			send_error(conn, EINVAL);
+			return;
+		}
+		stats = memdb_stats_string(in);
+		send_reply(conn, XS_DEBUG, stats, strlen(stats) + 1);
+		return;
+	}
+
+	if (streq(in->buffer, "watches")) {
+		char *stats = watch_stats_string(in);
+
+		send_reply(conn, XS_DEBUG, stats, strlen(stats) + 1);
+		return;
+	}
+
 	send_ack(conn, XS_DEBUG);
 }
 
@@ -1317,10 +1667,21 @@ bad_client:
 
 static void handle_output(struct connection *conn)
 {
-	if (!write_messages(conn))
+	if (!flush_output(conn))
 		talloc_free(conn);
 }
 
+/* Write out everything queued while handling this round of events. */
+static void flush_pending(void)
+{
+	struct connection *conn;
+
+	while ((conn = list_top(&flush_list, struct connection, flush_list))) {
+		list_del_init(&conn->flush_list);
+		handle_output(conn);
+	}
+}
+
 struct connection *new_connection(connwritefn_t *write, connreadfn_t *read)
 {
 	struct connection *new;
@@ -1335,6 +1696,7 @@ struct connection *new_connection(connwritefn_t *write, connreadfn_t *read)
 	new->can_write = true;
 	new->transaction_started = 0;
 	INIT_LIST_HEAD(&new->out_list);
+	INIT_LIST_HEAD(&new->flush_list);
 	INIT_LIST_HEAD(&new->watches);
 	INIT_LIST_HEAD(&new->transaction_list);
 
@@ -1376,10 +1738,9 @@ static int readfd(struct connection *conn, void *data, unsigned int len)
 	int rc;
 
 	while ((rc = read(conn->fd, data, len)) < 0) {
-		if (errno == EAGAIN) {
-			rc = 0;
-			break;
-		}
+		/* Sockets are non-blocking: nothing more to read yet. */
+		if (errno == EAGAIN)
+			return 0;
 		if (errno != EINTR)
 			break;
 	}
@@ -1403,16 +1764,39 @@ static void accept_connection(int sock, bool canwrite)
 		return;
 
 	conn = new_connection(writefd, readfd);
-	if (conn) {
-		conn->fd = fd;
-		conn->can_write = canwrite;
-	} else
+	if (!conn) {
 		close(fd);
+		return;
+	}
+	conn->fd = fd;
+	conn->can_write = canwrite;
+
+	if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) != 0) {
+		talloc_free(conn);
+		return;
+	}
+#ifdef XENSTORED_EPOLL
+	if (poll_ctl(EPOLL_CTL_ADD, fd, EPOLLIN, conn) != 0) {
+		talloc_free(conn);
+		return;
+	}
+	conn->poll_events = EPOLLIN;
+#endif
 }
 #endif
 
 static int tdb_flags;
 
+/* Carry on numbering from the newest record of a reopened store. */
+static int max_generation_(TDB_DATA key, TDB_DATA val, void *private)
+{
+	struct xs_tdb_record_hdr *hdr = (void *)val.dptr;
+
+	if (val.dsize >= sizeof(*hdr) && hdr->generation >= generation)
+		generation = hdr->generation + 1;
+	return 0;
+}
+
 /* We create initial nodes manually. */
 static void manual_node(const char *name, const char *child)
 {
@@ -1435,12 +1819,25 @@ static void manual_node(const char *name, const char *child)
 static void setup_structure(void)
 {
 	char *tdbname;
+	bool existing;
+
 	tdbname = talloc_strdup(talloc_autofree_context(), xs_daemon_tdb());
 
-	if (!(tdb_flags & TDB_INTERNAL))
-		tdb_ctx = tdb_open(tdbname, 0, tdb_flags, O_RDWR, 0);
+	if (memory_db) {
+		memdb_init();
+		snapshot_name = talloc_asprintf(talloc_autofree_context(),
+						"%s/memdb", xs_daemon_rootdir());
+		existing = memdb_load(snapshot_name);
+		if (!existing && errno != ENOENT)
+			barf_perror("Could not load snapshot %s",
+				    snapshot_name);
+	} else {
+		if (!(tdb_flags & TDB_INTERNAL))
+			tdb_ctx = tdb_open(tdbname, 0, tdb_flags, O_RDWR, 0);
+		existing = tdb_ctx != NULL;
+	}
 
-	if (tdb_ctx) {
+	if (existing) {
 		/* XXX When we make xenstored able to restart, this will have
 		   to become cleverer, checking for existing domains and not
 		   removing the corresponding entries, but for now xenstored
@@ -1457,6 +1854,8 @@ static void setup_structure(void)
 		*/
 		char *tlocal = talloc_strdup(NULL, "/local");
 
+		traverse_records(&max_generation_, NULL);
+		snapshot_generation = generation;
 		check_store();
 
 		if (remove_local) {
@@ -1469,10 +1868,13 @@ static void setup_structure(void)
 		talloc_free(tlocal);
 	}
 	else {
-		tdb_ctx = tdb_open(tdbname, 7919, tdb_flags, O_RDWR|O_CREAT,
-				   0640);
-		if (!tdb_ctx)
-			barf_perror("Could not create tdb file %s", tdbname);
+		if (!memory_db) {
+			tdb_ctx = tdb_open(tdbname, 7919, tdb_flags,
+					   O_RDWR|O_CREAT, 0640);
+			if (!tdb_ctx)
+				barf_perror("Could not create tdb file %s",
+					    tdbname);
+		}
 
 		manual_node("/", "tool");
 		manual_node("/tool", "xenstored");
@@ -1600,8 +2002,7 @@ static void check_store_(const char *name, struct hashtable *reachable)
 /**
  * Helper to clean_store below.
  */
-static int clean_store_(TDB_CONTEXT *tdb, TDB_DATA key, TDB_DATA val,
-			void *private)
+static int clean_store_(TDB_DATA key, TDB_DATA val, void *private)
 {
 	struct hashtable *reachable = private;
 	char * name = talloc_strndup(NULL, key.dptr, key.dsize);
@@ -1609,7 +2010,7 @@ static int clean_store_(TDB_CONTEXT *tdb, TDB_DATA key, TDB_DATA val,
 	if (!hashtable_search(reachable, name)) {
 		log("clean_store: '%s' is orphaned!", name);
 		if (recovery) {
-			tdb_delete(tdb, key);
+			delete_record(key);
 		}
 	}
 
@@ -1625,7 +2026,7 @@ static int clean_store_(TDB_CONTEXT *tdb, TDB_DATA key, TDB_DATA val,
  */
 static void clean_store(struct hashtable *reachable)
 {
-	tdb_traverse(tdb_ctx, &clean_store_, reachable);
+	traverse_records(&clean_store_, reachable);
 }
 
 
@@ -1647,7 +2048,7 @@ static void check_store(void)
 
 
 /* Something is horribly wrong: check the store. */
-static void corrupt(struct connection *conn, const char *fmt, ...)
+void corrupt(struct connection *conn, const char *fmt, ...)
 {
 	va_list arglist;
 	char *str;
@@ -1710,8 +2111,8 @@ static void init_sockets(int **psock, int **pro_sock)
 	    || chmod(xs_daemon_socket_ro(), 0660) != 0)
 		barf_perror("Could not chmod sockets");
 
-	if (listen(*sock, 1) != 0
-	    || listen(*ro_sock, 1) != 0)
+	if (listen(*sock, SOMAXCONN) != 0
+	    || listen(*ro_sock, SOMAXCONN) != 0)
 		barf_perror("Could not listen on sockets");
 
 
@@ -1740,6 +2141,11 @@ static void usage(void)
 "  --no-recovery       to request that no recovery should be attempted when\n"
 "                      the store is corrupted (debug only),\n"
 "  --internal-db       store database in memory, not on disk\n"
+"  --memory-db         keep nodes in memory rather than in a TDB, restored on\n"
+"                      start-up from the last snapshot,\n"
+"  --snapshot-interval <secs>\n"
+"                      snapshot the memory store this often (also on demand\n"
+"                      with \"xenstore-control snapshot\"),\n"
 "  --preserve-local    to request that /local is preserved on start-up,\n"
 "  --verbose           to request verbose execution.\n");
 }
@@ -1760,6 +2166,8 @@ static struct option options[] = {
 	{ "no-recovery", 0, NULL, 'R' },
 	{ "preserve-local", 0, NULL, 'L' },
 	{ "internal-db", 0, NULL, 'I' },
+	{ "memory-db", 0, NULL, 'M' },
+	{ "snapshot-interval", 1, NULL, 'i' },
 	{ "verbose", 0, NULL, 'V' },
 	{ "watch-nb", 1, NULL, 'W' },
 	{ NULL, 0, NULL, 0 } };
@@ -1768,18 +2176,217 @@ extern void dump_conn(struct connection *conn);
 int dom0_event = 0;
 int priv_domid = 0;
 
-int main(int argc, char *argv[])
+#ifdef XENSTORED_EPOLL
+static void poll_add(int fd, uint32_t events, void *ptr)
+{
+	if (fd != -1 && poll_ctl(EPOLL_CTL_ADD, fd, events, ptr) != 0)
+		barf_perror("Could not poll fd %d", fd);
+}
+
+/*
+ * Socket connections are polled level-triggered, each with only the events
+ * it is interested in.  The event channel fd is edge-triggered and drained
+ * completely each time it fires.  Domain rings have no fd of their own:
+ * they are only looked at after an event, or while they have work pending.
+ */
+static void main_loop(int *sock, int *ro_sock, int *evtchn_fd)
+{
+	struct epoll_event events[64];
+	struct rlimit rlim;
+	bool domains_pending = true;
+	int i, nr;
+
+	/* Allow as many connections as we are permitted. */
+	if (getrlimit(RLIMIT_NOFILE, &rlim) == 0 &&
+	    rlim.rlim_cur < rlim.rlim_max) {
+		rlim.rlim_cur = rlim.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rlim);
+	}
+
+	epoll_fd = epoll_create(64);
+	if (epoll_fd < 0)
+		barf_perror("Could not create epoll fd");
+
+	poll_add(*sock, EPOLLIN, sock);
+	poll_add(*ro_sock, EPOLLIN, ro_sock);
+	poll_add(reopen_log_pipe[0], EPOLLIN, reopen_log_pipe);
+	if (*evtchn_fd != -1) {
+		if (fcntl(*evtchn_fd, F_SETFL,
+			  fcntl(*evtchn_fd, F_GETFL) | O_NONBLOCK) != 0)
+			barf_perror("Could not make event fd non-blocking");
+		poll_add(*evtchn_fd, EPOLLIN | EPOLLET, evtchn_fd);
+	}
+
+	/* Tell the kernel we're up and running. */
+	xenbus_notify_running();
+
+	for (;;) {
+		struct connection *conn, *next;
+
+		nr = epoll_wait(epoll_fd, events, ARRAY_SIZE(events),
+				domains_pending ? 0 : -1);
+		if (nr < 0) {
+			if (errno == EINTR)
+				continue;
+			barf_perror("epoll_wait failed");
+		}
+
+		for (i = 0; i < nr; i++) {
+			void *ptr = events[i].data.ptr;
+			uint32_t ev = events[i].events;
+
+			if (ptr == reopen_log_pipe)
+				handle_signal_pipe();
+			else if (ptr == sock)
+				accept_connection(*sock, true);
+			else if (ptr == ro_sock)
+				accept_connection(*ro_sock, false);
+			else if (ptr == evtchn_fd) {
+				handle_events();
+				domains_pending = true;
+			} else {
+				conn = ptr;
+				talloc_increase_ref_count(conn);
+				if (ev & (EPOLLIN | EPOLLHUP | EPOLLERR))
+					handle_input(conn);
+				if (talloc_free(conn) == 0)
+					continue;
+
+				talloc_increase_ref_count(conn);
+				if (ev & EPOLLOUT)
+					handle_output(conn);
+				talloc_free(conn);
+			}
+		}
+
+		if (domains_pending) {
+			domains_pending = false;
+
+			next = list_entry(connections.next, typeof(*conn), list);
+			if (&next->list != &connections)
+				talloc_increase_ref_count(next);
+			while (&next->list != &connections) {
+				conn = next;
+
+				next = list_entry(conn->list.next,
+						  typeof(*conn), list);
+				if (&next->list != &connections)
+					talloc_increase_ref_count(next);
+
+				if (conn->domain && domain_can_read(conn))
+					handle_input(conn);
+				if (talloc_free(conn) == 0)
+					continue;
+				if (!conn->domain)
+					continue;
+
+				talloc_increase_ref_count(conn);
+				if (domain_can_write(conn) &&
+				    !list_empty(&conn->out_list))
+					handle_output(conn);
+				if (talloc_free(conn) == 0)
+					continue;
+
+				if (domain_can_read(conn) ||
+				    (domain_can_write(conn) &&
+				     !list_empty(&conn->out_list)))
+					domains_pending = true;
+			}
+		}
+
+		flush_pending();
+	}
+}
+#else
+static void main_loop(int *sock, int *ro_sock, int *evtchn_fd)
 {
-	int opt, *sock, *ro_sock, max;
 	fd_set inset, outset;
+	struct timeval *timeout;
+	int max;
+
+	/* Get ready to listen to the tools. */
+	max = initialize_set(&inset, &outset, *sock, *ro_sock, &timeout);
+
+	/* Tell the kernel we're up and running. */
+	xenbus_notify_running();
+
+	/* Main loop. */
+	for (;;) {
+		struct connection *conn, *next;
+
+		if (select(max+1, &inset, &outset, NULL, timeout) < 0) {
+			if (errno == EINTR)
+				continue;
+			barf_perror("Select failed");
+		}
+
+		if (reopen_log_pipe[0] != -1 && FD_ISSET(reopen_log_pipe[0], &inset))
+			handle_signal_pipe();
+
+		if (*sock != -1 && FD_ISSET(*sock, &inset))
+			accept_connection(*sock, true);
+
+		if (*ro_sock != -1 && FD_ISSET(*ro_sock, &inset))
+			accept_connection(*ro_sock, false);
+
+		if (*evtchn_fd != -1 && FD_ISSET(*evtchn_fd, &inset))
+			handle_event();
+
+		next = list_entry(connections.next, typeof(*conn), list);
+		if (&next->list != &connections)
+			talloc_increase_ref_count(next);
+		while (&next->list != &connections) {
+			conn = next;
+
+			next = list_entry(conn->list.next,
+					  typeof(*conn), list);
+			if (&next->list != &connections)
+				talloc_increase_ref_count(next);
+
+			if (conn->domain) {
+				if (domain_can_read(conn))
+					handle_input(conn);
+				if (talloc_free(conn) == 0)
+					continue;
+
+				talloc_increase_ref_count(conn);
+				if (domain_can_write(conn) &&
+				    !list_empty(&conn->out_list))
+					handle_output(conn);
+				if (talloc_free(conn) == 0)
+					continue;
+			} else {
+				if (FD_ISSET(conn->fd, &inset))
+					handle_input(conn);
+				if (talloc_free(conn) == 0)
+					continue;
+
+				talloc_increase_ref_count(conn);
+				if (FD_ISSET(conn->fd, &outset))
+					handle_output(conn);
+				if (talloc_free(conn) == 0)
+					continue;
+			}
+		}
+
+		flush_pending();
+
+		max = initialize_set(&inset, &outset, *sock, *ro_sock,
+				     &timeout);
+	}
+}
+#endif
+
+int main(int argc, char *argv[])
+{
+	int opt, *sock, *ro_sock;
 	bool dofork = true;
 	bool outputpid = false;
 	bool no_domain_init = false;
 	const char *pidfile = NULL;
 	int evtchn_fd = -1;
-	struct timeval *timeout;
 
-	while ((opt = getopt_long(argc, argv, "DE:F:HNPS:t:T:RLVW:", options,
+	while ((opt = getopt_long(argc, argv, "DE:F:HNPS:t:T:RLVW:Mi:", options,
 				  NULL)) != -1) {
 		switch (opt) {
 		case 'D':
@@ -1818,6 +2425,12 @@ int main(int argc, char *argv[])
 		case 'I':
 			tdb_flags = TDB_INTERNAL|TDB_NOLOCK;
 			break;
+		case 'M':
+			memory_db = true;
+			break;
+		case 'i':
+			snapshot_interval = strtoul(optarg, NULL, 10);
+			break;
 		case 'V':
 			verbose = true;
 			break;
@@ -1879,82 +2492,20 @@ int main(int argc, char *argv[])
 		finish_daemonize();
 
 	signal(SIGHUP, trigger_reopen_log);
+	if (memory_db) {
+		signal(SIGCHLD, trigger_reap);
+		if (snapshot_interval) {
+			signal(SIGALRM, trigger_snapshot);
+			alarm(snapshot_interval);
+		}
+	}
 
 	if (xce_handle != NULL)
 		evtchn_fd = xc_evtchn_fd(xce_handle);
 
-	/* Get ready to listen to the tools. */
-	max = initialize_set(&inset, &outset, *sock, *ro_sock, &timeout);
+	main_loop(sock, ro_sock, &evtchn_fd);
 
-	/* Tell the kernel we're up and running. */
-	xenbus_notify_running();
-
-	/* Main loop. */
-	for (;;) {
-		struct connection *conn, *next;
-
-		if (select(max+1, &inset, &outset, NULL, timeout) < 0) {
-			if (errno == EINTR)
-				continue;
-			barf_perror("Select failed");
-		}
-
-		if (reopen_log_pipe[0] != -1 && FD_ISSET(reopen_log_pipe[0], &inset)) {
-			char c;
-			if (read(reopen_log_pipe[0], &c, 1) != 1)
-				barf_perror("read failed");
-			reopen_log();
-		}
-
-		if (*sock != -1 && FD_ISSET(*sock, &inset))
-			accept_connection(*sock, true);
-
-		if (*ro_sock != -1 && FD_ISSET(*ro_sock, &inset))
-			accept_connection(*ro_sock, false);
-
-		if (evtchn_fd != -1 && FD_ISSET(evtchn_fd, &inset))
-			handle_event();
-
-		next = list_entry(connections.next, typeof(*conn), list);
-		if (&next->list != &connections)
-			talloc_increase_ref_count(next);
-		while (&next->list != &connections) {
-			conn = next;
-
-			next = list_entry(conn->list.next,
-					  typeof(*conn), list);
-			if (&next->list != &connections)
-				talloc_increase_ref_count(next);
-
-			if (conn->domain) {
-				if (domain_can_read(conn))
-					handle_input(conn);
-				if (talloc_free(conn) == 0)
-					continue;
-
-				talloc_increase_ref_count(conn);
-				if (domain_can_write(conn) &&
-				    !list_empty(&conn->out_list))
-					handle_output(conn);
-				if (talloc_free(conn) == 0)
-					continue;
-			} else {
-				if (FD_ISSET(conn->fd, &inset))
-					handle_input(conn);
-				if (talloc_free(conn) == 0)
-					continue;
-
-				talloc_increase_ref_count(conn);
-				if (FD_ISSET(conn->fd, &outset))
-					handle_output(conn);
-				if (talloc_free(conn) == 0)
-					continue;
-			}
-		}
-
-		max = initialize_set(&inset, &outset, *sock, *ro_sock,
-				     &timeout);
-	}
+	return 0;
 }
 
 /*
@@ -73,6 +73,12 @@ struct connection
 	/* Buffered output data */
 	struct list_head out_list;
 
+	/* On flush_list while there is output not yet tried. */
+	struct list_head flush_list;
+
+	/* Events we are polling the fd for (epoll only). */
+	uint32_t poll_events;
+
 	/* Transaction context for current request (NULL if none). */
 	struct transaction *transaction;
 
@@ -96,11 +102,22 @@ struct connection
 };
 extern struct list_head connections;
 
+/* On-disk layout of a node: perms, then data, then nul-separated children. */
+struct xs_tdb_record_hdr {
+	/* Bumped on every write to the main store. */
+	uint64_t generation;
+	uint32_t num_perms;
+	uint32_t datalen;
+	uint32_t childlen;
+	uint32_t pad;
+	struct xs_permissions perms[0];
+};
+
 struct node {
 	const char *name;
 
-	/* Database I came from */
-	TDB_CONTEXT *tdb;
+	/* Transaction I came from (NULL for the main store) */
+	struct transaction *trans;
 
 	/* Parent (optional) */
 	struct node *parent;
@@ -145,14 +162,14 @@ struct node *get_node(struct connection *conn,
 		      const char *name,
 		      enum xs_perm_type perm);
 
-/* Get TDB context for this connection */
-TDB_CONTEXT *tdb_context(struct connection *conn);
-
-/* Destructor for tdbs: required for transaction code */
-int destroy_tdb(void *_tdb);
+/* Main store access.  These set errno on failure; fetched records are
+ * talloc'ed and owned by the caller. */
+TDB_DATA fetch_record(TDB_DATA key);
+bool store_record(TDB_DATA key, TDB_DATA data);
+bool delete_record(TDB_DATA key);
 
-/* Replace the tdb: required for transaction code */
-bool replace_tdb(const char *newname, TDB_CONTEXT *newtdb);
+/* Log an inconsistency in the store and repair it. */
+void corrupt(struct connection *conn, const char *fmt, ...);
 
 struct connection *new_connection(connwritefn_t *write, connreadfn_t *read);
 
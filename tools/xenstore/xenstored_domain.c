@@ -237,6 +237,15 @@ static void domain_cleanup(void)
 }
 
 /* We scan all domains rather than use the information given here. */
+static void handle_port(evtchn_port_t port)
+{
+	if (port == virq_port)
+		domain_cleanup();
+
+	if (xc_evtchn_unmask(xce_handle, port) == -1)
+		barf_perror("Failed to write to event fd");
+}
+
 void handle_event(void)
 {
 	evtchn_port_t port;
@@ -244,11 +253,18 @@ void handle_event(void)
 	if ((port = xc_evtchn_pending(xce_handle)) == -1)
 		barf_perror("Failed to read from event fd");
 
-	if (port == virq_port)
-		domain_cleanup();
+	handle_port(port);
+}
 
-	if (xc_evtchn_unmask(xce_handle, port) == -1)
-		barf_perror("Failed to write to event fd");
+void handle_events(void)
+{
+	evtchn_port_or_error_t port;
+
+	while ((port = xc_evtchn_pending(xce_handle)) != -1)
+		handle_port(port);
+
+	if (errno != EAGAIN)
+		barf_perror("Failed to read from event fd");
 }
 
 bool domain_can_read(struct connection *conn)
@@ -22,6 +22,9 @@
 
 void handle_event(void);
 
+/* As above, for a non-blocking event fd: handle every pending port. */
+void handle_events(void);
+
 /* domid, mfn, eventchn, path */
 void do_introduce(struct connection *conn, struct buffered_data *in);
 
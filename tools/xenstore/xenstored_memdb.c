@@ -0,0 +1,377 @@
+/* 
+    In-memory node store for Xen Store Daemon.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/*
+ * With --memory-db, nodes live here rather than in a TDB.  Each node is a
+ * single allocation holding its path and its record (the same layout the
+ * TDB stores: header, perms, data, then the names of its children), so the
+ * tree is walked through the children lists as before.  Nodes are found by
+ * a hash of their path and are also kept on one list, for traversal and
+ * snapshots.  Small nodes come from an arena with per-size free lists,
+ * which avoids a malloc and talloc header for every node.
+ *
+ * This is deliberately not a tree of linked nodes.  Every request names a
+ * node by its full path, which the hash finds in one probe where a tree
+ * needs one lookup per component, and keeping the TDB record layout lets
+ * the core, transactions, check_store() and snapshots share one code path
+ * with the TDB backends.  The costs this mode exists to remove, TDB's
+ * locking, file mapping and free-list walks, are gone either way.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "talloc.h"
+#include "list.h"
+#include "utils.h"
+#include "xenstored_memdb.h"
+
+struct mem_node
+{
+	/* Hash chain. */
+	struct mem_node *hnext;
+
+	/* All nodes. */
+	struct list_head list;
+
+	uint32_t hash;
+	uint32_t keylen;
+	uint32_t reclen;
+
+	/* Path (nul-terminated), then the record, 8-byte aligned. */
+	char key[0];
+};
+
+#define REC_OFFSET(keylen) \
+	((offsetof(struct mem_node, key) + (keylen) + 1 + 7) & ~(size_t)7)
+#define NODE_SIZE(keylen, reclen) (REC_OFFSET(keylen) + (reclen))
+
+static inline void *node_record(struct mem_node *node)
+{
+	return (char *)node + REC_OFFSET(node->keylen);
+}
+
+/* Arena: nodes up to ARENA_MAX bytes, in ARENA_ALIGN sized classes. */
+#define ARENA_ALIGN 16
+#define ARENA_MAX   2048
+#define ARENA_CHUNK (64 * 1024)
+
+static void *free_lists[ARENA_MAX / ARENA_ALIGN + 1];
+static char *chunk;
+static size_t chunk_left;
+static size_t arena_bytes;
+
+static LIST_HEAD(nodes);
+static struct mem_node **buckets;
+static unsigned int nr_buckets, nr_nodes;
+static size_t record_bytes;
+
+static size_t arena_size(size_t size)
+{
+	return (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+static void *arena_alloc(size_t size)
+{
+	void *p;
+
+	size = arena_size(size);
+	if (size > ARENA_MAX)
+		return malloc(size);
+
+	p = free_lists[size / ARENA_ALIGN];
+	if (p) {
+		free_lists[size / ARENA_ALIGN] = *(void **)p;
+		return p;
+	}
+
+	if (chunk_left < size) {
+		/* The tail of the old chunk is too small: leave it. */
+		chunk = malloc(ARENA_CHUNK);
+		if (!chunk) {
+			chunk_left = 0;
+			return NULL;
+		}
+		chunk_left = ARENA_CHUNK;
+		arena_bytes += ARENA_CHUNK;
+	}
+	p = chunk;
+	chunk += size;
+	chunk_left -= size;
+	return p;
+}
+
+static void arena_free(void *p, size_t size)
+{
+	size = arena_size(size);
+	if (size > ARENA_MAX) {
+		free(p);
+		return;
+	}
+	*(void **)p = free_lists[size / ARENA_ALIGN];
+	free_lists[size / ARENA_ALIGN] = p;
+}
+
+static uint32_t hash_key(TDB_DATA key)
+{
+	uint32_t hash = 5381;
+	size_t i;
+
+	for (i = 0; i < key.dsize; i++)
+		hash = ((hash << 5) + hash) + (unsigned char)key.dptr[i];
+	return hash;
+}
+
+static struct mem_node **find(TDB_DATA key, uint32_t hash)
+{
+	struct mem_node **pp = &buckets[hash & (nr_buckets - 1)];
+
+	for (; *pp; pp = &(*pp)->hnext)
+		if ((*pp)->hash == hash && (*pp)->keylen == key.dsize &&
+		    !memcmp((*pp)->key, key.dptr, key.dsize))
+			break;
+	return pp;
+}
+
+static void grow_buckets(void)
+{
+	struct mem_node **old = buckets, *node, *next;
+	unsigned int i, old_nr = nr_buckets;
+
+	buckets = calloc(nr_buckets * 2, sizeof(*buckets));
+	if (!buckets) {
+		/* Carry on with longer chains. */
+		buckets = old;
+		return;
+	}
+	nr_buckets *= 2;
+
+	for (i = 0; i < old_nr; i++)
+		for (node = old[i]; node; node = next) {
+			next = node->hnext;
+			node->hnext = buckets[node->hash & (nr_buckets - 1)];
+			buckets[node->hash & (nr_buckets - 1)] = node;
+		}
+	free(old);
+}
+
+void memdb_init(void)
+{
+	nr_buckets = 1024;
+	buckets = calloc(nr_buckets, sizeof(*buckets));
+	if (!buckets)
+		barf_perror("Could not allocate memory db");
+}
+
+TDB_DATA memdb_fetch(TDB_DATA key)
+{
+	struct mem_node *node = *find(key, hash_key(key));
+	TDB_DATA data = { NULL, 0 };
+
+	if (!node) {
+		errno = ENOENT;
+		return data;
+	}
+	data.dptr = talloc_memdup(NULL, node_record(node), node->reclen);
+	if (!data.dptr) {
+		errno = ENOMEM;
+		return data;
+	}
+	data.dsize = node->reclen;
+	return data;
+}
+
+bool memdb_store(TDB_DATA key, TDB_DATA data)
+{
+	uint32_t hash = hash_key(key);
+	struct mem_node **pp = find(key, hash), *old = *pp, *node;
+
+	node = arena_alloc(NODE_SIZE(key.dsize, data.dsize));
+	if (!node) {
+		errno = ENOMEM;
+		return false;
+	}
+	node->hash = hash;
+	node->keylen = key.dsize;
+	node->reclen = data.dsize;
+	memcpy(node->key, key.dptr, key.dsize);
+	node->key[key.dsize] = '\0';
+	memcpy(node_record(node), data.dptr, data.dsize);
+
+	if (old) {
+		/* Take its place in the chain and the list. */
+		node->hnext = old->hnext;
+		*pp = node;
+		list_add(&node->list, &old->list);
+		list_del(&old->list);
+		record_bytes -= old->reclen;
+		arena_free(old, NODE_SIZE(old->keylen, old->reclen));
+	} else {
+		node->hnext = *pp;
+		*pp = node;
+		list_add_tail(&node->list, &nodes);
+		if (++nr_nodes > nr_buckets)
+			grow_buckets();
+	}
+	record_bytes += data.dsize;
+	return true;
+}
+
+bool memdb_delete(TDB_DATA key)
+{
+	struct mem_node **pp = find(key, hash_key(key)), *node = *pp;
+
+	if (!node) {
+		errno = ENOENT;
+		return false;
+	}
+	*pp = node->hnext;
+	list_del(&node->list);
+	nr_nodes--;
+	record_bytes -= node->reclen;
+	arena_free(node, NODE_SIZE(node->keylen, node->reclen));
+	return true;
+}
+
+void memdb_traverse(int (*fn)(TDB_DATA key, TDB_DATA data, void *priv),
+		    void *priv)
+{
+	struct mem_node *node, *next;
+	TDB_DATA key, data;
+
+	list_for_each_entry_safe(node, next, &nodes, list) {
+		key.dptr = node->key;
+		key.dsize = node->keylen;
+		data.dptr = node_record(node);
+		data.dsize = node->reclen;
+		if (fn(key, data, priv))
+			break;
+	}
+}
+
+/*
+ * Snapshot file: the magic, then for each node its path and record
+ * lengths (uint32_t each) followed by the path and the record.
+ */
+static const char snapshot_magic[8] = "XSMEMDB1";
+
+bool memdb_save(const char *path)
+{
+	struct mem_node *node;
+	char *tmp = talloc_asprintf(NULL, "%s.tmp", path);
+	uint32_t lens[2];
+	FILE *f;
+	int fd;
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0 || !(f = fdopen(fd, "w"))) {
+		if (fd >= 0)
+			close(fd);
+		talloc_free(tmp);
+		return false;
+	}
+
+	fwrite(snapshot_magic, sizeof(snapshot_magic), 1, f);
+	list_for_each_entry(node, &nodes, list) {
+		lens[0] = node->keylen;
+		lens[1] = node->reclen;
+		fwrite(lens, sizeof(lens), 1, f);
+		fwrite(node->key, node->keylen, 1, f);
+		fwrite(node_record(node), node->reclen, 1, f);
+	}
+
+	if (fflush(f) != 0 || ferror(f) || fsync(fd) != 0) {
+		fclose(f);
+		unlink(tmp);
+		talloc_free(tmp);
+		return false;
+	}
+	fclose(f);
+
+	if (rename(tmp, path) != 0) {
+		unlink(tmp);
+		talloc_free(tmp);
+		return false;
+	}
+	talloc_free(tmp);
+	return true;
+}
+
+bool memdb_load(const char *path)
+{
+	char magic[sizeof(snapshot_magic)];
+	uint32_t lens[2];
+	TDB_DATA key, data;
+	FILE *f;
+	bool ok = false;
+
+	f = fopen(path, "r");
+	if (!f)
+		return false;
+
+	if (fread(magic, sizeof(magic), 1, f) != 1 ||
+	    memcmp(magic, snapshot_magic, sizeof(magic)))
+		goto out;
+
+	while (fread(lens, sizeof(lens), 1, f) == 1) {
+		if (lens[0] == 0 || lens[0] > XENSTORE_ABS_PATH_MAX ||
+		    lens[1] < sizeof(struct xs_tdb_record_hdr))
+			goto out;
+		key.dsize = lens[0];
+		data.dsize = lens[1];
+		key.dptr = talloc_size(NULL, key.dsize);
+		data.dptr = talloc_size(key.dptr, data.dsize);
+		if (!data.dptr ||
+		    fread(key.dptr, key.dsize, 1, f) != 1 ||
+		    fread(data.dptr, data.dsize, 1, f) != 1 ||
+		    !memdb_store(key, data)) {
+			talloc_free(key.dptr);
+			goto out;
+		}
+		talloc_free(key.dptr);
+	}
+	ok = !ferror(f);
+
+ out:
+	fclose(f);
+	if (!ok)
+		errno = EINVAL;
+	return ok;
+}
+
+char *memdb_stats_string(const void *ctx)
+{
+	return talloc_asprintf(ctx,
+		"nodes: %u\n"
+		"record bytes: %zu\n"
+		"arena bytes: %zu\n",
+		nr_nodes, record_bytes, arena_bytes);
+}
+
+/*
+ * Local variables:
+ *  c-file-style: "linux"
+ *  indent-tabs-mode: t
+ *  c-indent-level: 8
+ *  c-basic-offset: 8
+ *  tab-width: 8
+ * End:
+ */
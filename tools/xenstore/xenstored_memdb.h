@@ -0,0 +1,42 @@
+/* 
+    In-memory node store for Xen Store Daemon.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef _XENSTORED_MEMDB_H
+#define _XENSTORED_MEMDB_H
+
+#include "xenstored_core.h"
+
+void memdb_init(void);
+
+/* Same conventions as fetch_record() and friends. */
+TDB_DATA memdb_fetch(TDB_DATA key);
+bool memdb_store(TDB_DATA key, TDB_DATA data);
+bool memdb_delete(TDB_DATA key);
+
+/* fn may delete the record it is given, but no other. */
+void memdb_traverse(int (*fn)(TDB_DATA key, TDB_DATA data, void *priv),
+		    void *priv);
+
+/* Snapshots for restart: load fails with ENOENT if there is none. */
+bool memdb_save(const char *path);
+bool memdb_load(const char *path);
+
+/* Nodes, bytes of records and bytes of arena backing them. */
+char *memdb_stats_string(const void *ctx);
+
+#endif /* _XENSTORED_MEMDB_H */
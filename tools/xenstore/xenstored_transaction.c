@@ -26,6 +26,7 @@
 #include <assert.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include "talloc.h"
@@ -48,6 +49,34 @@ struct changed_node
 	bool recurse;
 };
 
+/*
+ * Every node read or written by a transaction gets one of these.  The
+ * generation the node had in the main store when first touched is checked
+ * again at commit: if any of them moved on, the transaction conflicts.
+ */
+struct accessed_node
+{
+	/* List of all accessed nodes in the context of this transaction. */
+	struct list_head list;
+
+	/* The name of the node. */
+	char *node;
+
+	/* Main store generation when first accessed, or NO_GENERATION. */
+	uint64_t generation;
+
+	/* The record as this transaction sees it: dptr NULL if absent. */
+	TDB_DATA data;
+
+	/* Written or deleted by this transaction? */
+	bool modified;
+
+	/* If modified, the main store record at commit: dptr NULL if absent. */
+	TDB_DATA undo;
+};
+
+#define NO_GENERATION (~(uint64_t)0)
+
 struct changed_domain
 {
 	/* List of all changed domains in the context of this transaction. */
@@ -68,12 +97,8 @@ struct transaction
 	/* Connection-local identifier for this transaction. */
 	uint32_t id;
 
-	/* Generation when transaction started. */
-	unsigned int generation;
-
-	/* TDB to work on, and filename */
-	TDB_CONTEXT *tdb;
-	char *tdb_name;
+	/* Nodes read or written so far. */
+	struct list_head accessed;
 
 	/* List of changed nodes. */
 	struct list_head changes;
@@ -83,12 +108,170 @@ struct transaction
 };
 
 extern int quota_max_transaction;
-static unsigned int generation;
 
-/* Return tdb context to use for this connection. */
-TDB_CONTEXT *tdb_transaction_context(struct transaction *trans)
+static bool key_is(const char *node, TDB_DATA key)
+{
+	return strlen(node) == key.dsize && !memcmp(node, key.dptr, key.dsize);
+}
+
+/* Find the node, taking a copy from the main store on first access. */
+static struct accessed_node *get_accessed(struct transaction *trans,
+					  TDB_DATA key)
+{
+	struct accessed_node *i;
+	struct xs_tdb_record_hdr *hdr;
+
+	list_for_each_entry(i, &trans->accessed, list)
+		if (key_is(i->node, key))
+			return i;
+
+	i = talloc_zero(trans, struct accessed_node);
+	i->node = talloc_strndup(i, key.dptr, key.dsize);
+	i->data = fetch_record(key);
+	if (i->data.dptr) {
+		talloc_steal(i, i->data.dptr);
+		hdr = (void *)i->data.dptr;
+		i->generation = hdr->generation;
+	} else if (errno == ENOENT) {
+		i->generation = NO_GENERATION;
+	} else {
+		talloc_free(i);
+		return NULL;
+	}
+	list_add_tail(&i->list, &trans->accessed);
+	return i;
+}
+
+TDB_DATA transaction_fetch(struct transaction *trans, TDB_DATA key)
 {
-	return trans->tdb;
+	struct accessed_node *i = get_accessed(trans, key);
+	TDB_DATA data = { NULL, 0 };
+
+	if (!i)
+		return data;
+	if (!i->data.dptr) {
+		errno = ENOENT;
+		return data;
+	}
+	data.dptr = talloc_memdup(NULL, i->data.dptr, i->data.dsize);
+	data.dsize = i->data.dsize;
+	return data;
+}
+
+bool transaction_store(struct transaction *trans, TDB_DATA key, TDB_DATA data)
+{
+	struct accessed_node *i = get_accessed(trans, key);
+
+	if (!i)
+		return false;
+	talloc_free(i->data.dptr);
+	i->data.dptr = talloc_memdup(i, data.dptr, data.dsize);
+	i->data.dsize = data.dsize;
+	i->modified = true;
+	return true;
+}
+
+bool transaction_delete(struct transaction *trans, TDB_DATA key)
+{
+	struct accessed_node *i = get_accessed(trans, key);
+
+	if (!i)
+		return false;
+	if (!i->data.dptr) {
+		errno = ENOENT;
+		return false;
+	}
+	talloc_free(i->data.dptr);
+	i->data.dptr = NULL;
+	i->data.dsize = 0;
+	i->modified = true;
+	return true;
+}
+
+/*
+ * Has anything this transaction looked at changed underneath it?  The
+ * current records of the nodes it modifies are kept to undo the commit.
+ */
+static int check_conflicts(struct transaction *trans)
+{
+	struct accessed_node *i;
+	struct xs_tdb_record_hdr *hdr;
+	TDB_DATA key, data;
+	uint64_t gen;
+
+	list_for_each_entry(i, &trans->accessed, list) {
+		key.dptr = i->node;
+		key.dsize = strlen(i->node);
+		data = fetch_record(key);
+		if (data.dptr) {
+			hdr = (void *)data.dptr;
+			gen = hdr->generation;
+		} else if (errno == ENOENT)
+			gen = NO_GENERATION;
+		else
+			return errno;
+		if (gen != i->generation) {
+			talloc_free(data.dptr);
+			return EAGAIN;
+		}
+		if (i->modified) {
+			i->undo.dptr = talloc_steal(i, data.dptr);
+			i->undo.dsize = data.dsize;
+		} else
+			talloc_free(data.dptr);
+	}
+	return 0;
+}
+
+/* Put back the records of the nodes before failed, as check_conflicts saw
+ * them. */
+static void rollback_accessed(struct connection *conn,
+			      struct transaction *trans,
+			      struct accessed_node *failed)
+{
+	struct accessed_node *i;
+	TDB_DATA key;
+
+	list_for_each_entry(i, &trans->accessed, list) {
+		if (i == failed)
+			break;
+		if (!i->modified)
+			continue;
+		key.dptr = i->node;
+		key.dsize = strlen(i->node);
+		if (i->undo.dptr) {
+			if (!store_record(key, i->undo))
+				corrupt(conn, "Could not restore %s", i->node);
+		} else if (i->data.dptr) {
+			if (!delete_record(key))
+				corrupt(conn, "Could not remove %s", i->node);
+		}
+	}
+}
+
+/* All or nothing: a failed store undoes those before it. */
+static int commit_accessed(struct connection *conn, struct transaction *trans)
+{
+	struct accessed_node *i;
+	TDB_DATA key;
+	int ret;
+
+	list_for_each_entry(i, &trans->accessed, list) {
+		if (!i->modified)
+			continue;
+		key.dptr = i->node;
+		key.dsize = strlen(i->node);
+		if (i->data.dptr) {
+			if (store_record(key, i->data))
+				continue;
+		} else if (!i->undo.dptr || delete_record(key))
+			continue;
+
+		ret = errno;
+		rollback_accessed(conn, trans, i);
+		return ret;
+	}
+	return 0;
 }
 
 /* Callers get a change node (which can fail) and only commit after they've
@@ -97,11 +280,8 @@ void add_change_node(struct transaction *trans, const char *node, bool recurse)
 {
 	struct changed_node *i;
 
-	if (!trans) {
-		/* They're changing the global database. */
-		generation++;
+	if (!trans)
 		return;
-	}
 
 	list_for_each_entry(i, &trans->changes, list)
 		if (streq(i->node, node))
@@ -118,9 +298,6 @@ static int destroy_transaction(void *_transaction)
 	struct transaction *trans = _transaction;
 
 	trace_destroy(trans, "transaction");
-	if (trans->tdb)
-		tdb_close(trans->tdb);
-	unlink(trans->tdb_name);
 	return 0;
 }
 
@@ -156,18 +333,9 @@ void do_transaction_start(struct connection *conn, struct buffered_data *in)
 
 	/* Attach transaction to input for autofree until it's complete */
 	trans = talloc(in, struct transaction);
+	INIT_LIST_HEAD(&trans->accessed);
 	INIT_LIST_HEAD(&trans->changes);
 	INIT_LIST_HEAD(&trans->changed_domains);
-	trans->generation = generation;
-	trans->tdb_name = talloc_asprintf(trans, "%s.%p",
-					  xs_daemon_tdb(), trans);
-	trans->tdb = tdb_copy(tdb_context(conn), trans->tdb_name);
-	if (!trans->tdb) {
-		send_error(conn, errno);
-		return;
-	}
-	/* Make it close if we go away. */
-	talloc_steal(trans, trans->tdb);
 
 	/* Pick an unused transaction identifier. */
 	do {
@@ -190,6 +358,7 @@ void do_transaction_end(struct connection *conn, const char *arg)
 	struct changed_node *i;
 	struct changed_domain *d;
 	struct transaction *trans;
+	int ret;
 
 	if (!arg || (!streq(arg, "T") && !streq(arg, "F"))) {
 		send_error(conn, EINVAL);
@@ -209,17 +378,13 @@ void do_transaction_end(struct connection *conn, const char *arg)
 	talloc_steal(arg, trans);
 
 	if (streq(arg, "T")) {
-		/* FIXME: Merge, rather failing on any change. */
-		if (trans->generation != generation) {
-			send_error(conn, EAGAIN);
-			return;
-		}
-		if (!replace_tdb(trans->tdb_name, trans->tdb)) {
-			send_error(conn, errno);
+		ret = check_conflicts(trans);
+		if (!ret)
+			ret = commit_accessed(conn, trans);
+		if (ret) {
+			send_error(conn, ret);
 			return;
 		}
-		/* Don't close this: we won! */
-		trans->tdb = NULL;
 
 		/* fix domain entry for each changed domain */
 		list_for_each_entry(d, &trans->changed_domains, list)
@@ -228,7 +393,6 @@ void do_transaction_end(struct connection *conn, const char *arg)
 		/* Fire off the watches for everything that changed. */
 		list_for_each_entry(i, &trans->changes, list)
 			fire_watches(conn, i->node, i->recurse);
-		generation++;
 	}
 	send_ack(conn, XS_TRANSACTION_END);
 }
@@ -35,8 +35,11 @@ void transaction_entry_dec(struct transaction *trans, unsigned int domid);
 void add_change_node(struct transaction *trans, const char *node,
                      bool recurse);
 
-/* Return tdb context to use for this connection. */
-TDB_CONTEXT *tdb_transaction_context(struct transaction *trans);
+/* Node access within a transaction: these behave like the main store
+ * equivalents, but only record the change until the transaction ends. */
+TDB_DATA transaction_fetch(struct transaction *trans, TDB_DATA key);
+bool transaction_store(struct transaction *trans, TDB_DATA key, TDB_DATA data);
+bool transaction_delete(struct transaction *trans, TDB_DATA key);
 
 void conn_delete_all_transactions(struct connection *conn);
 
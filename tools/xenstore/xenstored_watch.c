@@ -21,6 +21,7 @@
 #include <sys/types.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/time.h>
 #include <time.h>
 #include <assert.h>
@@ -30,14 +31,53 @@
 #include "xenstore_lib.h"
 #include "utils.h"
 #include "xenstored_domain.h"
+#include "hashtable.h"
 
 extern int quota_nb_watch_per_domain;
 
+/*
+ * Watches are indexed by path in a trie, so a change only has to look at
+ * the watches on its ancestors (and, for rm, its descendants).  Each trie
+ * node is also in watch_index, keyed by its full path.  Event paths
+ * ("@releaseDomain" etc.) hang directly off "/", which sees everything.
+ */
+struct watch_node
+{
+	char *path;
+	struct watch_node *parent;
+
+	/* Our entry in the parent's children list. */
+	struct list_head sibling;
+	struct list_head children;
+
+	/* Watches registered on exactly this path. */
+	struct list_head watches;
+};
+
+static struct hashtable *watch_index;
+
+/* Statistics, reported by the "watches" debug command. */
+static struct {
+	unsigned long fires;		/* fire_watches() calls */
+	unsigned long events;		/* watch events queued */
+	unsigned long nodes_visited;	/* trie nodes looked at */
+	unsigned long watches_checked;	/* watches looked at */
+	unsigned int nr_watches;
+	unsigned int nr_nodes;
+} watch_stats;
+
 struct watch
 {
 	/* Watches on this connection */
 	struct list_head list;
 
+	/* Watches on this path, hanging off watch_node */
+	struct list_head node_list;
+	struct watch_node *wnode;
+
+	/* Connection the watch belongs to */
+	struct connection *conn;
+
 	/* Current outstanding events applying to this watch. */
 	struct list_head events;
 
@@ -82,33 +122,181 @@ static void add_event(struct connection *conn,
 	data = talloc_array(watch, char, len);
 	strcpy(data, name);
 	strcpy(data + strlen(name) + 1, watch->token);
+	watch_stats.events++;
 	send_reply(conn, XS_WATCH_EVENT, data, len);
 	talloc_free(data);
 }
 
+static unsigned int hash_path(void *k)
+{
+	char *str = k;
+	unsigned int hash = 5381;
+	char c;
+
+	while ((c = *str++))
+		hash = ((hash << 5) + hash) + (unsigned int)c;
+
+	return hash;
+}
+
+static int paths_equal(void *key1, void *key2)
+{
+	return streq(key1, key2);
+}
+
+static struct watch_node *lookup_watch_node(const char *path)
+{
+	if (!watch_index)
+		return NULL;
+	watch_stats.nodes_visited++;
+	return hashtable_search(watch_index, (void *)path);
+}
+
+/* Drop trie nodes which no longer lead to any watch. */
+static void put_watch_node(struct watch_node *wnode)
+{
+	struct watch_node *parent;
+
+	while (wnode && list_empty(&wnode->watches) &&
+	       list_empty(&wnode->children)) {
+		parent = wnode->parent;
+		if (parent)
+			list_del(&wnode->sibling);
+		hashtable_remove(watch_index, wnode->path);
+		talloc_free(wnode);
+		watch_stats.nr_nodes--;
+		wnode = parent;
+	}
+}
+
+static struct watch_node *get_watch_node(const char *path)
+{
+	struct watch_node *wnode, *parent = NULL;
+	char *key;
+
+	if (!watch_index) {
+		watch_index = create_hashtable(64, hash_path, paths_equal);
+		if (!watch_index)
+			return NULL;
+	}
+
+	wnode = hashtable_search(watch_index, (void *)path);
+	if (wnode)
+		return wnode;
+
+	if (!streq(path, "/")) {
+		const char *slash = strrchr(path, '/');
+		char *parentname = (!slash || slash == path) ?
+			talloc_strdup(NULL, "/") :
+			talloc_strndup(NULL, path, slash - path);
+
+		parent = get_watch_node(parentname);
+		talloc_free(parentname);
+		if (!parent)
+			return NULL;
+	}
+
+	wnode = talloc_zero(talloc_autofree_context(), struct watch_node);
+	key = strdup(path);
+	if (!wnode || !key || !hashtable_insert(watch_index, key, wnode)) {
+		free(key);
+		talloc_free(wnode);
+		put_watch_node(parent);
+		return NULL;
+	}
+	wnode->path = talloc_strdup(wnode, path);
+	wnode->parent = parent;
+	INIT_LIST_HEAD(&wnode->children);
+	INIT_LIST_HEAD(&wnode->watches);
+	if (parent)
+		list_add_tail(&wnode->sibling, &parent->children);
+	watch_stats.nr_nodes++;
+	return wnode;
+}
+
+static void fire_node(struct watch_node *wnode, const char *name)
+{
+	struct watch *watch, *tmp;
+
+	list_for_each_entry_safe(watch, tmp, &wnode->watches, node_list) {
+		watch_stats.watches_checked++;
+		add_event(watch->conn, watch, name ? name : watch->node);
+	}
+}
+
+/* Every watch strictly below wnode fires on its own path. */
+static void fire_descendants(struct watch_node *wnode)
+{
+	struct watch_node *child;
+
+	list_for_each_entry(child, &wnode->children, sibling) {
+		watch_stats.nodes_visited++;
+		fire_node(child, NULL);
+		fire_descendants(child);
+	}
+}
+
 void fire_watches(struct connection *conn, const char *name, bool recurse)
 {
-	struct connection *i;
-	struct watch *watch;
+	struct watch_node *wnode = NULL;
+	char *path;
+	unsigned int len;
 
 	/* During transactions, don't fire watches. */
 	if (conn && conn->transaction)
 		return;
 
-	/* Create an event for each watch. */
-	list_for_each_entry(i, &connections, list) {
-		list_for_each_entry(watch, &i->watches, list) {
-			if (is_child(name, watch->node))
-				add_event(i, watch, name);
-			else if (recurse && is_child(watch->node, name))
-				add_event(i, watch, watch->node);
-		}
+	watch_stats.fires++;
+
+	/* Watches on "/" see everything, including special events. */
+	wnode = lookup_watch_node("/");
+	if (wnode)
+		fire_node(wnode, name);
+	if (streq(name, "/"))
+		goto descendants;
+
+	/* Then the watches on name and each of its ancestors. */
+	path = talloc_strdup(NULL, name);
+	for (len = 1; ; len++) {
+		if (path[len] != '/' && path[len] != '\0')
+			continue;
+		path[len] = '\0';
+		wnode = lookup_watch_node(path);
+		if (wnode)
+			fire_node(wnode, name);
+		if (name[len] == '\0')
+			break;
+		path[len] = '/';
 	}
+	talloc_free(path);
+
+ descendants:
+	if (recurse && wnode)
+		fire_descendants(wnode);
+}
+
+char *watch_stats_string(const void *ctx)
+{
+	return talloc_asprintf(ctx,
+		"watches: %u\n"
+		"trie nodes: %u\n"
+		"fire_watches calls: %lu\n"
+		"events queued: %lu\n"
+		"trie nodes visited: %lu\n"
+		"watches checked: %lu\n",
+		watch_stats.nr_watches, watch_stats.nr_nodes,
+		watch_stats.fires, watch_stats.events,
+		watch_stats.nodes_visited, watch_stats.watches_checked);
 }
 
 static int destroy_watch(void *_watch)
 {
+	struct watch *watch = _watch;
+
 	trace_destroy(_watch, "watch");
+	list_del(&watch->node_list);
+	put_watch_node(watch->wnode);
+	watch_stats.nr_watches--;
 	return 0;
 }
 
@@ -154,6 +342,13 @@ void do_watch(struct connection *conn, struct buffered_data *in)
 	}
 
 	watch = talloc(conn, struct watch);
+	watch->wnode = get_watch_node(vec[0]);
+	if (!watch->wnode) {
+		talloc_free(watch);
+		send_error(conn, ENOMEM);
+		return;
+	}
+	watch->conn = conn;
 	watch->node = talloc_strdup(watch, vec[0]);
 	watch->token = talloc_strdup(watch, vec[1]);
 	if (relative)
@@ -165,6 +360,8 @@ void do_watch(struct connection *conn, struct buffered_data *in)
 
 	domain_watch_inc(conn);
 	list_add_tail(&watch->list, &conn->watches);
+	list_add_tail(&watch->node_list, &watch->wnode->watches);
+	watch_stats.nr_watches++;
 	trace_create(watch, "watch");
 	talloc_set_destructor(watch, destroy_watch);
 	send_ack(conn, XS_WATCH);
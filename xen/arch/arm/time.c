@@ -25,6 +25,7 @@
 #include <xen/mm.h>
 #include <xen/softirq.h>
 #include <xen/time.h>
+#include <xen/timer.h>
 #include <asm/system.h>
 
 /*
@@ -136,6 +137,8 @@ int reprogram_timer(s_time_t timeout)
 /* Handle the firing timer */
 static void timer_interrupt(int irq, void *dev_id, struct cpu_user_regs *regs)
 {
+    this_cpu(timer_interrupts)++;
+
     if ( irq == 26 && READ_CP32(CNTHP_CTL) & CNTx_CTL_PENDING )
     {
         /* Signal the generic timer code to do its work */
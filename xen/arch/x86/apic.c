@@ -1300,6 +1300,7 @@ void apic_timer_interrupt(struct cpu_user_regs * regs)
 {
     ack_APIC_irq();
     perfc_incr(apic_timer);
+    this_cpu(timer_interrupts)++;
     raise_softirq(TIMER_SOFTIRQ);
 }
 
@@ -118,7 +118,9 @@ static void idle_loop(void)
     {
         if ( cpu_is_offline(smp_processor_id()) )
             play_dead();
-        (*pm_idle)();
+        /* Scrub freed memory rather than sleeping while there is some. */
+        if ( !scrub_free_pages() )
+            (*pm_idle)();
         do_tasklet();
         do_softirq();
     }
@@ -184,7 +186,10 @@ void dump_pageframe_info(struct domain *d)
     }
 
     if ( is_hvm_domain(d) )
+    {
         p2m_pod_dump_data(d);
+        p2m_dump_stats(d);
+    }
 
     spin_lock(&d->page_alloc_lock);
     page_list_for_each ( page, &d->xenpage_list )
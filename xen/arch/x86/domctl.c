@@ -1549,6 +1549,34 @@ long arch_do_domctl(
     break;
 #endif /* P2M_AUDIT */
 
+    case XEN_DOMCTL_get_p2m_stats:
+    {
+        struct domain *d;
+        struct p2m_domain *p2m;
+        struct xen_domctl_p2m_stats *stats = &domctl->u.p2m_stats;
+
+        ret = rcu_lock_remote_target_domain_by_id(domctl->domain, &d);
+        if ( ret != 0 )
+            break;
+
+        ret = -EINVAL;
+        if ( paging_mode_translate(d) )
+        {
+            p2m = p2m_get_hostp2m(d);
+            stats->ram_4k = p2m->ram_entries[0];
+            stats->ram_2m = (uint64_t)p2m->ram_entries[1] << PAGE_ORDER_2M;
+            stats->ram_1g = (uint64_t)p2m->ram_entries[2] << PAGE_ORDER_1G;
+            stats->pod_entries = p2m->pod.entry_count;
+            stats->pod_cache = p2m->pod.count;
+            ret = 0;
+        }
+        rcu_unlock_domain(d);
+
+        if ( !ret && copy_to_guest(u_domctl, domctl, 1) )
+            ret = -EFAULT;
+    }
+    break;
+
     case XEN_DOMCTL_set_access_required:
     {
         struct domain *d;
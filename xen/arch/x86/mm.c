@@ -4433,6 +4433,7 @@ int donate_page(
     page->count_info = PGC_allocated | 1;
     page_set_owner(page, d);
     page_list_add_tail(page,&d->page_list);
+    domain_adjust_node_pages(d, page, 1);
 
     spin_unlock(&d->page_alloc_lock);
     return 0;
@@ -4480,6 +4481,7 @@ int steal_page(
     if ( !(memflags & MEMF_no_refcount) && !--d->tot_pages )
         drop_dom_ref = 1;
     page_list_del(page, &d->page_list);
+    domain_adjust_node_pages(d, page, -1);
 
     spin_unlock(&d->page_alloc_lock);
     if ( unlikely(drop_dom_ref) )
@@ -642,6 +642,7 @@ static int page_make_sharable(struct domain *d,
     d->tot_pages--;
     drop_dom_ref = (d->tot_pages == 0);
     page_list_del(page, &d->page_list);
+    domain_adjust_node_pages(d, page, -1);
     spin_unlock(&d->page_alloc_lock);
 
     if ( drop_dom_ref )
@@ -683,6 +684,7 @@ static int page_make_private(struct domain *d, struct page_info *page)
     if ( d->tot_pages++ == 0 )
         get_domain(d);
     page_list_add_tail(page, &d->page_list);
+    domain_adjust_node_pages(d, page, 1);
     spin_unlock(&d->page_alloc_lock);
 
     put_page(page);
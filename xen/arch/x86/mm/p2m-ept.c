@@ -151,7 +151,9 @@ static void ept_free_entry(struct p2m_domain *p2m, ept_entry_t *ept_entry, int l
     if ( level > 1 )
     {
         ept_entry_t *epte = map_domain_page(ept_entry->mfn);
-        for ( int i = 0; i < EPT_PAGETABLE_ENTRIES; i++ )
+        int i;
+
+        for ( i = 0; i < EPT_PAGETABLE_ENTRIES; i++ )
             ept_free_entry(p2m, epte + i, level - 1);
         unmap_domain_page(epte);
     }
@@ -159,12 +161,35 @@ static void ept_free_entry(struct p2m_domain *p2m, ept_entry_t *ept_entry, int l
     p2m_free_ptp(p2m, mfn_to_page(ept_entry->mfn));
 }
 
+/* Add delta to the RAM statistics for an entry and the sub tree behind it */
+static void ept_account_entry(struct p2m_domain *p2m, ept_entry_t *ept_entry,
+                              int level, long delta)
+{
+    ept_entry_t *epte;
+    int i;
+
+    if ( ept_entry->epte == 0 )
+        return;
+
+    if ( level == 0 || !is_epte_present(ept_entry) ||
+         is_epte_superpage(ept_entry) )
+    {
+        p2m_account_leaf(p2m, level, ept_entry->sa_p2mt, delta);
+        return;
+    }
+
+    epte = map_domain_page(ept_entry->mfn);
+    for ( i = 0; i < EPT_PAGETABLE_ENTRIES; i++ )
+        ept_account_entry(p2m, epte + i, level - 1, delta);
+    unmap_domain_page(epte);
+}
+
 static int ept_split_super_page(struct p2m_domain *p2m, ept_entry_t *ept_entry,
                                 int level, int target)
 {
     ept_entry_t new_ept, *table;
     uint64_t trunk;
-    int rv = 1;
+    int i, rv = 1;
 
     /* End if the entry is a leaf entry or reaches the target level. */
     if ( level == 0 || level == target )
@@ -178,7 +203,7 @@ static int ept_split_super_page(struct p2m_domain *p2m, ept_entry_t *ept_entry,
     table = map_domain_page(new_ept.mfn);
     trunk = 1UL << ((level - 1) * EPT_TABLE_ORDER);
 
-    for ( int i = 0; i < EPT_PAGETABLE_ENTRIES; i++ )
+    for ( i = 0; i < EPT_PAGETABLE_ENTRIES; i++ )
     {
         ept_entry_t *epte = table + i;
 
@@ -376,6 +401,10 @@ ept_set_entry(struct p2m_domain *p2m, unsigned long gfn, mfn_t mfn,
         }
 
         atomic_write_ept_entry(ept_entry, new_entry);
+
+        /* The old sub tree, if any, is still intact until freed below. */
+        ept_account_entry(p2m, &old_entry, target, -1);
+        ept_account_entry(p2m, &new_entry, target, 1);
     }
     else
     {
@@ -393,6 +422,11 @@ ept_set_entry(struct p2m_domain *p2m, unsigned long gfn, mfn_t mfn,
             goto out;
         }
 
+        /* The superpage is now mapped by entries at the target level. */
+        p2m_account_leaf(p2m, i, ept_entry->sa_p2mt, -1);
+        p2m_account_leaf(p2m, target, ept_entry->sa_p2mt,
+                         1L << ((i - target) * EPT_TABLE_ORDER));
+
         /* now install the newly split ept sub-tree */
         /* NB: please make sure domian is paused and no in-fly VT-d DMA. */
         atomic_write_ept_entry(ept_entry, split_ept_entry);
@@ -424,7 +458,9 @@ ept_set_entry(struct p2m_domain *p2m, unsigned long gfn, mfn_t mfn,
 
         ept_p2m_type_to_flags(&new_entry, p2mt, p2ma);
 
+        ept_account_entry(p2m, ept_entry, target, -1);
         atomic_write_ept_entry(ept_entry, new_entry);
+        ept_account_entry(p2m, &new_entry, target, 1);
     }
 
     /* Track the highest gfn for which we have ever had a valid mapping */
@@ -751,8 +787,9 @@ static void ept_change_entry_type_page(mfn_t ept_page_mfn, int ept_page_level,
                                        p2m_type_t ot, p2m_type_t nt)
 {
     ept_entry_t e, *epte = map_domain_page(mfn_x(ept_page_mfn));
+    int i;
 
-    for ( int i = 0; i < EPT_PAGETABLE_ENTRIES; i++ )
+    for ( i = 0; i < EPT_PAGETABLE_ENTRIES; i++ )
     {
         if ( !is_epte_valid(epte + i) )
             continue;
@@ -63,10 +63,29 @@ static inline void unlock_page_alloc(struct p2m_domain *p2m)
  * Populate-on-demand functionality
  */
 
+/*
+ * Pages from domain_alloc and returned by the balloon driver aren't
+ * guaranteed to be zero; but by reclaiming zero pages, we implicitly
+ * promise to provide zero pages. So we scrub pages before using.
+ */
+static void
+p2m_pod_scrub(struct page_info *page, unsigned int order)
+{
+    unsigned long i;
+
+    for ( i = 0; i < (1UL << order); i++ )
+    {
+        char *b = map_domain_page(mfn_x(page_to_mfn(page)) + i);
+        clear_page(b);
+        unmap_domain_page(b);
+    }
+}
+
+/* Add already scrubbed pages to the cache. */
 static int
-p2m_pod_cache_add(struct p2m_domain *p2m,
-                  struct page_info *page,
-                  unsigned int order)
+p2m_pod_cache_insert(struct p2m_domain *p2m,
+                     struct page_info *page,
+                     unsigned int order)
 {
     int i;
     struct page_info *p;
@@ -102,18 +121,6 @@ p2m_pod_cache_add(struct p2m_domain *p2m,
 
     ASSERT(pod_locked_by_me(p2m));
 
-    /*
-     * Pages from domain_alloc and returned by the balloon driver aren't
-     * guaranteed to be zero; but by reclaiming zero pages, we implicitly
-     * promise to provide zero pages. So we scrub pages before using.
-     */
-    for ( i = 0; i < (1 << order); i++ )
-    {
-        char *b = map_domain_page(mfn_x(page_to_mfn(page)) + i);
-        clear_page(b);
-        unmap_domain_page(b);
-    }
-
     /* First, take all pages off the domain list */
     lock_page_alloc(p2m);
     for(i=0; i < 1 << order ; i++)
@@ -127,6 +134,10 @@ p2m_pod_cache_add(struct p2m_domain *p2m,
     /* Then add the first one to the appropriate populate-on-demand list */
     switch(order)
     {
+    case PAGE_ORDER_1G:
+        page_list_add_tail(page, &p2m->pod.huge); /* lock: page_alloc */
+        p2m->pod.count += 1 << order;
+        break;
     case PAGE_ORDER_2M:
         page_list_add_tail(page, &p2m->pod.super); /* lock: page_alloc */
         p2m->pod.count += 1 << order;
@@ -142,9 +153,46 @@ p2m_pod_cache_add(struct p2m_domain *p2m,
     return 0;
 }
 
+static int
+p2m_pod_cache_add(struct p2m_domain *p2m,
+                  struct page_info *page,
+                  unsigned int order)
+{
+    p2m_pod_scrub(page, order);
+    return p2m_pod_cache_insert(p2m, page, order);
+}
+
+/*
+ * Scrubbing a 1GB page is too long to do in one go under the PoD lock, so
+ * it is done 2MB at a time.  If preemption is needed part way, the part
+ * already scrubbed goes into the cache as superpages, the rest is freed
+ * and -EAGAIN returned.
+ */
+static int
+p2m_pod_cache_add_huge(struct p2m_domain *p2m, struct page_info *page)
+{
+    unsigned long i, j;
+
+    for ( i = 0; i < (1UL << PAGE_ORDER_1G); i += SUPERPAGE_PAGES )
+    {
+        if ( i && hypercall_preempt_check() )
+        {
+            for ( j = 0; j < i; j += SUPERPAGE_PAGES )
+                p2m_pod_cache_insert(p2m, page + j, PAGE_ORDER_2M);
+            for ( ; j < (1UL << PAGE_ORDER_1G); j += SUPERPAGE_PAGES )
+                free_domheap_pages(page + j, PAGE_ORDER_2M);
+            return -EAGAIN;
+        }
+        p2m_pod_scrub(page + i, PAGE_ORDER_2M);
+    }
+
+    return p2m_pod_cache_insert(p2m, page, PAGE_ORDER_1G);
+}
+
 /* Get a page of size order from the populate-on-demand cache.  Will break
- * down 2-meg pages into singleton pages automatically.  Returns null if
- * a superpage is requested and no superpages are available. */
+ * down 1-gig pages into 2-meg pages and 2-meg pages into singleton pages
+ * automatically.  Returns null if a superpage is requested and no pages
+ * of that size (or larger) are available. */
 static struct page_info * p2m_pod_cache_get(struct p2m_domain *p2m,
                                             unsigned int order)
 {
@@ -153,6 +201,24 @@ static struct page_info * p2m_pod_cache_get(struct p2m_domain *p2m,
 
     ASSERT(pod_locked_by_me(p2m));
 
+    if ( order == PAGE_ORDER_1G && page_list_empty(&p2m->pod.huge) )
+        return NULL;
+
+    if ( order != PAGE_ORDER_1G && page_list_empty(&p2m->pod.super)
+         && !page_list_empty(&p2m->pod.huge)
+         && (order == PAGE_ORDER_2M || page_list_empty(&p2m->pod.single)) )
+    {
+        unsigned long mfn;
+
+        /* Break up a 1-gig page to make superpages. NB count doesn't
+         * need to be adjusted. */
+        p = page_list_remove_head(&p2m->pod.huge);
+        mfn = mfn_x(page_to_mfn(p));
+
+        for ( i = 0; i < (1 << PAGE_ORDER_1G); i += SUPERPAGE_PAGES )
+            page_list_add_tail(mfn_to_page(_mfn(mfn + i)), &p2m->pod.super);
+    }
+
     if ( order == PAGE_ORDER_2M && page_list_empty(&p2m->pod.super) )
     {
         return NULL;
@@ -178,6 +244,10 @@ static struct page_info * p2m_pod_cache_get(struct p2m_domain *p2m,
 
     switch ( order )
     {
+    case PAGE_ORDER_1G:
+        p = page_list_remove_head(&p2m->pod.huge);
+        p2m->pod.count -= 1 << order;
+        break;
     case PAGE_ORDER_2M:
         BUG_ON( page_list_empty(&p2m->pod.super) );
         p = page_list_remove_head(&p2m->pod.super);
@@ -219,7 +289,13 @@ p2m_pod_set_cache_target(struct p2m_domain *p2m, unsigned long pod_target, int p
         struct page_info * page;
         int order;
 
-        if ( (pod_target - p2m->pod.count) >= SUPERPAGE_PAGES )
+        /* Only keep 1-gig pages if they can be mapped as such, and only
+         * when we can be preempted while scrubbing them. */
+        if ( (pod_target - p2m->pod.count) >= (1UL << PAGE_ORDER_1G)
+             && hap_enabled(d) && hvm_hap_has_1gb(d) && opt_hap_1gb
+             && preemptible )
+            order = PAGE_ORDER_1G;
+        else if ( (pod_target - p2m->pod.count) >= SUPERPAGE_PAGES )
             order = PAGE_ORDER_2M;
         else
             order = PAGE_ORDER_4K;
@@ -227,6 +303,12 @@ p2m_pod_set_cache_target(struct p2m_domain *p2m, unsigned long pod_target, int p
         page = alloc_domheap_pages(d, order, PAGE_ORDER_4K);
         if ( unlikely(page == NULL) )
         {
+            if ( order == PAGE_ORDER_1G )
+            {
+                order = PAGE_ORDER_2M;
+                goto retry;
+            }
+
             if ( order == PAGE_ORDER_2M )
             {
                 /* If we can't allocate a superpage, try singleton pages */
@@ -240,9 +322,12 @@ p2m_pod_set_cache_target(struct p2m_domain *p2m, unsigned long pod_target, int p
             goto out;
         }
 
-        p2m_pod_cache_add(p2m, page, order);
+        if ( order == PAGE_ORDER_1G )
+            ret = p2m_pod_cache_add_huge(p2m, page);
+        else
+            p2m_pod_cache_add(p2m, page, order);
 
-        if ( hypercall_preempt_check() && preemptible )
+        if ( ret || (hypercall_preempt_check() && preemptible) )
         {
             ret = -EAGAIN;
             goto out;
@@ -257,8 +342,11 @@ p2m_pod_set_cache_target(struct p2m_domain *p2m, unsigned long pod_target, int p
         struct page_info * page;
         int order, i;
 
+        /* 1-gig pages are released as superpages, so that freeing can be
+         * preempted. */
         if ( (p2m->pod.count - pod_target) > SUPERPAGE_PAGES
-             && !page_list_empty(&p2m->pod.super) )
+             && (!page_list_empty(&p2m->pod.super)
+                 || !page_list_empty(&p2m->pod.huge)) )
             order = PAGE_ORDER_2M;
         else
             order = PAGE_ORDER_4K;
@@ -386,6 +474,19 @@ p2m_pod_empty_cache(struct domain *d)
 
     lock_page_alloc(p2m);
 
+    while ( (page = page_list_remove_head(&p2m->pod.huge)) )
+    {
+        int i;
+
+        for ( i = 0 ; i < (1 << PAGE_ORDER_1G) ; i++ )
+        {
+            BUG_ON(page_get_owner(page + i) != d);
+            page_list_add_tail(page + i, &d->page_list);
+        }
+
+        p2m->pod.count -= 1 << PAGE_ORDER_1G;
+    }
+
     while ( (page = page_list_remove_head(&p2m->pod.super)) )
     {
         int i;
@@ -425,6 +526,22 @@ p2m_pod_offline_or_broken_hit(struct page_info *p)
 
     pod_lock(p2m);
     bmfn = mfn_x(page_to_mfn(p));
+
+    /* Break up a 1-gig page containing p; it is then found below. */
+    page_list_for_each_safe(q, tmp, &p2m->pod.huge)
+    {
+        mfn = mfn_x(page_to_mfn(q));
+        if ( (bmfn >= mfn) && ((bmfn - mfn) < (1UL << PAGE_ORDER_1G)) )
+        {
+            unsigned long i;
+            page_list_del(q, &p2m->pod.huge);
+            for ( i = 0; i < (1UL << PAGE_ORDER_1G); i += SUPERPAGE_PAGES )
+                page_list_add_tail(mfn_to_page(_mfn(mfn + i)),
+                                   &p2m->pod.super);
+            break;
+        }
+    }
+
     page_list_for_each_safe(q, tmp, &p2m->pod.super)
     {
         mfn = mfn_x(page_to_mfn(q));
@@ -919,11 +1036,16 @@ p2m_pod_check_last_super(struct p2m_domain *p2m, unsigned long gfn_aligned)
 
 
 #define POD_SWEEP_STRIDE  16
+
+/* Unless split is set, superpage mappings are only reclaimed as a whole
+ * (2-meg mappings) or skipped (1-gig mappings), rather than shattered by
+ * checking their 4k pages individually. */
 static void
-p2m_pod_emergency_sweep(struct p2m_domain *p2m)
+p2m_pod_emergency_sweep(struct p2m_domain *p2m, bool_t split)
 {
     unsigned long gfns[POD_SWEEP_STRIDE];
     unsigned long i, j=0, start, limit;
+    unsigned int order;
     p2m_type_t t;
 
 
@@ -933,7 +1055,6 @@ p2m_pod_emergency_sweep(struct p2m_domain *p2m)
     start = p2m->pod.reclaim_single;
     limit = (start > POD_SWEEP_LIMIT) ? (start - POD_SWEEP_LIMIT) : 0;
 
-    /* FIXME: Figure out how to avoid superpages */
     /* NOTE: Promote to globally locking the p2m. This will get complicated
      * in a fine-grained scenario. If we lock each gfn individually we must be
      * careful about spinlock recursion limits and POD_SWEEP_STRIDE. */
@@ -941,8 +1062,20 @@ p2m_pod_emergency_sweep(struct p2m_domain *p2m)
     for ( i=p2m->pod.reclaim_single; i > 0 ; i-- )
     {
         p2m_access_t a;
-        (void)p2m->get_entry(p2m, i, &t, &a, 0, NULL);
-        if ( p2m_is_ram(t) )
+        order = PAGE_ORDER_4K;
+        (void)p2m->get_entry(p2m, i, &t, &a, 0, &order);
+        if ( p2m_is_ram(t) && order != PAGE_ORDER_4K && !split )
+        {
+            unsigned long base = i & ~((1UL << order) - 1);
+
+            if ( order == PAGE_ORDER_2M )
+                p2m_pod_zero_check_superpage(p2m, base);
+            /* Continue below the superpage. */
+            i = base;
+            if ( i == 0 )
+                break;
+        }
+        else if ( p2m_is_ram(t) )
         {
             gfns[j] = i;
             j++;
@@ -991,9 +1124,9 @@ p2m_pod_demand_populate(struct p2m_domain *p2m, unsigned long gfn,
         goto out_fail;
 
     
-    /* Because PoD does not have cache list for 1GB pages, it has to remap
-     * 1GB region to 2MB chunks for a retry. */
-    if ( order == PAGE_ORDER_1G )
+    /* Without a 1GB page in the cache, remap the 1GB region to 2MB chunks
+     * for a retry. */
+    if ( order == PAGE_ORDER_1G && page_list_empty(&p2m->pod.huge) )
     {
         pod_unlock(p2m);
         gfn_aligned = (gfn >> order) << order;
@@ -1011,9 +1144,12 @@ p2m_pod_demand_populate(struct p2m_domain *p2m, unsigned long gfn,
     }
 
     /* Only sweep if we're actually out of memory.  Doing anything else
-     * causes unnecessary time and fragmentation of superpages in the p2m. */
+     * causes unnecessary time and fragmentation of superpages in the p2m.
+     * Only shatter superpage mappings if nothing else could be found. */
+    if ( p2m->pod.count == 0 )
+        p2m_pod_emergency_sweep(p2m, 0);
     if ( p2m->pod.count == 0 )
-        p2m_pod_emergency_sweep(p2m);
+        p2m_pod_emergency_sweep(p2m, 1);
 
     /* If the sweep failed, give up. */
     if ( p2m->pod.count == 0 )
@@ -141,7 +141,9 @@ p2m_free_entry(struct p2m_domain *p2m, l1_pgentry_t *p2m_entry, int page_order)
     if ( page_order > PAGE_ORDER_2M )
     {
         l1_pgentry_t *l3_table = map_domain_page(l1e_get_pfn(*p2m_entry));
-        for ( int i = 0; i < L3_PAGETABLE_ENTRIES; i++ )
+        int i;
+
+        for ( i = 0; i < L3_PAGETABLE_ENTRIES; i++ )
             p2m_free_entry(p2m, l3_table + i, page_order - 9);
         unmap_domain_page(l3_table);
     }
@@ -149,6 +151,32 @@ p2m_free_entry(struct p2m_domain *p2m, l1_pgentry_t *p2m_entry, int page_order)
     p2m_free_ptp(p2m, mfn_to_page(_mfn(l1e_get_pfn(*p2m_entry))));
 }
 
+/* Add delta to the RAM statistics for an entry and the sub-tree behind it */
+static void
+p2m_account_entry(struct p2m_domain *p2m, l1_pgentry_t entry,
+                  int page_order, long delta)
+{
+    unsigned long flags = l1e_get_flags(entry);
+    l1_pgentry_t *table;
+    int i;
+
+    if ( flags == 0 )
+        return;
+
+    if ( page_order == PAGE_ORDER_4K || !(flags & _PAGE_PRESENT)
+         || (flags & _PAGE_PSE) )
+    {
+        p2m_account_leaf(p2m, page_order / PAGETABLE_ORDER,
+                         p2m_flags_to_type(flags), delta);
+        return;
+    }
+
+    table = map_domain_page(l1e_get_pfn(entry));
+    for ( i = 0; i < L1_PAGETABLE_ENTRIES; i++ )
+        p2m_account_entry(p2m, table[i], page_order - PAGETABLE_ORDER, delta);
+    unmap_domain_page(table);
+}
+
 // Walk one level of the P2M table, allocating a new table if required.
 // Returns 0 on error.
 //
@@ -230,6 +258,10 @@ p2m_next_level(struct p2m_domain *p2m, mfn_t *table_mfn, void **table,
         flags = l1e_get_flags(*p2m_entry);
         pfn = l1e_get_pfn(*p2m_entry);
 
+        p2m_account_leaf(p2m, 2, p2m_flags_to_type(flags), -1);
+        p2m_account_leaf(p2m, 1, p2m_flags_to_type(flags),
+                         L2_PAGETABLE_ENTRIES);
+
         l1_entry = map_domain_page(mfn_x(page_to_mfn(pg)));
         for ( i = 0; i < L2_PAGETABLE_ENTRIES; i++ )
         {
@@ -260,6 +292,11 @@ p2m_next_level(struct p2m_domain *p2m, mfn_t *table_mfn, void **table,
          * with a little reorganisation for the _PAGE_PSE_PAT bit. */
         flags = l1e_get_flags(*p2m_entry);
         pfn = l1e_get_pfn(*p2m_entry);
+
+        p2m_account_leaf(p2m, 1, p2m_flags_to_type(flags), -1);
+        p2m_account_leaf(p2m, 0, p2m_flags_to_type(flags),
+                         L1_PAGETABLE_ENTRIES);
+
         if ( pfn & 1 )           /* ==> _PAGE_PSE_PAT was set */
             pfn -= 1;            /* Clear it; _PAGE_PSE becomes _PAGE_PAT */
         else
@@ -363,8 +400,10 @@ p2m_set_entry(struct p2m_domain *p2m, unsigned long gfn, mfn_t mfn,
             old_mfn = l1e_get_pfn(*p2m_entry);
         }
 
+        p2m_account_entry(p2m, *p2m_entry, page_order, -1);
         p2m->write_p2m_entry(p2m, gfn, p2m_entry, table_mfn, entry_content, 3);
         /* NB: paging_write_p2m_entry() handles tlb flushes properly */
+        p2m_account_entry(p2m, entry_content, page_order, 1);
 
         /* Free old intermediate tables if necessary */
         if ( l1e_get_flags(old_entry) & _PAGE_PRESENT )
@@ -409,8 +448,10 @@ p2m_set_entry(struct p2m_domain *p2m, unsigned long gfn, mfn_t mfn,
             old_mfn = l1e_get_pfn(*p2m_entry);
         }
         /* level 1 entry */
+        p2m_account_entry(p2m, *p2m_entry, page_order, -1);
         p2m->write_p2m_entry(p2m, gfn, p2m_entry, table_mfn, entry_content, 1);
         /* NB: paging_write_p2m_entry() handles tlb flushes properly */
+        p2m_account_entry(p2m, entry_content, page_order, 1);
     }
     else if ( page_order == PAGE_ORDER_2M )
     {
@@ -445,8 +486,10 @@ p2m_set_entry(struct p2m_domain *p2m, unsigned long gfn, mfn_t mfn,
             old_mfn = l1e_get_pfn(*p2m_entry);
         }
 
+        p2m_account_entry(p2m, *p2m_entry, page_order, -1);
         p2m->write_p2m_entry(p2m, gfn, p2m_entry, table_mfn, entry_content, 2);
         /* NB: paging_write_p2m_entry() handles tlb flushes properly */
+        p2m_account_entry(p2m, entry_content, page_order, 1);
 
         /* Free old intermediate tables if necessary */
         if ( l1e_get_flags(old_entry) & _PAGE_PRESENT )
@@ -472,7 +515,7 @@ p2m_set_entry(struct p2m_domain *p2m, unsigned long gfn, mfn_t mfn,
                     iommu_map_page(p2m->domain, gfn+i, mfn_x(mfn)+i,
                                    IOMMUF_readable|IOMMUF_writable);
             else
-                for ( int i = 0; i < (1UL << page_order); i++ )
+                for ( i = 0; i < (1UL << page_order); i++ )
                     iommu_unmap_page(p2m->domain, gfn+i);
         }
     }
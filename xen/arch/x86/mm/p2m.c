@@ -75,6 +75,7 @@ static void p2m_initialise(struct domain *d, struct p2m_domain *p2m)
     mm_lock_init(&p2m->pod.lock);
     INIT_LIST_HEAD(&p2m->np2m_list);
     INIT_PAGE_LIST_HEAD(&p2m->pages);
+    INIT_PAGE_LIST_HEAD(&p2m->pod.huge);
     INIT_PAGE_LIST_HEAD(&p2m->pod.super);
     INIT_PAGE_LIST_HEAD(&p2m->pod.single);
 
@@ -440,6 +441,7 @@ void p2m_teardown(struct p2m_domain *p2m)
 #endif
 
     p2m->phys_table = pagetable_null();
+    memset(p2m->ram_entries, 0, sizeof(p2m->ram_entries));
 
     while ( (pg = page_list_remove_head(&p2m->pages)) )
         d->arch.paging.free_page(d, pg);
@@ -475,6 +477,23 @@ void p2m_final_teardown(struct domain *d)
     p2m_teardown_nestedp2m(d);
 }
 
+void p2m_dump_stats(struct domain *d)
+{
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+    unsigned long pages[3], total = 0;
+    int i;
+
+    for ( i = 0; i < 3; i++ )
+    {
+        pages[i] = p2m->ram_entries[i] << (i * PAGETABLE_ORDER);
+        total += pages[i];
+    }
+
+    printk("    P2M RAM pages: 4k=%lu 2M=%lu 1G=%lu (%lu%% in superpages)\n",
+           pages[0], pages[1], pages[2],
+           total ? (pages[1] + pages[2]) * 100 / total : 0);
+}
+
 
 static void
 p2m_remove_page(struct p2m_domain *p2m, unsigned long gfn, unsigned long mfn,
@@ -1464,6 +1483,7 @@ p2m_flush_table(struct p2m_domain *p2m)
      * care when discarding them */
     ASSERT(p2m_is_nestedp2m(p2m));
     /* Nested p2m's do not do pod, hence the asserts (and no pod lock)*/
+    ASSERT(page_list_empty(&p2m->pod.huge));
     ASSERT(page_list_empty(&p2m->pod.super));
     ASSERT(page_list_empty(&p2m->pod.single));
 
@@ -1475,6 +1495,7 @@ p2m_flush_table(struct p2m_domain *p2m)
     p = __map_domain_page(top);
     clear_page(p);
     unmap_domain_page(p);
+    memset(p2m->ram_entries, 0, sizeof(p2m->ram_entries));
 
     /* Make sure nobody else is using this p2m table */
     nestedhvm_vmcx_flushtlb(p2m);
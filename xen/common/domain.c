@@ -122,6 +122,8 @@ struct vcpu *alloc_vcpu(
 
     spin_lock_init(&v->virq_lock);
 
+    grant_table_init_vcpu(v);
+
     tasklet_init(&v->continue_hypercall_tasklet, NULL, 0);
 
     if ( !zalloc_cpumask_var(&v->cpu_affinity) ||
@@ -219,6 +221,7 @@ struct domain *domain_create(
     spin_lock_init_prof(d, domain_lock);
     spin_lock_init_prof(d, page_alloc_lock);
     spin_lock_init(&d->hypercall_deadlock_mutex);
+    spin_lock_init(&d->populate_lock);
     INIT_PAGE_LIST_HEAD(&d->page_list);
     INIT_PAGE_LIST_HEAD(&d->xenpage_list);
 
@@ -283,6 +286,10 @@ struct domain *domain_create(
         d->mem_event = xzalloc(struct mem_event_per_domain);
         if ( !d->mem_event )
             goto fail;
+
+        d->node_pages = xzalloc_array(unsigned long, MAX_NUMNODES);
+        if ( !d->node_pages )
+            goto fail;
     }
 
     if ( (err = arch_domain_create(d, domcr_flags)) != 0 )
@@ -315,6 +322,7 @@ struct domain *domain_create(
     d->is_dying = DOMDYING_dead;
     atomic_set(&d->refcnt, DOMAIN_DESTROYED);
     xfree(d->mem_event);
+    xfree(d->node_pages);
     if ( init_status & INIT_arch )
         arch_domain_destroy(d);
     if ( init_status & INIT_gnttab )
@@ -670,6 +678,8 @@ static void complete_domain_destroy(struct rcu_head *head)
 #endif
 
     xfree(d->mem_event);
+    xfree(d->node_pages);
+    xfree(d->populate_fallback);
 
     for ( i = d->max_vcpus - 1; i >= 0; i-- )
         if ( (v = d->vcpu[i]) != NULL )
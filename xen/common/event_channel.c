@@ -26,6 +26,7 @@
 #include <xen/compat.h>
 #include <xen/guest_access.h>
 #include <xen/keyhandler.h>
+#include <xen/event_fifo.h>
 #include <asm/current.h>
 
 #include <public/xen.h>
@@ -91,9 +92,6 @@ static uint8_t get_xen_consumer(xen_event_channel_notification_t fn)
     return i+1;
 }
 
-/* Get the notification function for a given Xen-bound event channel. */
-#define xen_notification_fn(e) (xen_consumers[(e)->xen_consumer-1])
-
 static void evtchn_set_pending(struct vcpu *v, int port);
 
 static int virq_is_global(uint32_t virq)
@@ -121,9 +119,38 @@ static int virq_is_global(uint32_t virq)
 }
 
 
+/*
+ * Per-channel locks let evtchn_send() run without the domain's event_lock.
+ * Any change to a channel's state (and to the remote binding of an
+ * interdomain channel) is made holding both event_lock and the channel's
+ * lock; for an interdomain pair, both channels' locks.
+ */
+static void double_evtchn_lock(struct evtchn *lchn, struct evtchn *rchn)
+{
+    if ( lchn < rchn )
+    {
+        spin_lock(&lchn->lock);
+        spin_lock(&rchn->lock);
+    }
+    else
+    {
+        if ( lchn != rchn )
+            spin_lock(&rchn->lock);
+        spin_lock(&lchn->lock);
+    }
+}
+
+static void double_evtchn_unlock(struct evtchn *lchn, struct evtchn *rchn)
+{
+    spin_unlock(&lchn->lock);
+    if ( lchn != rchn )
+        spin_unlock(&rchn->lock);
+}
+
 static int get_free_port(struct domain *d)
 {
     struct evtchn *chn;
+    struct evtchn **grp;
     int            port;
     int            i, j;
 
@@ -131,12 +158,23 @@ static int get_free_port(struct domain *d)
         return -EINVAL;
 
     for ( port = 0; port_is_valid(d, port); port++ )
-        if ( evtchn_from_port(d, port)->state == ECS_FREE )
+        if ( evtchn_from_port(d, port)->state == ECS_FREE &&
+             !evtchn_port_is_busy(d, port) )
             return port;
 
     if ( port == MAX_EVTCHNS(d) )
         return -ENOSPC;
 
+    if ( group_from_port(d, port) == NULL )
+    {
+        grp = xzalloc_array(struct evtchn *, BUCKETS_PER_GROUP);
+        if ( unlikely(grp == NULL) )
+            return -ENOMEM;
+        /* evtchn_send() walks the group and bucket arrays without locks. */
+        smp_wmb();
+        group_from_port(d, port) = grp;
+    }
+
     chn = xzalloc_array(struct evtchn, EVTCHNS_PER_BUCKET);
     if ( unlikely(chn == NULL) )
         return -ENOMEM;
@@ -150,8 +188,12 @@ static int get_free_port(struct domain *d)
             xfree(chn);
             return -ENOMEM;
         }
+        spin_lock_init(&chn[i].lock);
+        chn[i].priority      = EVTCHN_FIFO_PRIORITY_DEFAULT;
+        chn[i].last_priority = EVTCHN_FIFO_PRIORITY_DEFAULT;
     }
 
+    smp_wmb();
     bucket_from_port(d, port) = chn;
 
     return port;
@@ -180,10 +222,14 @@ static long evtchn_alloc_unbound(evtchn_alloc_unbound_t *alloc)
     if ( rc )
         goto out;
 
+    spin_lock(&chn->lock);
+
     chn->state = ECS_UNBOUND;
     if ( (chn->u.unbound.remote_domid = alloc->remote_dom) == DOMID_SELF )
         chn->u.unbound.remote_domid = current->domain->domain_id;
 
+    spin_unlock(&chn->lock);
+
     alloc->port = port;
 
  out:
@@ -236,14 +282,18 @@ static long evtchn_bind_interdomain(evtchn_bind_interdomain_t *bind)
     if ( rc )
         goto out;
 
+    double_evtchn_lock(lchn, rchn);
+
     lchn->u.interdomain.remote_dom  = rd;
-    lchn->u.interdomain.remote_port = (u16)rport;
+    lchn->u.interdomain.remote_port = rport;
     lchn->state                     = ECS_INTERDOMAIN;
     
     rchn->u.interdomain.remote_dom  = ld;
-    rchn->u.interdomain.remote_port = (u16)lport;
+    rchn->u.interdomain.remote_port = lport;
     rchn->state                     = ECS_INTERDOMAIN;
 
+    double_evtchn_unlock(lchn, rchn);
+
     /*
      * We may have lost notifications on the remote unbound port. Fix that up
      * here by conservatively always setting a notification on the local port.
@@ -290,10 +340,15 @@ static long evtchn_bind_virq(evtchn_bind_virq_t *bind)
         ERROR_EXIT(port);
 
     chn = evtchn_from_port(d, port);
+
+    spin_lock(&chn->lock);
+
     chn->state          = ECS_VIRQ;
     chn->notify_vcpu_id = vcpu;
     chn->u.virq         = virq;
 
+    spin_unlock(&chn->lock);
+
     v->virq_to_evtchn[virq] = bind->port = port;
 
  out:
@@ -320,9 +375,14 @@ static long evtchn_bind_ipi(evtchn_bind_ipi_t *bind)
         ERROR_EXIT(port);
 
     chn = evtchn_from_port(d, port);
+
+    spin_lock(&chn->lock);
+
     chn->state          = ECS_IPI;
     chn->notify_vcpu_id = vcpu;
 
+    spin_unlock(&chn->lock);
+
     bind->port = port;
 
  out:
@@ -397,10 +457,14 @@ static long evtchn_bind_pirq(evtchn_bind_pirq_t *bind)
         goto out;
     }
 
+    spin_lock(&chn->lock);
+
     chn->state  = ECS_PIRQ;
     chn->u.pirq.irq = pirq;
     link_pirq_port(port, chn, v);
 
+    spin_unlock(&chn->lock);
+
     bind->port = port;
 
 #ifdef CONFIG_X86
@@ -415,11 +479,11 @@ static long evtchn_bind_pirq(evtchn_bind_pirq_t *bind)
 }
 
 
-static long __evtchn_close(struct domain *d1, int port1)
+static long __evtchn_close(struct domain *d1, int port1, bool_t guest)
 {
     struct domain *d2 = NULL;
     struct vcpu   *v;
-    struct evtchn *chn1, *chn2;
+    struct evtchn *chn1, *chn2 = NULL;
     int            port2;
     long           rc = 0;
 
@@ -435,7 +499,7 @@ static long __evtchn_close(struct domain *d1, int port1)
     chn1 = evtchn_from_port(d1, port1);
 
     /* Guest cannot close a Xen-attached event channel. */
-    if ( unlikely(consumer_is_xen(chn1)) )
+    if ( unlikely(consumer_is_xen(chn1)) && guest )
     {
         rc = -EINVAL;
         goto out;
@@ -520,21 +584,36 @@ static long __evtchn_close(struct domain *d1, int port1)
         chn2 = evtchn_from_port(d2, port2);
         BUG_ON(chn2->state != ECS_INTERDOMAIN);
         BUG_ON(chn2->u.interdomain.remote_dom != d1);
-
-        chn2->state = ECS_UNBOUND;
-        chn2->u.unbound.remote_domid = d1->domain_id;
         break;
 
     default:
         BUG();
     }
 
+    if ( chn2 != NULL )
+    {
+        double_evtchn_lock(chn1, chn2);
+
+        chn2->state = ECS_UNBOUND;
+        chn2->u.unbound.remote_domid = d1->domain_id;
+    }
+    else
+        spin_lock(&chn1->lock);
+
     /* Clear pending event to avoid unexpected behavior on re-bind. */
-    clear_bit(port1, &shared_info(d1, evtchn_pending));
+    evtchn_port_clear_pending(d1, port1);
 
-    /* Reset binding to vcpu0 when the channel is freed. */
+    /* Reset binding to vcpu0 and priority when the channel is freed. */
     chn1->state          = ECS_FREE;
+    chn1->xen_consumer   = 0;
     chn1->notify_vcpu_id = 0;
+    chn1->priority       = EVTCHN_FIFO_PRIORITY_DEFAULT;
+    chn1->pending        = 0;
+
+    if ( chn2 != NULL )
+        double_evtchn_unlock(chn1, chn2);
+    else
+        spin_unlock(&chn1->lock);
 
     xsm_evtchn_close_post(chn1);
 
@@ -554,30 +633,34 @@ static long __evtchn_close(struct domain *d1, int port1)
 
 static long evtchn_close(evtchn_close_t *close)
 {
-    return __evtchn_close(current->domain, close->port);
+    return __evtchn_close(current->domain, close->port, 1);
 }
 
+/*
+ * Sending only needs the local channel's lock: while it is held the
+ * channel cannot change state, and an interdomain channel cannot be
+ * unbound from its remote end (see double_evtchn_lock()).  Buckets are
+ * only freed once the domain is dying and all its channels are closed.
+ */
 int evtchn_send(struct domain *d, unsigned int lport)
 {
     struct evtchn *lchn, *rchn;
     struct domain *ld = d, *rd;
     struct vcpu   *rvcpu;
     int            rport, ret = 0;
-
-    spin_lock(&ld->event_lock);
+    unsigned int   consumer;
 
     if ( unlikely(!port_is_valid(ld, lport)) )
-    {
-        spin_unlock(&ld->event_lock);
         return -EINVAL;
-    }
 
     lchn = evtchn_from_port(ld, lport);
 
+    spin_lock(&lchn->lock);
+
     /* Guest cannot send via a Xen-attached event channel. */
     if ( unlikely(consumer_is_xen(lchn)) )
     {
-        spin_unlock(&ld->event_lock);
+        spin_unlock(&lchn->lock);
         return -EINVAL;
     }
 
@@ -592,8 +675,10 @@ int evtchn_send(struct domain *d, unsigned int lport)
         rport = lchn->u.interdomain.remote_port;
         rchn  = evtchn_from_port(rd, rport);
         rvcpu = rd->vcpu[rchn->notify_vcpu_id];
-        if ( consumer_is_xen(rchn) )
-            (*xen_notification_fn(rchn))(rvcpu, rport);
+        /* Read once: we do not hold the remote channel's lock. */
+        consumer = read_atomic(&rchn->xen_consumer);
+        if ( consumer )
+            (*xen_consumers[consumer - 1])(rvcpu, rport);
         else
             evtchn_set_pending(rvcpu, rport);
         break;
@@ -608,33 +693,21 @@ int evtchn_send(struct domain *d, unsigned int lport)
     }
 
 out:
-    spin_unlock(&ld->event_lock);
+    spin_unlock(&lchn->lock);
 
     return ret;
 }
 
 static void evtchn_set_pending(struct vcpu *v, int port)
 {
-    struct domain *d = v->domain;
-    int vcpuid;
-
-    /*
-     * The following bit operations must happen in strict order.
-     * NB. On x86, the atomic bit operations also act as memory barriers.
-     * There is therefore sufficiently strict ordering for this architecture --
-     * others may require explicit memory barriers.
-     */
+    evtchn_port_set_pending(v, port);
+}
 
-    if ( test_and_set_bit(port, &shared_info(d, evtchn_pending)) )
-        return;
+void evtchn_check_pollers(struct domain *d, unsigned int port)
+{
+    struct vcpu *v;
+    int vcpuid;
 
-    if ( !test_bit        (port, &shared_info(d, evtchn_mask)) &&
-         !test_and_set_bit(port / BITS_PER_EVTCHN_WORD(d),
-                           &vcpu_info(v, evtchn_pending_sel)) )
-    {
-        vcpu_mark_events_pending(v);
-    }
-    
     /* Check if some VCPU might be polling for this event. */
     if ( likely(bitmap_empty(d->poll_mask, d->max_vcpus)) )
         return;
@@ -920,31 +993,37 @@ long evtchn_bind_vcpu(unsigned int port, unsigned int vcpu_id)
 int evtchn_unmask(unsigned int port)
 {
     struct domain *d = current->domain;
-    struct vcpu   *v;
 
     ASSERT(spin_is_locked(&d->event_lock));
 
     if ( unlikely(!port_is_valid(d, port)) )
         return -EINVAL;
 
-    v = d->vcpu[evtchn_from_port(d, port)->notify_vcpu_id];
-
-    /*
-     * These operations must happen in strict order. Based on
-     * include/xen/event.h:evtchn_set_pending(). 
-     */
-    if ( test_and_clear_bit(port, &shared_info(d, evtchn_mask)) &&
-         test_bit          (port, &shared_info(d, evtchn_pending)) &&
-         !test_and_set_bit (port / BITS_PER_EVTCHN_WORD(d),
-                            &vcpu_info(v, evtchn_pending_sel)) )
-    {
-        vcpu_mark_events_pending(v);
-    }
+    evtchn_port_unmask(d, port);
 
     return 0;
 }
 
 
+static long evtchn_set_priority(const struct evtchn_set_priority *set_priority)
+{
+    struct domain *d = current->domain;
+    unsigned int port = set_priority->port;
+    long rc;
+
+    spin_lock(&d->event_lock);
+
+    if ( !port_is_valid(d, port) )
+        rc = -EINVAL;
+    else
+        rc = evtchn_port_set_priority(d, port, set_priority->priority);
+
+    spin_unlock(&d->event_lock);
+
+    return rc;
+}
+
+
 static long evtchn_reset(evtchn_reset_t *r)
 {
     domid_t dom = r->dom;
@@ -960,7 +1039,7 @@ static long evtchn_reset(evtchn_reset_t *r)
         goto out;
 
     for ( i = 0; port_is_valid(d, i); i++ )
-        (void)__evtchn_close(d, i);
+        (void)__evtchn_close(d, i, 1);
 
     rc = 0;
 
@@ -1079,6 +1158,32 @@ long do_event_channel_op(int cmd, XEN_GUEST_HANDLE(void) arg)
         break;
     }
 
+    case EVTCHNOP_init_control: {
+        struct evtchn_init_control init_control;
+        if ( copy_from_guest(&init_control, arg, 1) != 0 )
+            return -EFAULT;
+        rc = evtchn_fifo_init_control(&init_control);
+        if ( (rc == 0) && (copy_to_guest(arg, &init_control, 1) != 0) )
+            rc = -EFAULT;
+        break;
+    }
+
+    case EVTCHNOP_expand_array: {
+        struct evtchn_expand_array expand_array;
+        if ( copy_from_guest(&expand_array, arg, 1) != 0 )
+            return -EFAULT;
+        rc = evtchn_fifo_expand_array(&expand_array);
+        break;
+    }
+
+    case EVTCHNOP_set_priority: {
+        struct evtchn_set_priority set_priority;
+        if ( copy_from_guest(&set_priority, arg, 1) != 0 )
+            return -EFAULT;
+        rc = evtchn_set_priority(&set_priority);
+        break;
+    }
+
     default:
         rc = -ENOSYS;
         break;
@@ -1104,11 +1209,15 @@ int alloc_unbound_xen_event_channel(
 
     rc = xsm_evtchn_unbound(d, chn, remote_domid);
 
+    spin_lock(&chn->lock);
+
     chn->state = ECS_UNBOUND;
     chn->xen_consumer = get_xen_consumer(notification_fn);
     chn->notify_vcpu_id = local_vcpu->vcpu_id;
     chn->u.unbound.remote_domid = !rc ? remote_domid : DOMID_INVALID;
 
+    spin_unlock(&chn->lock);
+
  out:
     spin_unlock(&d->event_lock);
 
@@ -1133,11 +1242,10 @@ void free_xen_event_channel(
     BUG_ON(!port_is_valid(d, port));
     chn = evtchn_from_port(d, port);
     BUG_ON(!consumer_is_xen(chn));
-    chn->xen_consumer = 0;
 
     spin_unlock(&d->event_lock);
 
-    (void)__evtchn_close(d, port);
+    (void)__evtchn_close(d, port, 0);
 }
 
 
@@ -1173,6 +1281,8 @@ void notify_via_xen_event_channel(struct domain *ld, int lport)
 
 int evtchn_init(struct domain *d)
 {
+    evtchn_2l_init(d);
+
     spin_lock_init(&d->event_lock);
     if ( get_free_port(d) != 0 )
         return -EINVAL;
@@ -1199,19 +1309,14 @@ void evtchn_destroy(struct domain *d)
 
     /* Close all existing event channels. */
     for ( i = 0; port_is_valid(d, i); i++ )
-    {
-        evtchn_from_port(d, i)->xen_consumer = 0;
-        (void)__evtchn_close(d, i);
-    }
+        (void)__evtchn_close(d, i, 0);
 
-    /* Free all event-channel buckets. */
+    /*
+     * Buckets are freed in evtchn_destroy_final(): evtchn_send() may still
+     * be looking up a port by the time we get here.
+     */
     spin_lock(&d->event_lock);
-    for ( i = 0; i < NR_EVTCHN_BUCKETS; i++ )
-    {
-        xsm_free_security_evtchn(d->evtchn[i]);
-        xfree(d->evtchn[i]);
-        d->evtchn[i] = NULL;
-    }
+    evtchn_fifo_destroy(d);
     spin_unlock(&d->event_lock);
 
     clear_global_virq_handlers(d);
@@ -1220,6 +1325,22 @@ void evtchn_destroy(struct domain *d)
 
 void evtchn_destroy_final(struct domain *d)
 {
+    unsigned int i, j;
+
+    /* Free all event-channel buckets. */
+    for ( i = 0; i < NR_EVTCHN_GROUPS; i++ )
+    {
+        if ( d->evtchn_group[i] == NULL )
+            continue;
+        for ( j = 0; j < BUCKETS_PER_GROUP; j++ )
+        {
+            xsm_free_security_evtchn(d->evtchn_group[i][j]);
+            xfree(d->evtchn_group[i][j]);
+        }
+        xfree(d->evtchn_group[i]);
+        d->evtchn_group[i] = NULL;
+    }
+
 #if MAX_VIRT_CPUS > BITS_PER_LONG
     xfree(d->poll_mask);
     d->poll_mask = NULL;
@@ -1270,9 +1391,11 @@ static void domain_dump_evtchn_info(struct domain *d)
 
         printk("    %4u [%d/%d]: s=%d n=%d x=%d",
                port,
-               !!test_bit(port, &shared_info(d, evtchn_pending)),
-               !!test_bit(port, &shared_info(d, evtchn_mask)),
+               !!evtchn_port_is_pending(d, port),
+               !!evtchn_port_is_masked(d, port),
                chn->state, chn->notify_vcpu_id, chn->xen_consumer);
+        if ( d->evtchn_fifo )
+            printk(" q=%d", chn->priority);
 
         switch ( chn->state )
         {
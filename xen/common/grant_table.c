@@ -109,6 +109,15 @@ static unsigned inline int max_nr_maptrack_frames(void)
 
 #define MAPTRACK_TAIL (~0u)
 
+/*
+ * Each vCPU keeps its own list of free maptrack handles, so that map and
+ * unmap do not take the grant table lock. Handles move between a vCPU's list
+ * and the shared list in t->maptrack_head in batches; a vCPU which finds
+ * both empty and the table at its limit steals from its siblings. [POLICY]
+ */
+#define MAPTRACK_BATCH 32
+#define MAPTRACK_HIGH  (4 * MAPTRACK_BATCH)
+
 #define SHGNT_PER_PAGE_V1 (PAGE_SIZE / sizeof(grant_entry_v1_t))
 #define shared_entry_v1(t, e) \
     ((t)->shared_v1[(e)/SHGNT_PER_PAGE_V1][(e)%SHGNT_PER_PAGE_V1])
@@ -219,39 +228,125 @@ static struct domain *gt_lock_target_domain_by_id(domid_t dom)
     return ERR_PTR(rc);
 }
 
-static inline int
-__get_maptrack_handle(
-    struct grant_table *t)
+/*
+ * Detach up to @nr handles from the free list at @head. Returns the first
+ * one, or MAPTRACK_TAIL, and the last one and count in @last and @taken.
+ */
+static unsigned int
+maptrack_take(
+    struct grant_table *t, unsigned int *head, unsigned int nr,
+    unsigned int *last, unsigned int *taken)
 {
-    unsigned int h;
-    if ( unlikely((h = t->maptrack_head) == MAPTRACK_TAIL) )
-        return -1;
-    t->maptrack_head = maptrack_entry(t, h).ref;
-    return h;
+    unsigned int first = *head, h = first, n = 0;
+
+    if ( first == MAPTRACK_TAIL )
+        return MAPTRACK_TAIL;
+
+    for ( ; ; )
+    {
+        *last = h;
+        n++;
+        if ( n == nr || maptrack_entry(t, h).ref == MAPTRACK_TAIL )
+            break;
+        h = maptrack_entry(t, h).ref;
+    }
+
+    *head = maptrack_entry(t, h).ref;
+    maptrack_entry(t, h).ref = MAPTRACK_TAIL;
+    *taken = n;
+
+    return first;
+}
+
+/* Prepend the chain @first..@last to the free list at @head. */
+static inline void
+maptrack_splice(
+    struct grant_table *t, unsigned int *head, unsigned int first,
+    unsigned int last)
+{
+    maptrack_entry(t, last).ref = *head;
+    *head = first;
 }
 
 static inline void
 put_maptrack_handle(
     struct grant_table *t, int handle)
 {
-    spin_lock(&t->lock);
-    maptrack_entry(t, handle).ref = t->maptrack_head;
-    t->maptrack_head = handle;
-    spin_unlock(&t->lock);
+    struct vcpu *v = current;
+    unsigned int first = MAPTRACK_TAIL, last, n;
+
+    spin_lock(&v->maptrack_lock);
+    maptrack_splice(t, &v->maptrack_head, handle, handle);
+    if ( unlikely(++v->maptrack_free > MAPTRACK_HIGH) )
+    {
+        first = maptrack_take(t, &v->maptrack_head, MAPTRACK_BATCH,
+                              &last, &n);
+        v->maptrack_free -= n;
+    }
+    spin_unlock(&v->maptrack_lock);
+
+    /* Hand a batch back for the other vCPUs. */
+    if ( unlikely(first != MAPTRACK_TAIL) )
+    {
+        spin_lock(&t->lock);
+        maptrack_splice(t, &t->maptrack_head, first, last);
+        spin_unlock(&t->lock);
+    }
+}
+
+/* Take a batch of handles from another vCPU of the current domain. */
+static unsigned int
+steal_maptrack_handles(
+    struct grant_table *t, unsigned int *last, unsigned int *taken)
+{
+    struct vcpu *v;
+    unsigned int first;
+
+    for_each_vcpu ( current->domain, v )
+    {
+        if ( v == current || !v->maptrack_free )
+            continue;
+
+        spin_lock(&v->maptrack_lock);
+        first = maptrack_take(t, &v->maptrack_head, MAPTRACK_BATCH,
+                              last, taken);
+        v->maptrack_free -= (first != MAPTRACK_TAIL) ? *taken : 0;
+        spin_unlock(&v->maptrack_lock);
+
+        if ( first != MAPTRACK_TAIL )
+            return first;
+    }
+
+    return MAPTRACK_TAIL;
 }
 
 static inline int
 get_maptrack_handle(
     struct grant_table *lgt)
 {
+    struct vcpu          *v = current;
     int                   i;
     grant_handle_t        handle;
     struct grant_mapping *new_mt;
-    unsigned int          new_mt_limit, nr_frames;
+    unsigned int          new_mt_limit, nr_frames, first, last, n;
+
+    spin_lock(&v->maptrack_lock);
+    if ( likely((handle = v->maptrack_head) != MAPTRACK_TAIL) )
+    {
+        v->maptrack_head = maptrack_entry(lgt, handle).ref;
+        v->maptrack_free--;
+    }
+    spin_unlock(&v->maptrack_lock);
+
+    if ( likely(handle != MAPTRACK_TAIL) )
+        return handle;
 
+    /* Refill from the shared list, growing the table if that is empty. */
     spin_lock(&lgt->lock);
 
-    while ( unlikely((handle = __get_maptrack_handle(lgt)) == -1) )
+    while ( unlikely((first = maptrack_take(lgt, &lgt->maptrack_head,
+                                            MAPTRACK_BATCH, &last,
+                                            &n)) == MAPTRACK_TAIL) )
     {
         nr_frames = nr_maptrack_frames(lgt);
         if ( nr_frames >= max_nr_maptrack_frames() )
@@ -280,6 +375,21 @@ get_maptrack_handle(
 
     spin_unlock(&lgt->lock);
 
+    if ( unlikely(first == MAPTRACK_TAIL) &&
+         (first = steal_maptrack_handles(lgt, &last, &n)) == MAPTRACK_TAIL )
+        return -1;
+
+    /* Keep the first handle and cache the rest of the batch. */
+    handle = first;
+    if ( n > 1 )
+    {
+        spin_lock(&v->maptrack_lock);
+        maptrack_splice(lgt, &v->maptrack_head,
+                        maptrack_entry(lgt, first).ref, last);
+        v->maptrack_free += n - 1;
+        spin_unlock(&v->maptrack_lock);
+    }
+
     return handle;
 }
 
@@ -1630,6 +1740,7 @@ gnttab_transfer(
             get_knownalive_domain(e);
         page_list_add_tail(page, &e->page_list);
         page_set_owner(page, e);
+        domain_adjust_node_pages(e, page, 1);
 
         spin_unlock(&e->page_alloc_lock);
         put_gfn(d, gop.mfn);
@@ -1966,130 +2077,236 @@ __acquire_grant_for_copy(
     return rc;
 }
 
+/*
+ * One side of a grant copy. A batch of copies keeps the domain, grant pin,
+ * page references and mapping from one op to the next as long as the ops
+ * name the same frame, so runs of ops on one page pay for them only once.
+ */
+struct gnttab_copy_buf {
+    /* What the guest asked for. */
+    domid_t domid;
+    bool_t is_gref;
+    unsigned long ptr;      /* Grant reference or GMFN. */
+
+    struct domain *domain;
+    unsigned long frame;
+    struct page_info *page;
+    void *virt;
+    unsigned int off, len;  /* Accessible part of the frame. */
+    bool_t read_only;
+    bool_t have_grant;
+    bool_t have_type;
+};
+
+struct gnttab_copy_batch {
+    struct gnttab_copy_buf src, dst;
+    /* The domain pair which last passed the XSM check. */
+    struct domain *checked_sd, *checked_dd;
+};
+
+/* Drop everything held for the frame, but keep the domain locked. */
 static void
-__gnttab_copy(
-    struct gnttab_copy *op)
+gnttab_copy_release_frame(
+    struct gnttab_copy_buf *buf)
 {
-    struct domain *sd = NULL, *dd = NULL;
-    unsigned long s_frame, d_frame;
-    struct page_info *s_pg = NULL, *d_pg = NULL;
-    char *sp, *dp;
-    s16 rc = GNTST_okay;
-    int have_d_grant = 0, have_s_grant = 0;
-    int src_is_gref, dest_is_gref;
-
-    if ( ((op->source.offset + op->len) > PAGE_SIZE) ||
-         ((op->dest.offset + op->len) > PAGE_SIZE) )
-        PIN_FAIL(error_out, GNTST_bad_copy_arg, "copy beyond page area.\n");
+    if ( buf->virt )
+    {
+        unmap_domain_page(buf->virt);
+        buf->virt = NULL;
+    }
+    if ( buf->have_type )
+    {
+        put_page_type(buf->page);
+        buf->have_type = 0;
+    }
+    if ( buf->page )
+    {
+        put_page(buf->page);
+        buf->page = NULL;
+    }
+    if ( buf->have_grant )
+    {
+        __release_grant_for_copy(buf->domain, buf->ptr, buf->read_only);
+        buf->have_grant = 0;
+    }
+}
 
-    src_is_gref = op->flags & GNTCOPY_source_gref;
-    dest_is_gref = op->flags & GNTCOPY_dest_gref;
+static void
+gnttab_copy_release_buf(
+    struct gnttab_copy_buf *buf)
+{
+    gnttab_copy_release_frame(buf);
+    if ( buf->domain )
+    {
+        rcu_unlock_domain(buf->domain);
+        buf->domain = NULL;
+    }
+}
 
-    if ( (op->source.domid != DOMID_SELF && !src_is_gref ) ||
-         (op->dest.domid   != DOMID_SELF && !dest_is_gref)   )
-        PIN_FAIL(error_out, GNTST_permission_denied,
-                 "only allow copy-by-mfn for DOMID_SELF.\n");
+static void
+gnttab_copy_release_batch(
+    struct gnttab_copy_batch *batch)
+{
+    gnttab_copy_release_buf(&batch->src);
+    gnttab_copy_release_buf(&batch->dst);
+    batch->checked_sd = batch->checked_dd = NULL;
+}
 
-    if ( op->source.domid == DOMID_SELF )
-        sd = rcu_lock_current_domain();
-    else if ( (sd = rcu_lock_domain_by_id(op->source.domid)) == NULL )
-        PIN_FAIL(error_out, GNTST_bad_domain,
-                 "couldn't find %d\n", op->source.domid);
+static s16
+gnttab_copy_lock_domain(
+    struct gnttab_copy_buf *buf, domid_t domid)
+{
+    if ( buf->domain && buf->domid == domid )
+        return GNTST_okay;
 
-    if ( op->dest.domid == DOMID_SELF )
-        dd = rcu_lock_current_domain();
-    else if ( (dd = rcu_lock_domain_by_id(op->dest.domid)) == NULL )
-        PIN_FAIL(error_out, GNTST_bad_domain,
-                 "couldn't find %d\n", op->dest.domid);
+    gnttab_copy_release_buf(buf);
 
-    rc = xsm_grant_copy(sd, dd);
-    if ( rc )
+    if ( domid == DOMID_SELF )
+        buf->domain = rcu_lock_current_domain();
+    else if ( (buf->domain = rcu_lock_domain_by_id(domid)) == NULL )
     {
-        rc = GNTST_permission_denied;
-        goto error_out;
+        gdprintk(XENLOG_WARNING, "couldn't find %d\n", domid);
+        return GNTST_bad_domain;
     }
+    buf->domid = domid;
 
-    if ( src_is_gref )
-    {
-        unsigned source_off, source_len;
-        rc = __acquire_grant_for_copy(sd, op->source.u.ref,
-                                      current->domain->domain_id, 1,
-                                      &s_frame, &s_pg,
-                                      &source_off, &source_len, 1);
-        if ( rc != GNTST_okay )
-            goto error_out;
-        have_s_grant = 1;
-        if ( op->source.offset < source_off ||
-             op->len > source_len )
-            PIN_FAIL(error_out, GNTST_general_error,
-                     "copy source out of bounds: %d < %d || %d > %d\n",
-                     op->source.offset, source_off,
-                     op->len, source_len);
-    }
-    else
+    return GNTST_okay;
+}
+
+/* Make @buf hold the frame named by @ptr, reusing what it already holds. */
+static s16
+gnttab_copy_claim_frame(
+    struct gnttab_copy_buf *buf, bool_t is_gref, unsigned long ptr,
+    bool_t read_only)
+{
+    s16 rc;
+
+    if ( buf->page && buf->is_gref == is_gref && buf->ptr == ptr )
     {
-        rc = __get_paged_frame(op->source.u.gmfn, &s_frame, &s_pg, 1, sd);
-        if ( rc != GNTST_okay )
-            PIN_FAIL(error_out, rc,
-                     "source frame %lx invalid.\n", s_frame);
+        if ( read_only )
+            perfc_incr(gnttab_copy_src_reuse);
+        else
+            perfc_incr(gnttab_copy_dst_reuse);
+        return GNTST_okay;
     }
 
-    if ( dest_is_gref )
+    gnttab_copy_release_frame(buf);
+
+    buf->is_gref = is_gref;
+    buf->ptr = ptr;
+    buf->read_only = read_only;
+
+    if ( is_gref )
     {
-        unsigned dest_off, dest_len;
-        rc = __acquire_grant_for_copy(dd, op->dest.u.ref,
-                                      current->domain->domain_id, 0,
-                                      &d_frame, &d_pg, &dest_off, &dest_len, 1);
+        rc = __acquire_grant_for_copy(buf->domain, ptr,
+                                      current->domain->domain_id, read_only,
+                                      &buf->frame, &buf->page,
+                                      &buf->off, &buf->len, 1);
         if ( rc != GNTST_okay )
-            goto error_out;
-        have_d_grant = 1;
-        if ( op->dest.offset < dest_off ||
-             op->len > dest_len )
-            PIN_FAIL(error_out, GNTST_general_error,
-                     "copy dest out of bounds: %d < %d || %d > %d\n",
-                     op->dest.offset, dest_off,
-                     op->len, dest_len);
+            return rc;
+        buf->have_grant = 1;
     }
     else
     {
-        rc = __get_paged_frame(op->dest.u.gmfn, &d_frame, &d_pg, 0, dd);
+        rc = __get_paged_frame(ptr, &buf->frame, &buf->page, read_only,
+                               buf->domain);
         if ( rc != GNTST_okay )
-            PIN_FAIL(error_out, rc,
-                     "destination frame %lx invalid.\n", d_frame);
+            PIN_FAIL(out, rc, "%s frame %lx invalid.\n",
+                     read_only ? "source" : "destination", ptr);
+        buf->off = 0;
+        buf->len = PAGE_SIZE;
     }
 
-    if ( !get_page_type(d_pg, PGT_writable_page) )
+    if ( !read_only )
     {
-        if ( !dd->is_dying )
-            gdprintk(XENLOG_WARNING, "Could not get dst frame %lx\n", d_frame);
-        rc = GNTST_general_error;
+        if ( !get_page_type(buf->page, PGT_writable_page) )
+        {
+            if ( !buf->domain->is_dying )
+                gdprintk(XENLOG_WARNING, "Could not get dst frame %lx\n",
+                         buf->frame);
+            rc = GNTST_general_error;
+            goto out;
+        }
+        buf->have_type = 1;
+    }
+
+    buf->virt = map_domain_page(buf->frame);
+
+    return GNTST_okay;
+
+ out:
+    gnttab_copy_release_frame(buf);
+    return rc;
+}
+
+static void
+__gnttab_copy(
+    struct gnttab_copy *op, struct gnttab_copy_batch *batch)
+{
+    struct gnttab_copy_buf *src = &batch->src, *dst = &batch->dst;
+    s16 rc = GNTST_okay;
+    int src_is_gref, dest_is_gref;
+
+    if ( ((op->source.offset + op->len) > PAGE_SIZE) ||
+         ((op->dest.offset + op->len) > PAGE_SIZE) )
+        PIN_FAIL(error_out, GNTST_bad_copy_arg, "copy beyond page area.\n");
+
+    src_is_gref = !!(op->flags & GNTCOPY_source_gref);
+    dest_is_gref = !!(op->flags & GNTCOPY_dest_gref);
+
+    if ( (op->source.domid != DOMID_SELF && !src_is_gref ) ||
+         (op->dest.domid   != DOMID_SELF && !dest_is_gref)   )
+        PIN_FAIL(error_out, GNTST_permission_denied,
+                 "only allow copy-by-mfn for DOMID_SELF.\n");
+
+    if ( (rc = gnttab_copy_lock_domain(src, op->source.domid)) != GNTST_okay ||
+         (rc = gnttab_copy_lock_domain(dst, op->dest.domid)) != GNTST_okay )
         goto error_out;
+
+    if ( batch->checked_sd != src->domain || batch->checked_dd != dst->domain )
+    {
+        if ( xsm_grant_copy(src->domain, dst->domain) )
+        {
+            rc = GNTST_permission_denied;
+            goto error_out;
+        }
+        batch->checked_sd = src->domain;
+        batch->checked_dd = dst->domain;
     }
 
-    sp = map_domain_page(s_frame);
-    dp = map_domain_page(d_frame);
+    rc = gnttab_copy_claim_frame(src, src_is_gref,
+                                 src_is_gref ? op->source.u.ref
+                                             : op->source.u.gmfn, 1);
+    if ( rc != GNTST_okay )
+        goto error_out;
+    if ( src_is_gref &&
+         (op->source.offset < src->off || op->len > src->len) )
+        PIN_FAIL(error_out, GNTST_general_error,
+                 "copy source out of bounds: %d < %d || %d > %d\n",
+                 op->source.offset, src->off, op->len, src->len);
+
+    rc = gnttab_copy_claim_frame(dst, dest_is_gref,
+                                 dest_is_gref ? op->dest.u.ref
+                                              : op->dest.u.gmfn, 0);
+    if ( rc != GNTST_okay )
+        goto error_out;
+    if ( dest_is_gref &&
+         (op->dest.offset < dst->off || op->len > dst->len) )
+        PIN_FAIL(error_out, GNTST_general_error,
+                 "copy dest out of bounds: %d < %d || %d > %d\n",
+                 op->dest.offset, dst->off, op->len, dst->len);
 
-    memcpy(dp + op->dest.offset, sp + op->source.offset, op->len);
+    memcpy(dst->virt + op->dest.offset, src->virt + op->source.offset,
+           op->len);
 
-    unmap_domain_page(dp);
-    unmap_domain_page(sp);
+    gnttab_mark_dirty(dst->domain, dst->frame);
 
-    gnttab_mark_dirty(dd, d_frame);
+    op->status = GNTST_okay;
+    return;
 
-    put_page_type(d_pg);
  error_out:
-    if ( d_pg )
-        put_page(d_pg);
-    if ( s_pg )
-        put_page(s_pg);
-    if ( have_s_grant )
-        __release_grant_for_copy(sd, op->source.u.ref, 1);
-    if ( have_d_grant )
-        __release_grant_for_copy(dd, op->dest.u.ref, 0);
-    if ( sd )
-        rcu_unlock_domain(sd);
-    if ( dd )
-        rcu_unlock_domain(dd);
+    /* Start afresh after a failure, as a single op always did. */
+    gnttab_copy_release_batch(batch);
     op->status = rc;
 }
 
@@ -2099,18 +2316,35 @@ gnttab_copy(
 {
     int i;
     struct gnttab_copy op;
+    struct gnttab_copy_batch batch = { };
+    long rc = 0;
+
+    perfc_incr(gnttab_copy_batches);
 
     for ( i = 0; i < count; i++ )
     {
-        if (i && hypercall_preempt_check())
-            return i;
+        if ( i && hypercall_preempt_check() )
+        {
+            rc = i;
+            break;
+        }
         if ( unlikely(__copy_from_guest_offset(&op, uop, i, 1)) )
-            return -EFAULT;
-        __gnttab_copy(&op);
+        {
+            rc = -EFAULT;
+            break;
+        }
+        __gnttab_copy(&op, &batch);
+        perfc_incr(gnttab_copy_ops);
         if ( unlikely(__copy_to_guest_offset(uop, i, &op, 1)) )
-            return -EFAULT;
+        {
+            rc = -EFAULT;
+            break;
+        }
     }
-    return 0;
+
+    gnttab_copy_release_batch(&batch);
+
+    return rc;
 }
 
 static long
@@ -2557,6 +2791,14 @@ static unsigned int max_nr_active_grant_frames(void)
                    / (PAGE_SIZE / sizeof(struct active_grant_entry)));
 }
 
+void
+grant_table_init_vcpu(struct vcpu *v)
+{
+    spin_lock_init(&v->maptrack_lock);
+    v->maptrack_head = MAPTRACK_TAIL;
+    v->maptrack_free = 0;
+}
+
 int 
 grant_table_create(
     struct domain *d)
@@ -68,8 +68,12 @@
  *  Richard Purdie <rpurdie@openedhand.com>
  */
 
+#ifdef __XEN__
 #include <xen/types.h>
 #include <xen/lzo.h>
+#else
+#include "xc_lzo.h"
+#endif
 #define get_unaligned(_p) (*(_p))
 #define put_unaligned(_val,_p) (*(_p)=_val)
 #define get_unaligned_le16(_p) (*(u16 *)(_p))
@@ -88,6 +88,209 @@ static void increase_reservation(struct memop_args *a)
     a->nr_done = i;
 }
 
+/* Each fallback step goes down one level of the p2m (1G -> 2M -> 4k). */
+#define FALLBACK_ORDER_STEP 9
+#define FALLBACK_MAX_PIECES (1U << FALLBACK_ORDER_STEP)
+
+/*
+ * A superpage extent being backed with smaller pieces.  It outlives a
+ * preempted hypercall, so that a retry carries on where it left off and a
+ * failure removes exactly the pieces this extent added.
+ */
+struct populate_fallback {
+    xen_pfn_t gpfn;
+    unsigned int order;
+    unsigned int next;        /* Next piece to add, or to remove if failed */
+    bool_t failed;
+    DECLARE_BITMAP(added, FALLBACK_MAX_PIECES);  /* Populated by us */
+    DECLARE_BITMAP(split, FALLBACK_MAX_PIECES);  /* ... with 4k pages */
+};
+
+static bool_t gfn_populated(struct domain *d, xen_pfn_t gpfn)
+{
+#ifdef CONFIG_X86
+    p2m_type_t t;
+
+    get_gfn_query_unlocked(d, gpfn, &t);
+    return !!p2m_is_ram(t);
+#else
+    return mfn_valid(gmfn_to_mfn(d, gpfn));
+#endif
+}
+
+/* Remove 2^order pages at gpfn that were populated as one extent. */
+static void remove_extent(struct domain *d, xen_pfn_t gpfn, unsigned int order)
+{
+    struct page_info *page;
+    unsigned long mfn, i;
+#ifdef CONFIG_X86
+    p2m_type_t t;
+
+    mfn = mfn_x(get_gfn_query(d, gpfn, &t));
+#else
+    mfn = gmfn_to_mfn(d, gpfn);
+#endif
+    guest_physmap_remove_page(d, gpfn, mfn, order);
+    put_gfn(d, gpfn);
+
+    for ( i = 0; i < (1UL << order); i++ )
+    {
+        page = mfn_to_page(mfn + i);
+        if ( test_and_clear_bit(_PGC_allocated, &page->count_info) )
+            put_page(page);
+    }
+}
+
+/*
+ * Populate the 2^order pages at gpfn with a single extent or, failing
+ * that, with 4k pages.  All or nothing; *split says which it was.
+ */
+static int populate_piece(struct domain *d, xen_pfn_t gpfn,
+                          unsigned int order, unsigned int memflags,
+                          bool_t *split)
+{
+    struct page_info *page;
+    unsigned long i;
+
+    page = alloc_domheap_pages(d, order, memflags);
+    if ( page != NULL )
+    {
+        guest_physmap_add_page(d, gpfn, page_to_mfn(page), order);
+        *split = 0;
+        return 0;
+    }
+
+    if ( order == 0 || !(memflags & MEMF_order_fallback) )
+        return -ENOMEM;
+
+    perfc_incr(populate_fallback);
+    for ( i = 0; i < (1UL << order); i++ )
+    {
+        page = alloc_domheap_pages(d, 0, memflags);
+        if ( page == NULL )
+            break;
+        guest_physmap_add_page(d, gpfn + i, page_to_mfn(page), 0);
+    }
+
+    if ( i == (1UL << order) )
+    {
+        *split = 1;
+        return 0;
+    }
+
+    perfc_incr(populate_fallback_fail);
+    while ( i-- )
+        guest_remove_page(d, gpfn + i);
+
+    return -ENOMEM;
+}
+
+/*
+ * Populate the 2^order pages at gpfn of a translated guest, backing them
+ * with the largest pages that can still be allocated when a single extent
+ * is not available.  On failure the pages added so far are removed again.
+ *
+ * A 1G extent is split into 2M pieces, each of which may in turn be split
+ * into 4k pages.  That can mean a quarter of a million allocations, and as
+ * many frees on failure, so this returns -EAGAIN between 2M pieces if
+ * preemption is needed; the caller retries the same extent.  Pieces that
+ * were already populated before the extent was started are left alone.
+ */
+static int populate_extent(struct domain *d, xen_pfn_t gpfn,
+                           unsigned int order, unsigned int memflags)
+{
+    struct populate_fallback *pf;
+    unsigned int nr, sub = FALLBACK_ORDER_STEP;
+    xen_pfn_t piece;
+    bool_t split;
+    int rc;
+
+    if ( order <= FALLBACK_ORDER_STEP || order > 2 * FALLBACK_ORDER_STEP )
+        return populate_piece(d, gpfn, order,
+                              order > 2 * FALLBACK_ORDER_STEP ?
+                              memflags & ~MEMF_order_fallback : memflags,
+                              &split);
+
+    spin_lock(&d->populate_lock);
+
+    pf = d->populate_fallback;
+    if ( pf != NULL && (pf->gpfn != gpfn || pf->order != order) )
+    {
+        /* Abandoned by its caller: its pieces stay populated. */
+        d->populate_fallback = NULL;
+        xfree(pf);
+        pf = NULL;
+    }
+
+    if ( pf == NULL )
+    {
+        rc = populate_piece(d, gpfn, order,
+                            memflags & ~MEMF_order_fallback, &split);
+        if ( rc == 0 )
+            goto out;
+
+        rc = -ENOMEM;
+        pf = xzalloc(struct populate_fallback);
+        if ( pf == NULL )
+            goto out;
+        pf->gpfn = gpfn;
+        pf->order = order;
+        d->populate_fallback = pf;
+        perfc_incr(populate_fallback);
+    }
+
+    nr = 1U << (order - sub);
+    while ( !pf->failed && pf->next < nr )
+    {
+        piece = gpfn + ((xen_pfn_t)pf->next << sub);
+        if ( !gfn_populated(d, piece) )
+        {
+            if ( populate_piece(d, piece, sub, memflags, &split) )
+            {
+                perfc_incr(populate_fallback_fail);
+                pf->failed = 1;
+                break;
+            }
+            __set_bit(pf->next, pf->added);
+            if ( split )
+                __set_bit(pf->next, pf->split);
+        }
+        if ( ++pf->next < nr && hypercall_preempt_check() )
+        {
+            rc = -EAGAIN;
+            goto out;
+        }
+    }
+
+    /* On failure, remove our pieces at the order they were added with. */
+    while ( pf->failed && pf->next )
+    {
+        unsigned long i;
+
+        piece = gpfn + ((xen_pfn_t)--pf->next << sub);
+        if ( !test_bit(pf->next, pf->added) )
+            continue;
+        if ( test_bit(pf->next, pf->split) )
+            for ( i = 0; i < (1UL << sub); i++ )
+                guest_remove_page(d, piece + i);
+        else
+            remove_extent(d, piece, sub);
+        if ( pf->next && hypercall_preempt_check() )
+        {
+            rc = -EAGAIN;
+            goto out;
+        }
+    }
+
+    rc = pf->failed ? -ENOMEM : 0;
+    d->populate_fallback = NULL;
+    xfree(pf);
+
+ out:
+    spin_unlock(&d->populate_lock);
+    return rc;
+}
+
 static void populate_physmap(struct memop_args *a)
 {
     struct page_info *page;
@@ -120,6 +323,25 @@ static void populate_physmap(struct memop_args *a)
                                                        a->extent_order) < 0 )
                 goto out;
         }
+        else if ( paging_mode_translate(d) &&
+                  (a->memflags & MEMF_order_fallback) )
+        {
+            int rc = populate_extent(d, gpfn, a->extent_order, a->memflags);
+
+            if ( rc == -EAGAIN )
+            {
+                a->preempted = 1;
+                goto out;
+            }
+            if ( rc )
+            {
+                gdprintk(XENLOG_INFO, "Could not populate order=%d extent:"
+                         " id=%d memflags=%x (%ld of %d)\n",
+                         a->extent_order, d->domain_id, a->memflags,
+                         i, a->nr_extents);
+                goto out;
+            }
+        }
         else
         {
             page = alloc_domheap_pages(d, a->extent_order, a->memflags);
@@ -581,6 +803,10 @@ long do_memory_op(unsigned long cmd, XEN_GUEST_HANDLE(void) arg)
              && (reservation.mem_flags & XENMEMF_populate_on_demand) )
             args.memflags |= MEMF_populate_on_demand;
 
+        if ( op == XENMEM_populate_physmap
+             && (reservation.mem_flags & XENMEMF_order_fallback) )
+            args.memflags |= MEMF_order_fallback;
+
         if ( unlikely(rcu_lock_target_domain_by_id(reservation.domid, &d)) )
             return start_extent;
         args.domain = d;
@@ -38,6 +38,8 @@
 #include <xen/event.h>
 #include <xen/tmem.h>
 #include <xen/tmem_xen.h>
+#include <xen/cpu.h>
+#include <xen/percpu.h>
 #include <public/sysctl.h>
 #include <public/sched.h>
 #include <asm/page.h>
@@ -63,6 +65,12 @@ string_param("badpage", opt_badpage);
 static bool_t opt_bootscrub __initdata = 1;
 boolean_param("bootscrub", opt_bootscrub);
 
+/*
+ * no-pcp_cache -> Every allocation and free goes through heap_lock.
+ */
+static bool_t __initdata opt_pcp_cache = 1;
+boolean_param("pcp_cache", opt_pcp_cache);
+
 /*
  * Bit width of the DMA heap -- used to override NUMA-node-first.
  * allocation strategy, which can otherwise exhaust low memory.
@@ -262,6 +270,30 @@ static long midsize_alloc_zone_pages;
 
 static DEFINE_SPINLOCK(heap_lock);
 
+/*
+ * Per-CPU caches of free low-order chunks in front of heap_lock. A CPU only
+ * caches memory from its own node, and moves chunks to and from the buddy
+ * lists in batches. Cached chunks are not on the buddy lists and are in the
+ * in-use state, so they are never merged.
+ */
+#define PCP_MAX_ORDER 2
+#define PCP_HIGH      64    /* Pages cached per order before draining. */
+#define PCP_BATCH     16    /* Pages moved per refill or drain. */
+
+struct pcp_cache {
+    spinlock_t lock;
+    bool_t ready;
+    unsigned int node;
+    unsigned int count[PCP_MAX_ORDER + 1];
+    struct page_list_head list[PCP_MAX_ORDER + 1];
+    unsigned long zone_pages[NR_ZONES]; /* Cached pages, for avail[] users. */
+};
+
+static DEFINE_PER_CPU(struct pcp_cache, pcp_cache);
+
+/* Lowest zone worth caching: DMA memory stays on the buddy lists. */
+static unsigned int __read_mostly pcp_zone_lo = NR_ZONES;
+
 static unsigned long init_node_heap(int node, unsigned long mfn,
                                     unsigned long nr, bool_t *use_tail)
 {
@@ -428,15 +460,85 @@ static void check_low_mem_virq(void)
     }
 }
 
-/* Allocate 2^@order contiguous pages. */
-static struct page_info *alloc_heap_pages(
+/*
+ * Take a free 2^@order chunk from @node, in the highest zone within
+ * [@zone_lo, @zone_hi] that has one. The caller must hold heap_lock.
+ */
+static struct page_info *take_heap_chunk(
+    unsigned int node, unsigned int zone_lo, unsigned int zone_hi,
+    unsigned int order)
+{
+    unsigned int j, zone = zone_hi;
+    unsigned long request = 1UL << order;
+    struct page_info *pg;
+
+    do {
+        /* Check if target node can support the allocation. */
+        if ( !avail[node] || (avail[node][zone] < request) )
+            continue;
+
+        /* Find smallest order which can satisfy the request. */
+        for ( j = order; j <= MAX_ORDER; j++ )
+            if ( (pg = page_list_remove_head(&heap(node, zone, j))) )
+                goto found;
+    } while ( zone-- > zone_lo ); /* careful: unsigned zone may wrap */
+
+    return NULL;
+
+ found: 
+    /* We may have to halve the chunk a number of times. */
+    while ( j != order )
+    {
+        PFN_ORDER(pg) = --j;
+        page_list_add_tail(pg, &heap(node, zone, j));
+        pg += 1 << j;
+    }
+
+    ASSERT(avail[node][zone] >= request);
+    avail[node][zone] -= request;
+    total_avail_pages -= request;
+    ASSERT(total_avail_pages >= 0);
+
+    return pg;
+}
+
+/* Track the safety TLB flush needed before reusing a free page. */
+static void note_page_tlbflush(
+    struct page_info *pg, bool_t *need_tlbflush, uint32_t *tlbflush_timestamp)
+{
+    if ( pg->u.free.need_tlbflush &&
+         (pg->tlbflush_timestamp <= tlbflush_current_time()) &&
+         (!*need_tlbflush || (pg->tlbflush_timestamp > *tlbflush_timestamp)) )
+    {
+        *need_tlbflush = 1;
+        *tlbflush_timestamp = pg->tlbflush_timestamp;
+    }
+}
+
+static void flush_for_reuse(bool_t need_tlbflush, uint32_t tlbflush_timestamp)
+{
+    cpumask_t mask;
+
+    if ( !need_tlbflush )
+        return;
+
+    mask = cpu_online_map;
+    tlbflush_filter(mask, tlbflush_timestamp);
+    if ( !cpumask_empty(&mask) )
+    {
+        perfc_incr(need_flush_tlb_flush);
+        flush_tlb_mask(&mask);
+    }
+}
+
+/* Allocate 2^@order contiguous pages from the buddy lists. */
+static struct page_info *__alloc_heap_pages(
     unsigned int zone_lo, unsigned int zone_hi,
     unsigned int order, unsigned int memflags,
     struct domain *d)
 {
-    unsigned int first_node, i, j, zone = 0, nodemask_retry = 0;
+    unsigned int first_node, i, nodemask_retry = 0;
     unsigned int node = (uint8_t)((memflags >> _MEMF_node) - 1);
-    unsigned long request = 1UL << order;
     struct page_info *pg;
     nodemask_t nodemask = (d != NULL ) ? d->node_affinity : node_online_map;
     bool_t need_tlbflush = 0;
@@ -483,17 +585,8 @@ static struct page_info *alloc_heap_pages(
      */
     for ( ; ; )
     {
-        zone = zone_hi;
-        do {
-            /* Check if target node can support the allocation. */
-            if ( !avail[node] || (avail[node][zone] < request) )
-                continue;
-
-            /* Find smallest order which can satisfy the request. */
-            for ( j = order; j <= MAX_ORDER; j++ )
-                if ( (pg = page_list_remove_head(&heap(node, zone, j))) )
-                    goto found;
-        } while ( zone-- > zone_lo ); /* careful: unsigned zone may wrap */
+        if ( (pg = take_heap_chunk(node, zone_lo, zone_hi, order)) != NULL )
+            goto found;
 
         if ( memflags & MEMF_exact_node )
             goto not_found;
@@ -536,19 +629,6 @@ static struct page_info *alloc_heap_pages(
     return NULL;
 
  found: 
-    /* We may have to halve the chunk a number of times. */
-    while ( j != order )
-    {
-        PFN_ORDER(pg) = --j;
-        page_list_add_tail(pg, &heap(node, zone, j));
-        pg += 1 << j;
-    }
-
-    ASSERT(avail[node][zone] >= request);
-    avail[node][zone] -= request;
-    total_avail_pages -= request;
-    ASSERT(total_avail_pages >= 0);
-
     check_low_mem_virq();
 
     if ( d != NULL )
@@ -560,14 +640,7 @@ static struct page_info *alloc_heap_pages(
         BUG_ON(pg[i].count_info != PGC_state_free);
         pg[i].count_info = PGC_state_inuse;
 
-        if ( pg[i].u.free.need_tlbflush &&
-             (pg[i].tlbflush_timestamp <= tlbflush_current_time()) &&
-             (!need_tlbflush ||
-              (pg[i].tlbflush_timestamp > tlbflush_timestamp)) )
-        {
-            need_tlbflush = 1;
-            tlbflush_timestamp = pg[i].tlbflush_timestamp;
-        }
+        note_page_tlbflush(&pg[i], &need_tlbflush, &tlbflush_timestamp);
 
         /* Initialise fields which have other uses for free pages. */
         pg[i].u.inuse.type_info = 0;
@@ -576,16 +649,7 @@ static struct page_info *alloc_heap_pages(
 
     spin_unlock(&heap_lock);
 
-    if ( need_tlbflush )
-    {
-        cpumask_t mask = cpu_online_map;
-        tlbflush_filter(mask, tlbflush_timestamp);
-        if ( !cpumask_empty(&mask) )
-        {
-            perfc_incr(need_flush_tlb_flush);
-            flush_tlb_mask(&mask);
-        }
-    }
+    flush_for_reuse(need_tlbflush, tlbflush_timestamp);
 
     return pg;
 }
@@ -665,49 +729,29 @@ static int reserve_offlined_page(struct page_info *head)
     return count;
 }
 
-/* Free 2^@order set of pages. */
-static void free_heap_pages(
-    struct page_info *pg, unsigned int order)
+/* Move an in-use page to the free state, or to offlined if requested. */
+static bool_t mark_page_free(struct page_info *pg)
 {
-    unsigned long mask, mfn = page_to_mfn(pg);
-    unsigned int i, node = phys_to_nid(page_to_maddr(pg)), tainted = 0;
-    unsigned int zone = page_to_zone(pg);
-
-    ASSERT(order <= MAX_ORDER);
-    ASSERT(node >= 0);
+    ASSERT(spin_is_locked(&heap_lock));
+    ASSERT(!page_state_is(pg, offlined));
 
-    spin_lock(&heap_lock);
+    pg->count_info =
+        ((pg->count_info & PGC_broken) |
+         (page_state_is(pg, offlining)
+          ? PGC_state_offlined : PGC_state_free));
 
-    for ( i = 0; i < (1 << order); i++ )
-    {
-        /*
-         * Cannot assume that count_info == 0, as there are some corner cases
-         * where it isn't the case and yet it isn't a bug:
-         *  1. page_get_owner() is NULL
-         *  2. page_get_owner() is a domain that was never accessible by
-         *     its domid (e.g., failed to fully construct the domain).
-         *  3. page was never addressable by the guest (e.g., it's an
-         *     auto-translate-physmap guest and the page was never included
-         *     in its pseudophysical address space).
-         * In all the above cases there can be no guest mappings of this page.
-         */
-        ASSERT(!page_state_is(&pg[i], offlined));
-        pg[i].count_info =
-            ((pg[i].count_info & PGC_broken) |
-             (page_state_is(&pg[i], offlining)
-              ? PGC_state_offlined : PGC_state_free));
-        if ( page_state_is(&pg[i], offlined) )
-            tainted = 1;
+    return page_state_is(pg, offlined);
+}
 
-        /* If a page has no owner it will need no safety TLB flush. */
-        pg[i].u.free.need_tlbflush = (page_get_owner(&pg[i]) != NULL);
-        if ( pg[i].u.free.need_tlbflush )
-            pg[i].tlbflush_timestamp = tlbflush_current_time();
+/* Put a 2^@order chunk of free pages back on the buddy lists. */
+static void merge_free_heap_pages(
+    struct page_info *pg, unsigned int order, bool_t tainted)
+{
+    unsigned long mask;
+    unsigned int node = phys_to_nid(page_to_maddr(pg));
+    unsigned int zone = page_to_zone(pg);
 
-        /* This page is not a guest frame any more. */
-        page_set_owner(&pg[i], NULL); /* set_gpfn_from_mfn snoops pg owner */
-        set_gpfn_from_mfn(mfn + i, INVALID_M2P_ENTRY);
-    }
+    ASSERT(spin_is_locked(&heap_lock));
 
     avail[node][zone] += 1 << order;
     total_avail_pages += 1 << order;
@@ -751,10 +795,541 @@ static void free_heap_pages(
 
     if ( tainted )
         reserve_offlined_page(pg);
+}
+
+/* Free 2^@order set of pages to the buddy lists. */
+static void __free_heap_pages(
+    struct page_info *pg, unsigned int order)
+{
+    unsigned long mfn = page_to_mfn(pg);
+    unsigned int i, tainted = 0;
+
+    ASSERT(order <= MAX_ORDER);
+    ASSERT(phys_to_nid(page_to_maddr(pg)) >= 0);
+
+    spin_lock(&heap_lock);
+
+    for ( i = 0; i < (1 << order); i++ )
+    {
+        /*
+         * Cannot assume that count_info == 0, as there are some corner cases
+         * where it isn't the case and yet it isn't a bug:
+         *  1. page_get_owner() is NULL
+         *  2. page_get_owner() is a domain that was never accessible by
+         *     its domid (e.g., failed to fully construct the domain).
+         *  3. page was never addressable by the guest (e.g., it's an
+         *     auto-translate-physmap guest and the page was never included
+         *     in its pseudophysical address space).
+         * In all the above cases there can be no guest mappings of this page.
+         */
+        if ( mark_page_free(&pg[i]) )
+            tainted = 1;
+
+        /* If a page has no owner it will need no safety TLB flush. */
+        pg[i].u.free.need_tlbflush = (page_get_owner(&pg[i]) != NULL);
+        if ( pg[i].u.free.need_tlbflush )
+            pg[i].tlbflush_timestamp = tlbflush_current_time();
+
+        /* This page is not a guest frame any more. */
+        page_set_owner(&pg[i], NULL); /* set_gpfn_from_mfn snoops pg owner */
+        set_gpfn_from_mfn(mfn + i, INVALID_M2P_ENTRY);
+    }
+
+    merge_free_heap_pages(pg, order, tainted);
 
     spin_unlock(&heap_lock);
 }
 
+/*************************
+ * PER-CPU PAGE CACHES
+ */
+
+/* Account for @nr 2^@order chunks like @pg entering (or leaving) the cache. */
+static inline void pcp_account(
+    struct pcp_cache *pcp, struct page_info *pg, unsigned int order, int nr)
+{
+    pcp->count[order] += nr;
+    pcp->zone_pages[page_to_zone(pg)] += (long)nr << order;
+}
+
+/* Give up to @nr chunks of 2^@order back to the heap. Returns the count. */
+static unsigned int pcp_drain(
+    struct pcp_cache *pcp, unsigned int order, unsigned int nr)
+{
+    struct page_info *pg;
+    unsigned int i, done = 0;
+    bool_t tainted;
+
+    ASSERT(spin_is_locked(&pcp->lock));
+
+    if ( page_list_empty(&pcp->list[order]) )
+        return 0;
+
+    spin_lock(&heap_lock);
+
+    while ( done < nr &&
+            (pg = page_list_remove_head(&pcp->list[order])) != NULL )
+    {
+        pcp_account(pcp, pg, order, -1);
+        for ( tainted = 0, i = 0; i < (1 << order); i++ )
+            tainted |= mark_page_free(&pg[i]);
+        merge_free_heap_pages(pg, order, tainted);
+        done++;
+    }
+
+    spin_unlock(&heap_lock);
+
+    perfc_incr(pcp_drain);
+
+    return done;
+}
+
+/* Pull a batch of 2^@order chunks from the local node within the zones. */
+static void pcp_refill(
+    struct pcp_cache *pcp, unsigned int zone_lo, unsigned int zone_hi,
+    unsigned int order)
+{
+    struct page_info *pg;
+    unsigned int i, n;
+
+    ASSERT(spin_is_locked(&pcp->lock));
+
+    spin_lock(&heap_lock);
+
+    for ( n = 0; n < (PCP_BATCH >> order); n++ )
+    {
+        if ( (pg = take_heap_chunk(pcp->node, zone_lo, zone_hi,
+                                   order)) == NULL )
+            break;
+
+        for ( i = 0; i < (1 << order); i++ )
+        {
+            BUG_ON(pg[i].count_info != PGC_state_free);
+            pg[i].count_info = PGC_state_inuse;
+            page_set_owner(&pg[i], NULL);
+        }
+
+        page_list_add_tail(pg, &pcp->list[order]);
+        pcp_account(pcp, pg, order, 1);
+    }
+
+    if ( n )
+        check_low_mem_virq();
+
+    spin_unlock(&heap_lock);
+
+    perfc_incr(pcp_refill);
+}
+
+/* Has anything but the cache touched the chunk's state since it was cached? */
+static bool_t pcp_chunk_clean(struct page_info *pg, unsigned int order)
+{
+    unsigned int i;
+
+    for ( i = 0; i < (1 << order); i++ )
+        if ( pg[i].count_info != PGC_state_inuse )
+            return 0;
+
+    return 1;
+}
+
+static struct page_info *pcp_alloc_pages(
+    unsigned int zone_lo, unsigned int zone_hi,
+    unsigned int order, unsigned int memflags,
+    struct domain *d)
+{
+    unsigned int i, zone, node = (uint8_t)((memflags >> _MEMF_node) - 1);
+    struct pcp_cache *pcp = &this_cpu(pcp_cache);
+    struct page_info *pg = NULL;
+    bool_t need_tlbflush = 0;
+    uint32_t tlbflush_timestamp = 0;
+
+    if ( order > PCP_MAX_ORDER || !pcp->ready || opt_tmem )
+        return NULL;
+
+    /* Only serve requests which the local node satisfies. */
+    if ( node == NUMA_NO_NODE )
+    {
+        if ( d != NULL && !node_isset(pcp->node, d->node_affinity) )
+            return NULL;
+    }
+    else if ( node != pcp->node )
+        return NULL;
+
+    zone_lo = max(zone_lo, pcp_zone_lo);
+    if ( zone_lo > zone_hi )
+        return NULL;
+
+    spin_lock(&pcp->lock);
+
+    if ( page_list_empty(&pcp->list[order]) )
+        pcp_refill(pcp, zone_lo, zone_hi, order);
+
+    while ( !page_list_empty(&pcp->list[order]) )
+    {
+        pg = page_list_first(&pcp->list[order]);
+        zone = page_to_zone(pg);
+        if ( zone < zone_lo || zone > zone_hi )
+        {
+            pg = NULL;
+            break;
+        }
+
+        page_list_del(pg, &pcp->list[order]);
+        pcp_account(pcp, pg, order, -1);
+        if ( likely(pcp_chunk_clean(pg, order)) )
+            break;
+
+        /* Offlining started while the chunk was cached: let the heap see. */
+        page_list_add(pg, &pcp->list[order]);
+        pcp_account(pcp, pg, order, 1);
+        pcp_drain(pcp, order, 1);
+        pg = NULL;
+    }
+
+    spin_unlock(&pcp->lock);
+
+    if ( pg == NULL )
+    {
+        perfc_incr(pcp_alloc_miss);
+        return NULL;
+    }
+    perfc_incr(pcp_alloc_hit);
+
+    if ( d != NULL )
+        d->last_alloc_node = pcp->node;
+
+    for ( i = 0; i < (1 << order); i++ )
+    {
+        note_page_tlbflush(&pg[i], &need_tlbflush, &tlbflush_timestamp);
+        pg[i].u.inuse.type_info = 0;
+    }
+
+    flush_for_reuse(need_tlbflush, tlbflush_timestamp);
+
+    return pg;
+}
+
+/*
+ * Release a 2^@order chunk from its owner without putting it on the buddy
+ * lists: the pages stay in the in-use state and unowned. Broken or offlining
+ * pages must reach the heap, so fail for those. Racing with
+ * mark_page_offline() is fine, as chunks are checked again before reuse.
+ */
+static bool_t detach_free_chunk(struct page_info *pg, unsigned int order)
+{
+    unsigned long x, mfn = page_to_mfn(pg);
+    unsigned int i;
+
+    for ( i = 0; i < (1 << order); i++ )
+    {
+        x = pg[i].count_info;
+        if ( (x & (PGC_state | PGC_broken)) != PGC_state_inuse ||
+             cmpxchg(&pg[i].count_info, x, PGC_state_inuse) != x )
+            return 0;
+    }
+
+    for ( i = 0; i < (1 << order); i++ )
+    {
+        /* See __free_heap_pages(). */
+        pg[i].u.free.need_tlbflush = (page_get_owner(&pg[i]) != NULL);
+        if ( pg[i].u.free.need_tlbflush )
+            pg[i].tlbflush_timestamp = tlbflush_current_time();
+
+        page_set_owner(&pg[i], NULL);
+        set_gpfn_from_mfn(mfn + i, INVALID_M2P_ENTRY);
+    }
+
+    return 1;
+}
+
+static bool_t pcp_free_pages(struct page_info *pg, unsigned int order)
+{
+    struct pcp_cache *pcp = &this_cpu(pcp_cache);
+
+    if ( order > PCP_MAX_ORDER || !pcp->ready || opt_tmem ||
+         phys_to_nid(page_to_maddr(pg)) != pcp->node ||
+         page_to_zone(pg) < pcp_zone_lo ||
+         !detach_free_chunk(pg, order) )
+        return 0;
+
+    spin_lock(&pcp->lock);
+
+    page_list_add(pg, &pcp->list[order]);
+    pcp_account(pcp, pg, order, 1);
+    if ( pcp->count[order] > (PCP_HIGH >> order) )
+        pcp_drain(pcp, order, PCP_BATCH >> order);
+
+    spin_unlock(&pcp->lock);
+
+    perfc_incr(pcp_free);
+
+    return 1;
+}
+
+/* Flush every CPU's cache back to the heap. Returns the number of pages. */
+static unsigned long pcp_drain_all(void)
+{
+    struct pcp_cache *pcp;
+    unsigned long nr = 0;
+    unsigned int cpu, order;
+
+    for_each_online_cpu ( cpu )
+    {
+        pcp = &per_cpu(pcp_cache, cpu);
+        if ( !pcp->ready )
+            continue;
+
+        spin_lock(&pcp->lock);
+        for ( order = 0; order <= PCP_MAX_ORDER; order++ )
+            nr += (unsigned long)pcp_drain(pcp, order, ~0U) << order;
+        spin_unlock(&pcp->lock);
+    }
+
+    return nr;
+}
+
+static unsigned long pcp_cached_pages(void)
+{
+    unsigned long nr = 0;
+    unsigned int cpu, order;
+
+    for_each_online_cpu ( cpu )
+        for ( order = 0; order <= PCP_MAX_ORDER; order++ )
+            nr += (unsigned long)per_cpu(pcp_cache, cpu).count[order] << order;
+
+    return nr;
+}
+
+static int cpu_callback(
+    struct notifier_block *nfb, unsigned long action, void *hcpu)
+{
+    unsigned int cpu = (unsigned long)hcpu, order;
+    struct pcp_cache *pcp = &per_cpu(pcp_cache, cpu);
+
+    switch ( action )
+    {
+    case CPU_UP_PREPARE:
+        spin_lock_init(&pcp->lock);
+        for ( order = 0; order <= PCP_MAX_ORDER; order++ )
+        {
+            INIT_PAGE_LIST_HEAD(&pcp->list[order]);
+            pcp->count[order] = 0;
+        }
+        memset(pcp->zone_pages, 0, sizeof(pcp->zone_pages));
+        pcp->node = cpu_to_node(cpu);
+        pcp->ready = 1;
+        break;
+    case CPU_UP_CANCELED:
+    case CPU_DEAD:
+        spin_lock(&pcp->lock);
+        pcp->ready = 0;
+        for ( order = 0; order <= PCP_MAX_ORDER; order++ )
+            pcp_drain(pcp, order, ~0U);
+        spin_unlock(&pcp->lock);
+        break;
+    default:
+        break;
+    }
+
+    return NOTIFY_DONE;
+}
+
+static struct notifier_block cpu_nfb = {
+    .notifier_call = cpu_callback
+};
+
+static int __init pcp_cache_init(void)
+{
+    void *hcpu = (void *)(long)smp_processor_id();
+
+    if ( !opt_pcp_cache )
+        return 0;
+
+    pcp_zone_lo = dma_bitsize ? bits_to_zone(dma_bitsize) + 1
+                              : MEMZONE_XEN + 1;
+
+    cpu_callback(&cpu_nfb, CPU_UP_PREPARE, hcpu);
+    register_cpu_notifier(&cpu_nfb);
+
+    return 0;
+}
+presmp_initcall(pcp_cache_init);
+
+/*************************
+ * BACKGROUND SCRUBBING
+ */
+
+/*
+ * Pages freed by dying domains are queued here, per node and order, and are
+ * scrubbed by idle CPUs before going back to the heap. Queued chunks are in
+ * the in-use state and unowned, like cached ones. Allocations which find the
+ * heap empty scrub on demand.
+ */
+#define SCRUB_CHUNK_ORDER 6 /* Largest chunk scrubbed in one go. */
+
+static struct page_list_head dirty_list[MAX_NUMNODES][MAX_ORDER + 1];
+static unsigned long dirty_pages[MAX_NUMNODES];
+static unsigned long total_dirty_pages;
+static DEFINE_SPINLOCK(dirty_lock);
+
+static void __init init_dirty_lists(void)
+{
+    unsigned int i, j;
+
+    for ( i = 0; i < MAX_NUMNODES; i++ )
+        for ( j = 0; j <= MAX_ORDER; j++ )
+            INIT_PAGE_LIST_HEAD(&dirty_list[i][j]);
+}
+
+/* Free 2^@order set of pages which must be scrubbed before reuse. */
+static void free_dirty_heap_pages(struct page_info *pg, unsigned int order)
+{
+    unsigned int i, node = phys_to_nid(page_to_maddr(pg));
+
+    if ( !detach_free_chunk(pg, order) )
+    {
+        for ( i = 0; i < (1 << order); i++ )
+            scrub_one_page(&pg[i]);
+        __free_heap_pages(pg, order);
+        return;
+    }
+
+    spin_lock(&dirty_lock);
+    page_list_add_tail(pg, &dirty_list[node][order]);
+    dirty_pages[node] += 1UL << order;
+    total_dirty_pages += 1UL << order;
+    spin_unlock(&dirty_lock);
+}
+
+/* Scrub one queued chunk from @node and free it. Returns the page count. */
+static unsigned long scrub_dirty_chunk(unsigned int node)
+{
+    struct page_info *pg = NULL;
+    unsigned int i, order;
+    bool_t tainted;
+
+    spin_lock(&dirty_lock);
+
+    for ( order = 0; order <= MAX_ORDER; order++ )
+        if ( (pg = page_list_remove_head(&dirty_list[node][order])) != NULL )
+            break;
+
+    if ( pg == NULL )
+    {
+        spin_unlock(&dirty_lock);
+        return 0;
+    }
+
+    /* Requeue the upper halves of big chunks to keep each pass short. */
+    while ( order > SCRUB_CHUNK_ORDER )
+    {
+        order--;
+        page_list_add(pg + (1 << order), &dirty_list[node][order]);
+    }
+
+    dirty_pages[node] -= 1UL << order;
+    total_dirty_pages -= 1UL << order;
+
+    spin_unlock(&dirty_lock);
+
+    for ( i = 0; i < (1 << order); i++ )
+        scrub_one_page(&pg[i]);
+
+    spin_lock(&heap_lock);
+    for ( tainted = 0, i = 0; i < (1 << order); i++ )
+        tainted |= mark_page_free(&pg[i]);
+    merge_free_heap_pages(pg, order, tainted);
+    spin_unlock(&heap_lock);
+
+    return 1UL << order;
+}
+
+/* Pick a node with queued pages, preferring @node. */
+static unsigned int dirty_node(unsigned int node)
+{
+    if ( node < MAX_NUMNODES && dirty_pages[node] )
+        return node;
+
+    for_each_online_node ( node )
+        if ( dirty_pages[node] )
+            break;
+
+    return node;
+}
+
+/* Scrub at least @nr queued pages if there are any, for an allocation. */
+static unsigned long scrub_dirty_pages(unsigned int node, unsigned long nr)
+{
+    unsigned long done = 0;
+
+    while ( done < nr && total_dirty_pages &&
+            (node = dirty_node(node)) < MAX_NUMNODES )
+        done += scrub_dirty_chunk(node);
+
+    perfc_add(scrub_sync, done);
+
+    return done;
+}
+
+/*
+ * Called by idle CPUs: scrub queued pages, local node first, until there is
+ * other work. Returns non-zero if any page was scrubbed.
+ */
+bool_t scrub_free_pages(void)
+{
+    unsigned int cpu = smp_processor_id(), node;
+    unsigned long done = 0;
+
+    while ( total_dirty_pages && cpu_is_haltable(cpu) &&
+            (node = dirty_node(cpu_to_node(cpu))) < MAX_NUMNODES )
+        done += scrub_dirty_chunk(node);
+
+    perfc_add(scrub_idle, done);
+
+    return done != 0;
+}
+
+unsigned long scrub_pending_pages(void)
+{
+    return total_dirty_pages;
+}
+
+/* Allocate 2^@order contiguous pages. */
+static struct page_info *alloc_heap_pages(
+    unsigned int zone_lo, unsigned int zone_hi,
+    unsigned int order, unsigned int memflags,
+    struct domain *d)
+{
+    unsigned int node = (uint8_t)((memflags >> _MEMF_node) - 1);
+    struct page_info *pg;
+
+    if ( (pg = pcp_alloc_pages(zone_lo, zone_hi, order, memflags, d)) )
+        return pg;
+
+    pg = __alloc_heap_pages(zone_lo, zone_hi, order, memflags, d);
+
+    /* The memory we need may be sitting in other CPUs' caches. */
+    if ( pg == NULL && pcp_cached_pages() && pcp_drain_all() )
+        pg = __alloc_heap_pages(zone_lo, zone_hi, order, memflags, d);
+
+    /* Or it may still be waiting for the idle CPUs to scrub it. */
+    if ( node == NUMA_NO_NODE )
+        node = cpu_to_node(smp_processor_id());
+    while ( pg == NULL && scrub_dirty_pages(node, 1UL << order) )
+        pg = __alloc_heap_pages(zone_lo, zone_hi, order, memflags, d);
+
+    return pg;
+}
+
+/* Free 2^@order set of pages. */
+static void free_heap_pages(
+    struct page_info *pg, unsigned int order)
+{
+    if ( !pcp_free_pages(pg, order) )
+        __free_heap_pages(pg, order);
+}
+
 
 /*
  * Following rules applied for page offline:
@@ -862,6 +1437,9 @@ int offline_page(unsigned long mfn, int broken, uint32_t *status)
         return 0;
     }
 
+    /* A page sitting in a per-CPU cache can go offline right away. */
+    pcp_drain_all();
+
     spin_lock(&heap_lock);
 
     old_info = mark_page_offline(pg, broken);
@@ -1053,6 +1631,7 @@ static unsigned long avail_heap_pages(
 {
     unsigned int i, zone;
     unsigned long free_pages = 0;
+    const struct pcp_cache *pcp;
 
     if ( zone_hi >= NR_ZONES )
         zone_hi = NR_ZONES - 1;
@@ -1066,18 +1645,31 @@ static unsigned long avail_heap_pages(
                 free_pages += avail[i][zone];
     }
 
+    /* Pages in the per-CPU caches are free too, just not on the lists. */
+    for_each_online_cpu ( i )
+    {
+        pcp = &per_cpu(pcp_cache, i);
+        if ( !pcp->ready || ((node != -1) && (node != pcp->node)) )
+            continue;
+        for ( zone = max(zone_lo, pcp_zone_lo); zone <= zone_hi; zone++ )
+            free_pages += pcp->zone_pages[zone];
+    }
+
     return free_pages;
 }
 
 unsigned long total_free_pages(void)
 {
-    return total_avail_pages - midsize_alloc_zone_pages;
+    return total_avail_pages + pcp_cached_pages() + total_dirty_pages -
+           midsize_alloc_zone_pages;
 }
 
 void __init end_boot_allocator(void)
 {
     unsigned int i;
 
+    init_dirty_lists();
+
     /* Pages that are free now go to the domain sub-allocator. */
     for ( i = 0; i < nr_bootmem_regions; i++ )
     {
@@ -1117,44 +1709,135 @@ void __init end_boot_allocator(void)
 }
 
 /*
- * Scrub all unallocated pages in all heap zones. This function is more
- * convoluted than appears necessary because we do not want to continuously
- * hold the lock while scrubbing very large memory areas.
+ * Boot-time scrubbing splits RAM into chunks which all online CPUs claim in
+ * rounds, each CPU preferring chunks on its own node and helping others once
+ * its node is done. A round runs every CPU in IPI context, so nothing can
+ * allocate while it is in progress and free pages need no locking.
  */
-void __init scrub_heap_pages(void)
+#define BOOTSCRUB_CHUNK (1UL << (26 - PAGE_SHIFT)) /* 64MB */
+
+static unsigned long __initdata bootscrub_nr_chunks;
+static u8 *__initdata bootscrub_node;
+static unsigned long __initdata bootscrub_next[MAX_NUMNODES];
+static unsigned long __initdata bootscrub_pages[NR_CPUS];
+static atomic_t __initdata bootscrub_claimed;
+
+static DEFINE_SPINLOCK(bootscrub_lock);
+
+/* Claim the next unscrubbed chunk on @node, or return ~0UL. */
+static unsigned long __init bootscrub_claim(unsigned int node)
+{
+    unsigned long c;
+
+    spin_lock(&bootscrub_lock);
+
+    for ( c = bootscrub_next[node]; c < bootscrub_nr_chunks; c++ )
+        if ( !bootscrub_node || bootscrub_node[c] == node )
+            break;
+
+    if ( c < bootscrub_nr_chunks )
+    {
+        bootscrub_next[node] = c + 1;
+        atomic_inc(&bootscrub_claimed);
+    }
+    else
+    {
+        bootscrub_next[node] = c;
+        c = ~0UL;
+    }
+
+    spin_unlock(&bootscrub_lock);
+
+    return c;
+}
+
+static void __init bootscrub_round(void *unused)
 {
-    unsigned long mfn;
+    unsigned int cpu = smp_processor_id(), node = cpu_to_node(cpu);
+    unsigned long chunk, mfn, end;
     struct page_info *pg;
 
-    if ( !opt_bootscrub )
+    if ( (chunk = bootscrub_claim(node)) == ~0UL )
+        for_each_online_node ( node )
+            if ( (chunk = bootscrub_claim(node)) != ~0UL )
+                break;
+    if ( chunk == ~0UL )
         return;
 
-    printk("Scrubbing Free RAM: ");
+    mfn = first_valid_mfn + chunk * BOOTSCRUB_CHUNK;
+    end = min(mfn + BOOTSCRUB_CHUNK, max_page);
 
-    for ( mfn = first_valid_mfn; mfn < max_page; mfn++ )
+    for ( ; mfn < end; mfn++ )
     {
-        process_pending_softirqs();
-
         pg = mfn_to_page(mfn);
 
-        /* Quick lock-free check. */
         if ( !mfn_valid(mfn) || !page_state_is(pg, free) )
             continue;
 
-        /* Every 100MB, print a progress dot. */
-        if ( (mfn % ((100*1024*1024)/PAGE_SIZE)) == 0 )
-            printk(".");
+        scrub_one_page(pg);
+        bootscrub_pages[cpu]++;
+    }
+}
+
+/* Scrub all unallocated pages in all heap zones, using every online CPU. */
+void __init scrub_heap_pages(void)
+{
+    unsigned long c, mfn, end, pages = 0;
+    unsigned int cpu, node, claimed, dots = 0;
+    s_time_t start, elapsed;
+
+    if ( !opt_bootscrub )
+        return;
 
-        spin_lock(&heap_lock);
+    printk("Scrubbing Free RAM on %u CPUs: ", num_online_cpus());
 
-        /* Re-check page status with lock held. */
-        if ( page_state_is(pg, free) )
-            scrub_one_page(pg);
+    pcp_drain_all();
 
-        spin_unlock(&heap_lock);
+    /* Note the node of each chunk, by its first valid page. */
+    bootscrub_nr_chunks = DIV_ROUND_UP(max_page - first_valid_mfn,
+                                       BOOTSCRUB_CHUNK);
+    bootscrub_node = xmalloc_array(u8, bootscrub_nr_chunks);
+    for ( c = 0; bootscrub_node && c < bootscrub_nr_chunks; c++ )
+    {
+        mfn = first_valid_mfn + c * BOOTSCRUB_CHUNK;
+        end = min(mfn + BOOTSCRUB_CHUNK, max_page);
+        while ( mfn < end && !mfn_valid(mfn) )
+            mfn++;
+        node = (mfn < end) ? phys_to_nid(pfn_to_paddr(mfn)) : NUMA_NO_NODE;
+        if ( node >= MAX_NUMNODES || !node_online(node) )
+            node = cpu_to_node(0);
+        bootscrub_node[c] = node;
     }
 
+    start = NOW();
+
+    do {
+        claimed = atomic_read(&bootscrub_claimed);
+
+        on_selected_cpus(&cpu_online_map, bootscrub_round, NULL, 1);
+        process_pending_softirqs();
+
+        /* A progress dot for every GB. */
+        for ( ; dots < (atomic_read(&bootscrub_claimed) *
+                        BOOTSCRUB_CHUNK) >> (30 - PAGE_SHIFT); dots++ )
+            printk(".");
+    } while ( atomic_read(&bootscrub_claimed) != claimed );
+
+    elapsed = NOW() - start;
+
+    xfree(bootscrub_node);
+    bootscrub_node = NULL;
+
+    for_each_online_cpu ( cpu )
+        pages += bootscrub_pages[cpu];
+
     printk("done.\n");
+    printk("Scrubbed %luMB in %lu.%03lus (%luMB/s)\n",
+           pages >> (20 - PAGE_SHIFT),
+           (unsigned long)(elapsed / SECONDS(1)),
+           (unsigned long)(elapsed % SECONDS(1)) / MILLISECS(1),
+           (unsigned long)((pages >> (20 - PAGE_SHIFT)) * SECONDS(1) /
+                           (elapsed ?: 1)));
 
     /* Now that the heap is initialized, run checks and set bounds
      * for the low mem virq algorithm. */
@@ -1327,6 +2010,8 @@ int assign_pages(
         page_list_add_tail(&pg[i], &d->page_list);
     }
 
+    domain_adjust_node_pages(d, pg, 1L << order);
+
     spin_unlock(&d->page_alloc_lock);
     return 0;
 
@@ -1336,6 +2021,28 @@ int assign_pages(
 }
 
 
+/*
+ * Account for pages of @pg's node joining (@nr > 0) or leaving a domain.
+ * The scheduler uses the result as a hint of where the domain's memory
+ * is.  Called with d->page_alloc_lock held; all pages of a chunk are on
+ * the same node.
+ */
+void domain_adjust_node_pages(
+    struct domain *d, struct page_info *pg, long nr)
+{
+    unsigned int node;
+
+    if ( d->node_pages == NULL )
+        return;
+
+    node = phys_to_nid(page_to_maddr(pg));
+    if ( nr < 0 && d->node_pages[node] < -nr )
+        d->node_pages[node] = 0;
+    else
+        d->node_pages[node] += nr;
+}
+
+
 struct page_info *alloc_domheap_pages(
     struct domain *d, unsigned int order, unsigned int memflags)
 {
@@ -1400,25 +2107,25 @@ void free_domheap_pages(struct page_info *pg, unsigned int order)
 
         d->tot_pages -= 1 << order;
         drop_dom_ref = (d->tot_pages == 0);
+        domain_adjust_node_pages(d, pg, -(1L << order));
 
         spin_unlock_recursive(&d->page_alloc_lock);
 
         /*
          * Normally we expect a domain to clear pages before freeing them, if 
          * it cares about the secrecy of their contents. However, after a 
-         * domain has died we assume responsibility for erasure.
+         * domain has died we assume responsibility for erasure, which is
+         * left to the idle CPUs.
          */
         if ( unlikely(d->is_dying) )
-            for ( i = 0; i < (1 << order); i++ )
-                scrub_one_page(&pg[i]);
-
-        free_heap_pages(pg, order);
+            free_dirty_heap_pages(pg, order);
+        else
+            free_heap_pages(pg, order);
     }
     else if ( unlikely(d == dom_cow) )
     {
         ASSERT(order == 0); 
-        scrub_one_page(pg);
-        free_heap_pages(pg, 0);
+        free_dirty_heap_pages(pg, 0);
         drop_dom_ref = 0;
     }
     else
@@ -1484,6 +2191,10 @@ static void pagealloc_info(unsigned char key)
     }
 
     printk("    Dom heap: %lukB free\n", total << (PAGE_SHIFT-10));
+    printk("    of which in per-CPU caches: %lukB\n",
+           pcp_cached_pages() << (PAGE_SHIFT-10));
+    printk("    Awaiting scrub: %lukB\n",
+           total_dirty_pages << (PAGE_SHIFT-10));
 }
 
 static struct keyhandler pagealloc_info_keyhandler = {
@@ -1521,7 +2232,7 @@ void scrub_one_page(struct page_info *pg)
 static void dump_heap(unsigned char key)
 {
     s_time_t      now = NOW();
-    int           i, j;
+    int           i, j, cpu;
 
     printk("'%c' pressed -> dumping heap info (now-0x%X:%08X)\n", key,
            (u32)(now>>32), (u32)now);
@@ -1534,6 +2245,21 @@ static void dump_heap(unsigned char key)
             printk("heap[node=%d][zone=%d] -> %lu pages\n",
                    i, j, avail[i][j]);
     }
+
+    for_each_online_cpu ( cpu )
+    {
+        struct pcp_cache *pcp = &per_cpu(pcp_cache, cpu);
+
+        if ( !pcp->ready )
+            continue;
+        for ( j = 0; j <= PCP_MAX_ORDER; j++ )
+            printk("pcp[cpu=%d][order=%d] -> %u chunks\n",
+                   cpu, j, pcp->count[j]);
+    }
+
+    for_each_online_node ( i )
+        if ( dirty_pages[i] )
+            printk("dirty[node=%d] -> %lu pages\n", i, dirty_pages[i]);
 }
 
 static struct keyhandler dump_heap_keyhandler = {
@@ -54,6 +54,12 @@
 #define CSCHED_PRI_TS_OVER      -2      /* time-share w/o credits */
 #define CSCHED_PRI_IDLE         -64     /* idle */
 
+/*
+ * Co-scheduling: once one vcpu of a co-scheduled domain is dispatched, its
+ * runnable siblings are preferred on their own pcpus for this long.
+ */
+#define CSCHED_COSCHED_WINDOW   MICROSECS(500)
+
 
 /*
  * Flags
@@ -62,6 +68,16 @@
 #define CSCHED_FLAG_VCPU_YIELD     0x1  /* VCPU yielding */
 
 
+/*
+ * NUMA load balancing steps: first the CPUs on the nodes holding most of
+ * the domain's memory, then any CPU in the VCPU's affinity.
+ */
+#define CSCHED_BALANCE_NODE_AFFINITY    0
+#define CSCHED_BALANCE_CPU_AFFINITY     1
+#define for_each_csched_balance_step(step) \
+    for ( (step) = 0; (step) <= CSCHED_BALANCE_CPU_AFFINITY; (step)++ )
+
+
 /*
  * Useful macros
  */
@@ -110,6 +126,14 @@ static bool_t __read_mostly sched_credit_default_yield;
 boolean_param("sched_credit_default_yield", sched_credit_default_yield);
 static int __read_mostly sched_credit_tslice_ms = CSCHED_DEFAULT_TSLICE_MS;
 integer_param("sched_credit_tslice_ms", sched_credit_tslice_ms);
+static bool_t __read_mostly sched_credit_tickless;
+boolean_param("sched_credit_tickless", sched_credit_tickless);
+
+/*
+ * Ticks may come this late, so that they can share an interrupt with
+ * other timers.
+ */
+#define CSCHED_TICK_SLACK           MICROSECS(500)
 
 /*
  * Physical CPU
@@ -120,6 +144,7 @@ struct csched_pcpu {
     struct timer ticker;
     unsigned int tick;
     unsigned int idle_bias;
+    bool_t tick_stopped;        /* Tickless and idle: ticker not running */
 };
 
 /*
@@ -132,6 +157,7 @@ struct csched_vcpu {
     struct vcpu *vcpu;
     atomic_t credit;
     s_time_t start_time;   /* When we were scheduled (used for credit) */
+    s_time_t remote_time;  /* Time run outside the domain's memory nodes */
     unsigned flags;
     int16_t pri;
 #ifdef CSCHED_STATS
@@ -156,6 +182,10 @@ struct csched_dom {
     uint16_t active_vcpu_count;
     uint16_t weight;
     uint16_t cap;
+    nodemask_t node_affinity;  /* Nodes holding most of dom's memory */
+    cpumask_t node_cpus;       /* CPUs of those nodes */
+    bool_t cosched;            /* Dispatch vcpus together */
+    s_time_t cosched_until;    /* End of the current co-scheduling window */
 };
 
 /*
@@ -178,6 +208,8 @@ struct csched_private {
     /* Period of master and tick in milliseconds */
     unsigned tslice_ms, tick_period_us, ticks_per_tslice;
     unsigned credits_per_tslice;
+    unsigned int ncosched;      /* # of co-scheduled domains */
+    bool_t acct_stopped;        /* Tickless and no active vcpus */
 };
 
 static void csched_tick(void *_cpu);
@@ -247,6 +279,77 @@ static void burn_credits(struct csched_vcpu *svc, s_time_t now)
     credits = (delta*CSCHED_CREDITS_PER_MSEC + MILLISECS(1)/2) / MILLISECS(1);
     atomic_sub(credits, &svc->credit);
     svc->start_time += (credits * MILLISECS(1)) / CSCHED_CREDITS_PER_MSEC;
+
+    /* Count what start_time moved on by, as the remainder of delta is
+     * charged again on the next call. */
+    if ( !nodes_empty(svc->sdom->node_affinity) &&
+         !cpumask_test_cpu(svc->vcpu->processor, &svc->sdom->node_cpus) )
+    {
+        CSCHED_STAT_CRANK(run_remote_node);
+        svc->remote_time += (credits * MILLISECS(1)) / CSCHED_CREDITS_PER_MSEC;
+    }
+}
+
+/*
+ * Recompute the nodes a domain's memory mostly lives on: those holding at
+ * least half as many of its pages as the node holding the most.  Evenly
+ * spread memory thus yields all nodes, i.e. no preference.
+ */
+static void
+csched_dom_update_node_affinity(struct csched_dom *sdom)
+{
+    const unsigned long *node_pages = sdom->dom->node_pages;
+    nodemask_t nodes = NODE_MASK_NONE;
+    unsigned long max = 0;
+    unsigned int node;
+
+    if ( node_pages == NULL )
+        return;
+
+    for_each_online_node ( node )
+        if ( node_pages[node] > max )
+            max = node_pages[node];
+
+    for_each_online_node ( node )
+        if ( max && node_pages[node] * 2 >= max )
+            node_set(node, nodes);
+
+    if ( nodes_equal(nodes, sdom->node_affinity) )
+        return;
+
+    cpumask_clear(&sdom->node_cpus);
+    for_each_node_mask ( node, nodes )
+        cpumask_or(&sdom->node_cpus, &sdom->node_cpus,
+                   &node_to_cpumask(node));
+    sdom->node_affinity = nodes;
+}
+
+/*
+ * Is the node-affinity step worth trying for vc: do the domain's memory
+ * nodes cover some, but not all, of the online CPUs vc may run on?
+ */
+static inline int
+__vcpu_has_node_affinity(const struct vcpu *vc, const cpumask_t *online)
+{
+    const struct csched_dom *sdom = CSCHED_DOM(vc->domain);
+    cpumask_t cpus;
+
+    if ( sdom == NULL || nodes_empty(sdom->node_affinity) )
+        return 0;
+
+    cpumask_and(&cpus, online, vc->cpu_affinity);
+    return cpumask_intersects(&cpus, &sdom->node_cpus) &&
+           !cpumask_subset(&cpus, &sdom->node_cpus);
+}
+
+static inline void
+csched_balance_cpumask(const struct vcpu *vc, int step, cpumask_t *mask)
+{
+    if ( step == CSCHED_BALANCE_NODE_AFFINITY )
+        cpumask_and(mask, &CSCHED_DOM(vc->domain)->node_cpus,
+                    vc->cpu_affinity);
+    else
+        cpumask_copy(mask, vc->cpu_affinity);
 }
 
 static bool_t __read_mostly opt_tickle_one_idle = 1;
@@ -367,12 +470,15 @@ csched_alloc_pdata(const struct scheduler *ops, int cpu)
     if ( prv->ncpus == 1 )
     {
         prv->master = cpu;
+        prv->acct_stopped = 0;
         init_timer(&prv->master_ticker, csched_acct, prv, cpu);
+        set_timer_slack(&prv->master_ticker, CSCHED_TICK_SLACK);
         set_timer(&prv->master_ticker,
                   NOW() + MILLISECS(prv->tslice_ms));
     }
 
     init_timer(&spc->ticker, csched_tick, (void *)(unsigned long)cpu, cpu);
+    set_timer_slack(&spc->ticker, CSCHED_TICK_SLACK);
     set_timer(&spc->ticker, NOW() + MICROSECS(prv->tick_period_us) );
 
     INIT_LIST_HEAD(&spc->runq);
@@ -466,85 +572,116 @@ _csched_cpu_pick(const struct scheduler *ops, struct vcpu *vc, bool_t commit)
     cpumask_t idlers;
     cpumask_t *online;
     struct csched_pcpu *spc = NULL;
-    int cpu;
+    int cpu = vc->processor;
+    int balance_step;
 
-    /*
-     * Pick from online CPUs in VCPU's affinity mask, giving a
-     * preference to its current processor if it's in there.
-     */
     online = cpupool_scheduler_cpumask(vc->domain->cpupool);
-    cpumask_and(&cpus, online, vc->cpu_affinity);
-    cpu = cpumask_test_cpu(vc->processor, &cpus)
-            ? vc->processor
-            : cpumask_cycle(vc->processor, &cpus);
-    ASSERT( !cpumask_empty(&cpus) && cpumask_test_cpu(cpu, &cpus) );
-
-    /*
-     * Try to find an idle processor within the above constraints.
-     *
-     * In multi-core and multi-threaded CPUs, not all idle execution
-     * vehicles are equal!
-     *
-     * We give preference to the idle execution vehicle with the most
-     * idling neighbours in its grouping. This distributes work across
-     * distinct cores first and guarantees we don't do something stupid
-     * like run two VCPUs on co-hyperthreads while there are idle cores
-     * or sockets.
-     *
-     * Notice that, when computing the "idleness" of cpu, we may want to
-     * discount vc. That is, iff vc is the currently running and the only
-     * runnable vcpu on cpu, we add cpu to the idlers.
-     */
-    cpumask_and(&idlers, &cpu_online_map, CSCHED_PRIV(ops)->idlers);
-    if ( vc->processor == cpu && IS_RUNQ_IDLE(cpu) )
-        cpumask_set_cpu(cpu, &idlers);
-    cpumask_and(&cpus, &cpus, &idlers);
-    cpumask_clear_cpu(cpu, &cpus);
-
-    while ( !cpumask_empty(&cpus) )
+    for_each_csched_balance_step( balance_step )
     {
-        cpumask_t cpu_idlers;
-        cpumask_t nxt_idlers;
-        int nxt, weight_cpu, weight_nxt;
-        int migrate_factor;
-
-        nxt = cpumask_cycle(cpu, &cpus);
+        if ( balance_step == CSCHED_BALANCE_NODE_AFFINITY &&
+             !__vcpu_has_node_affinity(vc, online) )
+            continue;
 
-        if ( cpumask_test_cpu(cpu, per_cpu(cpu_core_mask, nxt)) )
-        {
-            /* We're on the same socket, so check the busy-ness of threads.
-             * Migrate if # of idlers is less at all */
-            ASSERT( cpumask_test_cpu(nxt, per_cpu(cpu_core_mask, cpu)) );
-            migrate_factor = 1;
-            cpumask_and(&cpu_idlers, &idlers, per_cpu(cpu_sibling_mask, cpu));
-            cpumask_and(&nxt_idlers, &idlers, per_cpu(cpu_sibling_mask, nxt));
-        }
-        else
+        /*
+         * Pick from online CPUs in VCPU's affinity mask (narrowed down to
+         * the domain's memory nodes in the first step), giving a
+         * preference to its current processor if it's in there.
+         */
+        csched_balance_cpumask(vc, balance_step, &cpus);
+        cpumask_and(&cpus, &cpus, online);
+        if ( cpumask_empty(&cpus) )
         {
-            /* We're on different sockets, so check the busy-ness of cores.
-             * Migrate only if the other core is twice as idle */
-            ASSERT( !cpumask_test_cpu(nxt, per_cpu(cpu_core_mask, cpu)) );
-            migrate_factor = 2;
-            cpumask_and(&cpu_idlers, &idlers, per_cpu(cpu_core_mask, cpu));
-            cpumask_and(&nxt_idlers, &idlers, per_cpu(cpu_core_mask, nxt));
+            /* The domain's memory nodes may have just changed under us. */
+            ASSERT( balance_step == CSCHED_BALANCE_NODE_AFFINITY );
+            continue;
         }
+        cpu = cpumask_test_cpu(vc->processor, &cpus)
+                ? vc->processor
+                : cpumask_cycle(vc->processor, &cpus);
+        ASSERT( !cpumask_empty(&cpus) && cpumask_test_cpu(cpu, &cpus) );
 
-        weight_cpu = cpumask_weight(&cpu_idlers);
-        weight_nxt = cpumask_weight(&nxt_idlers);
-        /* smt_power_savings: consolidate work rather than spreading it */
-        if ( sched_smt_power_savings ?
-             weight_cpu > weight_nxt :
-             weight_cpu * migrate_factor < weight_nxt )
-        {
-            cpumask_and(&nxt_idlers, &cpus, &nxt_idlers);
-            spc = CSCHED_PCPU(nxt);
-            cpu = cpumask_cycle(spc->idle_bias, &nxt_idlers);
-            cpumask_andnot(&cpus, &cpus, per_cpu(cpu_sibling_mask, cpu));
-        }
-        else
+        /*
+         * Try to find an idle processor within the above constraints.
+         *
+         * In multi-core and multi-threaded CPUs, not all idle execution
+         * vehicles are equal!
+         *
+         * We give preference to the idle execution vehicle with the most
+         * idling neighbours in its grouping. This distributes work across
+         * distinct cores first and guarantees we don't do something stupid
+         * like run two VCPUs on co-hyperthreads while there are idle cores
+         * or sockets.
+         *
+         * Notice that, when computing the "idleness" of cpu, we may want to
+         * discount vc. That is, iff vc is the currently running and the only
+         * runnable vcpu on cpu, we add cpu to the idlers.
+         */
+        cpumask_and(&idlers, &cpu_online_map, CSCHED_PRIV(ops)->idlers);
+        if ( vc->processor == cpu && IS_RUNQ_IDLE(cpu) )
+            cpumask_set_cpu(cpu, &idlers);
+        cpumask_and(&cpus, &cpus, &idlers);
+
+        /*
+         * Nothing idle on the domain's memory nodes: rather than queueing
+         * there, see whether the wider affinity has an idle CPU.
+         */
+        if ( balance_step == CSCHED_BALANCE_NODE_AFFINITY &&
+             cpumask_empty(&cpus) )
+            continue;
+        if ( balance_step == CSCHED_BALANCE_NODE_AFFINITY )
+            CSCHED_STAT_CRANK(pick_node_affinity);
+
+        cpumask_clear_cpu(cpu, &cpus);
+
+        while ( !cpumask_empty(&cpus) )
         {
-            cpumask_andnot(&cpus, &cpus, &nxt_idlers);
+            cpumask_t cpu_idlers;
+            cpumask_t nxt_idlers;
+            int nxt, weight_cpu, weight_nxt;
+            int migrate_factor;
+
+            nxt = cpumask_cycle(cpu, &cpus);
+
+            if ( cpumask_test_cpu(cpu, per_cpu(cpu_core_mask, nxt)) )
+            {
+                /* We're on the same socket, so check the busy-ness of threads.
+                 * Migrate if # of idlers is less at all */
+                ASSERT( cpumask_test_cpu(nxt, per_cpu(cpu_core_mask, cpu)) );
+                migrate_factor = 1;
+                cpumask_and(&cpu_idlers, &idlers,
+                            per_cpu(cpu_sibling_mask, cpu));
+                cpumask_and(&nxt_idlers, &idlers,
+                            per_cpu(cpu_sibling_mask, nxt));
+            }
+            else
+            {
+                /* We're on different sockets, so check the busy-ness of cores.
+                 * Migrate only if the other core is twice as idle */
+                ASSERT( !cpumask_test_cpu(nxt, per_cpu(cpu_core_mask, cpu)) );
+                migrate_factor = 2;
+                cpumask_and(&cpu_idlers, &idlers, per_cpu(cpu_core_mask, cpu));
+                cpumask_and(&nxt_idlers, &idlers, per_cpu(cpu_core_mask, nxt));
+            }
+
+            weight_cpu = cpumask_weight(&cpu_idlers);
+            weight_nxt = cpumask_weight(&nxt_idlers);
+            /* smt_power_savings: consolidate work rather than spreading it */
+            if ( sched_smt_power_savings ?
+                 weight_cpu > weight_nxt :
+                 weight_cpu * migrate_factor < weight_nxt )
+            {
+                cpumask_and(&nxt_idlers, &cpus, &nxt_idlers);
+                spc = CSCHED_PCPU(nxt);
+                cpu = cpumask_cycle(spc->idle_bias, &nxt_idlers);
+                cpumask_andnot(&cpus, &cpus, per_cpu(cpu_sibling_mask, cpu));
+            }
+            else
+            {
+                cpumask_andnot(&cpus, &cpus, &nxt_idlers);
+            }
         }
+
+        break;
     }
 
     if ( commit && spc )
@@ -580,6 +717,14 @@ __csched_vcpu_acct_start(struct csched_private *prv, struct csched_vcpu *svc)
         {
             list_add(&sdom->active_sdom_elem, &prv->active_sdom);
         }
+
+        /* There was nothing to account for until now. */
+        if ( unlikely(prv->acct_stopped) )
+        {
+            prv->acct_stopped = 0;
+            set_timer(&prv->master_ticker,
+                      NOW() + MILLISECS(prv->tslice_ms));
+        }
     }
 
     spin_unlock_irqrestore(&prv->lock, flags);
@@ -798,6 +943,27 @@ csched_vcpu_yield(const struct scheduler *ops, struct vcpu *vc)
     }
 }
 
+/*
+ * A sibling spinning on a lock wants vc, which was preempted while
+ * runnable, to run again soon.  Treat it like a waking vcpu.
+ */
+static void
+csched_vcpu_yield_to(const struct scheduler *ops, struct vcpu *from,
+                     struct vcpu *vc)
+{
+    struct csched_vcpu * const svc = CSCHED_VCPU(vc);
+    const unsigned int cpu = vc->processor;
+
+    if ( svc->pri != CSCHED_PRI_TS_UNDER || !__vcpu_on_runq(svc) )
+        return;
+
+    CSCHED_STAT_CRANK(vcpu_boost_yield_to);
+    __runq_remove(svc);
+    svc->pri = CSCHED_PRI_TS_BOOST;
+    __runq_insert(cpu, svc);
+    __runq_tickle(cpu, svc);
+}
+
 static int
 csched_dom_cntl(
     const struct scheduler *ops,
@@ -816,6 +982,7 @@ csched_dom_cntl(
     {
         op->u.credit.weight = sdom->weight;
         op->u.credit.cap = sdom->cap;
+        op->u.credit.cosched = sdom->cosched;
     }
     else
     {
@@ -834,6 +1001,16 @@ csched_dom_cntl(
         if ( op->u.credit.cap != (uint16_t)~0U )
             sdom->cap = op->u.credit.cap;
 
+        if ( op->u.credit.cosched != (uint16_t)~0U &&
+             !!op->u.credit.cosched != sdom->cosched )
+        {
+            sdom->cosched = !!op->u.credit.cosched;
+            if ( sdom->cosched )
+                prv->ncosched++;
+            else
+                prv->ncosched--;
+        }
+
     }
 
     spin_unlock_irqrestore(&prv->lock, flags);
@@ -889,6 +1066,24 @@ csched_alloc_domdata(const struct scheduler *ops, struct domain *dom)
     sdom->weight = CSCHED_DEFAULT_WEIGHT;
     sdom->cap = 0U;
 
+    /*
+     * When a domain moves here from another credit cpupool, it stays
+     * co-scheduled.  csched_free_domdata() takes care of the count if the
+     * move fails.
+     */
+    if ( dom->sched_priv != NULL && dom->cpupool != NULL &&
+         dom->cpupool->sched->sched_id == XEN_SCHEDULER_CREDIT &&
+         CSCHED_DOM(dom)->cosched )
+    {
+        struct csched_private *prv = CSCHED_PRIV(ops);
+        unsigned long flags;
+
+        spin_lock_irqsave(&prv->lock, flags);
+        sdom->cosched = 1;
+        prv->ncosched++;
+        spin_unlock_irqrestore(&prv->lock, flags);
+    }
+
     return (void *)sdom;
 }
 
@@ -914,6 +1109,17 @@ csched_dom_init(const struct scheduler *ops, struct domain *dom)
 static void
 csched_free_domdata(const struct scheduler *ops, void *data)
 {
+    struct csched_dom *sdom = data;
+    struct csched_private *prv = CSCHED_PRIV(ops);
+    unsigned long flags;
+
+    if ( sdom->cosched )
+    {
+        spin_lock_irqsave(&prv->lock, flags);
+        prv->ncosched--;
+        spin_unlock_irqrestore(&prv->lock, flags);
+    }
+
     xfree(data);
 }
 
@@ -1009,8 +1215,16 @@ csched_acct(void* dummy)
     if ( unlikely(weight_total == 0) )
     {
         prv->credit_balance = 0;
-        spin_unlock_irqrestore(&prv->lock, flags);
         CSCHED_STAT_CRANK(acct_no_work);
+        if ( sched_credit_tickless )
+        {
+            /* __csched_vcpu_acct_start() restarts us. */
+            prv->acct_stopped = 1;
+            spin_unlock_irqrestore(&prv->lock, flags);
+            CSCHED_STAT_CRANK(acct_stopped);
+            return;
+        }
+        spin_unlock_irqrestore(&prv->lock, flags);
         goto out;
     }
 
@@ -1026,6 +1240,8 @@ csched_acct(void* dummy)
         sdom = list_entry(iter_sdom, struct csched_dom, active_sdom_elem);
 
         BUG_ON( is_idle_domain(sdom->dom) );
+
+        csched_dom_update_node_affinity(sdom);
         BUG_ON( sdom->active_vcpu_count == 0 );
         BUG_ON( sdom->weight == 0 );
         BUG_ON( (sdom->weight * sdom->active_vcpu_count) > weight_left );
@@ -1208,8 +1424,26 @@ csched_tick(void *_cpu)
     set_timer(&spc->ticker, NOW() + MICROSECS(prv->tick_period_us) );
 }
 
+static void
+csched_tick_idle(struct csched_private *prv, unsigned int cpu, bool_t idle)
+{
+    struct csched_pcpu *spc = CSCHED_PCPU(cpu);
+
+    if ( idle == spc->tick_stopped )
+        return;
+
+    spc->tick_stopped = idle;
+    if ( idle )
+    {
+        stop_timer(&spc->ticker);
+        CSCHED_STAT_CRANK(tick_stopped);
+    }
+    else
+        set_timer(&spc->ticker, NOW() + MICROSECS(prv->tick_period_us));
+}
+
 static struct csched_vcpu *
-csched_runq_steal(int peer_cpu, int cpu, int pri)
+csched_runq_steal(int peer_cpu, int cpu, int pri, int balance_step)
 {
     const struct csched_pcpu * const peer_pcpu = CSCHED_PCPU(peer_cpu);
     const struct vcpu * const peer_vcpu = per_cpu(schedule_data, peer_cpu).curr;
@@ -1238,11 +1472,19 @@ csched_runq_steal(int peer_cpu, int cpu, int pri)
             vc = speer->vcpu;
             BUG_ON( is_idle_vcpu(vc) );
 
+            /* First pass: only VCPUs whose memory is local to us. */
+            if ( balance_step == CSCHED_BALANCE_NODE_AFFINITY &&
+                 (nodes_empty(speer->sdom->node_affinity) ||
+                  !cpumask_test_cpu(cpu, &speer->sdom->node_cpus)) )
+                continue;
+
             if (__csched_vcpu_is_migrateable(vc, cpu))
             {
                 /* We got a candidate. Grab it! */
                 CSCHED_VCPU_STAT_CRANK(speer, migrate_q);
                 CSCHED_STAT_CRANK(migrate_queued);
+                if ( balance_step == CSCHED_BALANCE_NODE_AFFINITY )
+                    CSCHED_STAT_CRANK(migrate_node_local);
                 WARN_ON(vc->is_urgent);
                 __runq_remove(speer);
                 vc->processor = cpu;
@@ -1262,7 +1504,7 @@ csched_load_balance(struct csched_private *prv, int cpu,
     struct csched_vcpu *speer;
     cpumask_t workers;
     cpumask_t *online;
-    int peer_cpu;
+    int peer_cpu, peer_node, node, balance_step;
 
     BUG_ON( cpu != snext->vcpu->processor );
     online = cpupool_scheduler_cpumask(per_cpu(cpupool, cpu));
@@ -1279,42 +1521,64 @@ csched_load_balance(struct csched_private *prv, int cpu,
         CSCHED_STAT_CRANK(load_balance_other);
 
     /*
-     * Peek at non-idling CPUs in the system, starting with our
-     * immediate neighbour.
+     * Peek at non-idling CPUs in the system, node by node starting with
+     * our own, and within a node starting with our immediate neighbour.
+     * The first pass only looks for VCPUs whose memory lives on our node;
+     * it is pointless on non-NUMA hosts.
      */
-    cpumask_andnot(&workers, online, prv->idlers);
-    cpumask_clear_cpu(cpu, &workers);
-    peer_cpu = cpu;
-
-    while ( !cpumask_empty(&workers) )
+    node = cpu_to_node(cpu);
+    if ( node >= MAX_NUMNODES || !node_online(node) )
+        node = first_node(node_online_map);
+    for_each_csched_balance_step( balance_step )
     {
-        peer_cpu = cpumask_cycle(peer_cpu, &workers);
-        cpumask_clear_cpu(peer_cpu, &workers);
-
-        /*
-         * Get ahold of the scheduler lock for this peer CPU.
-         *
-         * Note: We don't spin on this lock but simply try it. Spinning could
-         * cause a deadlock if the peer CPU is also load balancing and trying
-         * to lock this CPU.
-         */
-        if ( !pcpu_schedule_trylock(peer_cpu) )
-        {
-            CSCHED_STAT_CRANK(steal_trylock_failed);
+        if ( balance_step == CSCHED_BALANCE_NODE_AFFINITY &&
+             num_online_nodes() <= 1 )
             continue;
-        }
 
-        /*
-         * Any work over there to steal?
-         */
-        speer = cpumask_test_cpu(peer_cpu, online) ?
-            csched_runq_steal(peer_cpu, cpu, snext->pri) : NULL;
-        pcpu_schedule_unlock(peer_cpu);
-        if ( speer != NULL )
+        peer_node = node;
+        do
         {
-            *stolen = 1;
-            return speer;
-        }
+            cpumask_andnot(&workers, online, prv->idlers);
+            cpumask_and(&workers, &workers, &node_to_cpumask(peer_node));
+            cpumask_clear_cpu(cpu, &workers);
+            peer_cpu = cpu;
+
+            while ( !cpumask_empty(&workers) )
+            {
+                peer_cpu = cpumask_cycle(peer_cpu, &workers);
+                cpumask_clear_cpu(peer_cpu, &workers);
+
+                /*
+                 * Get ahold of the scheduler lock for this peer CPU.
+                 *
+                 * Note: We don't spin on this lock but simply try it.
+                 * Spinning could cause a deadlock if the peer CPU is also
+                 * load balancing and trying to lock this CPU.
+                 */
+                if ( !pcpu_schedule_trylock(peer_cpu) )
+                {
+                    CSCHED_STAT_CRANK(steal_trylock_failed);
+                    continue;
+                }
+
+                /*
+                 * Any work over there to steal?
+                 */
+                speer = cpumask_test_cpu(peer_cpu, online) ?
+                    csched_runq_steal(peer_cpu, cpu, snext->pri,
+                                      balance_step) : NULL;
+                pcpu_schedule_unlock(peer_cpu);
+                if ( speer != NULL )
+                {
+                    *stolen = 1;
+                    return speer;
+                }
+            }
+
+            peer_node = next_node(peer_node, node_online_map);
+            if ( peer_node == MAX_NUMNODES )
+                peer_node = first_node(node_online_map);
+        } while ( peer_node != node );
     }
 
  out:
@@ -1323,6 +1587,63 @@ csched_load_balance(struct csched_private *prv, int cpu,
     return snext;
 }
 
+/*
+ * Of the vcpus queued at the head's priority, prefer one whose siblings
+ * are being dispatched right now.
+ */
+static struct csched_vcpu *
+csched_runq_cosched(struct list_head *runq, struct csched_vcpu *snext,
+                    s_time_t now)
+{
+    struct list_head *iter;
+
+    list_for_each( iter, runq )
+    {
+        struct csched_vcpu * const svc = __runq_elem(iter);
+
+        if ( svc->pri < snext->pri )
+            break;
+        if ( svc->sdom != NULL && svc->sdom->cosched &&
+             svc->sdom->cosched_until > now )
+        {
+            if ( svc != snext )
+                CSCHED_STAT_CRANK(cosched_pick);
+            return svc;
+        }
+    }
+
+    return snext;
+}
+
+/*
+ * svc, of a co-scheduled domain, is about to run: open a window in which
+ * its siblings are preferred, and make their pcpus reschedule.
+ */
+static void
+csched_cosched_kick(struct csched_vcpu *svc, s_time_t now)
+{
+    struct csched_dom * const sdom = svc->sdom;
+    struct vcpu *v;
+    cpumask_t mask;
+
+    /* The siblings being dispatched in this window don't kick again. */
+    if ( sdom->cosched_until > now )
+        return;
+    sdom->cosched_until = now + CSCHED_COSCHED_WINDOW;
+
+    cpumask_clear(&mask);
+    for_each_vcpu ( sdom->dom, v )
+        if ( v != svc->vcpu && v->runstate.state == RUNSTATE_runnable )
+            cpumask_set_cpu(v->processor, &mask);
+    cpumask_clear_cpu(svc->vcpu->processor, &mask);
+
+    if ( !cpumask_empty(&mask) )
+    {
+        CSCHED_STAT_CRANK(cosched_kick);
+        cpumask_raise_softirq(&mask, SCHEDULE_SOFTIRQ);
+    }
+}
+
 /*
  * This function is in the critical path. It is designed to be simple and
  * fast for the common case.
@@ -1398,6 +1719,10 @@ csched_schedule(
     snext = __runq_elem(runq->next);
     ret.migrated = 0;
 
+    if ( unlikely(prv->ncosched) && snext->pri <= CSCHED_PRI_TS_UNDER &&
+         snext->pri > CSCHED_PRI_IDLE )
+        snext = csched_runq_cosched(runq, snext, now);
+
     /* Tasklet work (which runs in idle VCPU context) overrides all else. */
     if ( tasklet_work_scheduled )
     {
@@ -1438,9 +1763,20 @@ csched_schedule(
     }
 
     if ( !is_idle_vcpu(snext->vcpu) )
+    {
         snext->start_time += now;
+        if ( snext->sdom->cosched && snext != scurr )
+            csched_cosched_kick(snext, now);
+    }
 
 out:
+    /*
+     * Tickless: ticks only account for and sort the work of a busy pcpu,
+     * so stop them while idle.
+     */
+    if ( sched_credit_tickless )
+        csched_tick_idle(prv, cpu, is_idle_vcpu(snext->vcpu));
+
     /*
      * Return task to run next...
      */
@@ -1467,6 +1803,8 @@ csched_dump_vcpu(struct csched_vcpu *svc)
     if ( sdom )
     {
         printk(" credit=%i [w=%u]", atomic_read(&svc->credit), sdom->weight);
+        if ( !nodes_empty(sdom->node_affinity) )
+            printk(" remote=%"PRI_stime"ms", svc->remote_time / MILLISECS(1));
 #ifdef CSCHED_STATS
         printk(" (%d+%u) {a/i=%u/%u m=%u+%u}",
                 svc->stats.credit_last,
@@ -1663,6 +2001,10 @@ static void csched_tick_resume(const struct scheduler *ops, unsigned int cpu)
 
     spc = CSCHED_PCPU(cpu);
 
+    /* Tickless and idle: leave it to csched_schedule(). */
+    if ( spc->tick_stopped )
+        return;
+
     prv = CSCHED_PRIV(ops);
 
     set_timer(&spc->ticker, now + MICROSECS(prv->tick_period_us)
@@ -1686,6 +2028,7 @@ const struct scheduler sched_credit_def = {
     .sleep          = csched_vcpu_sleep,
     .wake           = csched_vcpu_wake,
     .yield          = csched_vcpu_yield,
+    .yield_to       = csched_vcpu_yield_to,
 
     .adjust         = csched_dom_cntl,
     .adjust_global  = csched_sys_cntl,
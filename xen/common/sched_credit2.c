@@ -25,6 +25,7 @@
 #include <xen/errno.h>
 #include <xen/trace.h>
 #include <xen/cpu.h>
+#include <xen/rbtree.h>
 
 #define d2printk(x...)
 //#define d2printk printk
@@ -41,6 +42,7 @@
 #define TRC_CSCHED2_RUNQ_ASSIGN   TRC_SCHED_CLASS + 10
 #define TRC_CSCHED2_UPDATE_VCPU_LOAD   TRC_SCHED_CLASS + 11
 #define TRC_CSCHED2_UPDATE_RUNQ_LOAD   TRC_SCHED_CLASS + 12
+#define TRC_CSCHED2_SCHEDULE_TIME      TRC_SCHED_CLASS + 13
 
 /*
  * WARNING: This is still in an experimental phase.  Status and work can be found at the
@@ -190,6 +192,18 @@ integer_param("credit2_balance_under", opt_underload_balance_tolerance);
 int opt_overload_balance_tolerance=-3;
 integer_param("credit2_balance_over", opt_overload_balance_tolerance);
 
+/*
+ * Runqueue arrangement: one runqueue (and hence one lock) per socket, per
+ * core, or per cpu.  Smaller runqueues mean less lock contention and
+ * shorter queues, at the price of more work for the load balancer.
+ */
+#define OPT_RUNQUEUE_CPU    0
+#define OPT_RUNQUEUE_CORE   1
+#define OPT_RUNQUEUE_SOCKET 2
+static char __initdata opt_runqueue_str[8] = "socket";
+string_param("credit2_runqueue", opt_runqueue_str);
+static int __read_mostly opt_runqueue = OPT_RUNQUEUE_SOCKET;
+
 /*
  * Per-runqueue data
  */
@@ -199,7 +213,7 @@ struct csched_runqueue_data {
     spinlock_t lock;      /* Lock for this runqueue. */
     cpumask_t active;      /* CPUs enabled for this runqueue */
 
-    struct list_head runq; /* Ordered list of runnable vms */
+    struct rb_root runq;   /* Runnable vms, ordered by credit */
     struct list_head svc;  /* List of all vcpus assigned to this runqueue */
     int max_weight;
 
@@ -233,7 +247,7 @@ struct csched_private {
 struct csched_vcpu {
     struct list_head rqd_elem;  /* On the runqueue data list */
     struct list_head sdom_elem; /* On the domain vcpu list */
-    struct list_head runq_elem; /* On the runqueue         */
+    struct rb_node runq_elem;   /* On the runqueue         */
     struct csched_runqueue_data *rqd; /* Up-pointer to the runqueue */
 
     /* Up-pointers */
@@ -286,13 +300,13 @@ static s_time_t c2t(struct csched_runqueue_data *rqd, s_time_t credit, struct cs
 static /*inline*/ int
 __vcpu_on_runq(struct csched_vcpu *svc)
 {
-    return !list_empty(&svc->runq_elem);
+    return !RB_EMPTY_NODE(&svc->runq_elem);
 }
 
 static /*inline*/ struct csched_vcpu *
-__runq_elem(struct list_head *elem)
+__runq_elem(struct rb_node *elem)
 {
-    return list_entry(elem, struct csched_vcpu, runq_elem);
+    return rb_entry(elem, struct csched_vcpu, runq_elem);
 }
 
 static void
@@ -394,11 +408,10 @@ update_load(const struct scheduler *ops,
         __update_svc_load(ops, svc, change, now);
 }
 
-static int
-__runq_insert(struct list_head *runq, struct csched_vcpu *svc)
+static void
+__runq_insert(struct rb_root *runq, struct csched_vcpu *svc)
 {
-    struct list_head *iter;
-    int pos = 0;
+    struct rb_node **link = &runq->rb_node, *parent = NULL;
 
     d2printk("rqi d%dv%d\n",
            svc->vcpu->domain->domain_id,
@@ -410,47 +423,46 @@ __runq_insert(struct list_head *runq, struct csched_vcpu *svc)
     BUG_ON(svc->vcpu->is_running);
     BUG_ON(test_bit(__CSFLAG_scheduled, &svc->flags));
 
-    list_for_each( iter, runq )
+    /* Highest credit leftmost; equal credit goes behind existing entries. */
+    while ( *link )
     {
-        struct csched_vcpu * iter_svc = __runq_elem(iter);
-
-        if ( svc->credit > iter_svc->credit )
-        {
-            d2printk(" p%d d%dv%d\n",
-                   pos,
-                   iter_svc->vcpu->domain->domain_id,
-                   iter_svc->vcpu->vcpu_id);
-            break;
-        }
-        pos++;
+        parent = *link;
+        if ( svc->credit > __runq_elem(parent)->credit )
+            link = &parent->rb_left;
+        else
+            link = &parent->rb_right;
     }
 
-    list_add_tail(&svc->runq_elem, iter);
-
-    return pos;
+    rb_link_node(&svc->runq_elem, parent, link);
+    rb_insert_color(&svc->runq_elem, runq);
 }
 
 static void
 runq_insert(const struct scheduler *ops, unsigned int cpu, struct csched_vcpu *svc)
 {
-    struct list_head * runq = &RQD(ops, cpu)->runq;
-    int pos = 0;
+    struct rb_root * runq = &RQD(ops, cpu)->runq;
 
     ASSERT( spin_is_locked(per_cpu(schedule_data, cpu).schedule_lock) );
 
     BUG_ON( __vcpu_on_runq(svc) );
     BUG_ON( c2r(ops, cpu) != c2r(ops, svc->vcpu->processor) );
 
-    pos = __runq_insert(runq, svc);
+    __runq_insert(runq, svc);
 
+    /* The position is only worked out (linearly) when tracing. */
+    if ( unlikely(tb_init_done) )
     {
         struct {
             unsigned dom:16,vcpu:16;
             unsigned pos;
         } d;
+        struct rb_node *iter;
+
         d.dom = svc->vcpu->domain->domain_id;
         d.vcpu = svc->vcpu->vcpu_id;
-        d.pos = pos;
+        d.pos = 0;
+        for ( iter = rb_prev(&svc->runq_elem); iter; iter = rb_prev(iter) )
+            d.pos++;
         trace_var(TRC_CSCHED2_RUNQ_POS, 0,
                   sizeof(d),
                   (unsigned char *)&d);
@@ -463,7 +475,8 @@ static inline void
 __runq_remove(struct csched_vcpu *svc)
 {
     BUG_ON( !__vcpu_on_runq(svc) );
-    list_del_init(&svc->runq_elem);
+    rb_erase(&svc->runq_elem, &svc->rqd->runq);
+    RB_CLEAR_NODE(&svc->runq_elem);
 }
 
 void burn_credits(struct csched_runqueue_data *rqd, struct csched_vcpu *, s_time_t);
@@ -730,7 +743,7 @@ csched_alloc_vdata(const struct scheduler *ops, struct vcpu *vc, void *dd)
 
     INIT_LIST_HEAD(&svc->rqd_elem);
     INIT_LIST_HEAD(&svc->sdom_elem);
-    INIT_LIST_HEAD(&svc->runq_elem);
+    RB_CLEAR_NODE(&svc->runq_elem);
 
     svc->sdom = dd;
     svc->vcpu = vc;
@@ -866,7 +879,7 @@ csched_vcpu_remove(const struct scheduler *ops, struct vcpu *vc)
     struct csched_dom * const sdom = svc->sdom;
 
     BUG_ON( sdom == NULL );
-    BUG_ON( !list_empty(&svc->runq_elem) );
+    BUG_ON( __vcpu_on_runq(svc) );
 
     if ( ! is_idle_vcpu(vc) )
     {
@@ -1499,7 +1512,7 @@ csched_runtime(const struct scheduler *ops, int cpu, struct csched_vcpu *snext)
 {
     s_time_t time = CSCHED_MAX_TIMER;
     struct csched_runqueue_data *rqd = RQD(ops, cpu);
-    struct list_head *runq = &rqd->runq;
+    struct rb_root *runq = &rqd->runq;
 
     if ( is_idle_vcpu(snext->vcpu) )
         return CSCHED_MAX_TIMER;
@@ -1508,9 +1521,9 @@ csched_runtime(const struct scheduler *ops, int cpu, struct csched_vcpu *snext)
     time = c2t(rqd, snext->credit, snext);
 
     /* Next guy on runqueue */
-    if ( ! list_empty(runq) )
+    if ( ! RB_EMPTY_ROOT(runq) )
     {
-        struct csched_vcpu *svc = __runq_elem(runq->next);
+        struct csched_vcpu *svc = __runq_elem(rb_first(runq));
         s_time_t ntime;
 
         if ( ! is_idle_vcpu(svc->vcpu) )
@@ -1541,7 +1554,7 @@ runq_candidate(struct csched_runqueue_data *rqd,
                struct csched_vcpu *scurr,
                int cpu, s_time_t now)
 {
-    struct list_head *iter;
+    struct rb_node *iter;
     struct csched_vcpu *snext = NULL;
 
     /* Default to current if runnable, idle otherwise */
@@ -1550,9 +1563,13 @@ runq_candidate(struct csched_runqueue_data *rqd,
     else
         snext = CSCHED_VCPU(idle_vcpu[cpu]);
 
-    list_for_each( iter, &rqd->runq )
+    for ( iter = rb_first(&rqd->runq); iter != NULL; iter = rb_next(iter) )
     {
-        struct csched_vcpu * svc = list_entry(iter, struct csched_vcpu, runq_elem);
+        struct csched_vcpu * svc = __runq_elem(iter);
+
+        /* The runqueue is sorted: nobody further down can beat snext. */
+        if ( svc->credit <= snext->credit )
+            break;
 
         /* If this is on a different processor, don't pull it unless
          * its credit is at least CSCHED_MIGRATE_RESIST higher. */
@@ -1730,6 +1747,21 @@ csched_schedule(
     ret.time = csched_runtime(ops, cpu, snext);
     ret.task = snext->vcpu;
 
+    /* Time spent making the decision, for latency analysis. */
+    if ( unlikely(tb_init_done) )
+    {
+        struct {
+            unsigned rqi:16, load:16;
+            unsigned ns;
+        } d;
+        d.rqi = rqd->id;
+        d.load = rqd->load;
+        d.ns = NOW() - now;
+        trace_var(TRC_CSCHED2_SCHEDULE_TIME, 1,
+                  sizeof(d),
+                  (unsigned char *)&d);
+    }
+
     CSCHED_VCPU_CHECK(ret.task);
     return ret;
 }
@@ -1751,15 +1783,13 @@ csched_dump_vcpu(struct csched_vcpu *svc)
 static void
 csched_dump_pcpu(const struct scheduler *ops, int cpu)
 {
-    struct list_head *runq, *iter;
+    struct rb_node *iter;
     struct csched_vcpu *svc;
     int loop;
     char cpustr[100];
 
     /* FIXME: Do locking properly for access to runqueue structures */
 
-    runq = &RQD(ops, cpu)->runq;
-
     cpumask_scnprintf(cpustr, sizeof(cpustr), per_cpu(cpu_sibling_mask, cpu));
     printk(" sibling=%s, ", cpustr);
     cpumask_scnprintf(cpustr, sizeof(cpustr), per_cpu(cpu_core_mask, cpu));
@@ -1774,7 +1804,7 @@ csched_dump_pcpu(const struct scheduler *ops, int cpu)
     }
 
     loop = 0;
-    list_for_each( iter, runq )
+    for ( iter = rb_first(&RQD(ops, cpu)->runq); iter; iter = rb_next(iter) )
     {
         svc = __runq_elem(iter);
         if ( svc )
@@ -1850,7 +1880,7 @@ static void activate_runqueue(struct csched_private *prv, int rqi)
     rqd->max_weight = 1;
     rqd->id = rqi;
     INIT_LIST_HEAD(&rqd->svc);
-    INIT_LIST_HEAD(&rqd->runq);
+    rqd->runq = RB_ROOT;
     spin_lock_init(&rqd->lock);
 
     cpumask_set_cpu(rqi, &prv->active_queues);
@@ -1885,19 +1915,20 @@ static void init_pcpu(const struct scheduler *ops, int cpu)
         return;
     }
 
-    /* Figure out which runqueue to put it in */
-    rqi = 0;
-
     /* Figure out which runqueue to put it in */
     /* NB: cpu 0 doesn't get a STARTING callback, so we hard-code it to runqueue 0. */
     if ( cpu == 0 )
         rqi = 0;
+    else if ( opt_runqueue == OPT_RUNQUEUE_CPU )
+        rqi = cpu;
+    else if ( opt_runqueue == OPT_RUNQUEUE_CORE )
+        rqi = cpumask_first(per_cpu(cpu_sibling_mask, cpu));
     else
         rqi = cpu_to_socket(cpu);
 
     if ( rqi < 0 )
     {
-        printk("%s: cpu_to_socket(%d) returned %d!\n",
+        printk("%s: no runqueue for cpu %d (%d)!\n",
                __func__, cpu, rqi);
         BUG();
     }
@@ -1980,10 +2011,11 @@ csched_free_pdata(const struct scheduler *ops, void *pcpu, int cpu)
         deactivate_runqueue(prv, rqi);
     }
 
-    /* Move spinlock to the original lock.  */
-    ASSERT(sd->schedule_lock == &rqd->lock);
+    /* Move spinlock to the original lock, unless the new pool's scheduler
+     * has already taken it over. */
     ASSERT(!spin_is_locked(&sd->_lock));
-    sd->schedule_lock = &sd->_lock;
+    if ( sd->schedule_lock == &rqd->lock )
+        sd->schedule_lock = &sd->_lock;
 
     spin_unlock(&rqd->lock);
 
@@ -2033,6 +2065,14 @@ static struct notifier_block cpu_credit2_nfb = {
 static int
 csched_global_init(void)
 {
+    if ( !strcmp(opt_runqueue_str, "cpu") )
+        opt_runqueue = OPT_RUNQUEUE_CPU;
+    else if ( !strcmp(opt_runqueue_str, "core") )
+        opt_runqueue = OPT_RUNQUEUE_CORE;
+    else if ( strcmp(opt_runqueue_str, "socket") )
+        printk("credit2: unknown runqueue arrangement '%s', using socket\n",
+               opt_runqueue_str);
+
     register_cpu_notifier(&cpu_credit2_nfb);
     return 0;
 }
@@ -2050,6 +2090,9 @@ csched_init(struct scheduler *ops)
     printk(" load_window_shift: %d\n", opt_load_window_shift);
     printk(" underload_balance_tolerance: %d\n", opt_underload_balance_tolerance);
     printk(" overload_balance_tolerance: %d\n", opt_overload_balance_tolerance);
+    printk(" runqueues: per %s\n",
+           opt_runqueue == OPT_RUNQUEUE_CPU ? "cpu" :
+           opt_runqueue == OPT_RUNQUEUE_CORE ? "core" : "socket");
 
     if ( opt_load_window_shift < LOADAVG_WINDOW_SHIFT_MIN )
     {
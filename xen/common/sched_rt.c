@@ -0,0 +1,950 @@
+/******************************************************************************
+ * sched_rt.c
+ *
+ * Global Earliest Deadline First real-time scheduler.
+ *
+ * Every vcpu is a deferrable server with a budget and a period: it may run
+ * for up to budget ns in each period, and whatever it does not use while
+ * blocked is kept until the end of the period, at which point the budget
+ * is replenished and the deadline moves on by a period.  Runnable vcpus
+ * with budget left are kept on a single, deadline-ordered run queue shared
+ * by all the pcpus of the cpupool; the pcpus run the vcpus with the
+ * earliest deadlines.  Vcpus which exhausted their budget wait on the
+ * depleted queue, ordered by replenishment time.  A per-pool timer fires
+ * at the earliest replenishment, so a vcpu gets its budget back on time
+ * even when no pcpu has a reason to reschedule.
+ *
+ * Parameters are set per domain (applying to all its vcpus) or per vcpu
+ * through XEN_DOMCTL_SCHEDOP_putinfo.  Vcpus are only let into a pool,
+ * and their parameters only raised, while the pool can guarantee them.
+ */
+
+#include <xen/config.h>
+#include <xen/init.h>
+#include <xen/lib.h>
+#include <xen/sched.h>
+#include <xen/sched-if.h>
+#include <xen/softirq.h>
+#include <xen/time.h>
+#include <xen/timer.h>
+#include <xen/errno.h>
+#include <xen/list.h>
+#include <xen/cpumask.h>
+#include <xen/perfc.h>
+#include <xen/keyhandler.h>
+
+/*
+ * Default and minimum parameters, in microseconds.
+ */
+#define RTDS_DEFAULT_PERIOD     10000
+#define RTDS_DEFAULT_BUDGET     4000
+#define RTDS_MIN_PERIOD         100
+#define RTDS_MIN_BUDGET         10
+
+/* Upper bound on the timeslice handed out, so the queues are revisited. */
+#define RTDS_MAX_SCHEDULE       MILLISECS(10)
+
+/* Fixed point utilisation: RTDS_UTIL_ONE is one full pcpu. */
+#define RTDS_UTIL_SHIFT         20
+#define RTDS_UTIL_ONE           (1ULL << RTDS_UTIL_SHIFT)
+
+/*
+ * Flags
+ */
+/* The vcpu is running (or about to) on a pcpu, and not on any queue. */
+#define __RTDS_scheduled        1
+/* The vcpu is being descheduled while runnable; queue it in context_saved. */
+#define __RTDS_delayed_runq_add 2
+
+#define RTDS_PRIV(_ops)     ((struct rt_private *)((_ops)->sched_data))
+#define RTDS_VCPU(_vcpu)    ((struct rt_vcpu *)(_vcpu)->sched_priv)
+#define RTDS_DOM(_dom)      ((struct rt_dom *)(_dom)->sched_priv)
+
+/*
+ * System-wide private data.  All the pcpus of the pool use lock as their
+ * schedule lock, so every hook runs with it held unless noted otherwise.
+ */
+struct rt_private {
+    spinlock_t lock;
+    struct list_head sdom;      /* All domains, for admission control */
+    struct list_head runq;      /* Runnable, budget left; by deadline */
+    struct list_head depletedq; /* Runnable, no budget; by deadline */
+    cpumask_t cpus;             /* pcpus of the pool */
+    cpumask_t tickled;          /* pcpus asked to reschedule */
+    struct timer repl_timer;    /* Replenishes the queues */
+    unsigned int repl_cpu;      /* Where repl_timer runs */
+    s_time_t repl_time;         /* When repl_timer is set for */
+};
+
+/*
+ * Virtual CPU
+ */
+struct rt_vcpu {
+    struct list_head q_elem;    /* On runq or depletedq */
+    struct list_head sdom_elem; /* On the domain's vcpu list */
+    struct rt_dom *sdom;
+    struct vcpu *vcpu;
+
+    s_time_t period;
+    s_time_t budget;
+
+    s_time_t cur_budget;        /* Budget left in this period */
+    s_time_t cur_deadline;      /* End of this period */
+    s_time_t last_start;        /* When we last started running */
+
+    unsigned flags;
+};
+
+/*
+ * Domain
+ */
+struct rt_dom {
+    struct list_head vcpu;
+    struct list_head sdom_elem;
+    struct domain *dom;
+    s_time_t period;            /* Parameters given to new vcpus */
+    s_time_t budget;
+};
+
+static inline int
+__vcpu_on_q(const struct rt_vcpu *svc)
+{
+    return !list_empty(&svc->q_elem);
+}
+
+static inline struct rt_vcpu *
+__q_elem(struct list_head *elem)
+{
+    return list_entry(elem, struct rt_vcpu, q_elem);
+}
+
+static inline uint64_t
+rt_util(s_time_t budget, s_time_t period)
+{
+    return ((uint64_t)budget << RTDS_UTIL_SHIFT) / period;
+}
+
+/*
+ * Move svc into the period containing now, with a full budget, if its
+ * current period has ended.
+ */
+static void
+rt_update_deadline(struct rt_vcpu *svc, s_time_t now)
+{
+    s_time_t missed;
+
+    if ( now < svc->cur_deadline )
+        return;
+
+    if ( svc->cur_deadline == 0 )
+        svc->cur_deadline = now + svc->period;
+    else
+    {
+        missed = (now - svc->cur_deadline) / svc->period + 1;
+        svc->cur_deadline += missed * svc->period;
+    }
+    svc->cur_budget = svc->budget;
+}
+
+static void
+burn_budget(struct rt_vcpu *svc, s_time_t now)
+{
+    s_time_t delta;
+
+    if ( is_idle_vcpu(svc->vcpu) )
+        return;
+
+    delta = now - svc->last_start;
+    if ( delta > 0 )
+    {
+        svc->cur_budget -= delta;
+        if ( svc->cur_budget < 0 )
+            svc->cur_budget = 0;
+        svc->last_start = now;
+    }
+}
+
+static void
+__q_insert(struct list_head *q, struct rt_vcpu *svc)
+{
+    struct list_head *iter;
+
+    list_for_each( iter, q )
+        if ( svc->cur_deadline < __q_elem(iter)->cur_deadline )
+            break;
+
+    list_add_tail(&svc->q_elem, iter);
+}
+
+/*
+ * Queue a runnable vcpu which is not running, bringing the replenishment
+ * timer forward if it is now the first to need its budget back.
+ */
+static void
+__runq_insert(const struct scheduler *ops, struct rt_vcpu *svc)
+{
+    struct rt_private *prv = RTDS_PRIV(ops);
+
+    ASSERT( spin_is_locked(&prv->lock) );
+    BUG_ON( __vcpu_on_q(svc) );
+    BUG_ON( is_idle_vcpu(svc->vcpu) );
+
+    __q_insert(svc->cur_budget > 0 ? &prv->runq : &prv->depletedq, svc);
+
+    if ( svc->cur_deadline < prv->repl_time && !cpumask_empty(&prv->cpus) )
+    {
+        prv->repl_time = svc->cur_deadline;
+        set_timer(&prv->repl_timer, prv->repl_time);
+    }
+}
+
+static inline void
+__q_remove(struct rt_vcpu *svc)
+{
+    if ( __vcpu_on_q(svc) )
+        list_del_init(&svc->q_elem);
+}
+
+/* When the first queued vcpu needs replenishing. */
+static s_time_t
+__next_repl(const struct scheduler *ops)
+{
+    struct rt_private *prv = RTDS_PRIV(ops);
+    s_time_t next = STIME_MAX;
+
+    if ( !list_empty(&prv->depletedq) )
+        next = __q_elem(prv->depletedq.next)->cur_deadline;
+    if ( !list_empty(&prv->runq) &&
+         __q_elem(prv->runq.next)->cur_deadline < next )
+        next = __q_elem(prv->runq.next)->cur_deadline;
+
+    return next;
+}
+
+/* The earliest deadline vcpu on the runq which may run on cpu. */
+static struct rt_vcpu *
+__runq_pick(const struct scheduler *ops, unsigned int cpu)
+{
+    struct rt_private *prv = RTDS_PRIV(ops);
+    struct list_head *iter;
+
+    list_for_each( iter, &prv->runq )
+    {
+        struct rt_vcpu *svc = __q_elem(iter);
+
+        if ( cpumask_test_cpu(cpu, svc->vcpu->cpu_affinity) )
+            return svc;
+    }
+
+    return NULL;
+}
+
+/*
+ * new has just been queued: find a pcpu for it, preferring an idle one,
+ * otherwise the one running the latest deadline later than new's.
+ */
+static void
+runq_tickle(const struct scheduler *ops, struct rt_vcpu *new)
+{
+    struct rt_private *prv = RTDS_PRIV(ops);
+    struct rt_vcpu *latest = NULL, *cur;
+    cpumask_t cpus;
+    unsigned int cpu, target = 0;
+
+    if ( new == NULL || is_idle_vcpu(new->vcpu) || new->cur_budget <= 0 )
+        return;
+
+    cpumask_and(&cpus, &prv->cpus, new->vcpu->cpu_affinity);
+    cpumask_andnot(&cpus, &cpus, &prv->tickled);
+
+    for_each_cpu ( cpu, &cpus )
+    {
+        cur = RTDS_VCPU(per_cpu(schedule_data, cpu).curr);
+        if ( is_idle_vcpu(cur->vcpu) )
+        {
+            target = cpu;
+            goto tickle;
+        }
+        if ( latest == NULL || cur->cur_deadline > latest->cur_deadline )
+        {
+            latest = cur;
+            target = cpu;
+        }
+    }
+
+    if ( latest == NULL || latest->cur_deadline <= new->cur_deadline )
+        return;
+
+ tickle:
+    cpumask_set_cpu(target, &prv->tickled);
+    cpu_raise_softirq(target, SCHEDULE_SOFTIRQ);
+}
+
+/*
+ * Replenish the queued vcpus whose period has ended.  Both queues are
+ * ordered by deadline, so only their heads need looking at.  A vcpu
+ * which got its budget back may preempt one running elsewhere.
+ */
+static void
+__repl_update(const struct scheduler *ops, s_time_t now)
+{
+    struct rt_private *prv = RTDS_PRIV(ops);
+    struct list_head *queues[] = { &prv->depletedq, &prv->runq };
+    struct rt_vcpu *svc;
+    unsigned int i;
+
+    for ( i = 0; i < ARRAY_SIZE(queues); i++ )
+        while ( !list_empty(queues[i]) )
+        {
+            svc = __q_elem(queues[i]->next);
+            if ( now < svc->cur_deadline )
+                break;
+            __q_remove(svc);
+            rt_update_deadline(svc, now);
+            __runq_insert(ops, svc);
+            runq_tickle(ops, svc);
+        }
+}
+
+static void
+rt_repl_timer(void *data)
+{
+    const struct scheduler *ops = data;
+    struct rt_private *prv = RTDS_PRIV(ops);
+    unsigned long flags;
+
+    spin_lock_irqsave(&prv->lock, flags);
+
+    prv->repl_time = STIME_MAX;
+    __repl_update(ops, NOW());
+    prv->repl_time = __next_repl(ops);
+    if ( prv->repl_time != STIME_MAX )
+        set_timer(&prv->repl_timer, prv->repl_time);
+
+    spin_unlock_irqrestore(&prv->lock, flags);
+}
+
+/*
+ * Is the set of vcpus in the pool, with sdom's (or just svc's)
+ * parameters replaced by period/budget, schedulable by global EDF on the
+ * pool's pcpus?  This uses the utilisation bound of Goossens, Funk and
+ * Baruah: U <= m - (m - 1) * u_max.  A svc not on its domain's list yet
+ * is being added to the pool.  Changes which fail the bound are still
+ * allowed if they raise neither U nor u_max, so an overloaded pool can
+ * always be relieved.
+ */
+static int
+rt_admit(const struct scheduler *ops, struct rt_dom *sdom,
+         struct rt_vcpu *svc, s_time_t period, s_time_t budget)
+{
+    struct rt_private *prv = RTDS_PRIV(ops);
+    struct list_head *iter_sdom, *iter_svc;
+    uint64_t total = 0, max = 0, old_total = 0, old_max = 0, u, old;
+    unsigned int m = cpumask_weight(&prv->cpus);
+
+    list_for_each( iter_sdom, &prv->sdom )
+    {
+        struct rt_dom *d = list_entry(iter_sdom, struct rt_dom, sdom_elem);
+
+        list_for_each( iter_svc, &d->vcpu )
+        {
+            struct rt_vcpu *v = list_entry(iter_svc, struct rt_vcpu,
+                                           sdom_elem);
+
+            old = rt_util(v->budget, v->period);
+            if ( v == svc || (svc == NULL && d == sdom) )
+                u = rt_util(budget, period);
+            else
+                u = old;
+            total += u;
+            old_total += old;
+            if ( u > max )
+                max = u;
+            if ( old > old_max )
+                old_max = old;
+        }
+    }
+
+    if ( svc != NULL && list_empty(&svc->sdom_elem) )
+    {
+        u = rt_util(budget, period);
+        total += u;
+        if ( u > max )
+            max = u;
+    }
+
+    if ( m == 0 )
+        return 0;
+
+    if ( total <= m * RTDS_UTIL_ONE - (m - 1) * max )
+        return 0;
+
+    return total <= old_total && max <= old_max ? 0 : -EBUSY;
+}
+
+static void
+rt_set_params(struct rt_vcpu *svc, s_time_t period, s_time_t budget)
+{
+    svc->period = period;
+    svc->budget = budget;
+    if ( svc->cur_budget > budget )
+        svc->cur_budget = budget;
+}
+
+/*
+ * Hooks
+ */
+
+/*
+ * Vcpus joining the pool, whether new or moved from another pool, go
+ * through admission here, where failing is still possible.
+ */
+static void *
+rt_alloc_vdata(const struct scheduler *ops, struct vcpu *vc, void *dd)
+{
+    struct rt_private *prv = RTDS_PRIV(ops);
+    struct rt_vcpu *svc;
+    struct rt_dom *sdom = dd;
+    unsigned long flags;
+
+    svc = xzalloc(struct rt_vcpu);
+    if ( svc == NULL )
+        return NULL;
+
+    INIT_LIST_HEAD(&svc->q_elem);
+    INIT_LIST_HEAD(&svc->sdom_elem);
+    svc->sdom = sdom;
+    svc->vcpu = vc;
+
+    if ( !is_idle_vcpu(vc) )
+    {
+        BUG_ON( sdom == NULL );
+        svc->period = sdom->period;
+        svc->budget = sdom->budget;
+
+        spin_lock_irqsave(&prv->lock, flags);
+        if ( rt_admit(ops, sdom, svc, svc->period, svc->budget) )
+        {
+            spin_unlock_irqrestore(&prv->lock, flags);
+            printk(XENLOG_G_WARNING "RTDS: d%dv%d does not fit in the pool\n",
+                   vc->domain->domain_id, vc->vcpu_id);
+            xfree(svc);
+            return NULL;
+        }
+        list_add_tail(&svc->sdom_elem, &sdom->vcpu);
+        spin_unlock_irqrestore(&prv->lock, flags);
+    }
+    else
+    {
+        svc->period = MICROSECS(RTDS_DEFAULT_PERIOD);
+        svc->budget = 0;
+        svc->cur_deadline = STIME_MAX;
+    }
+
+    return svc;
+}
+
+static void
+rt_free_vdata(const struct scheduler *ops, void *priv)
+{
+    struct rt_private *prv = RTDS_PRIV(ops);
+    struct rt_vcpu *svc = priv;
+    unsigned long flags;
+
+    spin_lock_irqsave(&prv->lock, flags);
+    list_del_init(&svc->sdom_elem);
+    spin_unlock_irqrestore(&prv->lock, flags);
+
+    xfree(svc);
+}
+
+static void
+rt_vcpu_insert(const struct scheduler *ops, struct vcpu *vc)
+{
+    struct rt_vcpu *svc = RTDS_VCPU(vc);
+
+    if ( is_idle_vcpu(vc) )
+        return;
+
+    vcpu_schedule_lock_irq(vc);
+
+    rt_update_deadline(svc, NOW());
+    if ( vcpu_runnable(vc) && !vc->is_running )
+    {
+        __runq_insert(ops, svc);
+        runq_tickle(ops, svc);
+    }
+
+    vcpu_schedule_unlock_irq(vc);
+}
+
+static void
+rt_vcpu_remove(const struct scheduler *ops, struct vcpu *vc)
+{
+    struct rt_vcpu *svc = RTDS_VCPU(vc);
+
+    if ( is_idle_vcpu(vc) )
+        return;
+
+    vcpu_schedule_lock_irq(vc);
+    __q_remove(svc);
+    list_del_init(&svc->sdom_elem);
+    vcpu_schedule_unlock_irq(vc);
+}
+
+static int
+rt_cpu_pick(const struct scheduler *ops, struct vcpu *vc)
+{
+    cpumask_t cpus;
+
+    cpumask_and(&cpus, cpupool_scheduler_cpumask(vc->domain->cpupool),
+                vc->cpu_affinity);
+    ASSERT( !cpumask_empty(&cpus) );
+
+    /* The run queue is global: staying put is as good as anywhere. */
+    return cpumask_test_cpu(vc->processor, &cpus)
+           ? vc->processor : cpumask_cycle(vc->processor, &cpus);
+}
+
+static void
+rt_vcpu_sleep(const struct scheduler *ops, struct vcpu *vc)
+{
+    struct rt_vcpu * const svc = RTDS_VCPU(vc);
+
+    BUG_ON( is_idle_vcpu(vc) );
+
+    if ( per_cpu(schedule_data, vc->processor).curr == vc )
+        cpu_raise_softirq(vc->processor, SCHEDULE_SOFTIRQ);
+    else if ( __vcpu_on_q(svc) )
+        __q_remove(svc);
+    else if ( test_bit(__RTDS_delayed_runq_add, &svc->flags) )
+        clear_bit(__RTDS_delayed_runq_add, &svc->flags);
+}
+
+static void
+rt_vcpu_wake(const struct scheduler *ops, struct vcpu *vc)
+{
+    struct rt_vcpu * const svc = RTDS_VCPU(vc);
+
+    BUG_ON( is_idle_vcpu(vc) );
+
+    if ( unlikely(per_cpu(schedule_data, vc->processor).curr == vc) ||
+         unlikely(__vcpu_on_q(svc)) )
+        return;
+
+    /* Budget saved up while blocked is kept until the period ends. */
+    rt_update_deadline(svc, NOW());
+
+    /* Still on its way off a pcpu: context_saved() will queue it. */
+    if ( unlikely(test_bit(__RTDS_scheduled, &svc->flags)) )
+    {
+        set_bit(__RTDS_delayed_runq_add, &svc->flags);
+        return;
+    }
+
+    __runq_insert(ops, svc);
+    runq_tickle(ops, svc);
+}
+
+static void
+rt_context_saved(const struct scheduler *ops, struct vcpu *vc)
+{
+    struct rt_vcpu * const svc = RTDS_VCPU(vc);
+
+    vcpu_schedule_lock_irq(vc);
+
+    clear_bit(__RTDS_scheduled, &svc->flags);
+    if ( test_and_clear_bit(__RTDS_delayed_runq_add, &svc->flags) &&
+         likely(vcpu_runnable(vc)) )
+    {
+        __runq_insert(ops, svc);
+        runq_tickle(ops, svc);
+    }
+
+    vcpu_schedule_unlock_irq(vc);
+}
+
+static struct task_slice
+rt_schedule(const struct scheduler *ops, s_time_t now,
+            bool_t tasklet_work_scheduled)
+{
+    const unsigned int cpu = smp_processor_id();
+    struct rt_private *prv = RTDS_PRIV(ops);
+    struct rt_vcpu * const scurr = RTDS_VCPU(current);
+    struct rt_vcpu *snext = NULL;
+    struct task_slice ret = { .migrated = 0 };
+
+    cpumask_clear_cpu(cpu, &prv->tickled);
+
+    burn_budget(scurr, now);
+    if ( !is_idle_vcpu(current) )
+        rt_update_deadline(scurr, now);
+    __repl_update(ops, now);
+
+    if ( tasklet_work_scheduled )
+        snext = RTDS_VCPU(idle_vcpu[cpu]);
+    else
+    {
+        snext = __runq_pick(ops, cpu);
+        if ( snext == NULL )
+            snext = RTDS_VCPU(idle_vcpu[cpu]);
+
+        /* Keep running current if it still has the earliest deadline. */
+        if ( !is_idle_vcpu(current) && vcpu_runnable(current) &&
+             scurr->cur_budget > 0 &&
+             (is_idle_vcpu(snext->vcpu) ||
+              scurr->cur_deadline <= snext->cur_deadline) )
+            snext = scurr;
+    }
+
+    if ( snext != scurr && !is_idle_vcpu(current) && vcpu_runnable(current) )
+        set_bit(__RTDS_delayed_runq_add, &scurr->flags);
+
+    snext->last_start = now;
+    if ( !is_idle_vcpu(snext->vcpu) )
+    {
+        if ( snext != scurr )
+        {
+            __q_remove(snext);
+            set_bit(__RTDS_scheduled, &snext->flags);
+        }
+        if ( snext->vcpu->processor != cpu )
+        {
+            snext->vcpu->processor = cpu;
+            ret.migrated = 1;
+        }
+    }
+
+    /*
+     * Come back when snext runs out of budget or reaches its deadline.
+     * Queued vcpus being replenished is repl_timer's business: it tickles
+     * whichever pcpu they should preempt.
+     */
+    if ( is_idle_vcpu(snext->vcpu) )
+        ret.time = -1;
+    else
+    {
+        ret.time = min(snext->cur_budget, snext->cur_deadline - now);
+        ret.time = max_t(s_time_t, min(ret.time, RTDS_MAX_SCHEDULE),
+                         MICROSECS(RTDS_MIN_BUDGET));
+    }
+    ret.task = snext->vcpu;
+
+    return ret;
+}
+
+static int
+rt_dom_cntl(const struct scheduler *ops, struct domain *d,
+            struct xen_domctl_scheduler_op *op)
+{
+    struct rt_private *prv = RTDS_PRIV(ops);
+    struct rt_dom * const sdom = RTDS_DOM(d);
+    struct rt_vcpu *svc = NULL;
+    struct list_head *iter;
+    s_time_t period, budget;
+    unsigned long flags;
+    int rc = 0;
+
+    if ( op->u.rtds.vcpuid != XEN_DOMCTL_SCHED_RTDS_ALL_VCPUS )
+    {
+        if ( op->u.rtds.vcpuid >= d->max_vcpus ||
+             d->vcpu[op->u.rtds.vcpuid] == NULL )
+            return -EINVAL;
+        svc = RTDS_VCPU(d->vcpu[op->u.rtds.vcpuid]);
+    }
+
+    spin_lock_irqsave(&prv->lock, flags);
+
+    if ( op->cmd == XEN_DOMCTL_SCHEDOP_getinfo )
+    {
+        op->u.rtds.period = (svc ? svc->period : sdom->period) / MICROSECS(1);
+        op->u.rtds.budget = (svc ? svc->budget : sdom->budget) / MICROSECS(1);
+        goto out;
+    }
+
+    ASSERT(op->cmd == XEN_DOMCTL_SCHEDOP_putinfo);
+
+    if ( op->u.rtds.period < RTDS_MIN_PERIOD ||
+         op->u.rtds.budget < RTDS_MIN_BUDGET ||
+         op->u.rtds.budget > op->u.rtds.period )
+    {
+        rc = -EINVAL;
+        goto out;
+    }
+    period = MICROSECS(op->u.rtds.period);
+    budget = MICROSECS(op->u.rtds.budget);
+
+    rc = rt_admit(ops, sdom, svc, period, budget);
+    if ( rc )
+        goto out;
+
+    if ( svc != NULL )
+        rt_set_params(svc, period, budget);
+    else
+    {
+        sdom->period = period;
+        sdom->budget = budget;
+        list_for_each( iter, &sdom->vcpu )
+            rt_set_params(list_entry(iter, struct rt_vcpu, sdom_elem),
+                          period, budget);
+    }
+
+ out:
+    spin_unlock_irqrestore(&prv->lock, flags);
+
+    return rc;
+}
+
+static void *
+rt_alloc_domdata(const struct scheduler *ops, struct domain *dom)
+{
+    struct rt_private *prv = RTDS_PRIV(ops);
+    struct rt_dom *sdom;
+    unsigned long flags;
+
+    sdom = xzalloc(struct rt_dom);
+    if ( sdom == NULL )
+        return NULL;
+
+    INIT_LIST_HEAD(&sdom->vcpu);
+    INIT_LIST_HEAD(&sdom->sdom_elem);
+    sdom->dom = dom;
+    sdom->period = MICROSECS(RTDS_DEFAULT_PERIOD);
+    sdom->budget = MICROSECS(RTDS_DEFAULT_BUDGET);
+
+    spin_lock_irqsave(&prv->lock, flags);
+    list_add_tail(&sdom->sdom_elem, &prv->sdom);
+    spin_unlock_irqrestore(&prv->lock, flags);
+
+    return sdom;
+}
+
+static void
+rt_free_domdata(const struct scheduler *ops, void *data)
+{
+    struct rt_private *prv = RTDS_PRIV(ops);
+    struct rt_dom *sdom = data;
+    unsigned long flags;
+
+    spin_lock_irqsave(&prv->lock, flags);
+    list_del_init(&sdom->sdom_elem);
+    spin_unlock_irqrestore(&prv->lock, flags);
+
+    xfree(data);
+}
+
+static int
+rt_dom_init(const struct scheduler *ops, struct domain *dom)
+{
+    struct rt_dom *sdom;
+
+    if ( is_idle_domain(dom) )
+        return 0;
+
+    sdom = rt_alloc_domdata(ops, dom);
+    if ( sdom == NULL )
+        return -ENOMEM;
+
+    dom->sched_priv = sdom;
+
+    return 0;
+}
+
+static void
+rt_dom_destroy(const struct scheduler *ops, struct domain *dom)
+{
+    rt_free_domdata(ops, RTDS_DOM(dom));
+}
+
+static void *
+rt_alloc_pdata(const struct scheduler *ops, int cpu)
+{
+    struct rt_private *prv = RTDS_PRIV(ops);
+    spinlock_t *old_lock;
+    unsigned long flags;
+
+    /* Move the pcpu over to the pool-wide lock. */
+    local_irq_save(flags);
+    old_lock = pcpu_schedule_lock(cpu);
+    per_cpu(schedule_data, cpu).schedule_lock = &prv->lock;
+    spin_unlock(old_lock);
+
+    spin_lock(&prv->lock);
+    if ( cpumask_empty(&prv->cpus) )
+    {
+        prv->repl_cpu = cpu;
+        init_timer(&prv->repl_timer, rt_repl_timer, (void *)ops, cpu);
+        prv->repl_time = __next_repl(ops);
+        if ( prv->repl_time != STIME_MAX )
+            set_timer(&prv->repl_timer, prv->repl_time);
+    }
+    cpumask_set_cpu(cpu, &prv->cpus);
+    spin_unlock_irqrestore(&prv->lock, flags);
+
+    /* Anything non-NULL will do. */
+    return (void *)1;
+}
+
+static void
+rt_free_pdata(const struct scheduler *ops, void *pcpu, int cpu)
+{
+    struct rt_private *prv = RTDS_PRIV(ops);
+    struct schedule_data *sd = &per_cpu(schedule_data, cpu);
+    unsigned long flags;
+    bool_t last;
+
+    spin_lock_irqsave(&prv->lock, flags);
+    cpumask_clear_cpu(cpu, &prv->cpus);
+    cpumask_clear_cpu(cpu, &prv->tickled);
+    last = cpumask_empty(&prv->cpus);
+    if ( last )
+        prv->repl_time = STIME_MAX;
+    else if ( prv->repl_cpu == cpu )
+    {
+        prv->repl_cpu = cpumask_first(&prv->cpus);
+        migrate_timer(&prv->repl_timer, prv->repl_cpu);
+    }
+    /* Unless the new pool's scheduler took it over already. */
+    if ( sd->schedule_lock == &prv->lock )
+        sd->schedule_lock = &sd->_lock;
+    spin_unlock_irqrestore(&prv->lock, flags);
+
+    /* Not under the lock: kill_timer() waits for a running handler. */
+    if ( last )
+        kill_timer(&prv->repl_timer);
+}
+
+static void
+rt_dump_vcpu(const struct rt_vcpu *svc)
+{
+    printk("[%5d.%-2d] cpu %d period=%"PRI_stime" budget=%"PRI_stime
+           " cur_b=%"PRI_stime" cur_d=%"PRI_stime" flags=%x\n",
+           svc->vcpu->domain->domain_id, svc->vcpu->vcpu_id,
+           svc->vcpu->processor, svc->period / MICROSECS(1),
+           svc->budget / MICROSECS(1), svc->cur_budget / MICROSECS(1),
+           svc->cur_deadline / MICROSECS(1), svc->flags);
+}
+
+static void
+rt_dump_pcpu(const struct scheduler *ops, int cpu)
+{
+    struct rt_vcpu *svc = RTDS_VCPU(per_cpu(schedule_data, cpu).curr);
+
+    if ( svc && !is_idle_vcpu(svc->vcpu) )
+    {
+        printk("\trun: ");
+        rt_dump_vcpu(svc);
+    }
+}
+
+static void
+rt_dump(const struct scheduler *ops)
+{
+    struct rt_private *prv = RTDS_PRIV(ops);
+    struct list_head *iter, *iter_svc;
+    uint64_t total = 0;
+    unsigned long flags;
+
+    spin_lock_irqsave(&prv->lock, flags);
+
+    printk("Global RunQueue info:\n");
+    list_for_each( iter, &prv->runq )
+        rt_dump_vcpu(__q_elem(iter));
+
+    printk("Global DepletedQueue info:\n");
+    list_for_each( iter, &prv->depletedq )
+        rt_dump_vcpu(__q_elem(iter));
+
+    printk("Domain info:\n");
+    list_for_each( iter, &prv->sdom )
+    {
+        struct rt_dom *sdom = list_entry(iter, struct rt_dom, sdom_elem);
+
+        printk("\tdomain: %d\n", sdom->dom->domain_id);
+        list_for_each( iter_svc, &sdom->vcpu )
+        {
+            struct rt_vcpu *svc = list_entry(iter_svc, struct rt_vcpu,
+                                             sdom_elem);
+
+            printk("\t\t");
+            rt_dump_vcpu(svc);
+            total += rt_util(svc->budget, svc->period);
+        }
+    }
+
+    printk("Utilisation: %"PRIu64"%% of %u pcpus\n",
+           (total * 100) >> RTDS_UTIL_SHIFT, cpumask_weight(&prv->cpus));
+
+    spin_unlock_irqrestore(&prv->lock, flags);
+}
+
+static int
+rt_init(struct scheduler *ops)
+{
+    struct rt_private *prv = xzalloc(struct rt_private);
+
+    printk("Initializing RTDS scheduler\n"
+           " WARNING: This is experimental software in development.\n"
+           " Use at your own risk.\n");
+
+    if ( prv == NULL )
+        return -ENOMEM;
+
+    spin_lock_init(&prv->lock);
+    INIT_LIST_HEAD(&prv->sdom);
+    INIT_LIST_HEAD(&prv->runq);
+    INIT_LIST_HEAD(&prv->depletedq);
+    prv->repl_time = STIME_MAX;
+
+    ops->sched_data = prv;
+
+    return 0;
+}
+
+static void
+rt_deinit(const struct scheduler *ops)
+{
+    xfree(RTDS_PRIV(ops));
+}
+
+static struct rt_private _rt_priv;
+
+const struct scheduler sched_rtds_def = {
+    .name           = "SMP RTDS Scheduler",
+    .opt_name       = "rtds",
+    .sched_id       = XEN_SCHEDULER_RTDS,
+    .sched_data     = &_rt_priv,
+
+    .dump_cpu_state = rt_dump_pcpu,
+    .dump_settings  = rt_dump,
+    .init           = rt_init,
+    .deinit         = rt_deinit,
+    .alloc_pdata    = rt_alloc_pdata,
+    .free_pdata     = rt_free_pdata,
+    .alloc_domdata  = rt_alloc_domdata,
+    .free_domdata   = rt_free_domdata,
+    .init_domain    = rt_dom_init,
+    .destroy_domain = rt_dom_destroy,
+    .alloc_vdata    = rt_alloc_vdata,
+    .free_vdata     = rt_free_vdata,
+    .insert_vcpu    = rt_vcpu_insert,
+    .remove_vcpu    = rt_vcpu_remove,
+
+    .adjust         = rt_dom_cntl,
+
+    .pick_cpu       = rt_cpu_pick,
+    .do_schedule    = rt_schedule,
+    .sleep          = rt_vcpu_sleep,
+    .wake           = rt_vcpu_wake,
+    .context_saved  = rt_context_saved,
+};
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
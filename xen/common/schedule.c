@@ -52,6 +52,11 @@ boolean_param("sched_smt_power_savings", sched_smt_power_savings);
  * */
 int sched_ratelimit_us = SCHED_DEFAULT_RATELIMIT_US;
 integer_param("sched_ratelimit_us", sched_ratelimit_us);
+
+/* Spinning vcpus yield to a preempted sibling rather than to anyone. */
+static bool_t __read_mostly opt_directed_yield = 1;
+boolean_param("sched_directed_yield", opt_directed_yield);
+
 /* Various timer handlers. */
 static void s_timer_fn(void *unused);
 static void vcpu_periodic_timer_fn(void *data);
@@ -67,6 +72,7 @@ static const struct scheduler *schedulers[] = {
     &sched_credit_def,
     &sched_credit2_def,
     &sched_arinc653_def,
+    &sched_rtds_def,
 };
 
 static struct scheduler __read_mostly ops;
@@ -216,9 +222,20 @@ int sched_init_vcpu(struct vcpu *v, unsigned int processor)
 
     TRACE_2D(TRC_SCHED_DOM_ADD, v->domain->domain_id, v->vcpu_id);
 
+    if ( !is_idle_domain(d) )
+    {
+        v->sched_lat = xzalloc(struct xen_sysctl_schedlat_stats);
+        if ( v->sched_lat == NULL )
+            return 1;
+    }
+
     v->sched_priv = SCHED_OP(DOM2OP(d), alloc_vdata, v, d->sched_priv);
     if ( v->sched_priv == NULL )
+    {
+        xfree(v->sched_lat);
+        v->sched_lat = NULL;
         return 1;
+    }
 
     SCHED_OP(DOM2OP(d), insert_vcpu, v);
 
@@ -316,6 +333,8 @@ void sched_destroy_vcpu(struct vcpu *v)
         atomic_dec(&per_cpu(schedule_data, v->processor).urgent_count);
     SCHED_OP(VCPU2OP(v), remove_vcpu, v);
     SCHED_OP(VCPU2OP(v), free_vdata, v->sched_priv);
+    xfree(v->sched_lat);
+    v->sched_lat = NULL;
 }
 
 int sched_init_domain(struct domain *d)
@@ -366,7 +385,10 @@ void vcpu_wake(struct vcpu *v)
     if ( likely(vcpu_runnable(v)) )
     {
         if ( v->runstate.state >= RUNSTATE_blocked )
+        {
             vcpu_runstate_change(v, RUNSTATE_runnable, NOW());
+            v->sched_woken = 1;
+        }
         SCHED_OP(VCPU2OP(v), wake, v);
     }
     else if ( !test_bit(_VPF_blocked, &v->pause_flags) )
@@ -739,7 +761,7 @@ static long do_poll(struct sched_poll *sched_poll)
             goto out;
 
         rc = 0;
-        if ( test_bit(port, &shared_info(d, evtchn_pending)) )
+        if ( evtchn_port_is_pending(d, port) )
             goto out;
     }
 
@@ -775,6 +797,35 @@ static long do_yield(void)
     return 0;
 }
 
+/*
+ * Yield on behalf of a vcpu caught spinning (e.g. by pause-loop exiting).
+ * A sibling that was preempted while runnable is the likely lock holder,
+ * so let the scheduler push it forward before yielding.
+ */
+void vcpu_yield_to_preempted(void)
+{
+    struct vcpu *v = current, *t;
+    struct domain *d = v->domain;
+    unsigned int i;
+
+    for ( i = 1; opt_directed_yield && i < d->max_vcpus; i++ )
+    {
+        t = d->vcpu[(v->vcpu_id + i) % d->max_vcpus];
+        if ( t == NULL || t->runstate.state != RUNSTATE_runnable )
+            continue;
+
+        vcpu_schedule_lock_irq(t);
+        if ( t->runstate.state == RUNSTATE_runnable )
+            SCHED_OP(VCPU2OP(t), yield_to, v, t);
+        vcpu_schedule_unlock_irq(t);
+
+        perfc_incr(sched_yield_to);
+        break;
+    }
+
+    do_yield();
+}
+
 static void domain_watchdog_timeout(void *data)
 {
     struct domain *d = data;
@@ -1093,6 +1144,135 @@ long sched_adjust_global(struct xen_sysctl_scheduler_op *op)
     return rc;
 }
 
+static void sched_latency_add(struct xen_sysctl_schedlat_hist *h,
+                              s_time_t delta)
+{
+    uint64_t us = delta / MICROSECS(1);
+    unsigned int b = us ? fls(min_t(uint64_t, us, 1U << 30)) : 0;
+
+    h->count++;
+    h->total_ns += delta;
+    if ( delta > h->max_ns )
+        h->max_ns = delta;
+    h->buckets[min_t(unsigned int, b, XEN_SYSCTL_SCHEDLAT_BUCKETS - 1)]++;
+}
+
+/*
+ * Account a context switch from prev to next.  Called with the cpu's
+ * schedule lock held, which also covers the statistics of both: a vcpu's
+ * are only updated on the cpu it runs on.
+ */
+static void sched_latency_switch(struct vcpu *prev, struct vcpu *next,
+                                 s_time_t now)
+{
+    s_time_t delta;
+
+    if ( prev->sched_lat != NULL && prev->runstate.state == RUNSTATE_runnable )
+        prev->sched_lat->preemptions++;
+
+    if ( next->sched_lat == NULL || next->runstate.state != RUNSTATE_runnable )
+        return;
+
+    delta = max_t(s_time_t, now - next->runstate.state_entry_time, 0);
+    sched_latency_add(&next->sched_lat->wait, delta);
+    if ( next->sched_woken )
+        sched_latency_add(&next->sched_lat->wakeup, delta);
+    next->sched_woken = 0;
+}
+
+static void sched_latency_sum_hist(struct xen_sysctl_schedlat_hist *sum,
+                                   const struct xen_sysctl_schedlat_hist *h)
+{
+    unsigned int i;
+
+    sum->count += h->count;
+    sum->total_ns += h->total_ns;
+    if ( h->max_ns > sum->max_ns )
+        sum->max_ns = h->max_ns;
+    for ( i = 0; i < XEN_SYSCTL_SCHEDLAT_BUCKETS; i++ )
+        sum->buckets[i] += h->buckets[i];
+}
+
+/* Add d's statistics into sum, or clear them if sum is NULL. */
+static void sched_latency_domain(struct domain *d,
+                                 struct xen_sysctl_schedlat_stats *sum)
+{
+    struct vcpu *v;
+
+    for_each_vcpu ( d, v )
+    {
+        if ( v->sched_lat == NULL )
+            continue;
+        if ( sum == NULL )
+        {
+            vcpu_schedule_lock_irq(v);
+            memset(v->sched_lat, 0, sizeof(*v->sched_lat));
+            vcpu_schedule_unlock_irq(v);
+            continue;
+        }
+        /* Unlocked: a snapshot which may be a switch or two out of date. */
+        sched_latency_sum_hist(&sum->wakeup, &v->sched_lat->wakeup);
+        sched_latency_sum_hist(&sum->wait, &v->sched_lat->wait);
+        sum->preemptions += v->sched_lat->preemptions;
+    }
+}
+
+long sched_latency_op(struct xen_sysctl_schedlat_op *op)
+{
+    struct xen_sysctl_schedlat_stats *sum = NULL;
+    struct domain *d;
+    struct cpupool *pool;
+    int rc = 0;
+
+    if ( op->cmd == XEN_SYSCTL_SCHEDLAT_OP_get )
+    {
+        sum = xzalloc(struct xen_sysctl_schedlat_stats);
+        if ( sum == NULL )
+            return -ENOMEM;
+    }
+    else if ( op->cmd != XEN_SYSCTL_SCHEDLAT_OP_reset )
+        return -EINVAL;
+
+    switch ( op->type )
+    {
+    case XEN_SYSCTL_SCHEDLAT_domain:
+        d = rcu_lock_domain_by_id(op->id);
+        if ( d == NULL )
+        {
+            rc = -ESRCH;
+            break;
+        }
+        sched_latency_domain(d, sum);
+        rcu_unlock_domain(d);
+        break;
+
+    case XEN_SYSCTL_SCHEDLAT_cpupool:
+        pool = cpupool_get_by_id(op->id);
+        if ( pool == NULL )
+        {
+            rc = -ESRCH;
+            break;
+        }
+        rcu_read_lock(&domlist_read_lock);
+        for_each_domain_in_cpupool ( d, pool )
+            sched_latency_domain(d, sum);
+        rcu_read_unlock(&domlist_read_lock);
+        cpupool_put(pool);
+        break;
+
+    default:
+        rc = -EINVAL;
+        break;
+    }
+
+    if ( rc == 0 && sum != NULL && copy_to_guest(op->stats, sum, 1) )
+        rc = -EFAULT;
+
+    xfree(sum);
+
+    return rc;
+}
+
 static void vcpu_periodic_timer_work(struct vcpu *v)
 {
     s_time_t now = NOW();
@@ -1197,6 +1377,8 @@ static void schedule(void)
         now);
     prev->last_run_time = now;
 
+    sched_latency_switch(prev, next, now);
+
     ASSERT(next->runstate.state != RUNSTATE_running);
     vcpu_runstate_change(next, RUNSTATE_running, now);
 
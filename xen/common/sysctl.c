@@ -344,6 +344,16 @@ long do_sysctl(XEN_GUEST_HANDLE(xen_sysctl_t) u_sysctl)
     }
     break;
 
+    case XEN_SYSCTL_schedlat_op:
+    {
+        ret = xsm_sched_op();
+        if ( ret )
+            break;
+
+        ret = sched_latency_op(&op->u.schedlat_op);
+    }
+    break;
+
     default:
         ret = arch_do_sysctl(op, u_sysctl);
         break;
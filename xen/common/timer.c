@@ -35,6 +35,8 @@ struct timers {
     struct timer  *list;
     struct timer  *running;
     struct list_head inactive;
+    unsigned long  softirqs;    /* timer_softirq_action() runs */
+    unsigned long  executed;    /* timers executed */
 } __cacheline_aligned;
 
 static DEFINE_PER_CPU(struct timers, timers);
@@ -44,6 +46,15 @@ static DEFINE_RCU_READ_LOCK(timer_cpu_read_lock);
 
 DEFINE_PER_CPU(s_time_t, timer_deadline);
 
+DEFINE_PER_CPU(unsigned long, timer_interrupts);
+
+/* Latest time @t may fire. */
+static inline s_time_t timer_latest(const struct timer *t)
+{
+    return (t->expires > STIME_MAX - t->slack) ? STIME_MAX
+                                               : t->expires + t->slack;
+}
+
 /****************************************************************************
  * HEAP OPERATIONS.
  */
@@ -119,6 +130,23 @@ static int remove_from_heap(struct timer **heap, struct timer *t)
 }
 
 
+/*
+ * Earliest latest-firing time of the timers in the subtree of @heap rooted
+ * at @pos, or @limit if that is earlier.  Subtrees whose root expires after
+ * @limit cannot lower it, so are skipped.
+ */
+static s_time_t heap_deadline(struct timer **heap, int pos, s_time_t limit)
+{
+    struct timer *t;
+
+    if ( (pos > GET_HEAP_SIZE(heap)) || ((t = heap[pos])->expires >= limit) )
+        return limit;
+
+    limit = min(limit, timer_latest(t));
+    limit = heap_deadline(heap, pos << 1, limit);
+    return heap_deadline(heap, (pos << 1) + 1, limit);
+}
+
 /* Add new entry @t to @heap. Return TRUE if new top of heap. */
 static int add_to_heap(struct timer **heap, struct timer *t)
 {
@@ -212,13 +240,21 @@ static int add_entry(struct timer *t)
     return add_to_list(&timers->list, t);
 }
 
+/*
+ * The hardware may be programmed for later than the new top of the heap
+ * (it waits for the earliest latest-firing time), so a timer added below
+ * the top must also reprogram it if it needs to fire before then.
+ */
 static inline void activate_timer(struct timer *timer)
 {
+    s_time_t deadline = per_cpu(timer_deadline, timer->cpu);
+
     ASSERT(timer->status == TIMER_STATUS_inactive);
     timer->status = TIMER_STATUS_invalid;
     list_del(&timer->inactive);
 
-    if ( add_entry(timer) )
+    if ( add_entry(timer) || (deadline == 0) ||
+         (timer_latest(timer) < deadline) )
         cpu_raise_softirq(timer->cpu, TIMER_SOFTIRQ);
 }
 
@@ -319,6 +355,12 @@ void set_timer(struct timer *timer, s_time_t expires)
 }
 
 
+void set_timer_slack(struct timer *timer, s_time_t slack)
+{
+    timer->slack = min_t(s_time_t, max_t(s_time_t, slack, 0), ~0U);
+}
+
+
 void stop_timer(struct timer *timer)
 {
     unsigned long flags;
@@ -421,6 +463,7 @@ static void execute_timer(struct timers *ts, struct timer *t)
     list_add(&t->inactive, &ts->inactive);
 
     ts->running = t;
+    ts->executed++;
     spin_unlock_irq(&ts->lock);
     (*fn)(data);
     spin_lock_irq(&ts->lock);
@@ -459,6 +502,7 @@ static void timer_softirq_action(void)
 
     spin_lock_irq(&ts->lock);
 
+    ts->softirqs++;
     now = NOW();
 
     /* Execute ready heap timers. */
@@ -486,12 +530,15 @@ static void timer_softirq_action(void)
         add_entry(t);
     }
 
-    /* Find earliest deadline from head of linked list and top of heap. */
-    deadline = STIME_MAX;
-    if ( GET_HEAP_SIZE(heap) != 0 )
-        deadline = heap[1]->expires;
-    if ( (ts->list != NULL) && (ts->list->expires < deadline) )
-        deadline = ts->list->expires;
+    /*
+     * Find the earliest time by which some timer must fire.  Timers expiring
+     * before then are run by the same interrupt, however much slack they
+     * have left.
+     */
+    deadline = heap_deadline(heap, 1, STIME_MAX);
+    for ( t = ts->list; (t != NULL) && (t->expires < deadline);
+          t = t->list_next )
+        deadline = min(deadline, timer_latest(t));
     this_cpu(timer_deadline) =
         (deadline == STIME_MAX) ? 0 : deadline + timer_slop;
 
@@ -511,8 +558,9 @@ s_time_t align_timer(s_time_t firsttick, uint64_t period)
 
 static void dump_timer(struct timer *t, s_time_t now)
 {
-    printk("  ex=%8"PRId64"us timer=%p cb=%p(%p)",
-           (t->expires - now) / 1000, t, t->function, t->data);
+    printk("  ex=%8"PRId64"us sl=%uus timer=%p cb=%p(%p)",
+           (t->expires - now) / 1000, t->slack / 1000, t, t->function,
+           t->data);
     print_symbol(" %s\n", (unsigned long)t->function);
 }
 
@@ -530,7 +578,8 @@ static void dump_timerq(unsigned char key)
     {
         ts = &per_cpu(timers, i);
 
-        printk("CPU%02d:\n", i);
+        printk("CPU%02d: %lu interrupts, %lu softirqs, %lu timers run\n", i,
+               per_cpu(timer_interrupts, i), ts->softirqs, ts->executed);
         spin_lock_irqsave(&ts->lock, flags);
         for ( j = 1; j <= GET_HEAP_SIZE(ts->heap); j++ )
             dump_timer(ts->heap[j], now);
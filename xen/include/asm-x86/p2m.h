@@ -268,6 +268,11 @@ struct p2m_domain {
     /* Highest guest frame that's ever been mapped in the p2m */
     unsigned long max_mapped_pfn;
 
+    /* Number of leaf entries mapping guest RAM at each level (4k, 2M,
+     * 1G).  Maintained by the set_entry implementations under the p2m
+     * lock. */
+    unsigned long ram_entries[3];
+
     /* When releasing shared gfn's in a preemptible manner, recall where
      * to resume the search */
     unsigned long next_shared_gfn_to_relinquish;
@@ -280,7 +285,8 @@ struct p2m_domain {
      * within the PoD lock, we enforce it's ordering (by remembering
      * the unlock level in the arch_domain sub struct). */
     struct {
-        struct page_list_head super,   /* List of superpages                */
+        struct page_list_head huge,    /* List of 1G pages                  */
+                         super,        /* List of superpages                */
                          single;       /* Non-super lists                   */
         long             count,        /* # of pages in cache lists         */
                          entry_count;  /* # of pages in p2m marked pod      */
@@ -298,6 +304,16 @@ struct p2m_domain {
 /* get host p2m table */
 #define p2m_get_hostp2m(d)      ((d)->arch.p2m)
 
+/* Account nr leaf entries of type t at the given level (0: 4k, 1: 2M,
+ * 2: 1G) in the p2m's RAM statistics */
+static inline void p2m_account_leaf(struct p2m_domain *p2m,
+                                    unsigned int level, p2m_type_t t,
+                                    long nr)
+{
+    if ( p2m_is_ram(t) )
+        p2m->ram_entries[level] += nr;
+}
+
 /* Get p2m table (re)usable for specified cr3.
  * Automatically destroys and re-initializes a p2m if none found.
  * If cr3 == 0 then v->arch.hvm_vcpu.guest_cr[3] is used.
@@ -530,6 +546,9 @@ int clear_mmio_p2m_entry(struct domain *d, unsigned long gfn);
 /* Dump PoD information about the domain */
 void p2m_pod_dump_data(struct domain *d);
 
+/* Dump how much of the domain's RAM is mapped by 4k, 2M and 1G entries */
+void p2m_dump_stats(struct domain *d);
+
 /* Move all pages from the populate-on-demand cache to the domain page_list
  * (usually in preparation for domain destruction) */
 void p2m_pod_empty_cache(struct domain *d);
@@ -35,7 +35,7 @@
 #include "xen.h"
 #include "grant_table.h"
 
-#define XEN_DOMCTL_INTERFACE_VERSION 0x00000008
+#define XEN_DOMCTL_INTERFACE_VERSION 0x00000009
 
 /*
  * NB. xen_domctl.domain is an IN/OUT parameter for this operation.
@@ -303,6 +303,7 @@ DEFINE_XEN_GUEST_HANDLE(xen_domctl_max_vcpus_t);
 #define XEN_SCHEDULER_CREDIT   5
 #define XEN_SCHEDULER_CREDIT2  6
 #define XEN_SCHEDULER_ARINC653 7
+#define XEN_SCHEDULER_RTDS     8
 /* Set or get info? */
 #define XEN_DOMCTL_SCHEDOP_putinfo 0
 #define XEN_DOMCTL_SCHEDOP_getinfo 1
@@ -320,12 +321,19 @@ struct xen_domctl_scheduler_op {
         struct xen_domctl_sched_credit {
             uint16_t weight;
             uint16_t cap;
+            uint16_t cosched; /* 0/1, or ~0 to leave unchanged */
         } credit;
         struct xen_domctl_sched_credit2 {
             uint16_t weight;
         } credit2;
+        struct xen_domctl_sched_rtds {
+            uint32_t period;    /* microseconds */
+            uint32_t budget;    /* microseconds, <= period */
+            uint32_t vcpuid;    /* or XEN_DOMCTL_SCHED_RTDS_ALL_VCPUS */
+        } rtds;
     } u;
 };
+#define XEN_DOMCTL_SCHED_RTDS_ALL_VCPUS (~0U)
 typedef struct xen_domctl_scheduler_op xen_domctl_scheduler_op_t;
 DEFINE_XEN_GUEST_HANDLE(xen_domctl_scheduler_op_t);
 
@@ -808,6 +816,19 @@ struct xen_domctl_audit_p2m {
 typedef struct xen_domctl_audit_p2m xen_domctl_audit_p2m_t;
 DEFINE_XEN_GUEST_HANDLE(xen_domctl_audit_p2m_t);
 
+/* XEN_DOMCTL_get_p2m_stats */
+struct xen_domctl_p2m_stats {
+    /* OUT: guest RAM pages mapped by 4k, 2M and 1G p2m entries */
+    uint64_aligned_t ram_4k;
+    uint64_aligned_t ram_2m;
+    uint64_aligned_t ram_1g;
+    /* OUT: outstanding populate-on-demand entries and cache size (pages) */
+    uint64_aligned_t pod_entries;
+    uint64_aligned_t pod_cache;
+};
+typedef struct xen_domctl_p2m_stats xen_domctl_p2m_stats_t;
+DEFINE_XEN_GUEST_HANDLE(xen_domctl_p2m_stats_t);
+
 struct xen_domctl_set_virq_handler {
     uint32_t virq; /* IN */
 };
@@ -914,6 +935,7 @@ struct xen_domctl {
 #define XEN_DOMCTL_set_access_required           64
 #define XEN_DOMCTL_audit_p2m                     65
 #define XEN_DOMCTL_set_virq_handler              66
+#define XEN_DOMCTL_get_p2m_stats                 67
 #define XEN_DOMCTL_gdbsx_guestmemio            1000
 #define XEN_DOMCTL_gdbsx_pausevcpu             1001
 #define XEN_DOMCTL_gdbsx_unpausevcpu           1002
@@ -969,6 +991,7 @@ struct xen_domctl {
         struct xen_domctl_set_access_required access_required;
         struct xen_domctl_audit_p2m         audit_p2m;
         struct xen_domctl_set_virq_handler  set_virq_handler;
+        struct xen_domctl_p2m_stats         p2m_stats;
         struct xen_domctl_gdbsx_memio       gdbsx_guest_memio;
         struct xen_domctl_gdbsx_pauseunp_vcpu gdbsx_pauseunp_vcpu;
         struct xen_domctl_gdbsx_domstatus   gdbsx_domstatus;
@@ -55,6 +55,13 @@
 /* Flag to request allocation only from the node specified */
 #define XENMEMF_exact_node_request  (1<<17)
 #define XENMEMF_exact_node(n) (XENMEMF_node(n) | XENMEMF_exact_node_request)
+/*
+ * XENMEM_populate_physmap for translated guests: if an extent cannot be
+ * allocated in one piece, back it with the largest smaller pages available
+ * (e.g., 2MB pages for a 1GB extent) instead of failing it.  Extents
+ * larger than 1GB are not split.
+ */
+#define XENMEMF_order_fallback (1<<18)
 #endif
 
 struct xen_memory_reservation {
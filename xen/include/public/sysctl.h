@@ -596,6 +596,47 @@ struct xen_sysctl_scheduler_op {
 typedef struct xen_sysctl_scheduler_op xen_sysctl_scheduler_op_t;
 DEFINE_XEN_GUEST_HANDLE(xen_sysctl_scheduler_op_t);
 
+/* XEN_SYSCTL_schedlat_op */
+/*
+ * Scheduling latency histograms.  buckets[0] counts latencies below 1us,
+ * buckets[i] those in [2^(i-1), 2^i) us, and the last bucket everything
+ * above.
+ */
+#define XEN_SYSCTL_SCHEDLAT_BUCKETS 24
+struct xen_sysctl_schedlat_hist {
+    uint64_aligned_t count;
+    uint64_aligned_t total_ns;
+    uint64_aligned_t max_ns;
+    uint64_aligned_t buckets[XEN_SYSCTL_SCHEDLAT_BUCKETS];
+};
+typedef struct xen_sysctl_schedlat_hist xen_sysctl_schedlat_hist_t;
+
+struct xen_sysctl_schedlat_stats {
+    /* From being woken up (blocked or offline -> runnable) to running. */
+    struct xen_sysctl_schedlat_hist wakeup;
+    /* From becoming runnable for any reason, wakeups included, to running. */
+    struct xen_sysctl_schedlat_hist wait;
+    /* Times a vcpu was descheduled while still runnable. */
+    uint64_aligned_t preemptions;
+};
+typedef struct xen_sysctl_schedlat_stats xen_sysctl_schedlat_stats_t;
+DEFINE_XEN_GUEST_HANDLE(xen_sysctl_schedlat_stats_t);
+
+#define XEN_SYSCTL_SCHEDLAT_OP_get      0
+#define XEN_SYSCTL_SCHEDLAT_OP_reset    1
+#define XEN_SYSCTL_SCHEDLAT_domain      0
+#define XEN_SYSCTL_SCHEDLAT_cpupool     1
+struct xen_sysctl_schedlat_op {
+    uint32_t cmd;       /* IN: XEN_SYSCTL_SCHEDLAT_OP_* */
+    uint32_t type;      /* IN: XEN_SYSCTL_SCHEDLAT_{domain,cpupool} */
+    uint32_t id;        /* IN: domain or cpupool id */
+    uint32_t pad;
+    /* OUT: sum over the domain's vcpus, or the pool's domains (get only). */
+    XEN_GUEST_HANDLE_64(xen_sysctl_schedlat_stats_t) stats;
+};
+typedef struct xen_sysctl_schedlat_op xen_sysctl_schedlat_op_t;
+DEFINE_XEN_GUEST_HANDLE(xen_sysctl_schedlat_op_t);
+
 struct xen_sysctl {
     uint32_t cmd;
 #define XEN_SYSCTL_readconsole                    1
@@ -616,6 +657,7 @@ struct xen_sysctl {
 #define XEN_SYSCTL_numainfo                      17
 #define XEN_SYSCTL_cpupool_op                    18
 #define XEN_SYSCTL_scheduler_op                  19
+#define XEN_SYSCTL_schedlat_op                   20
     uint32_t interface_version; /* XEN_SYSCTL_INTERFACE_VERSION */
     union {
         struct xen_sysctl_readconsole       readconsole;
@@ -636,6 +678,7 @@ struct xen_sysctl {
         struct xen_sysctl_lockprof_op       lockprof_op;
         struct xen_sysctl_cpupool_op        cpupool_op;
         struct xen_sysctl_scheduler_op      scheduler_op;
+        struct xen_sysctl_schedlat_op       schedlat_op;
         uint8_t                             pad[128];
     } u;
 };
@@ -9,6 +9,7 @@
 #ifndef __XEN_EVENT_H__
 #define __XEN_EVENT_H__
 
+#include <xen/errno.h>
 #include <xen/sched.h>
 #include <xen/smp.h>
 #include <xen/softirq.h>
@@ -69,15 +70,86 @@ int guest_enabled_event(struct vcpu *v, uint32_t virq);
 /* Notify remote end of a Xen-attached event channel.*/
 void notify_via_xen_event_channel(struct domain *ld, int lport);
 
+/* Wake any VCPU polling on a port that has just become pending. */
+void evtchn_check_pollers(struct domain *d, unsigned int port);
+
 /* Internal event channel object accessors */
+#define group_from_port(d,p) \
+    ((d)->evtchn_group[(p)/EVTCHNS_PER_GROUP])
 #define bucket_from_port(d,p) \
-    ((d)->evtchn[(p)/EVTCHNS_PER_BUCKET])
-#define port_is_valid(d,p)    \
-    (((p) >= 0) && ((p) < MAX_EVTCHNS(d)) && \
-     (bucket_from_port(d,p) != NULL))
+    (group_from_port(d,p)[((p)%EVTCHNS_PER_GROUP)/EVTCHNS_PER_BUCKET])
 #define evtchn_from_port(d,p) \
     (&(bucket_from_port(d,p))[(p)&(EVTCHNS_PER_BUCKET-1)])
 
+static inline bool_t port_is_valid(struct domain *d, unsigned int p)
+{
+    return (p < MAX_EVTCHNS(d)) && (group_from_port(d, p) != NULL) &&
+           (bucket_from_port(d, p) != NULL);
+}
+
+/*
+ * Low-level event channel port operations.  The 2-level bitmap ABI in
+ * shared_info is the default; a domain may switch to the FIFO-based ABI
+ * with EVTCHNOP_init_control.
+ */
+struct evtchn_port_ops {
+    void (*set_pending)(struct vcpu *v, unsigned int port);
+    void (*clear_pending)(struct domain *d, unsigned int port);
+    void (*unmask)(struct domain *d, unsigned int port);
+    bool_t (*is_pending)(struct domain *d, unsigned int port);
+    bool_t (*is_masked)(struct domain *d, unsigned int port);
+    /* Optional: the port cannot be reused yet (e.g. it is still queued). */
+    bool_t (*is_busy)(struct domain *d, unsigned int port);
+    int (*set_priority)(struct domain *d, unsigned int port,
+                        unsigned int priority);
+};
+
+void evtchn_2l_init(struct domain *d);
+
+static inline void evtchn_port_set_pending(struct vcpu *v, unsigned int port)
+{
+    v->domain->evtchn_port_ops->set_pending(v, port);
+}
+
+static inline void evtchn_port_clear_pending(struct domain *d,
+                                             unsigned int port)
+{
+    d->evtchn_port_ops->clear_pending(d, port);
+}
+
+static inline void evtchn_port_unmask(struct domain *d, unsigned int port)
+{
+    d->evtchn_port_ops->unmask(d, port);
+}
+
+static inline bool_t evtchn_port_is_pending(struct domain *d,
+                                            unsigned int port)
+{
+    return d->evtchn_port_ops->is_pending(d, port);
+}
+
+static inline bool_t evtchn_port_is_masked(struct domain *d,
+                                           unsigned int port)
+{
+    return d->evtchn_port_ops->is_masked(d, port);
+}
+
+static inline bool_t evtchn_port_is_busy(struct domain *d,
+                                         unsigned int port)
+{
+    return d->evtchn_port_ops->is_busy &&
+           d->evtchn_port_ops->is_busy(d, port);
+}
+
+static inline int evtchn_port_set_priority(struct domain *d,
+                                           unsigned int port,
+                                           unsigned int priority)
+{
+    if ( !d->evtchn_port_ops->set_priority )
+        return -ENOSYS;
+    return d->evtchn_port_ops->set_priority(d, port, priority);
+}
+
 
 /* Wait on a Xen-attached event channel. */
 #define wait_on_xen_event_channel(port, condition)                      \
@@ -112,6 +112,8 @@ struct grant_table {
 /* Create/destroy per-domain grant table context. */
 int grant_table_create(
     struct domain *d);
+void grant_table_init_vcpu(
+    struct vcpu *v);
 void grant_table_destroy(
     struct domain *d);
 
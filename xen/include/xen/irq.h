@@ -122,7 +122,7 @@ struct vcpu;
 
 struct pirq {
     int pirq;
-    u16 evtchn;
+    unsigned int evtchn;
     bool_t masked;
     struct rcu_head rcu_head;
     struct arch_pirq arch;
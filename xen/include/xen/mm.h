@@ -65,12 +65,16 @@ int query_page_offline(unsigned long mfn, uint32_t *status);
 unsigned long total_free_pages(void);
 
 void scrub_heap_pages(void);
+bool_t scrub_free_pages(void);
+unsigned long scrub_pending_pages(void);
 
 int assign_pages(
     struct domain *d,
     struct page_info *pg,
     unsigned int order,
     unsigned int memflags);
+void domain_adjust_node_pages(
+    struct domain *d, struct page_info *pg, long nr);
 
 /* Dump info to serial console */
 void arch_dump_shared_mem_info(void);
@@ -86,6 +90,8 @@ void arch_dump_shared_mem_info(void);
 #define  MEMF_no_dma      (1U<<_MEMF_no_dma)
 #define _MEMF_exact_node  4
 #define  MEMF_exact_node  (1U<<_MEMF_exact_node)
+#define _MEMF_order_fallback 5
+#define  MEMF_order_fallback (1U<<_MEMF_order_fallback)
 #define _MEMF_node        8
 #define  MEMF_node(n)     ((((n)+1)&0xff)<<_MEMF_node)
 #define _MEMF_bits        24
@@ -15,12 +15,15 @@ PERFCOUNTER(ipis,                   "#IPIs")
 PERFCOUNTER(sched_irq,              "sched: timer")
 PERFCOUNTER(sched_run,              "sched: runs through scheduler")
 PERFCOUNTER(sched_ctx,              "sched: context switches")
+PERFCOUNTER(sched_yield_to,         "sched: directed yields")
 
 PERFCOUNTER(delay_ms,               "csched: delay")
 PERFCOUNTER(vcpu_check,             "csched: vcpu_check")
 PERFCOUNTER(schedule,               "csched: schedule")
 PERFCOUNTER(acct_run,               "csched: acct_run")
 PERFCOUNTER(acct_no_work,           "csched: acct_no_work")
+PERFCOUNTER(acct_stopped,           "csched: acct_stopped")
+PERFCOUNTER(tick_stopped,           "csched: tick_stopped")
 PERFCOUNTER(acct_balance,           "csched: acct_balance")
 PERFCOUNTER(acct_reorder,           "csched: acct_reorder")
 PERFCOUNTER(acct_min_credit,        "csched: acct_min_credit")
@@ -45,13 +48,35 @@ PERFCOUNTER(load_balance_other,     "csched: load_balance_other")
 PERFCOUNTER(steal_trylock_failed,   "csched: steal_trylock_failed")
 PERFCOUNTER(steal_peer_idle,        "csched: steal_peer_idle")
 PERFCOUNTER(migrate_queued,         "csched: migrate_queued")
+PERFCOUNTER(migrate_node_local,     "csched: migrate_node_local")
 PERFCOUNTER(migrate_running,        "csched: migrate_running")
+PERFCOUNTER(pick_node_affinity,     "csched: pick_node_affinity")
+PERFCOUNTER(run_remote_node,        "csched: run_remote_node")
 PERFCOUNTER(dom_init,               "csched: dom_init")
 PERFCOUNTER(dom_destroy,            "csched: dom_destroy")
 PERFCOUNTER(vcpu_init,              "csched: vcpu_init")
 PERFCOUNTER(vcpu_destroy,           "csched: vcpu_destroy")
 PERFCOUNTER(vcpu_hot,               "csched: vcpu_hot")
+PERFCOUNTER(vcpu_boost_yield_to,    "csched: vcpu_boost_yield_to")
+PERFCOUNTER(cosched_kick,           "csched: cosched_kick")
+PERFCOUNTER(cosched_pick,           "csched: cosched_pick")
 
 PERFCOUNTER(need_flush_tlb_flush,   "PG_need_flush tlb flushes")
 
+PERFCOUNTER(gnttab_copy_batches,    "gnttab: copy batches")
+PERFCOUNTER(gnttab_copy_ops,        "gnttab: copy ops")
+PERFCOUNTER(gnttab_copy_src_reuse,  "gnttab: copy source frame reused")
+PERFCOUNTER(gnttab_copy_dst_reuse,  "gnttab: copy dest frame reused")
+
+PERFCOUNTER(pcp_alloc_hit,          "page_alloc: pcp alloc hit")
+PERFCOUNTER(pcp_alloc_miss,         "page_alloc: pcp alloc miss")
+PERFCOUNTER(pcp_free,               "page_alloc: pcp free")
+PERFCOUNTER(pcp_refill,             "page_alloc: pcp refill")
+PERFCOUNTER(pcp_drain,              "page_alloc: pcp drain")
+PERFCOUNTER(scrub_idle,             "page_alloc: pages scrubbed when idle")
+PERFCOUNTER(scrub_sync,             "page_alloc: pages scrubbed on demand")
+
+PERFCOUNTER(populate_fallback,      "populate_physmap: extents split")
+PERFCOUNTER(populate_fallback_fail, "populate_physmap: split extents failed")
+
 /*#endif*/ /* __XEN_PERFC_DEFN_H__ */
@@ -23,6 +23,7 @@
 #include <public/sysctl.h>
 #include <public/vcpu.h>
 #include <public/mem_event.h>
+#include <public/event_channel.h>
 
 #ifdef CONFIG_COMPAT
 #include <compat/vcpu.h>
@@ -37,9 +38,15 @@ extern struct domain *dom0;
 #else
 #define BITS_PER_EVTCHN_WORD(d) (has_32bit_shinfo(d) ? 32 : BITS_PER_LONG)
 #endif
-#define MAX_EVTCHNS(d) (BITS_PER_EVTCHN_WORD(d) * BITS_PER_EVTCHN_WORD(d))
+#define EVTCHN_2L_NR_CHANNELS(d) \
+    (BITS_PER_EVTCHN_WORD(d) * BITS_PER_EVTCHN_WORD(d))
+#define MAX_EVTCHNS(d) \
+    ((d)->evtchn_fifo ? EVTCHN_FIFO_NR_CHANNELS : EVTCHN_2L_NR_CHANNELS(d))
+#define MAX_NR_EVTCHNS     EVTCHN_FIFO_NR_CHANNELS
 #define EVTCHNS_PER_BUCKET 128
-#define NR_EVTCHN_BUCKETS  (NR_EVENT_CHANNELS / EVTCHNS_PER_BUCKET)
+#define BUCKETS_PER_GROUP  (PAGE_SIZE / sizeof(struct evtchn *))
+#define EVTCHNS_PER_GROUP  (BUCKETS_PER_GROUP * EVTCHNS_PER_BUCKET)
+#define NR_EVTCHN_GROUPS   DIV_ROUND_UP(MAX_NR_EVTCHNS, EVTCHNS_PER_GROUP)
 
 struct evtchn
 {
@@ -50,24 +57,29 @@ struct evtchn
 #define ECS_PIRQ         4 /* Channel is bound to a physical IRQ line.       */
 #define ECS_VIRQ         5 /* Channel is bound to a virtual IRQ line.        */
 #define ECS_IPI          6 /* Channel is bound to a virtual IPI line.        */
+    spinlock_t lock;       /* Protects state changes; see evtchn_send() */
     u8  state;             /* ECS_* */
     u8  xen_consumer;      /* Consumer in Xen, if any? (0 = send to guest) */
     u16 notify_vcpu_id;    /* VCPU for local delivery notification */
+    u8  priority;          /* FIFO queue the event is linked on when raised */
+    u8  last_priority;     /* FIFO queue the event was last linked on */
+    u16 last_vcpu_id;      /* VCPU owning that queue */
     union {
         struct {
             domid_t remote_domid;
         } unbound;     /* state == ECS_UNBOUND */
         struct {
-            u16            remote_port;
+            evtchn_port_t  remote_port;
             struct domain *remote_dom;
         } interdomain; /* state == ECS_INTERDOMAIN */
         struct {
             u16            irq;
-            u16            next_port;
-            u16            prev_port;
+            evtchn_port_t  next_port;
+            evtchn_port_t  prev_port;
         } pirq;        /* state == ECS_PIRQ */
         u16 virq;      /* state == ECS_VIRQ */
     } u;
+    bool_t pending;        /* Raised before its FIFO event word existed */
 #ifdef FLASK_ENABLE
     void *ssid;
 #endif
@@ -78,6 +90,10 @@ void evtchn_destroy(struct domain *d); /* from domain_kill */
 void evtchn_destroy_final(struct domain *d); /* from complete_domain_destroy */
 
 struct waitqueue_vcpu;
+struct evtchn_port_ops;
+struct evtchn_fifo_vcpu;
+struct evtchn_fifo_domain;
+struct populate_fallback;
 
 struct vcpu 
 {
@@ -115,6 +131,11 @@ struct vcpu
     /* last time when vCPU is scheduled out */
     uint64_t last_run_time;
 
+    /* Scheduling latency statistics; NULL for idle vcpus. */
+    struct xen_sysctl_schedlat_stats *sched_lat;
+    /* Became runnable by being woken, rather than preempted. */
+    bool_t           sched_woken;
+
     /* Has the FPU been initialised? */
     bool_t           fpu_initialised;
     /* Has the FPU been used since it was last saved? */
@@ -158,9 +179,12 @@ struct vcpu
     atomic_t         pause_count;
 
     /* IRQ-safe virq_lock protects against delivering VIRQ to stale evtchn. */
-    u16              virq_to_evtchn[NR_VIRQS];
+    evtchn_port_t    virq_to_evtchn[NR_VIRQS];
     spinlock_t       virq_lock;
 
+    /* FIFO event channel queues, if the domain uses that ABI. */
+    struct evtchn_fifo_vcpu *evtchn_fifo;
+
     /* Bitmask of CPUs on which this VCPU may run. */
     cpumask_var_t    cpu_affinity;
     /* Used to change affinity temporarily. */
@@ -177,6 +201,11 @@ struct vcpu
     /* Multicall information. */
     struct mc_state  mc_state;
 
+    /* Free grant-table maptrack handles owned by this VCPU. */
+    spinlock_t       maptrack_lock;
+    unsigned int     maptrack_head;
+    unsigned int     maptrack_free;
+
     struct waitqueue_vcpu *waitqueue_vcpu;
 
     struct arch_vcpu arch;
@@ -238,6 +267,11 @@ struct domain
     atomic_t         shr_pages;       /* number of shared pages             */
     atomic_t         paged_pages;     /* number of paged-out pages          */
     unsigned int     xenheap_pages;   /* # pages allocated from Xen heap    */
+    unsigned long   *node_pages;      /* # pages on each NUMA node          */
+
+    /* XENMEMF_order_fallback extent in progress; see populate_extent(). */
+    spinlock_t       populate_lock;
+    struct populate_fallback *populate_fallback;
 
     unsigned int     max_vcpus;
 
@@ -252,8 +286,10 @@ struct domain
     spinlock_t       rangesets_lock;
 
     /* Event channel information. */
-    struct evtchn   *evtchn[NR_EVTCHN_BUCKETS];
+    struct evtchn  **evtchn_group[NR_EVTCHN_GROUPS];
     spinlock_t       event_lock;
+    const struct evtchn_port_ops *evtchn_port_ops;
+    struct evtchn_fifo_domain *evtchn_fifo;
 
     struct grant_table *grant_table;
 
@@ -524,6 +560,7 @@ void sched_destroy_domain(struct domain *d);
 int sched_move_domain(struct domain *d, struct cpupool *c);
 long sched_adjust(struct domain *, struct xen_domctl_scheduler_op *);
 long sched_adjust_global(struct xen_sysctl_scheduler_op *);
+long sched_latency_op(struct xen_sysctl_schedlat_op *);
 int  sched_id(void);
 void sched_tick_suspend(void);
 void sched_tick_resume(void);
@@ -672,6 +709,7 @@ struct scheduler *scheduler_alloc(unsigned int sched_id, int *perr);
 void scheduler_free(struct scheduler *sched);
 int schedule_cpu_switch(unsigned int cpu, struct cpupool *c);
 void vcpu_force_reschedule(struct vcpu *v);
+void vcpu_yield_to_preempted(void);
 int cpu_disable_scheduler(unsigned int cpu);
 int vcpu_set_affinity(struct vcpu *v, const cpumask_t *affinity);
 void restore_vcpu_affinity(struct domain *d);
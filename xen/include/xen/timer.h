@@ -43,6 +43,9 @@ struct timer {
 #define TIMER_STATUS_in_heap  3 /* In use; on timer heap.           */
 #define TIMER_STATUS_in_list  4 /* In use; on overflow linked list. */
     uint8_t status;
+
+    /* May fire up to this many nanoseconds late, to batch with others. */
+    uint32_t slack;
 };
 
 /*
@@ -64,6 +67,13 @@ void init_timer(
 /* Set the expiry time and activate a timer. */
 void set_timer(struct timer *timer, s_time_t expires);
 
+/*
+ * Allow a timer to fire up to @slack ns after its expiry time, so that its
+ * CPU can take one interrupt for several timers which expire close
+ * together.  Takes effect from the next set_timer().
+ */
+void set_timer_slack(struct timer *timer, s_time_t slack);
+
 /*
  * Deactivate a timer This function has no effect if the timer is not currently
  * active.
@@ -86,6 +96,9 @@ void timer_init(void);
 /* Next timer deadline for each CPU. */
 DECLARE_PER_CPU(s_time_t, timer_deadline);
 
+/* Local timer interrupts taken by each CPU; counted by arch code. */
+DECLARE_PER_CPU(unsigned long, timer_interrupts);
+
 /* Arch-defined function to reprogram timer hardware for new deadline. */
 int reprogram_timer(s_time_t timeout);
 